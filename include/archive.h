@@ -0,0 +1,208 @@
+#ifndef archive_h
+#define archive_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "logging.h"
+#include "linkedlist.h"
+#include "hashtable.h"
+
+struct com_Buffer;
+struct usr_UserData;
+struct hist_Entry;
+
+/*	ARCHIVE FORMAT:
+	<ArchiveDirectory>/<group>/<first msgid>.seg
+
+	Every group appends the messages of its channels to its newest
+	segment until it would grow past ArchiveSegmentSize, then a new
+	segment is started. A record is a single line:
+	<msgid> <unix time> <channel> :<prefix> PRIVMSG <target> :<text>\r\n
+
+	Only the writer thread writes, records are queued and written in
+	batches so sending a message never waits for the disk. Readers map
+	a segment and slice the lines out of the mapping, the sparse index
+	lets them skip straight to a time range and a small filter of the
+	channels in a segment lets them skip it altogether. A read stops at
+	the end of a segment once it has scanned ARCH_READ_BYTES, the reply
+	tells the client where to go on from. Segments older than
+	ArchiveRetention seconds are deleted by the writer
+
+	HISTORY is answered by the reader thread, so a data thread never
+	waits for the disk either
+*/
+
+#define ARCH_INDEX_STEP 4096 // Bytes between two index points
+#define ARCH_BATCH 64 // Records handed to a single writev()
+#define ARCH_PATH_LEN (BUFSIZ + 32) // A log path, '/' and a segment name
+#define ARCH_READ_BYTES (16 * 1024 * 1024) // Scanned by one read before it stops at a segment boundary
+#define ARCH_FILTER_WORDS 4 // 256 bit channel filter per segment
+
+struct arch_IndexPoint {
+	time_t time; // Time of the first record starting at offset
+	long offset;
+};
+
+struct arch_Segment {
+	unsigned long firstId; // Also the file name
+	unsigned long minId, maxId;
+	time_t firstTime, lastTime;
+	long size;
+	uint64_t channels[ARCH_FILTER_WORDS]; // Two bits for every channel with records here
+	int numIndex, maxIndex;
+	struct arch_IndexPoint *index;
+};
+
+// All segments of one group, oldest first
+struct arch_Log {
+	char path[BUFSIZ];
+	int numSegments, maxSegments;
+	struct arch_Segment *segments;
+	int fd; // Appends to the newest segment, only used by the writer
+	pthread_mutex_t logMutex; // Protects the segment array, not the files
+};
+
+// A message waiting for the writer thread
+struct arch_Record {
+	unsigned long msgid;
+	time_t time;
+	char *group, *channel; // Names live as long as the server
+	struct com_Buffer *buffer;
+};
+
+// Part of a segment a reader has to look at
+struct arch_Range {
+	unsigned long firstId, minId;
+	long start, end;
+	char *lines; // Copy of the lines kept from it, the mapping is gone by then
+};
+
+// A line sliced out of a mapped segment
+struct arch_Line {
+	unsigned long msgid;
+	time_t time;
+	char *str; // Not terminated, without the \r\n
+	int len;
+};
+
+// A HISTORY request memory could not fill, answered by the reader thread
+struct arch_Query {
+	struct usr_UserData *user;
+	int userId; // The slot may belong to someone else by the time it runs
+	char nick[50];
+	char target[BUFSIZ];
+	char *group, *channel; // Names live as long as the server
+	unsigned long beforeId;
+	time_t since;
+	int max;
+	int numEntries;
+	struct hist_Entry *entries; // Lines memory had, newer than anything read from disk
+};
+
+struct arch_Archive {
+	struct link_List queue;
+	pthread_mutex_t queueMutex;
+	pthread_cond_t queueCond;
+	int running;
+	int busy; // The writer took records it has not written yet
+	pthread_t writer;
+
+	struct link_List reads; // arch_Query
+	pthread_mutex_t readMutex;
+	pthread_cond_t readCond;
+	pthread_t reader;
+
+	struct hash_Table logs; // Group name -> arch_Log
+	struct link_List logList; // Same logs, for retention
+	pthread_mutex_t logsMutex; // Serializes creating logs
+};
+
+extern struct arch_Archive arch_state;
+
+int init_archive();
+
+// Writes everything still queued and stops the writer
+void arch_close();
+
+// Returns once everything queued so far is on disk
+void arch_flush();
+
+// Queues a message for the writer, takes a reference to buffer
+int arch_append(char *group, char *channel, unsigned long msgid, time_t time, struct com_Buffer *buffer);
+
+// Returns the log of a group, loading its segments from disk the first time
+struct arch_Log *arch_getLog(char *group);
+
+// Orders segments by their first msgid, for qsort()
+int arch_compareSegments(const void *first, const void *second);
+
+// Reads the existing segments of a log and rebuilds their indexes
+int arch_loadLog(struct arch_Log *log);
+
+// Fills path with the file name of a segment
+void arch_segmentPath(struct arch_Log *log, unsigned long firstId, char path[ARCH_PATH_LEN]);
+
+// Scans a whole segment file to rebuild its metadata
+int arch_scanSegment(struct arch_Log *log, struct arch_Segment *segment);
+
+// Adds an empty segment to the end of the log, logMutex must be held
+struct arch_Segment *arch_addSegment(struct arch_Log *log, unsigned long firstId);
+
+// Updates a segment after a record of channel was written at offset
+void arch_noteRecord(struct arch_Segment *segment, unsigned long msgid, time_t time, long offset, long len,
+		char *channel, int channelLen);
+
+// Case insensitive hash of a channel name for the segment filters
+unsigned long arch_hashChannel(char *channel, int len);
+
+// Returns 1 if the segment may hold records of the channel with that hash
+int arch_hasChannel(struct arch_Segment *segment, unsigned long hash);
+
+// Returns the offset of the first record that may be at or after since
+long arch_findOffset(struct arch_Segment *segment, time_t since);
+
+// Parses the header of a record, returns the length of the header or -1
+int arch_parseRecord(char *line, int len, unsigned long *msgid, time_t *time, char **channel, int *channelLen);
+
+void *arch_writerThread(void *param);
+
+// Writes records[first..last), repeating writev() until all of it is written
+// A record that only got partly written is truncated away, returns how many made it
+int arch_flushRecords(struct arch_Log *log, struct arch_Segment *segment, struct arch_Record **records,
+		struct iovec *iov, long *lens, int first, int last);
+
+// Writes records that all belong to the same log
+int arch_writeRecords(struct arch_Log *log, struct arch_Record **records, int count);
+
+// Deletes segments older than ArchiveRetention, never the newest one
+int arch_expire(struct arch_Log *log, time_t now);
+
+// Calls func for up to max of the newest lines of channel older than beforeId (0 for any)
+// and not older than since, oldest first
+// If the read stopped before it reached since, resumeId is set to the msgid to go on before
+int arch_read(char *group, char *channel, unsigned long beforeId, time_t since, int max,
+		void (*func)(unsigned long msgid, time_t time, char *line, int len, void *data), void *data,
+		unsigned long *resumeId);
+
+// Queues a HISTORY request for the reader thread, which frees it once it answered
+int arch_query(struct arch_Query *query);
+
+void arch_freeQuery(struct arch_Query *query);
+
+void *arch_readerThread(void *param);
+
+// Reads what memory did not have and sends the HISTORY reply
+int arch_answer(struct arch_Query *query);
+
+#endif
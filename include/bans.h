@@ -0,0 +1,141 @@
+#ifndef bans_h
+#define bans_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include "logging.h"
+#include "reclaim.h"
+#include "hashtable.h"
+
+struct usr_UserData;
+
+/*	BAN MASK FORMAT:
+	nick!user@host with * and ? as wildcards
+
+	"nick" is read as nick!*@*, "user@host" as *!user@host
+	Masks are sorted into the fastest structure that can match them:
+	*!*@1.2.3.4       - exact host, hash set
+	*!*@10.0.0.0/8    - CIDR range, prefix trie
+	nick!*@*          - exact nick, hash set
+	anything else     - compiled wildcard pattern
+
+	Wildcard masks are indexed by the rarest run of three plain
+	characters they hold, a trigram any match must contain as well. A
+	check hashes every trigram of the nickname and the host and only
+	tries the masks in those buckets, so thousands of them cost about as
+	much as a few dozen. Masks without a trigram, like *!*@*.a?, are
+	always tried.
+*/
+
+// Open addressing set of case insensitive strings
+struct ban_StrSet {
+	unsigned long mask; // Size - 1, size is a power of two
+	char **items;
+};
+
+// Binary trie over 128 bit addresses, IPv4 is stored as ::ffff:a.b.c.d
+// Nodes refer to each other by index inside of ban_Set.nodes
+struct ban_TrieNode {
+	int child[2];
+	int terminal; // A range ends here: everything below matches
+};
+
+#define BAN_NICK 0
+#define BAN_USER 1
+#define BAN_HOST 2
+
+// One part of a wildcard mask, already lowercase
+struct ban_GlobPart {
+	char *pattern; // NULL when the part is just "*"
+	int len;
+	int minLen; // Characters that are not '*'
+	int hasStar;
+	int prefixLen, suffixLen; // Plain characters before the first and after the last wildcard
+};
+
+// A wildcard mask split into its three parts
+struct ban_Glob {
+	struct ban_GlobPart parts[3]; // Indexed by BAN_NICK, BAN_USER and BAN_HOST
+	int next; // Next glob in the same bucket of the index, -1 at the end
+};
+
+// Immutable set of bans, replaced as a whole when the list changes
+struct ban_Set {
+	int count;
+	char **masks; // Normalized masks in the order they were added
+
+	struct ban_StrSet hosts, nicks;
+
+	int numNodes;
+	struct ban_TrieNode *nodes; // nodes[0] is the root
+
+	int numGlobs;
+	struct ban_Glob *globs;
+	unsigned long globMask; // Size - 1 of globIndex
+	int *globIndex; // First glob of every trigram bucket, -1 when empty
+	int unindexed; // First glob without a trigram, chained through next
+};
+
+// Writers must hold the owner's mutex, readers need no lock
+struct ban_List {
+	struct ban_Set *current;
+};
+
+int ban_init(struct ban_List *list);
+
+void ban_free(struct ban_List *list);
+
+// Rewrites mask into the full nick!user@host form
+int ban_normalizeMask(char *mask, char *buff, int size);
+
+// Builds a new set from a list of normalized masks
+struct ban_Set *ban_createSet(char **masks, int count);
+
+void ban_freeSet(void *ptr);
+
+// Adds a mask, returns -1 if it already exists
+int ban_add(struct ban_List *list, char *mask);
+
+// Adds many normalized masks with a single new set, returns -1 if none were new
+int ban_addList(struct ban_List *list, char **masks, int count);
+
+// Removes a mask, returns -1 if it does not exist
+int ban_remove(struct ban_List *list, char *mask);
+
+// Returns 1 if the user matches any of the bans
+int ban_isBanned(struct ban_List *list, struct usr_UserData *user);
+
+// Calls func for every mask in the list, without holding any lock
+int ban_forEach(struct ban_List *list, void (*func)(char *mask, void *data), void *data);
+
+// Case insensitive wildcard match, pattern must be lowercase
+int ban_globMatch(char *pattern, char *str);
+
+// Splits pattern into the checks ban_partMatch makes, NULL for "*"
+void ban_compilePart(struct ban_GlobPart *part, char *pattern);
+
+// Matches a lowercase string of length len against a compiled part
+int ban_partMatch(struct ban_GlobPart *part, char *str, int len);
+
+// Returns the position of the next trigram without wildcards in pattern at or after pos, or -1
+int ban_nextTrigram(char *pattern, int pos);
+
+// Hashes the trigram at str, tag tells the nickname and the host apart
+unsigned long ban_hashTrigram(int tag, char *str);
+
+// Buckets the wildcard masks of the set by their rarest trigram
+int ban_indexGlobs(struct ban_Set *set);
+
+// Returns 1 if a wildcard mask matches, nick and host must be lowercase
+int ban_matchGlobs(struct ban_Set *set, char *nick, char *host, char *plainHost);
+
+// Converts a socket address to the 128 bit form used by the trie
+int ban_addrToBytes(struct sockaddr_storage *addr, unsigned char bytes[16]);
+
+// Parses "address/length", returns the prefix length or -1
+int ban_parseCidr(char *str, unsigned char bytes[16]);
+
+#endif
@@ -16,5 +16,12 @@
 #include "user.h"
 #include "channel.h"
 #include "group.h"
+#include "reclaim.h"
+#include "snapshot.h"
+#include "upgrade.h"
+#include "clock.h"
+#include "capture.h"
+#include "trace.h"
+#include "metrics.h"
 
 #endif
@@ -0,0 +1,88 @@
+#ifndef capture_h
+#define capture_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+
+/*	TRAFFIC CAPTURE FORMAT:
+	CaptureFile is a cap_Header followed by a ring of CaptureSize KiB
+	that is mapped into memory, so recording a line is a reservation and
+	a memcpy, the kernel writes the pages out on its own. head counts
+	every byte ever reserved, a record lives at head % size.
+
+	A record is a cap_Record followed by len bytes of the line, padded
+	to CAP_ALIGN. Records never wrap: when one does not fit before the
+	end, a CAP_SKIP record marks the rest of the ring as unused and it
+	starts at offset 0, so every lap starts on a record. Every record
+	stores its own absolute position, which lets a reader tell where the
+	records of the previous lap begin after the current lap cut into
+	them. committed is set last, records a crash cut short are skipped.
+
+	Lines are sampled, either 1 in CaptureSample lines or every line of
+	1 in CaptureSample users. tools/capdecode prints a capture file
+*/
+
+#define CAP_MAGIC "BNDCAPTR"
+#define CAP_VERSION 1
+#define CAP_ALIGN 32
+
+#define CAP_IN 1
+#define CAP_OUT 2
+#define CAP_SKIP 3
+
+struct cap_Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerLen; // Offset of the ring
+	uint64_t size; // Of the ring
+	uint64_t head;
+};
+
+struct cap_Record {
+	uint64_t pos; // Absolute position, head at the time it was reserved
+	uint64_t time; // Nanoseconds since the epoch
+	int32_t userId;
+	uint32_t slot; // Index in serverLists.users
+	uint16_t len;
+	uint8_t direction;
+	uint8_t committed;
+	uint32_t unused;
+};
+
+struct cap_Capture {
+	int enabled;
+	int fd;
+	struct cap_Header *header;
+	char *ring;
+	uint64_t size;
+	unsigned long sample;
+	int sampleUsers;
+};
+
+extern struct cap_Capture cap_state;
+
+// Maps CaptureFile when EnableCapture is set
+int init_capture();
+
+// Stops recording and syncs the ring to the file
+// The ring stays mapped for threads that are still writing a record
+void cap_close();
+
+// Returns 1 if a line of this user is to be recorded
+int cap_isSampled(int userId);
+
+// Records one or more lines, every line of data becomes its own record
+void cap_record(int direction, int slot, int userId, char *data, int len);
+
+// Reserves room for and writes a single record
+void cap_addRecord(int direction, int slot, int userId, uint64_t time, char *line, int len);
+
+#endif
@@ -5,6 +5,11 @@
 #include "chat.h"
 #include "security.h"
 #include "group.h"
+#include "members.h"
+#include "bans.h"
+#include "history.h"
+#include "archive.h"
+#include "search.h"
 
 /*	CHANNEL NAME FORMAT:
 	&<groupname>/#<channelname>
@@ -16,19 +21,14 @@
 
 struct chat_Group;
 
-// Data about a user specific to a channel
-struct chan_ChannelUser {
-	struct usr_UserData *user;
-	int permLevel; // 0 - Default, 1 - chanvoice, 2 - chanop, 3 - groupop
-};
-
 struct chan_Channel {
 	int id;
 	char *name;
 	char modes[NUM_MODES];
 	char key[20];
-	int max;
-	struct chan_ChannelUser *users;
+	struct mbr_List members; // Limit is set with mode +l
+	struct ban_List bans; // Masks set with mode +b
+	struct hist_Ring history; // Recent PRIVMSGs, replayed on JOIN
 	struct link_Node *group;
 	pthread_mutex_t channelMutex;
 };
@@ -69,17 +69,31 @@ char *chan_removeKey(struct link_Node *channelNode, char *key);
 // Checks to see if a given key is equal to the current key
 int chan_checkKey(struct link_Node *channelNode, char *key);
 
+// Sets or removes the channel's user limit
+char *chan_setLimit(struct link_Node *channelNode, char op, char *limit);
+
+// Adds or removes a ban mask
+char *chan_setBan(struct link_Node *channelNode, char op, char *mask);
+
+// Returns 1 if the user is banned from the channel or its group
+int chan_isBanned(struct link_Node *channelNode, struct usr_UserData *user);
+
 // Give or remove chan op or voice
 char *chan_giveChanPerms(struct link_Node *channelNode, struct usr_UserData *user, char op, int perm);
 
 // check if a user is in a channel
-struct chan_ChannelUser *chan_isInChannel(struct link_Node *channelNode, struct usr_UserData *user);
+int chan_isInChannel(struct link_Node *channelNode, struct usr_UserData *user);
 
 // Places a pointer to the user into the Channel's list
-struct chan_ChannelUser *chan_addToChannel(struct link_Node *channelNode, struct usr_UserData *user, int permLevel);
+// Returns -1 if the channel is full, -2 if the user is banned from it or its group
+// Ops are added without checking the bans
+int chan_addToChannel(struct link_Node *channelNode, struct usr_UserData *user, int permLevel);
+
+// Returns the cached NAMES lines, only use them inside of a read section
+struct mbr_Names *chan_getNames(struct link_Node *channelNode, int lineLen);
 
-// Will fill a buffer with list of nicknames
-int chan_getUsersInChannel(struct link_Node *channelNode, char *buff, int size);
+// Queues the channel's recent messages for a user that just joined
+int chan_replayHistory(struct link_Node *channelNode, struct usr_UserData *user);
 
 // Sends a message to all online users in this room
 int chan_sendChannelMessage(struct chat_Message *cmd, struct link_Node *channelNode);
@@ -11,6 +11,7 @@
 #include "user.h"
 #include "channel.h"
 #include "group.h"
+#include "hashtable.h"
 
 #define ARRAY_SIZE(arr) (int)(sizeof(arr)/sizeof((arr)[0]))
 
@@ -32,6 +33,7 @@ struct chat_ServerLists {
 	int connected;
 	struct usr_UserData *users;
 	struct link_List groups;	
+	struct hash_Table groupIndex; // Group name -> node inside of groups
 	pthread_mutex_t groupsMutex;
 };
 
@@ -39,6 +41,7 @@ struct chat_DataQueue {
     struct link_List queue;
     pthread_t *threads;
     pthread_mutex_t queueMutex;
+    int busy; // Jobs a data thread took and has not finished yet
 };
 
 // Contains all parts of a typical message
@@ -46,10 +49,11 @@ struct chat_DataQueue {
 // and used to identify the recipient when sending
 struct chat_Message {
     struct usr_UserData *user;
-    char prefix[50];
+    char prefix[100];
     char command[50];
     int paramCount;
     char params[10][400];
+    uint64_t traceOrigin; // When the line was read, 0 when not traced
 };
 
 // So all functions can access this global list
@@ -71,12 +75,21 @@ int chat_insertQueue(struct usr_UserData *user, int type, char *str, struct chat
 // to the communication queue for sending back to clients
 void *chat_processQueue(void *param);
 
+// Returns once the queue is empty and no data thread is running a job
+int chat_waitIdle();
+
+// Returns the jobs waiting in the queue, busy is set to the jobs being run
+int chat_getQueueDepth(int *busy);
+
 // Parse the input from a user and act on it
 int chat_parseInput(struct com_QueueJob *job);
 
 // Will send a Message struct to specified node
 int chat_sendMessage(struct chat_Message *msg);
 
+// Adds a Message struct to a batch that is later sent with com_sendBuffer
+int chat_appendMessage(struct com_Buffer **buffer, struct chat_Message *msg);
+
 // Sends a message to every connected user
 int chat_sendServerMessage(struct chat_Message *cmd);
 
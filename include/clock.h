@@ -0,0 +1,61 @@
+#ifndef clock_h
+#define clock_h
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "logging.h"
+
+/* CACHED CLOCK:
+   A thread wakes up at the start of every second and formats the time
+   once, every other thread copies the strings out of clk_cache instead
+   of calling localtime, which takes a lock inside of glibc. The strings
+   are guarded by a sequence number that is odd while they are being
+   written, readers retry until they read the same even number before
+   and after copying. clk_now is a single atomic load.
+
+   Until init_clock started the thread everything is computed directly */
+
+#define CLK_LOG_LEN 22 // [YYYY-MM-DD HH:MM:SS]
+#define CLK_ISO_LEN 25 // YYYY-MM-DDTHH:MM:SS.000Z, for server-time
+#define CLK_DATE_LEN 11 // YYYY-MM-DD
+
+struct clk_Cache {
+	unsigned long seq;
+	time_t now;
+	char logTime[CLK_LOG_LEN];
+	char isoTime[CLK_ISO_LEN];
+	char date[CLK_DATE_LEN];
+	int running;
+	pthread_t thread;
+};
+
+extern struct clk_Cache clk_cache;
+
+// Fills the cache and starts the thread that keeps it current
+int init_clock();
+
+// Current time in seconds, at most a second behind
+time_t clk_now();
+
+// Copy out the formatted current time
+void clk_getLogTime(char str[CLK_LOG_LEN]);
+
+void clk_getIsoTime(char str[CLK_ISO_LEN]);
+
+void clk_getDate(char str[CLK_DATE_LEN]);
+
+// Copies one of the cached strings without tearing it
+void clk_copy(char *dest, char *src, int len);
+
+// Formats time into the three strings
+void clk_format(time_t time, char logTime[CLK_LOG_LEN], char isoTime[CLK_ISO_LEN], char date[CLK_DATE_LEN]);
+
+// Formats the current time into the cache
+void clk_refresh();
+
+// Refreshes the cache at the start of every second
+void *clk_thread(void *param);
+
+#endif
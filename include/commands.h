@@ -12,21 +12,27 @@
 
 struct chat_Message;
 struct chan_Channel;
+struct ban_List;
+
+extern char *thisServer;
 
 struct cmd_CommandList {
     struct link_List commands;	
     pthread_mutex_t commandMutex;
 };
 
+extern struct cmd_CommandList cmd_commandList;
+
 // permLevel describes the permissions needed for a user to run a command
 // 0 = Unregistered
 // 1 = Registered
-// 2 = Server Admin
+// 2 = Server Admin, user mode o
 struct cmd_Command {
     char word[50];
     int minParams;
     int (*func)(struct chat_Message *, struct chat_Message *);
 	int permLevel;
+	int id; // Order it was added in, indexes the command metrics
 };
 
 int init_commands();
@@ -49,6 +55,34 @@ void err_usernotinchannel(struct chat_Message *msg, struct chan_Channel *chan, s
 
 void err_chanoprivsneeded(struct chat_Message *msg, struct chan_Channel *chan, struct usr_UserData *user);
 
+// Passed to rpl_banlist by ban_forEach
+struct cmd_BanList {
+	struct chat_Message *msg;
+	struct usr_UserData *user;
+	char *nick;
+	char *target;
+};
+
+// Sends one RPL_BANLIST line
+void rpl_banlist(char *mask, void *data);
+
+// Passed to rpl_history for every line of a HISTORY reply
+struct cmd_History {
+	struct com_Buffer *batch;
+	char *nick;
+	char *target;
+	unsigned long oldest;
+};
+
+// Adds one RPL_HISTORY line to the batch
+void rpl_history(unsigned long msgid, time_t time, char *line, int len, void *data);
+
+// Sends every mask in bans followed by RPL_ENDOFBANLIST
+int cmd_listBans(struct chat_Message *reply, struct usr_UserData *user, char *target, struct ban_List *bans);
+
+// Returns 1 if MODE only asks for the ban list
+int cmd_isBanListRequest(struct chat_Message *cmd);
+
 // Change a user's nickname
 int cmd_nick(struct chat_Message *cmd, struct chat_Message *reply);
 
@@ -61,6 +95,12 @@ int cmd_join(struct chat_Message *cmd, struct chat_Message *reply);
 // Return a list of names inside a channel
 int cmd_names(struct chat_Message *cmd, struct chat_Message *reply);
 
+// Longest names list that keeps a RPL_NAMREPLY within 512 bytes
+int cmd_namesLineLen(char *target);
+
+// Queues the names of every comma separated target and RPL_ENDOFNAMES as one batch
+int cmd_namesReply(struct chat_Message *reply, struct usr_UserData *user, char *targets);
+
 // Remove a user from a channel
 int cmd_part(struct chat_Message *cmd, struct chat_Message *reply);
 
@@ -73,6 +113,25 @@ int cmd_modeUser(struct chat_Message *cmd, struct chat_Message *reply, char op,
 int cmd_modeChan(struct chat_Message *cmd, struct chat_Message *reply, char op, int hasOp);
 int cmd_modeGroup(struct chat_Message *cmd, struct chat_Message *reply, char op, int hasOp);
 
+// Page backwards through a channel's recent messages
+int cmd_history(struct chat_Message *cmd, struct chat_Message *reply);
+
+// Search the messages of a channel, or of every channel of a group the user is in
+int cmd_search(struct chat_Message *cmd, struct chat_Message *reply);
+
+// Report server statistics, e for the timed events, t for the message stages, m for the server metrics
+// Only for users with mode o
+int cmd_stats(struct chat_Message *cmd, struct chat_Message *reply);
+
+// Adds one RPL_STATSEVENT line per timed event to the batch
+void cmd_statsEvents(struct com_Buffer **batch, char *nick);
+
+// Adds one RPL_STATSTRACE line per pipeline stage to the batch
+void cmd_statsTrace(struct com_Buffer **batch, char *nick);
+
+// Adds the RPL_STATSMETRIC lines of a metrics report to the batch
+void cmd_statsMetrics(struct com_Buffer **batch, char *nick);
+
 // Send back a PONG
 int cmd_ping(struct chat_Message *cmd, struct chat_Message *reply);
 
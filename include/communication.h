@@ -11,11 +11,13 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <limits.h>
 #include <time.h>
 #include "logging.h"
 #include "config.h"
 #include "linkedlist.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(arr) (int)(sizeof(arr)/sizeof((arr)[0]))
 #define MAX_MESSAGE_LENGTH 2048
@@ -24,33 +26,117 @@
  * Sending and receiving of data that the server will handle
  */
 
+struct mbr_Snapshot;
+
+// Lines shared by many send jobs, freed along with the last job
+struct com_Buffer {
+	int refs;
+	int len;
+	int size; // Room inside of str, including the terminator
+	char str[];
+};
+
+#define COM_LINE_LEN 1024 // Room for the line of a job without a buffer
+
 // Jobs for queues
 // TODO - combine str and msg into a union
 struct com_QueueJob {
     int type;
     struct usr_UserData *user;
-    char str[1024];
     struct chat_Message *msg; 
+	struct com_Buffer *buffer; // Sent instead of str when set
+	struct trc_Stamps trace;
+    char str[]; // COM_LINE_LEN long, jobs with a buffer allocate none of it
+};
+
+// A broadcast handed to an IO thread for the members it owns
+struct com_FanOut {
+	struct com_Buffer *buffer;
+	struct mbr_Snapshot *snapshot;
+	struct usr_UserData *origin; // Does not receive the message
+	uint64_t traceOrigin;
+};
+
+// Every IO thread has its own epoll, so a connection always
+// stays on the thread that accepted it
+struct com_IOThread {
+	int id;
+	pthread_t thread;
+	int epollfd;
+	int eventfd; // Wakes the thread when fanOut has work
+	struct link_List fanOut;
+	pthread_mutex_t fanOutMutex;
 };
 
 //struct to store data about the socket, and its file descriptor
 struct com_SocketInfo {
     int socket;
 	int socket2; // Used for filtering epoll writing events
+	int ioThread; // Index of the IO thread that owns the connection
     struct sockaddr_storage addr;
 };
 
 extern int com_serverSocket;
+extern struct com_IOThread *com_ioThreads;
+extern int com_numThreads;
+extern int com_paused; // Set while the connections are handed to a new process
 
 // Setup the server's socket
 int init_server();
 
+// Starts accepting clients on the server's socket
+int com_listen();
+
 // close server socket
 void com_close();
 
 // Will send a string to client inside node, also appends \r\n
 int com_sendStr(struct usr_UserData *user, char *msg);
 
+// Creates a shared line with one reference, also appends \r\n
+struct com_Buffer *com_createBuffer(char *msg);
+
+// Creates an empty buffer to collect many lines into, sent as one job
+struct com_Buffer *com_allocBuffer(int size);
+
+// Appends msg and \r\n, growing the buffer if needed
+// Only valid while the caller holds the only reference
+int com_appendBuffer(struct com_Buffer **buffer, char *msg);
+
+// Drops a reference to the buffer
+void com_releaseBuffer(struct com_Buffer *buffer);
+
+// Queues a shared line for the user without copying it
+int com_sendBuffer(struct usr_UserData *user, struct com_Buffer *buffer);
+
+// Same as com_sendBuffer without the rearm, for queueing many at once
+int com_queueBuffer(struct usr_UserData *user, struct com_Buffer *buffer);
+
+// Tells the user's IO thread that there is data to write
+int com_rearmWrite(struct usr_UserData *user);
+
+// Frees a job along with its buffer reference
+void com_freeJob(struct com_QueueJob *job);
+
+// Hands a broadcast to every IO thread that owns members of the partitioned snapshot
+// Must be called between mbr_acquire() and mbr_release()
+int com_fanOut(struct mbr_Snapshot *snapshot, struct usr_UserData *origin, struct com_Buffer *buffer);
+
+// Delivers all pending broadcasts of an IO thread to its own members
+int com_runFanOut(struct com_IOThread *thread);
+
+// Same as com_runFanOut without reading the eventfd, for when the thread is paused
+int com_drainFanOut(struct com_IOThread *thread);
+
+// Stops every IO thread between two events, returns once all of them wait
+int com_pauseIO();
+
+// Lets the paused IO threads continue
+void com_resumeIO();
+
+// Called by the IO threads, blocks for as long as com_paused is set
+void com_waitWhilePaused();
+
 // Remove all user jobs from queue
 int com_cleanQueue(struct usr_UserData *user);
 
@@ -76,6 +162,9 @@ int com_setupIOThreads(struct fig_ConfigData *config);
 //accept communication with clients
 int com_acceptClient(struct com_SocketInfo *serverSock, int epoll_sock);
 
+// Starts watching a user's connection on the IO thread that owns it
+int com_addClient(struct usr_UserData *user);
+
 //start server socket based on configuration
 int com_startServerSocket(struct fig_ConfigData* data, struct com_SocketInfo* sockAddr, int forceIPv4);
 
@@ -16,11 +16,38 @@ struct fig_ConfigData {
 	char logDirectory[BUFSIZ];
 	char serverName[BUFSIZ];
 	int useFile;
+	int logBlock; // Wait for the log writer instead of dropping records when a thread's ring is full
+	int logMaxSize; // In KiB, 0 to only rotate by date
+	int logCompress;
+	int logRetention; // Log files kept, 0 to keep all of them
 	int port;
 	int threadsIO, threadsDATA;
+	int threadsEVENT; // Run timed events, the main thread only dispatches them
 	int clients;
 	int nickLen, chanNameLength, groupNameLength;
 	int timeOut, messageLimit;
+	int largeChannel;
+	int historySize, historyReplay, historyReplayAge;
+	int historyMemory; // In KiB, shared by every channel
+	int useArchive;
+	char archiveDirectory[BUFSIZ];
+	int archiveSegmentSize; // In KiB
+	int archiveRetention; // In seconds
+	int useSearch;
+	int searchMessages; // Indexed before the oldest half is dropped
+	int useState;
+	char stateFile[BUFSIZ];
+	int stateInterval; // Seconds between two snapshots
+	int useUpgrade;
+	char upgradeSocket[BUFSIZ];
+	int useCapture;
+	char captureFile[BUFSIZ];
+	int captureSize; // In KiB
+	int captureSample; // Record 1 in N lines or users
+	int captureSampleUsers;
+	int useTracing;
+	int useMetrics;
+	char metricsSocket[BUFSIZ];
 };	
 
 // Struct to store all config data
@@ -41,6 +68,7 @@ void fig_parseLine(char *line, int lineNo);
 int fig_readConfig(char *path);
 
 //make sure all config values are valid, if not set them to default
-int fig_editConfigInt(int *orig, char *str, int lineNo);
+//values below min are rejected
+int fig_editConfigInt(int *orig, char *str, int lineNo, int min);
 
 #endif
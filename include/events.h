@@ -5,39 +5,218 @@
 #include <pthread.h>
 #include <time.h>
 
-struct evt_List {
-	struct link_List list;
+/*	TIMERS:
+	A scheduler keeps its timers in a binary min-heap ordered by
+	execTime, which is on CLOCK_MONOTONIC so changing the wall clock
+	neither fires nor stalls them. Adding, moving and cancelling a
+	timer is O(log n), finding the next one O(1).
+
+	Timers live in a slot array, the heap only holds slot numbers and
+	every slot knows its position inside of the heap. A handle is the
+	slot number and the generation of the slot, which is bumped every
+	time the slot is freed, so handles of timers that already ran
+	simply stop matching. 0 is never a valid handle.
+
+	Timers can be cancelled or moved while they run: a cancelled one is
+	freed and a moved one added back once its run returns. Every user
+	has a timer of its own for its timeout (usr_checkTimeout), which
+	moves itself to the next time the user could time out.
+
+	EVENT POOL:
+	The main thread only takes due timers off of evt_scheduler and
+	queues them for NumEventThreads workers, so a slow event no longer
+	holds back the others. An event marked EVT_NO_OVERLAP is added back
+	once its run returned, others as soon as they are taken, so their
+	next run may start while the last one is still going. Events added
+	with evt_addEvent keep an evt_Stats entry for STATS. An upgrade
+	pauses the pool, so no event touches users or channels while they
+	are handed over; due jobs wait in the queue until it resumes.
+*/
+
+#define EVT_MIN_TIMERS 16
+
+#define EVT_MAX_EVENTS 32 // Named events that keep statistics
+
+// Timer flags
+#define EVT_NO_OVERLAP 1 // Never runs concurrently with itself
+
+#define EVT_FREE 0
+#define EVT_WAITING 1 // Inside of the heap
+#define EVT_RUNNING 2
+#define EVT_CANCELLED 3 // Cancelled while running, freed once it returns
+#define EVT_MOVED 4 // Moved while running, added back once it returns
+
+struct evt_Timer {
+	struct timespec execTime; // When it is to be executed, on CLOCK_MONOTONIC
+	long interval; // Milliseconds between two runs, 0 to run once
+	int (*func)(void *data); // Function to run
+	void *data;
+	struct evt_Stats *stats; // NULL unless added with evt_addEvent
+	int flags;
+	uint32_t generation;
+	int state;
+	int heapPos; // Only while EVT_WAITING
+	int nextFree; // Only while EVT_FREE
+};
+
+struct evt_Scheduler {
+	struct evt_Timer *timers;
+	int *heap; // Slot numbers, earliest first
+	int numTimers; // Slots in use or on the free list
+	int maxTimers;
+	int heapSize;
+	int freeSlot; // First free slot, -1 if there is none
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; // Signalled when the earliest timer changes
+};
+
+// Lateness is measured from when a run was due to when it started, all times in microseconds
+struct evt_Stats {
+	char name[32];
+	long maxRuntime; // In milliseconds, a longer run counts as an overrun
+	unsigned long runs, overruns;
+	unsigned long skipped; // Runs dropped because the previous ones fell behind
+	long lateTotal, lateMax;
+	long runTotal, runMax;
+};
+
+struct evt_Registry {
+	struct evt_Stats events[EVT_MAX_EVENTS];
+	int count;
 	pthread_mutex_t mutex;
 };
 
-struct evt_Item {
-	struct timespec execTime; // When it is to be executed
-    int (*func)(); // Function to run
+// A timer that was taken off of its scheduler and is ready to run
+struct evt_Job {
+	struct evt_Scheduler *sched;
+	int slot; // -1 if the timer is already waiting for its next run
+	int (*func)(void *data);
+	void *data;
+	struct evt_Stats *stats;
+	struct timespec execTime; // When it was due
+	int skipped;
+};
+
+struct evt_Pool {
+	struct link_List queue; // evt_Job
+	pthread_t *threads;
+	int paused;
+	int busy; // Workers running a job right now
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_cond_t idleCond; // Signalled when a job returns
 };
 
+// Runs the server-wide events
+extern struct evt_Scheduler evt_scheduler;
+extern struct evt_Registry evt_registry;
+
 int init_events();
 
 void events_close();
 
+// Sets up an empty scheduler
+int evt_initScheduler(struct evt_Scheduler *sched);
+
+// Frees the timers of a scheduler nothing runs anymore
+void evt_closeScheduler(struct evt_Scheduler *sched);
+
 // Compares two timespec values and returns true if second is earlier
 int evt_compareTimes(struct timespec *first, struct timespec *second);
 
-int evt_addEvent(struct timespec *execTime, int (*func)());
+// Adds ms milliseconds to time
+void evt_addMs(struct timespec *time, long ms);
+
+// Microseconds from first to second
+long evt_diffUs(struct timespec *first, struct timespec *second);
+
+// Runs func after delay milliseconds and then every interval milliseconds, if interval is not 0
+// Returns a handle for evt_cancelTimer and evt_moveTimer, 0 on failure
+uint64_t evt_addTimer(struct evt_Scheduler *sched, long delay, long interval, int flags, int (*func)(void *data), void *data);
+
+// Same as evt_addTimer, runs are recorded in stats when it is not NULL
+uint64_t evt_scheduleTimer(struct evt_Scheduler *sched, long delay, long interval, int flags,
+		int (*func)(void *data), void *data, struct evt_Stats *stats);
 
-// Runs the next event, if any, from the queue
-int evt_runNextEvent();
+// Adds a named server-wide event that runs right away and then every interval milliseconds
+// Runs longer than maxRuntime milliseconds are counted and logged
+uint64_t evt_addEvent(char *name, long interval, long maxRuntime, int flags, int (*func)(void *data));
+
+// Copies the statistics of up to max events, returns the amount
+int evt_getStats(struct evt_Stats *stats, int max);
+
+// Stops a timer, returns -1 if it already ran or was cancelled
+// A timer that is running right now finishes but does not run again
+int evt_cancelTimer(struct evt_Scheduler *sched, uint64_t handle);
+
+// Makes a timer run delay milliseconds from now instead, returns -1 if it already ran or was cancelled
+int evt_moveTimer(struct evt_Scheduler *sched, uint64_t handle, long delay);
+
+// Returns the slot of a handle or -1 if it no longer matches, the mutex must be held
+int evt_findTimer(struct evt_Scheduler *sched, uint64_t handle);
+
+// Takes a free slot, growing the slot array and the heap if needed. Returns -1 on failure
+int evt_allocTimer(struct evt_Scheduler *sched);
+
+void evt_freeTimer(struct evt_Scheduler *sched, int slot);
+
+// Heap operations, the mutex must be held
+void evt_heapSwap(struct evt_Scheduler *sched, int first, int second);
+
+void evt_heapUp(struct evt_Scheduler *sched, int pos);
+
+void evt_heapDown(struct evt_Scheduler *sched, int pos);
+
+void evt_heapPush(struct evt_Scheduler *sched, int slot);
+
+void evt_heapRemove(struct evt_Scheduler *sched, int pos);
+
+// Tells whoever waits for the scheduler that the earliest timer changed, the mutex must be held
+void evt_notify(struct evt_Scheduler *sched);
+
+// Moves execTime past now by whole intervals, returns the amount of runs that were skipped
+int evt_advanceTimer(struct evt_Timer *timer, struct timespec *now);
+
+// Takes the earliest timer off of the heap if it is due, returns -1 if none was
+int evt_takeNextEvent(struct evt_Scheduler *sched, struct evt_Job *job);
+
+// Runs a job and hands its timer back to the scheduler
+void evt_runJob(struct evt_Job *job);
+
+// Adds a timer back after its run or frees it, returns the amount of runs that were skipped
+int evt_finishJob(struct evt_Job *job);
+
+void evt_recordRun(struct evt_Job *job, long late, long runtime);
 
 // Blocks until the next event is ready to be executed
-void evt_waitUntilNextEvent();
+void evt_waitUntilNextEvent(struct evt_Scheduler *sched);
 
 // Will dedicate a thread to executing events at the correct times
 int evt_executeEvents();
 
+// Queues a job for the event threads
+int evt_dispatchJob(struct evt_Job *job);
+
+// Runs queued jobs
+void *evt_workerThread(void *param);
+
+// Stops the workers from taking jobs, returns once none of them runs one
+void evt_pausePool();
+
+// Lets the workers take jobs again
+void evt_resumePool();
+
 /* Start of EVENTS */
 // Will print "test" every 5 seconds
-int evt_test(); 
+int evt_test(void *data);
+
+// Frees memory retired by lock free writers once readers are done with it
+int evt_reclaimMemory(void *data);
+
+// Turns the per thread counters into the rates STATS m reports
+int evt_sampleMetrics(void *data);
 
-// Searches for and kicks users that surpassed their message timeouts
-int evt_userTimeout();
+// Saves groups and channels so a restart can bring them back
+int evt_saveState(void *data);
 
 #endif
@@ -1,15 +1,12 @@
 #ifndef group_h
 #define group_h
 
+#include "hashtable.h"
 #include "boundless.h"
 #include "channel.h"
 #include "user.h"
-
-// Data about a user specific to a group
-struct grp_GroupUser {
-	struct usr_UserData *user;
-	int permLevel; // 0 - Default, 1 - groupop
-};
+#include "members.h"
+#include "bans.h"
 
 // New feature: A group a channels that a user can join
 // All at once, and an operator has full control over all
@@ -18,8 +15,9 @@ struct grp_Group {
 	char modes[NUM_MODES];
 	char key[20];
     struct link_List channels;
-	int max;
-	struct grp_GroupUser *users;
+	struct hash_Table channelIndex; // Channel name -> node inside of channels
+	struct mbr_List members;
+	struct ban_List bans; // Masks set with mode +b, also apply to every channel
     pthread_mutex_t groupMutex;
 };
 
@@ -34,9 +32,11 @@ struct link_Node *grp_getGroup(char *name);
 int grp_getName(struct link_Node *groupNode, char *buff, int size);
 
 // Add user to the group and auto join to all public channels
-struct grp_GroupUser *grp_addUser(struct link_Node *groupNode, struct usr_UserData *user, int permLevel);
+// Returns -1 if the group is full, -2 if the user is banned
+// Groupops are added without checking the bans
+int grp_addUser(struct link_Node *groupNode, struct usr_UserData *user, int permLevel);
 
-struct grp_GroupUser *grp_isInGroup(struct link_Node *groupNode, struct usr_UserData *user);
+int grp_isInGroup(struct link_Node *groupNode, struct usr_UserData *user);
 
 struct link_Node *grp_addChannel(struct link_Node *groupNode, struct chan_Channel *chan);
 
@@ -44,8 +44,14 @@ struct link_Node *grp_getChannel(struct link_Node *groupNode, char *name);
 
 int grp_isGroupMode(char mode);
 
-// Fills string with names of users in the group
-int grp_getUsersInGroup(struct link_Node *groupNode, char *buff, int size);
+// Adds or removes a ban mask
+char *grp_setBan(struct link_Node *groupNode, char op, char *mask);
+
+// Returns 1 if the user is banned from the group
+int grp_isBanned(struct link_Node *groupNode, struct usr_UserData *user);
+
+// Returns the cached NAMES lines, only use them inside of a read section
+struct mbr_Names *grp_getNames(struct link_Node *groupNode, int lineLen);
 
 // Sends a message to all users in this group
 int grp_sendGroupMessage(struct chat_Message *cmd, struct link_Node *groupNode);
@@ -0,0 +1,67 @@
+#ifndef hashtable_h
+#define hashtable_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "logging.h"
+#include "reclaim.h"
+
+/* Hash table keyed by case insensitive strings
+
+   Lookups never lock: they run inside of a reclaim read section and
+   only follow pointers that writers publish atomically. Writers are
+   serialized by writeMutex, removed entries and old bucket arrays
+   are handed to rcl_retire() */
+
+struct hash_Entry {
+	struct hash_Entry *next;
+	unsigned long hash;
+	void *data;
+	char key[];
+};
+
+struct hash_Buckets {
+	unsigned long mask; // Amount of buckets - 1
+	struct hash_Entry *heads[];
+};
+
+struct hash_Table {
+	int count;
+	struct hash_Buckets *buckets;
+	pthread_mutex_t writeMutex;
+};
+
+// Allocates an empty array of size buckets
+struct hash_Buckets *hash_createBuckets(unsigned long size);
+
+// Frees a bucket array and every entry chained to it
+void hash_freeBuckets(void *ptr);
+
+// Size is rounded up to a power of two
+int hash_init(struct hash_Table *table, int size);
+
+// Frees the table, only call when no readers are left
+void hash_free(struct hash_Table *table);
+
+// Case insensitive FNV-1a
+unsigned long hash_string(char *str);
+
+// Returns 1 if both strings are equal ignoring case
+int hash_keysEqual(char *first, char *second);
+
+// Returns the data stored under key or NULL
+void *hash_get(struct hash_Table *table, char *key);
+
+// Doubles the amount of buckets, writeMutex must be held
+int hash_grow(struct hash_Table *table);
+
+// Adds data under key, fails if the key is already taken
+int hash_put(struct hash_Table *table, char *key, void *data);
+
+// Removes key and returns its data
+void *hash_remove(struct hash_Table *table, char *key);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef history_h
+#define history_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "logging.h"
+
+#define HIST_PAGE_MAX 100 // Most lines a single HISTORY reply may hold
+
+struct com_Buffer;
+struct usr_UserData;
+
+/* Recent messages of a channel
+
+   Entries hold a reference to the com_Buffer that was broadcast, so
+   remembering a line costs no copy. Every ring has a fixed capacity and
+   the bytes kept alive by all rings together are capped by
+   HistoryMemory, a ring over the cap gives up its own oldest lines */
+
+struct hist_Entry {
+	unsigned long msgid; // Unique, also across restarts
+	time_t time;
+	struct com_Buffer *buffer;
+};
+
+struct hist_Ring {
+	int capacity;
+	int head; // Next slot to write
+	int count;
+	long bytes;
+	struct hist_Entry *entries; // Allocated with the first message
+	pthread_mutex_t ringMutex;
+};
+
+// Bytes held by every ring together
+extern long hist_totalBytes;
+
+// Seeds the msgids from the clock so they keep growing across restarts
+int init_history();
+
+// Returns a new msgid
+unsigned long hist_newMsgid();
+
+// Never hands out a msgid below next, used when taking over from another process
+void hist_seedMsgid(unsigned long next);
+
+// A capacity of 0 keeps no history at all
+int hist_init(struct hist_Ring *ring, int capacity);
+
+void hist_free(struct hist_Ring *ring);
+
+// Memory an entry keeps alive
+long hist_entrySize(struct com_Buffer *buffer);
+
+// Keeps a reference to buffer, returns -1 if there was no room for it
+int hist_add(struct hist_Ring *ring, struct com_Buffer *buffer, unsigned long msgid, time_t time);
+
+// Forgets the oldest entry, ringMutex must be held
+void hist_dropOldest(struct hist_Ring *ring);
+
+// Copies up to max entries older than beforeId (0 for the newest) and not older than since
+// Entries are returned oldest first, each buffer gains a reference the caller releases
+int hist_collect(struct hist_Ring *ring, unsigned long beforeId, time_t since, struct hist_Entry *out, int max);
+
+// Releases the buffers handed out by hist_collect
+void hist_releaseEntries(struct hist_Entry *entries, int count);
+
+// Queues the recent messages for a user that just joined
+int hist_replay(struct hist_Ring *ring, struct usr_UserData *user);
+
+#endif
@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "config.h"
 
 #define ARRAY_SIZE(arr) (int)(sizeof(arr)/sizeof((arr)[0]))
@@ -19,6 +21,137 @@
 #define MESSAGE	(6)
 #define EVENT	(7)
 
+/* LEVELS:
+   A record is only handed over when its rank reaches the minimum level
+   of the subsystem it comes from. MESSAGE lines rank with TRACE and
+   EVENT with INFO. The test is done at the call site, before the
+   message is built, and with LOG_MIN_LEVEL set at build time
+   (make LOG_MIN_LEVEL=2) calls below it are compiled out altogether.
+
+   Every source file defines LOG_SUBSYSTEM before its includes */
+
+#define LOG_CORE	(0)
+#define LOG_COM		(1)
+#define LOG_CHAT	(2)
+#define LOG_USER	(3)
+#define LOG_CHAN	(4)
+#define LOG_EVENTS	(5)
+#define LOG_STORE	(6)
+#define LOG_UPGRADE	(7)
+#define LOG_NUM_SUBSYSTEMS (8)
+
+#ifndef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_CORE
+#endif
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL TRACE
+#endif
+
+#define LOG_RANK(type) ((type) == MESSAGE ? TRACE : (type) == EVENT ? INFO : (type))
+
+// Minimum level of every subsystem, set from the config
+extern int log_levels[LOG_NUM_SUBSYSTEMS];
+
+#define log_isEnabled(type) (LOG_RANK(type) >= LOG_MIN_LEVEL && LOG_RANK(type) >= log_levels[LOG_SUBSYSTEM])
+
+//print to stdout and log to file, if type reaches the minimum level
+#define log_logMessage(msg, type) ({ int logRet_ = 0; if(log_isEnabled(type)) logRet_ = log_submitMessage((msg), (type)); logRet_; })
+
+//same as logMessage, but will append strerror at end of the string
+#define log_logError(msg, type) ({ int logRet_ = 0; if(log_isEnabled(type)) logRet_ = log_submitError((msg), (type)); logRet_; })
+
+/* ASYNCHRONOUS LOGGING:
+   Once init_logging started the writer thread, log_logMessage only copies
+   the message into a ring that belongs to the calling thread. Every ring
+   has one producer (its thread) and one consumer (the writer), so
+   neither side takes a lock. The writer formats the records and writes
+   them out in batches, a ring is drained in order but records of
+   different threads may be interleaved slightly out of order.
+
+   When a ring is full the record is dropped and counted, or with
+   LogOverflow block the thread waits for the writer. Before the writer
+   runs and after log_close stopped it, messages are written directly */
+
+#define LOG_RING_SIZE 256 // Records per thread, must be a power of 2
+#define LOG_MSG_SIZE 1008 // Longer messages are cut off
+#define LOG_BATCH_SIZE 65536 // Bytes the writer collects before writing
+#define LOG_WAIT_MS 10 // How long the writer sleeps when there is nothing to write
+
+struct log_Record {
+	time_t time;
+	int type;
+	int len;
+	char msg[LOG_MSG_SIZE];
+};
+
+// One per thread that has ever logged
+struct log_Ring {
+	struct log_Record records[LOG_RING_SIZE];
+	unsigned long head; // Next record to write, only moved by the owning thread
+	unsigned long tail; // Next record to read, only moved by the writer
+	unsigned long dropped; // Records that did not fit
+	unsigned long reported; // Dropped records the writer already reported, writer only
+	struct log_Ring *next;
+};
+
+/* ROTATION:
+   Records go to <Log>/YYYY-MM-DD.log. The writer switches files when
+   the date changes and, with LogMaxSize, before a batch would make the
+   file grow past it, continuing with YYYY-MM-DD.1.log and so on. The
+   file it switches to is opened ahead of time: once the current one is
+   90% full, or LOG_PREOPEN_SECS before midnight.
+
+   Files that were switched away from are handed to a maintainer thread
+   with the lowest priority, which gzips them with LogCompress and then
+   keeps only the newest LogRetention log files */
+
+#define LOG_PREOPEN_SECS 60
+#define LOG_MAX_INDEX 1000 // Files per day
+#define LOG_MAX_OLD 512 // Files looked at by retention, the oldest beyond it are left alone
+
+struct log_File {
+	FILE *file;
+	char date[11];
+	int index; // 0 for YYYY-MM-DD.log, N for YYYY-MM-DD.N.log
+	long size;
+};
+
+struct log_Writer {
+	struct log_Ring *rings;
+	pthread_t thread;
+	int running;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; // Wakes the writer up early when a ring fills up
+	char batch[LOG_BATCH_SIZE];
+	int len;
+	time_t lastTime; // Second the cached timestamp is for
+	char timeStr[22];
+	struct log_File next; // Opened ahead of the next rotation
+	time_t lastCheck; // Second the next file was last looked for
+};
+
+// A rotated file waiting for the maintainer
+struct log_Pending {
+	char path[BUFSIZ];
+	struct log_Pending *next;
+};
+
+struct log_Maintainer {
+	struct log_Pending *pending;
+	pthread_t thread;
+	int running;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	char open[2][32]; // Names of log_current and log_writer.next, retention never removes them
+};
+
+// A log file retention may remove
+struct log_Old {
+	char name[256];
+	int index;
+};
+
 /* Struct that defines how logging should be carried out
    useFile determines if logs will go to a file or not
    directory specifies the directory that the log files will go 
@@ -38,9 +171,67 @@ void log_editConfig(int useFule, char* dir);
 //open the log file
 int log_openFile();
 
-//cleans up the logging for termination of the program
+//builds the path of a log file
+void log_getPath(char *path, int size, char *date, int index);
+
+//opens a log file for appending, returns -1 on failure
+int log_openPath(struct log_File *file, char *date, int index);
+
+//tells the maintainer which files are open
+void log_noteOpen();
+
+//returns the newest file of a day if it still has room and was not compressed yet, else the one after it
+//never less than first
+int log_findIndex(char *date, int first);
+
+//switches files if the date changed or len more bytes would not fit, returns -1 if no file could be opened
+int log_rotate(long len);
+
+//opens the file the next rotation will switch to, if it is coming up
+void log_prepareNext();
+
+//closes a file that is done and hands it to the maintainer
+void log_retireFile(struct log_File *file);
+
+//closes a file that was opened ahead of time, removing it when nothing was written to it
+void log_discardFile(struct log_File *file);
+
+//compresses rotated files and applies retention
+void *log_maintainThread(void *param);
+
+//runs gzip on a file and waits for it
+int log_compress(char *path);
+
+//removes all but the newest keep log files, returns the amount removed
+int log_applyRetention(int keep);
+
+//returns 1 if first was started after second
+int log_isNewer(struct log_Old *first, struct log_Old *second);
+
+//returns 1 for YYYY-MM-DD[.N].log[.gz]
+int log_isLogName(char *name);
+
+//writes out everything that is still queued, then cleans up the logging for termination of the program
 void log_close();
 
+//gives the calling thread a ring to queue its records in
+struct log_Ring *log_registerThread();
+
+//copies a record into the ring of the calling thread, returns -1 if it has to be written directly
+int log_queueMessage(char *msg, int type);
+
+//drains the rings in batches until log_close
+void *log_writerThread(void *param);
+
+//formats everything that is queued into the batch, returns the amount of records
+int log_drainRings();
+
+//adds one formatted line to the batch, writing the batch out first if it is full
+void log_addToBatch(struct log_Record *record);
+
+//writes the batch to stdout and the log file
+void log_writeBatch();
+
 //Time format: [YYYY-MM-DD HH-MM-SS]
 int log_getTime(char str[22]);
 
@@ -66,10 +257,25 @@ void log_printLogFormat(char *msg, int type);
 // 6 = MESSAGE
 void log_createLogFormat(char* buffer, int size, char* msg, int type);
 
-//same as logMessage, but will append strerror at end of the string
-int log_logError(char* msg, int type);
+//returns the name of a type of message
+char *log_getTypeName(int type);
+
+//sets the minimum level of a subsystem, or of all of them when subsystem is NULL
+//returns -1 if either name is unknown
+int log_setLevel(char *subsystem, char *level);
+
+//returns the level or subsystem with that name, or -1
+int log_findLevel(char *name);
+
+int log_findSubsystem(char *name);
+
+//what log_logError does once the level was checked
+int log_submitError(char* msg, int type);
+
+//what log_logMessage does once the level was checked
+int log_submitMessage(char* msg, int type);
 
-//print to stdout and log to file
-int log_logMessage(char* msg, int type);
+//what log_submitMessage did before the writer thread, also used when it is not running
+int log_writeMessage(char* msg, int type);
 
 #endif
@@ -0,0 +1,130 @@
+#ifndef members_h
+#define members_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "reclaim.h"
+
+struct usr_UserData;
+
+// Data about a user specific to a channel or group
+// Channels: 0 - Default, 1 - chanvoice, 2 - chanop, 3 - groupop
+// Groups:   0 - Default, 1 - groupop
+struct mbr_Member {
+	struct usr_UserData *user;
+	int permLevel;
+};
+
+#define MBR_CHUNK_SIZE 256 // Members per chunk, a change copies at most two of them
+
+// Returns the member at index of a snapshot
+#define MBR_MEMBER(snapshot, index) (&(snapshot)->chunks[(index) / MBR_CHUNK_SIZE]->members[(index) % MBR_CHUNK_SIZE])
+
+// Immutable once published, shared by every snapshot that did not change it
+struct mbr_Chunk {
+	int refs; // Snapshots pointing to it
+	struct mbr_Member members[MBR_CHUNK_SIZE];
+};
+
+// Immutable, densely packed copy of the members
+// Every change publishes a new snapshot, only the chunks it touched are copied
+struct mbr_Snapshot {
+	int refs; // The list owns one, broadcasts in progress own the rest
+	int count; // Every chunk but the last one is full
+
+	// Only for large lists: members grouped by their IO thread, built on the first broadcast
+	// Thread i owns the members at order[start[i]] to order[start[i+1]-1], order follows start
+	int numParts;
+	int *start;
+
+	int numChunks;
+	struct mbr_Chunk *chunks[];
+};
+
+// Pre-rendered NAMES reply, shared by every request
+// Stale once the version of its list moves on
+struct mbr_Names {
+	unsigned long version;
+	int lineLen; // Longest line allowed when it was built
+	int numLines;
+	char **lines; // ":@nick +nick nick", each at most lineLen long
+	char data[];
+};
+
+/* Copy on write list of members
+
+   Readers call mbr_acquire() and may use the snapshot without any lock
+   until mbr_release(). Writers must hold the owner's mutex, they copy
+   the current snapshot, edit the copy and publish it atomically.
+   A copy only copies the chunk pointers, mbr_edit copies the chunks it
+   writes to, so a join or part costs a chunk instead of the whole list.
+   Old snapshots are freed through rcl_retire() */
+struct mbr_List {
+	int limit; // Maximum amount of members, 0 for no limit
+	unsigned long version; // Bumped by every new snapshot and when a member's nick changes or goes away
+	struct mbr_Snapshot *current;
+	struct mbr_Names *names; // Cache, replaced whenever it is found stale
+};
+
+int mbr_init(struct mbr_List *list);
+
+void mbr_free(struct mbr_List *list);
+
+// Returns the current snapshot, it stays valid until mbr_release()
+struct mbr_Snapshot *mbr_acquire(struct mbr_List *list);
+
+void mbr_release();
+
+// Keeps a snapshot alive after mbr_release(), only call between acquire and release
+void mbr_holdSnapshot(struct mbr_Snapshot *snapshot);
+
+// Drops a reference, the last one frees the snapshot
+void mbr_releaseSnapshot(void *ptr);
+
+// Groups the members by the IO thread that owns their connection, unless that was done already
+// Returns start or NULL if the snapshot is not partitioned
+int *mbr_partition(struct mbr_Snapshot *snapshot);
+
+// Returns the index of the user inside of the snapshot or -1
+int mbr_find(struct mbr_Snapshot *snapshot, struct usr_UserData *user);
+
+// Returns the permLevel of the user or -1 if not a member
+int mbr_getPermLevel(struct mbr_List *list, struct usr_UserData *user);
+
+// Copies the current snapshot with room for extra members, writers only
+// The chunks stay shared until mbr_edit writes to them
+struct mbr_Snapshot *mbr_copy(struct mbr_List *list, int extra);
+
+// Returns the member at index for writing, copying or adding its chunk first. NULL on failure
+// index may be at most count, the snapshot must not be published yet
+struct mbr_Member *mbr_edit(struct mbr_Snapshot *snapshot, int index);
+
+// Drops a reference to a chunk, the last one frees it
+void mbr_releaseChunk(struct mbr_Chunk *chunk);
+
+// Makes snapshot the current one and retires the old one, writers only
+void mbr_publish(struct mbr_List *list, struct mbr_Snapshot *snapshot);
+
+// Appends a user, returns -1 if the limit is reached or out of memory
+int mbr_add(struct mbr_List *list, struct usr_UserData *user, int permLevel);
+
+// Appends many users with a single copy, writers only
+// Neither the limit nor duplicates are checked
+int mbr_addMany(struct mbr_List *list, struct mbr_Member *members, int count);
+
+// Removes a user by swapping in the last member, returns -1 if not found
+int mbr_remove(struct mbr_List *list, struct usr_UserData *user);
+
+// Changes the permLevel of a member, returns -1 if not found
+int mbr_setPermLevel(struct mbr_List *list, struct usr_UserData *user, int permLevel);
+
+// Builds the NAMES lines, symbols[permLevel] is the nick prefix (' ' for none)
+struct mbr_Names *mbr_renderNames(struct mbr_Snapshot *snapshot, const char *symbols, int lineLen, unsigned long version);
+
+// Returns the cached NAMES lines, rebuilding them if they are stale
+// Must be called inside of a read section, the result is valid until it ends
+struct mbr_Names *mbr_getNames(struct mbr_List *list, const char *symbols, int lineLen);
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <pthread.h>
+#include "logging.h"
+
+/*	SERVER METRICS:
+	Every thread counts into its own mtr_Thread, which only that thread
+	writes, so counting is a relaxed store into a line nobody else
+	writes. Readers sum the threads up whenever they are asked.
+
+	The SampleMetrics event turns the counters into per second rates
+	once a second. Busy time is counted in ns, so its rate divided by
+	1e9 is how much of the last second a thread spent working.
+
+	Gauges such as queue depths are not counted, they are looked up
+	while a report is made. mtr_makeReport collects everything for
+	STATS m. With EnableMetrics MetricsSocket answers with the same
+	report plus the timed events in the Prometheus text format, to a
+	plain connection or to an HTTP GET.
+*/
+
+#define MTR_MAX_COMMANDS 64
+#define MTR_MAX_THREADS 256
+#define MTR_TIMEOUT 5 // Seconds a reader may stall the metrics thread
+
+#define MTR_MSGS_IN 0
+#define MTR_BYTES_IN 1
+#define MTR_MSGS_OUT 2
+#define MTR_BYTES_OUT 3
+#define MTR_WAKEUPS 4 // epoll_wait returning
+#define MTR_EVENTS 5 // epoll events or dataQueue jobs handled
+#define MTR_BUSY 6 // In ns
+#define MTR_NUM_COUNTERS 7
+
+// Upper bounds of the sendQ depth buckets, the last one takes the rest
+#define MTR_SENDQ_BUCKETS {0, 1, 4, 16, 64, 256, 1024}
+#define MTR_NUM_SENDQ_BUCKETS 8
+
+struct mtr_Command {
+	uint64_t count;
+	uint64_t total; // In ns
+	uint64_t max;
+};
+
+struct mtr_Thread {
+	char name[16];
+	int index; // Tells threads of the same name apart, the id for IO threads
+	uint64_t counters[MTR_NUM_COUNTERS];
+	struct mtr_Command commands[MTR_MAX_COMMANDS];
+
+	// Only written by the SampleMetrics event
+	uint64_t sampled[MTR_NUM_COUNTERS] __attribute__((aligned(64)));
+	uint64_t perSecond[MTR_NUM_COUNTERS];
+
+	struct mtr_Thread *next;
+} __attribute__((aligned(64))); // Prevent false sharing between threads
+
+struct mtr_Metrics {
+	int listener;
+	struct mtr_Thread *threads;
+	uint64_t sampleTime; // Of the last sample, 0 before the first
+};
+
+struct mtr_ThreadReport {
+	char name[16];
+	int index;
+	uint64_t counters[MTR_NUM_COUNTERS];
+	uint64_t perSecond[MTR_NUM_COUNTERS];
+};
+
+struct mtr_CommandReport {
+	char name[50];
+	struct mtr_Command stats;
+};
+
+struct mtr_Report {
+	int users;
+	int dataQueue, dataBusy;
+	int retired; // Waiting for rcl_collect
+	long historyBytes;
+
+	// sendQ depth of every connected user
+	uint64_t sendQ[MTR_NUM_SENDQ_BUCKETS];
+	uint64_t sendQTotal;
+	int sendQMax;
+
+	uint64_t counters[MTR_NUM_COUNTERS];
+	uint64_t perSecond[MTR_NUM_COUNTERS];
+
+	struct mtr_ThreadReport threads[MTR_MAX_THREADS];
+	int numThreads;
+
+	struct mtr_CommandReport commands[MTR_MAX_COMMANDS];
+	int numCommands;
+};
+
+extern struct mtr_Metrics mtr_metrics;
+extern const char *mtr_counterNames[MTR_NUM_COUNTERS];
+
+// Listens on MetricsSocket when EnableMetrics is set
+int init_metrics();
+
+// Stops answering on MetricsSocket and removes it
+void mtr_close();
+
+// Adds the calling thread's counters to the list under name
+// An index of -1 takes the next one that is free for that name
+struct mtr_Thread *mtr_registerThread(const char *name, int index);
+
+// Adds n to a counter of the calling thread
+void mtr_count(int counter, uint64_t n);
+
+// Records a run of the command with that id
+void mtr_recordCommand(int id, uint64_t ns);
+
+// Turns the counters into per second rates, run once a second
+int mtr_sample();
+
+// Fills in report with the current counters and gauges
+int mtr_makeReport(struct mtr_Report *report);
+
+// Appends a formatted string to out, growing it as needed. Returns the new length or -1
+int mtr_append(char **out, int *size, int len, const char *format, ...);
+
+// Appends report to out in the Prometheus text format, growing it as needed
+// Returns the new length or -1
+int mtr_formatPrometheus(struct mtr_Report *report, char **out, int *size, int len);
+
+// Accepts connections on MetricsSocket
+void *mtr_thread(void *param);
+
+// Answers one connection with a report
+int mtr_serve(int conn);
+
+#endif
@@ -3,8 +3,11 @@
 
 // Standard replies
 #define RPL_WELCOME "001"
+#define RPL_ENDOFSTATS "219"
 #define RPL_NAMREPLY "353"
 #define RPL_ENDOFNAMES "366"
+#define RPL_BANLIST "367"
+#define RPL_ENDOFBANLIST "368"
 
 // Errors
 #define ERR_UNKNOWNERROR "400"
@@ -21,12 +24,21 @@
 #define ERR_KEYSET "467"
 #define ERR_CHANNELISFULL "471"
 #define ERR_UNKNOWNMODE "472"
+#define ERR_BANNEDFROMCHAN "474"
 #define ERR_BADCHANNELKEY "475"
+#define ERR_NOPRIVILEGES "481"
 #define ERR_CHANOPRIVSNEEDED "482"
 #define ERR_USERSDONTMATCH "502"
 
 // Custom
 #define ERR_NOSUCHGROUP "434"
 #define ERR_GROUPISFULL "435"
+#define RPL_HISTORY "610"
+#define RPL_ENDOFHISTORY "611"
+#define RPL_SEARCH "612"
+#define RPL_ENDOFSEARCH "613"
+#define RPL_STATSEVENT "614"
+#define RPL_STATSTRACE "615"
+#define RPL_STATSMETRIC "616"
 
 #endif
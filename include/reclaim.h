@@ -0,0 +1,67 @@
+#ifndef reclaim_h
+#define reclaim_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "logging.h"
+
+/* Epoch based memory reclamation
+
+   Data that is read without a lock (nicknames, member lists...) is
+   replaced by publishing a new copy with an atomic store. The old copy
+   is handed to rcl_retire() and only freed by rcl_collect() once every
+   thread that could still be reading it has left its read section.
+
+   Readers must wrap every access in rcl_readLock()/rcl_readUnlock()
+   and must never keep a pointer after unlocking. Sections may be nested */
+
+// One per thread that has ever entered a read section
+struct rcl_Thread {
+	unsigned long epoch; // 0 when not inside of a read section
+	int depth; // Nesting level, only touched by the owning thread
+	struct rcl_Thread *next;
+} __attribute__((aligned(64))); // Prevent false sharing between readers
+
+// Memory waiting for all readers to be done with it
+struct rcl_Retired {
+	void *ptr;
+	void (*freeFunc)(void *);
+	unsigned long epoch; // Global epoch at the time it was retired
+	struct rcl_Retired *next;
+};
+
+struct rcl_Domain {
+	unsigned long epoch;
+	struct rcl_Thread *threads;
+	struct rcl_Retired *retired;
+	int numRetired;
+	pthread_mutex_t retiredMutex;
+};
+
+int init_reclaim();
+
+// Frees everything that is still waiting, only call when no readers are left
+void rcl_close();
+
+// Gives the calling thread a slot to announce its epoch in
+struct rcl_Thread *rcl_registerThread();
+
+// Marks the start of a lock free read section for this thread
+void rcl_readLock();
+
+// Marks the end of a lock free read section for this thread
+void rcl_readUnlock();
+
+// Schedule ptr to be freed with freeFunc (free() if NULL) after all current readers are done
+int rcl_retire(void *ptr, void (*freeFunc)(void *));
+
+// Frees all retired memory that can no longer be reached by readers
+// Returns the amount of items freed
+int rcl_collect();
+
+// Returns the amount of items waiting to be freed
+int rcl_countRetired();
+
+#endif
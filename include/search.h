@@ -0,0 +1,164 @@
+#ifndef search_h
+#define search_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include "logging.h"
+#include "linkedlist.h"
+#include "hashtable.h"
+
+struct com_Buffer;
+struct usr_UserData;
+struct chan_Channel;
+
+/*	SEARCH INDEX:
+	word -> every message containing it
+
+	Messages get document numbers in the order the search thread sees
+	them, so the list of a word only ever grows at its end. Lists store
+	the distance to the previous number as a varint, most take a single
+	byte. Every SRCH_SKIP_STEP numbers a skip point remembers where the
+	decoder was, a query can jump over the parts of long lists that can
+	not match.
+
+	Only the search thread reads or writes the index. Messages and
+	queries are both queued to it, the IO and data threads never wait
+	for a query. Once SearchMessages messages are indexed the oldest
+	half is dropped
+*/
+
+#define SRCH_SKIP_STEP 128 // Postings between two skip points
+#define SRCH_TERM_LEN 32 // Longer words are cut
+#define SRCH_MAX_TERMS 8 // Words a query may contain
+#define SRCH_PAGE_MAX 50 // Most results a single reply may hold
+
+struct srch_Skip {
+	unsigned long doc; // Last document before offset
+	int offset;
+};
+
+struct srch_Posting {
+	int count;
+	unsigned long last; // Newest document in the list
+	int len, size;
+	unsigned char *data; // Varint encoded differences
+	int numSkips, maxSkips;
+	struct srch_Skip *skips;
+};
+
+// Decodes a posting list front to back
+struct srch_Cursor {
+	struct srch_Posting *list;
+	int pos; // Byte offset of the next varint
+	int index; // Documents decoded so far
+	unsigned long doc; // Current document
+};
+
+// What a document number refers to
+struct srch_Doc {
+	unsigned long msgid;
+	time_t time;
+	struct chan_Channel *channel; // Channels live as long as the server
+};
+
+// Asked for by SEARCH, answered by the search thread
+struct srch_Query {
+	struct usr_UserData *user;
+	int userId; // The slot may belong to someone else by the time it runs
+	char nick[50];
+	char words[BUFSIZ];
+	time_t since, until;
+	int max;
+	int numChannels;
+	struct chan_Channel **channels; // The only channels results may come from
+};
+
+// Either a message to index or a query to answer
+struct srch_Job {
+	struct srch_Query *query; // NULL for a message
+	unsigned long msgid;
+	time_t time;
+	struct chan_Channel *channel;
+	struct com_Buffer *buffer;
+};
+
+struct srch_Index {
+	struct hash_Table terms; // Word -> srch_Posting
+	unsigned long base; // Document number of docs[0]
+	int numDocs, maxDocs;
+	struct srch_Doc *docs;
+
+	struct link_List queue;
+	pthread_mutex_t queueMutex;
+	pthread_cond_t queueCond;
+	int running;
+	pthread_t thread;
+};
+
+extern struct srch_Index srch_index;
+
+int init_search();
+
+// Stops the search thread, dropping whatever is still queued
+void srch_close();
+
+// Queues a channel message for indexing, takes a reference to buffer
+int srch_addMessage(struct chan_Channel *channel, unsigned long msgid, time_t time, struct com_Buffer *buffer);
+
+// Queues a query, the thread frees it once the reply is sent
+int srch_query(struct srch_Query *query);
+
+void srch_freeQuery(struct srch_Query *query);
+
+void *srch_thread(void *param);
+
+// Cuts the next word out of str, lowercase and at most SRCH_TERM_LEN - 1 long
+// Returns a pointer past the word or NULL when there are no words left
+char *srch_nextWord(char *str, char *end, char word[SRCH_TERM_LEN]);
+
+// Adds a document number to the end of a list
+int srch_append(struct srch_Posting *list, unsigned long doc);
+
+void srch_freePosting(struct srch_Posting *list);
+
+// Indexes every word of a message
+int srch_indexMessage(struct srch_Job *job);
+
+// Drops the oldest half of the documents and rewrites every list
+int srch_compact();
+
+// Moves to the next document, returns -1 at the end of the list
+int srch_next(struct srch_Cursor *cursor);
+
+// Moves to the first document at or after doc, returns -1 if there is none
+int srch_seek(struct srch_Cursor *cursor, unsigned long doc);
+
+// Returns the index of the first document not older than time
+int srch_findTime(time_t time);
+
+// Fills hits with up to max matching document numbers, newest first
+int srch_match(struct srch_Query *query, unsigned long *hits, int max);
+
+// Passed to srch_addLine while looking for the text of a result
+struct srch_Line {
+	unsigned long msgid; // The only line that is wanted
+	struct com_Buffer **batch;
+	struct srch_Query *query;
+	char *target;
+	int found;
+};
+
+// Adds one RPL_SEARCH line to the batch if it is the message that was asked for
+void srch_addLine(unsigned long msgid, time_t time, char *line, int len, void *data);
+
+// Finds the text of a message in memory or the archive and adds it to the reply
+int srch_addResult(struct com_Buffer **batch, struct srch_Query *query, struct srch_Doc *doc);
+
+// Runs a query and sends the reply
+int srch_answer(struct srch_Query *query);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef snapshot_h
+#define snapshot_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "linkedlist.h"
+#include "chat.h"
+
+struct link_Node;
+
+/*	STATE FILE FORMAT:
+	snap_Header, then one snap_Record per group followed by the
+	records of its channels. Every record is followed by its name,
+	its key and numStrings ban masks. Who had ops is not kept, a nick
+	proves nothing after a restart. A string is a uint16_t length and the bytes, without a
+	terminator. Records start on 8 byte boundaries
+
+	The file is built in memory, written to <StateFile>.tmp and renamed
+	over the old one, so a crash never leaves half a file behind.
+	Loading maps the file and walks it once from front to back
+*/
+
+#define SNAP_MAGIC "BNDSTATE"
+#define SNAP_VERSION 2
+
+#define SNAP_GROUP 1
+#define SNAP_CHANNEL 2
+
+struct snap_Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t numGroups;
+	uint64_t size; // Of the whole file, a shorter file is rejected
+	int64_t time; // When it was taken
+};
+
+struct snap_Record {
+	uint32_t type;
+	uint32_t numStrings; // Bans, not counting name and key
+	int32_t limit; // Channels only, 0 for none
+	char modes[NUM_MODES];
+};
+
+// Growing buffer the file is built in
+struct snap_Writer {
+	char *data;
+	long len, size;
+	int failed;
+};
+
+// Passed to snap_addMask by ban_forEach
+struct snap_Strings {
+	struct snap_Writer *writer;
+	uint32_t count;
+};
+
+// Restores the saved state when EnableState is set
+int init_snapshot();
+
+// Saves the state one last time before quitting
+void snap_close();
+
+// Builds a whole snapshot in memory, the caller frees writer->data
+int snap_build(struct snap_Writer *writer);
+
+// Writes the state file, called periodically by evt_saveState
+int snap_save();
+
+// Restores the groups and channels from the state file, if there is one
+int snap_load();
+
+// Restores the groups and channels of a snapshot in memory, source is only logged
+int snap_loadData(char *data, long size, char *source);
+
+// Appends len bytes, aligned to 8 bytes when align is set
+void snap_put(struct snap_Writer *writer, void *data, long len, int align);
+
+void snap_putString(struct snap_Writer *writer, char *str);
+
+// Adds a ban mask, for ban_forEach
+void snap_addMask(char *mask, void *data);
+
+// Adds the record of a group and all of its channels
+int snap_saveGroup(struct snap_Writer *writer, struct link_Node *groupNode);
+
+int snap_saveChannel(struct snap_Writer *writer, struct link_Node *channelNode);
+
+// Reads a string, returns its length or -1 if it runs past end
+int snap_getString(char **pos, char *end, char *buff, int size);
+
+// Copies count strings into one allocation and fills in an array of pointers to them
+// Returns the allocation, or NULL if the strings run past end. Both must be freed
+char *snap_getStrings(char **pos, char *end, uint32_t count, char ***strings);
+
+// Applies one record, returns the group for the channel records that follow
+struct link_Node *snap_loadRecord(struct snap_Record *record, char **pos, char *end, struct link_Node *groupNode);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "logging.h"
+
+/*	STAGE TRACING:
+	With EnableTracing every line a client sends is stamped when it is
+	read and the stamp travels with it: on the com_QueueJob through the
+	dataQueue, on the chat_Message through the type 1 re-enqueue and
+	cmd_runCommand, and through trc_origin onto every job the command
+	queues for sending, across a fan-out to the IO threads as well.
+	Each stage adds the time it took to a histogram of the thread it
+	ran on:
+		read        reading the socket and queueing the lines
+		dataqueue   a line waiting in the dataQueue to be parsed
+		parse       chat_parseInput
+		cmdqueue    the parsed command waiting in the dataQueue again
+		command     cmd_runCommand
+		sendq       output waiting in the sendQ until it is written
+		epollout    EPOLLOUT being armed until it fires
+		write       sending a job to the socket
+		total       the read until the output it caused is written
+
+	A thread's histograms are only written by that thread, so recording
+	is a clock read and a few relaxed stores. STATS t merges them when it
+	is asked to.
+*/
+
+#define TRC_SUB_BITS 4 // 16 buckets per power of two
+#define TRC_MAX_BITS 40 // Values up to 2^41 ns, about 36 minutes
+#define TRC_BUCKETS ((TRC_MAX_BITS - TRC_SUB_BITS + 2) << TRC_SUB_BITS)
+
+#define TRC_READ 0
+#define TRC_DATA_QUEUE 1
+#define TRC_PARSE 2
+#define TRC_COMMAND_QUEUE 3
+#define TRC_COMMAND 4
+#define TRC_SEND_QUEUE 5
+#define TRC_EPOLLOUT 6
+#define TRC_WRITE 7
+#define TRC_TOTAL 8
+#define TRC_NUM_STAGES 9
+
+// Carried on a com_QueueJob, 0 when not traced
+struct trc_Stamps {
+	uint64_t origin; // When the line that caused the job was read
+	uint64_t queued;
+};
+
+struct trc_Histogram {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[TRC_BUCKETS];
+};
+
+struct trc_Thread {
+	char name[16];
+	struct trc_Histogram stages[TRC_NUM_STAGES];
+	struct trc_Thread *next;
+};
+
+struct trc_Tracer {
+	int enabled;
+	struct trc_Thread *threads; // Every thread that recorded something
+};
+
+// Percentiles in ns
+struct trc_Summary {
+	const char *stage;
+	uint64_t count;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+extern struct trc_Tracer trc_state;
+extern const char *trc_stageNames[TRC_NUM_STAGES];
+
+// Read time of the line the calling thread is handling, 0 if none
+extern __thread uint64_t trc_origin;
+
+// Turns tracing on when EnableTracing is set
+int init_tracing();
+
+// Monotonic time in ns
+uint64_t trc_now();
+
+// Adds the calling thread's histograms to the list under name
+struct trc_Thread *trc_registerThread(const char *name);
+
+// Records ns in a stage of the calling thread
+void trc_recordValue(int stage, uint64_t ns);
+
+// Records the time since start in a stage and returns the current time
+uint64_t trc_record(int stage, uint64_t start);
+
+// Sets *stamp to the current time unless it is already set
+void trc_stampOnce(uint64_t *stamp);
+
+// Returns the bucket of a value
+int trc_bucket(uint64_t ns);
+
+// Returns the highest value of a bucket
+uint64_t trc_bucketValue(int bucket);
+
+// Sums up a stage over every thread, returns the number of threads
+int trc_merge(struct trc_Histogram *hist, int stage);
+
+// Returns the value below which percentile % of the histogram lies
+uint64_t trc_percentile(struct trc_Histogram *hist, double percentile);
+
+// Fills summaries with every stage, returns TRC_NUM_STAGES or -1
+int trc_getSummary(struct trc_Summary summaries[TRC_NUM_STAGES]);
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef upgrade_h
+#define upgrade_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "logging.h"
+#include "chat.h"
+
+struct com_SocketInfo;
+struct snap_Writer;
+struct mbr_List;
+struct hist_Ring;
+
+/*	HOT UPGRADE:
+	A running server listens on UpgradeSocket. A newly started binary
+	with EnableUpgrade connects to it before it sets anything else up,
+	the old process then:
+		pauses its IO threads, waits for the data threads to run out of
+		work and for the archive to reach the disk
+		sends an upg_Header, a state snapshot (see snapshot.h) and the
+		data records, then the listening socket and one socket per user
+		with SCM_RIGHTS
+		waits for the new process to confirm, confirms back and quits
+
+	Input the old process had not read yet is still inside of the
+	sockets, output it had not written yet is sent along with the user.
+	If the new process goes away before confirming, the old one simply
+	resumes. The new process only confirms once everything is restored,
+	right before it starts serving the clients
+
+	DATA RECORDS:
+	One upg_User per user, followed by its nick and its unsent output.
+	Then one upg_List per group followed by the records of its channels,
+	each followed by its name, numMembers upg_Member and numLines recent
+	messages, an upg_Line followed by the line. Records start on 8 byte
+	boundaries, a user is referred to by the order of its record
+*/
+
+#define UPG_MAGIC "BNDUPGRD"
+#define UPG_VERSION 1
+
+#define UPG_USER 1
+#define UPG_GROUP 2
+#define UPG_CHANNEL 3
+
+#define UPG_FDS_PER_MSG 250 // Below SCM_MAX_FD
+#define UPG_TIMEOUT 60 // Seconds either side waits for the other
+
+struct upg_Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t numFds; // The listening socket, then one per user
+	uint64_t stateLen;
+	uint64_t dataLen;
+	uint64_t nextMsgid;
+};
+
+struct upg_User {
+	uint32_t type;
+	uint32_t sendLen; // Output that was queued but not written
+	int64_t lastMsg;
+	int32_t pinged;
+	char modes[NUM_MODES];
+	struct sockaddr_storage addr;
+};
+
+struct upg_List {
+	uint32_t type;
+	uint32_t numMembers;
+	uint32_t numLines;
+};
+
+struct upg_Member {
+	uint32_t user;
+	int32_t permLevel;
+};
+
+struct upg_Line {
+	uint64_t msgid;
+	int64_t time;
+	uint32_t len;
+};
+
+// What this process received from the one it replaces
+struct upg_Handoff {
+	int active; // Set when this process took over from another one
+	int conn; // To the old process, until the takeover is confirmed
+	struct upg_Header header;
+	char *state; // header.stateLen bytes
+	char *data; // header.dataLen bytes
+	int *fds;
+};
+
+extern struct upg_Handoff upg_handoff;
+extern int upg_handedOver; // Set in the old process once the new one took over
+
+// Takes over from a running server when there is one listening on UpgradeSocket
+int init_upgrade();
+
+// Stops waiting for new binaries
+void upg_close();
+
+// Restores the handed over users and starts serving them, then accepts new clients
+// and waits for the next upgrade
+int upg_resume();
+
+// Returns the listening socket that was handed over or -1
+int upg_takeListener(struct com_SocketInfo *info);
+
+// Creates UpgradeSocket and the thread that waits on it
+int upg_listen();
+
+// Accepts new binaries one at a time
+void *upg_thread(void *param);
+
+// Returns 1 if the peer runs as the same user as this process
+int upg_checkPeer(int conn);
+
+// Everything the old process does, returns only if the upgrade failed
+int upg_handOver(int conn);
+
+// Adds a record per user, fills in index (slot -> record) and fds, returns the amount
+int upg_addUsers(struct snap_Writer *writer, int *index, int *fds);
+
+// Adds the members that were handed over, returns the amount
+int upg_addMembers(struct snap_Writer *writer, struct mbr_List *list, int *index);
+
+// Adds the recent messages of a channel, returns the amount
+int upg_addLines(struct snap_Writer *writer, struct hist_Ring *ring);
+
+// Adds one group or channel record
+int upg_addList(struct snap_Writer *writer, uint32_t type, char *name, struct mbr_List *list, struct hist_Ring *ring, int *index);
+
+// Adds a record per group and channel
+int upg_addGroups(struct snap_Writer *writer, int *index);
+
+// Sends or receives exactly len bytes
+int upg_send(int conn, void *data, long len);
+
+int upg_recv(int conn, void *data, long len);
+
+// Passes count descriptors, at most UPG_FDS_PER_MSG in a single message
+int upg_sendFds(int conn, int *fds, int count);
+
+int upg_recvFds(int conn, int *fds, int count);
+
+// Reads everything the old process sends
+int upg_receive(int conn);
+
+// Restores a user record, user is left NULL if it could not be created
+// Returns -1 only if the record runs past end
+int upg_restoreUser(struct upg_User *record, char **pos, char *end, int fd, int number, struct usr_UserData **user);
+
+// Restores a group or channel record, groupNode is the group of the channel records that follow
+// Returns -1 only if the record runs past end
+int upg_restoreList(struct upg_List *record, char **pos, char *end, struct link_Node **groupNode,
+		struct usr_UserData **users, int numUsers);
+
+// Walks the data records, fills in users in record order
+int upg_restore(struct usr_UserData **users, int numUsers);
+
+// Tells the old process to quit and waits until it agreed
+int upg_confirm();
+
+#endif
@@ -2,10 +2,21 @@
 #define user_h
 
 #include "chat.h"
+#include "reclaim.h"
 #include <time.h>
 
 #define UNREGISTERED_NAME "unreg"
 
+struct mbr_List;
+
+// Immutable copy of a user's nickname, replaced as a whole on NICK
+// Only access it inside of rcl_readLock()/rcl_readUnlock()
+struct usr_Name {
+	char *nick;
+	char *prefix; // nick!user@host, used as the source of messages
+	char data[];
+};
+
 // Data about an user
 // When a user is first loaded from save
 // All details will come from the save
@@ -14,18 +25,44 @@
 struct usr_UserData {
 	int id;
 	char modes[NUM_MODES];
-	char *nickname;
+	struct usr_Name *name; // Swapped atomically, never edited in place
+	char host[INET6_ADDRSTRLEN];
 	struct com_SocketInfo socketInfo;	
 	pthread_mutex_t userMutex;
 	struct link_List sendQ;
 
 	time_t lastMsg; // Keep track of time, too fast = kick, too slow = kick
 	int pinged; // Send only one ping to prevent spam from server
+	uint64_t timer; // Checks for a timeout, on evt_scheduler
+	uint64_t traceArmed; // When EPOLLOUT was armed, 0 once it fired
+
+	// Member lists the user is in, their NAMES go stale when the nick changes
+	// Guarded by userMutex, channels and groups are never freed
+	struct mbr_List **lists;
+	int numLists, maxLists;
 };
 
 // Fills in buffer with selected user's nickname
 int usr_getNickname(char *buff, struct usr_UserData *user);
 
+// Fills in buffer with selected user's nick!user@host
+int usr_getPrefix(char *buff, int size, struct usr_UserData *user);
+
+// Allocates a name holding both the nickname and the prefix
+struct usr_Name *usr_createName(char *nick, char *host);
+
+// Publishes a new nickname and retires the old one
+int usr_setNickname(struct usr_UserData *user, char *nick);
+
+// Remembers that the user joined list, called by the list's writer
+int usr_addList(struct usr_UserData *user, struct mbr_List *list);
+
+// Forgets list again, called by the list's writer
+void usr_removeList(struct usr_UserData *user, struct mbr_List *list);
+
+// Marks the NAMES of every list the user is in as stale, userMutex must be held
+void usr_touchLists(struct usr_UserData *user);
+
 //Get a user by name
 struct usr_UserData *usr_getUserByName(char *name);
 
@@ -41,8 +78,9 @@ struct usr_UserData *usr_createUser(struct com_SocketInfo *sockInfo, char *name)
 // Remove a user from the server
 int usr_deleteUser(struct usr_UserData *user);
 
-// Searches for and kicks users that surpassed their message timeouts
-int usr_timeOutUsers(int timeOut);
+// Kicks the user once it surpassed its message timeout and pings it halfway there
+// Runs on the user's own timer, which it moves to the next time that could happen
+int usr_checkTimeout(void *data);
 
 // Adds or removes a mode from a user
 void usr_changeUserMode(struct usr_UserData *user, char op, char mode);
@@ -0,0 +1,779 @@
+#define LOG_SUBSYSTEM LOG_STORE
+#include "archive.h"
+#include "boundless.h"
+
+struct arch_Archive arch_state = {0};
+
+int init_archive(){
+	if(fig_Configuration.useArchive == 0)
+		return 1;
+
+	int ret = pthread_mutex_init(&arch_state.queueMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	ret = pthread_mutex_init(&arch_state.logsMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	ret = pthread_cond_init(&arch_state.queueCond, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_cond.", ERROR);
+		return -1;
+	}
+
+	ret = pthread_mutex_init(&arch_state.readMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	ret = pthread_cond_init(&arch_state.readCond, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_cond.", ERROR);
+		return -1;
+	}
+
+	if(hash_init(&arch_state.logs, 16) == -1)
+		return -1;
+
+	if(mkdir(fig_Configuration.archiveDirectory, 0750) == -1 && errno != EEXIST){
+		log_logError("Error creating archive directory", ERROR);
+		return -1;
+	}
+
+	arch_state.running = 1;
+	if(pthread_create(&arch_state.writer, NULL, arch_writerThread, NULL) != 0){
+		log_logError("Error creating archive thread", ERROR);
+		return -1;
+	}
+
+	if(pthread_create(&arch_state.reader, NULL, arch_readerThread, NULL) != 0){
+		log_logError("Error creating archive reader thread", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+void arch_close(){
+	if(arch_state.running == 0)
+		return;
+
+	pthread_mutex_lock(&arch_state.queueMutex);
+	arch_state.running = 0;
+	pthread_cond_signal(&arch_state.queueCond);
+	pthread_mutex_unlock(&arch_state.queueMutex);
+
+	pthread_mutex_lock(&arch_state.readMutex);
+	pthread_cond_signal(&arch_state.readCond);
+	pthread_mutex_unlock(&arch_state.readMutex);
+
+	pthread_join(arch_state.writer, NULL);
+	pthread_join(arch_state.reader, NULL);
+}
+
+void arch_flush(){
+	struct timespec delay = {.tv_nsec = 1000000}; // 1ms
+
+	pthread_mutex_lock(&arch_state.queueMutex);
+	while(arch_state.running && (link_isEmpty(&arch_state.queue) == -1 || arch_state.busy)){
+		pthread_cond_signal(&arch_state.queueCond);
+		pthread_mutex_unlock(&arch_state.queueMutex);
+		nanosleep(&delay, NULL);
+		pthread_mutex_lock(&arch_state.queueMutex);
+	}
+	pthread_mutex_unlock(&arch_state.queueMutex);
+}
+
+int arch_append(char *group, char *channel, unsigned long msgid, time_t time, struct com_Buffer *buffer){
+	if(__atomic_load_n(&arch_state.running, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	struct arch_Record *record = malloc(sizeof(struct arch_Record));
+	if(record == NULL){
+		log_logError("Error allocating archive record", WARNING);
+		return -1;
+	}
+
+	record->msgid = msgid;
+	record->time = time;
+	record->group = group;
+	record->channel = channel;
+	record->buffer = buffer;
+	__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&arch_state.queueMutex);
+	struct link_Node *node = link_add(&arch_state.queue, record);
+	pthread_cond_signal(&arch_state.queueCond);
+	pthread_mutex_unlock(&arch_state.queueMutex);
+
+	if(node == NULL){
+		com_releaseBuffer(buffer);
+		free(record);
+		return -1;
+	}
+
+	return 1;
+}
+
+struct arch_Log *arch_getLog(char *group){
+	struct arch_Log *log = hash_get(&arch_state.logs, group);
+	if(log != NULL)
+		return log;
+
+	// Only one thread may create and load a log
+	pthread_mutex_lock(&arch_state.logsMutex);
+	log = hash_get(&arch_state.logs, group);
+	if(log != NULL){
+		pthread_mutex_unlock(&arch_state.logsMutex);
+		return log;
+	}
+
+	log = calloc(1, sizeof(struct arch_Log));
+	if(log == NULL){
+		pthread_mutex_unlock(&arch_state.logsMutex);
+		log_logError("Error allocating archive log", WARNING);
+		return NULL;
+	}
+	log->fd = -1;
+	pthread_mutex_init(&log->logMutex, NULL);
+
+	// Group names are case insensitive, keep the directory name safe
+	int len = snprintf(log->path, ARRAY_SIZE(log->path), "%s/", fig_Configuration.archiveDirectory);
+	for(int i = 0; group[i] != '\0' && len < ARRAY_SIZE(log->path) - 1; i++){
+		unsigned char c = tolower((unsigned char) group[i]);
+		log->path[len++] = isalnum(c) || c == '&' || c == '-' || c == '_' ? c : '_';
+	}
+	log->path[len] = '\0';
+
+	if(mkdir(log->path, 0750) == -1 && errno != EEXIST)
+		log_logError("Error creating group archive", WARNING);
+
+	arch_loadLog(log);
+	hash_put(&arch_state.logs, group, log);
+	link_add(&arch_state.logList, log);
+	pthread_mutex_unlock(&arch_state.logsMutex);
+
+	return log;
+}
+
+int arch_compareSegments(const void *first, const void *second){
+	const struct arch_Segment *a = first, *b = second;
+	return (a->firstId > b->firstId) - (a->firstId < b->firstId);
+}
+
+int arch_loadLog(struct arch_Log *log){
+	DIR *dir = opendir(log->path);
+	if(dir == NULL)
+		return -1;
+
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL){
+		char *end;
+		unsigned long firstId = strtoul(entry->d_name, &end, 10);
+		if(end == entry->d_name || strcmp(end, ".seg") != 0)
+			continue;
+
+		arch_addSegment(log, firstId);
+	}
+	closedir(dir);
+
+	qsort(log->segments, log->numSegments, sizeof(struct arch_Segment), arch_compareSegments);
+	for(int i = 0; i < log->numSegments; i++)
+		arch_scanSegment(log, &log->segments[i]);
+
+	return log->numSegments;
+}
+
+void arch_segmentPath(struct arch_Log *log, unsigned long firstId, char path[ARCH_PATH_LEN]){
+	snprintf(path, ARCH_PATH_LEN, "%s/%lu.seg", log->path, firstId);
+}
+
+int arch_scanSegment(struct arch_Log *log, struct arch_Segment *segment){
+	char path[ARCH_PATH_LEN];
+	arch_segmentPath(log, segment->firstId, path);
+
+	int fd = open(path, O_RDWR);
+	if(fd == -1)
+		return -1;
+
+	struct stat info;
+	if(fstat(fd, &info) == -1 || info.st_size == 0){
+		close(fd);
+		return -1;
+	}
+
+	char *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED){
+		log_logError("Error mapping archive segment", WARNING);
+		close(fd);
+		return -1;
+	}
+
+	// A record cut short by a crash has no newline and is cut off
+	long pos = 0;
+	while(pos < info.st_size){
+		char *end = memchr(&map[pos], '\n', info.st_size - pos);
+		if(end == NULL)
+			break;
+
+		long len = end - &map[pos] + 1;
+		unsigned long msgid;
+		time_t time;
+		char *channel;
+		int channelLen;
+		if(arch_parseRecord(&map[pos], len, &msgid, &time, &channel, &channelLen) > 0)
+			arch_noteRecord(segment, msgid, time, pos, len, channel, channelLen);
+
+		pos += len;
+	}
+	munmap(map, info.st_size);
+
+	// Otherwise the writer would append the next record to the partial line
+	if(pos < info.st_size && ftruncate(fd, pos) == -1){
+		log_logError("Error truncating archive segment", WARNING);
+		pos = info.st_size;
+	}
+	segment->size = pos;
+	close(fd);
+
+	return 1;
+}
+
+struct arch_Segment *arch_addSegment(struct arch_Log *log, unsigned long firstId){
+	if(log->numSegments == log->maxSegments){
+		int size = log->maxSegments == 0 ? 8 : log->maxSegments * 2;
+		struct arch_Segment *segments = realloc(log->segments, size * sizeof(struct arch_Segment));
+		if(segments == NULL){
+			log_logError("Error growing archive", WARNING);
+			return NULL;
+		}
+
+		log->segments = segments;
+		log->maxSegments = size;
+	}
+
+	struct arch_Segment *segment = &log->segments[log->numSegments++];
+	memset(segment, 0, sizeof(struct arch_Segment));
+	segment->firstId = firstId;
+
+	return segment;
+}
+
+void arch_noteRecord(struct arch_Segment *segment, unsigned long msgid, time_t time, long offset, long len,
+		char *channel, int channelLen){
+	unsigned long hash = arch_hashChannel(channel, channelLen);
+	segment->channels[(hash & 0xff) >> 6] |= 1UL << (hash & 63);
+	segment->channels[((hash >> 8) & 0xff) >> 6] |= 1UL << ((hash >> 8) & 63);
+
+	if(offset + len > segment->size)
+		segment->size = offset + len;
+	if(segment->minId == 0 || msgid < segment->minId)
+		segment->minId = msgid;
+	if(msgid > segment->maxId)
+		segment->maxId = msgid;
+	if(segment->firstTime == 0)
+		segment->firstTime = time;
+	if(time > segment->lastTime)
+		segment->lastTime = time;
+
+	// One point every ARCH_INDEX_STEP bytes is enough to seek by time
+	if(segment->numIndex == 0 || offset >= segment->index[segment->numIndex-1].offset + ARCH_INDEX_STEP){
+		if(segment->numIndex == segment->maxIndex){
+			int size = segment->maxIndex == 0 ? 16 : segment->maxIndex * 2;
+			struct arch_IndexPoint *index = realloc(segment->index, size * sizeof(struct arch_IndexPoint));
+			if(index == NULL)
+				return; // Seeks are just less precise
+			segment->index = index;
+			segment->maxIndex = size;
+		}
+
+		segment->index[segment->numIndex].time = time;
+		segment->index[segment->numIndex].offset = offset;
+		segment->numIndex++;
+	}
+}
+
+unsigned long arch_hashChannel(char *channel, int len){
+	unsigned long hash = 14695981039346656037UL; // FNV-1a
+	for(int i = 0; i < len; i++)
+		hash = (hash ^ tolower((unsigned char) channel[i])) * 1099511628211UL;
+
+	return hash;
+}
+
+int arch_hasChannel(struct arch_Segment *segment, unsigned long hash){
+	return (segment->channels[(hash & 0xff) >> 6] & (1UL << (hash & 63)))
+		&& (segment->channels[((hash >> 8) & 0xff) >> 6] & (1UL << ((hash >> 8) & 63))) ? 1 : -1;
+}
+
+long arch_findOffset(struct arch_Segment *segment, time_t since){
+	// Times are only roughly in order, so step one point further back
+	long offset = 0;
+	for(int i = 1; i < segment->numIndex; i++){
+		if(segment->index[i].time >= since)
+			break;
+		offset = segment->index[i-1].offset;
+	}
+
+	return offset;
+}
+
+int arch_parseRecord(char *line, int len, unsigned long *msgid, time_t *time, char **channel, int *channelLen){
+	char *end = &line[len];
+	char *pos = line;
+
+	*msgid = 0;
+	for(; pos < end && isdigit((unsigned char) *pos); pos++)
+		*msgid = *msgid * 10 + (*pos - '0');
+	if(pos == line || pos >= end || *pos != ' ')
+		return -1;
+
+	char *timeStart = ++pos;
+	*time = 0;
+	for(; pos < end && isdigit((unsigned char) *pos); pos++)
+		*time = *time * 10 + (*pos - '0');
+	if(pos == timeStart || pos >= end || *pos != ' ')
+		return -1;
+
+	*channel = ++pos;
+	for(; pos < end && *pos != ' '; pos++);
+	if(pos >= end)
+		return -1;
+	*channelLen = pos - *channel;
+
+	return pos + 1 - line;
+}
+
+void *arch_writerThread(UNUSED(void *param)){
+	time_t lastExpire = 0;
+
+	while(1){
+		pthread_mutex_lock(&arch_state.queueMutex);
+		if(arch_state.running && link_isEmpty(&arch_state.queue) == 1){
+			struct timespec wake;
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_sec += 1;
+			pthread_cond_timedwait(&arch_state.queueCond, &arch_state.queueMutex, &wake);
+		}
+
+		// Take everything at once, appenders never wait for the disk
+		struct link_List pending = arch_state.queue;
+		memset(&arch_state.queue, 0, sizeof(struct link_List));
+		int running = arch_state.running;
+		arch_state.busy = link_isEmpty(&pending) == -1;
+		pthread_mutex_unlock(&arch_state.queueMutex);
+
+		struct arch_Record *batch[ARCH_BATCH];
+		struct arch_Log *batchLog = NULL;
+		int count = 0;
+		while(link_isEmpty(&pending) == -1){
+			struct arch_Record *record = link_remove(&pending, 0);
+			struct arch_Log *log = arch_getLog(record->group);
+
+			// Runs of records for the same group go out in one writev()
+			if(count > 0 && (log != batchLog || count == ARCH_BATCH)){
+				arch_writeRecords(batchLog, batch, count);
+				count = 0;
+			}
+
+			if(log == NULL){
+				com_releaseBuffer(record->buffer);
+				free(record);
+				continue;
+			}
+
+			batchLog = log;
+			batch[count++] = record;
+		}
+		if(count > 0)
+			arch_writeRecords(batchLog, batch, count);
+
+		pthread_mutex_lock(&arch_state.queueMutex);
+		arch_state.busy = 0;
+		pthread_mutex_unlock(&arch_state.queueMutex);
+
+		time_t now = time(NULL);
+		if(now - lastExpire >= 60 || running == 0){
+			for(struct link_Node *node = arch_state.logList.head; node != NULL; node = node->next)
+				arch_expire(node->data, now);
+			lastExpire = now;
+		}
+
+		if(running == 0)
+			break;
+	}
+
+	for(struct link_Node *node = arch_state.logList.head; node != NULL; node = node->next){
+		struct arch_Log *log = node->data;
+		if(log->fd != -1)
+			close(log->fd);
+		log->fd = -1;
+	}
+
+	return NULL;
+}
+
+int arch_flushRecords(struct arch_Log *log, struct arch_Segment *segment, struct arch_Record **records,
+		struct iovec *iov, long *lens, int first, int last){
+	if(segment == NULL || first >= last)
+		return 0;
+
+	if(log->fd == -1){
+		char path[ARCH_PATH_LEN];
+		arch_segmentPath(log, segment->firstId, path);
+		log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0640);
+		if(log->fd == -1){
+			log_logError("Error opening archive segment", WARNING);
+			return 0;
+		}
+	}
+
+	long wanted = 0, total = 0;
+	for(int i = first; i < last; i++)
+		wanted += lens[i];
+
+	// A short write leaves the rest of the iovecs for the next call
+	struct iovec *vec = &iov[first*2];
+	int numVec = (last - first) * 2;
+	while(total < wanted){
+		ssize_t ret = writev(log->fd, vec, numVec);
+		if(ret == -1 && errno == EINTR)
+			continue;
+		if(ret <= 0){
+			log_logError("Error writing archive", WARNING);
+			break;
+		}
+
+		total += ret;
+		while(numVec > 0 && (size_t) ret >= vec->iov_len){
+			ret -= vec->iov_len;
+			vec++;
+			numVec--;
+		}
+		if(numVec > 0){
+			vec->iov_base = (char *) vec->iov_base + ret;
+			vec->iov_len -= ret;
+		}
+	}
+
+	// Only complete records become visible to readers
+	int num = 0;
+	pthread_mutex_lock(&log->logMutex);
+	long offset = segment->size, end = segment->size + total;
+	for(int i = first; i < last && offset + lens[i] <= end; i++){
+		arch_noteRecord(segment, records[i]->msgid, records[i]->time, offset, lens[i],
+				records[i]->channel, strlen(records[i]->channel));
+		offset += lens[i];
+		num++;
+	}
+
+	// Cut off a partial record so the next one starts on a line of its own
+	if(offset < end && ftruncate(log->fd, offset) == -1){
+		log_logError("Error truncating archive segment", WARNING);
+		offset = end;
+	}
+	segment->size = offset;
+	pthread_mutex_unlock(&log->logMutex);
+
+	return num;
+}
+
+int arch_writeRecords(struct arch_Log *log, struct arch_Record **records, int count){
+	long segmentSize = (long) fig_Configuration.archiveSegmentSize * 1024;
+	char headers[ARCH_BATCH][64 + fig_Configuration.chanNameLength];
+	struct iovec iov[ARCH_BATCH * 2];
+	long lens[ARCH_BATCH];
+	int first = 0, written = 0;
+
+	// Only this thread adds or removes segments, the pointer stays valid
+	pthread_mutex_lock(&log->logMutex);
+	struct arch_Segment *segment = log->numSegments > 0 ? &log->segments[log->numSegments-1] : NULL;
+	long size = segment != NULL ? segment->size : 0;
+	pthread_mutex_unlock(&log->logMutex);
+
+	for(int i = 0; i < count && i < ARCH_BATCH; i++){
+		struct arch_Record *record = records[i];
+		int headerLen = snprintf(headers[i], ARRAY_SIZE(headers[i]), "%lu %ld %s ",
+				record->msgid, (long) record->time, record->channel);
+		iov[i*2].iov_base = headers[i];
+		iov[i*2].iov_len = headerLen;
+		iov[i*2+1].iov_base = record->buffer->str;
+		iov[i*2+1].iov_len = record->buffer->len;
+		lens[i] = headerLen + record->buffer->len;
+
+		// Start a new segment when this record would not fit
+		if(segment == NULL || (size > 0 && size + lens[i] > segmentSize)){
+			written += arch_flushRecords(log, segment, records, iov, lens, first, i);
+			first = i;
+
+			if(log->fd != -1)
+				close(log->fd);
+			log->fd = -1;
+
+			pthread_mutex_lock(&log->logMutex);
+			segment = arch_addSegment(log, record->msgid);
+			pthread_mutex_unlock(&log->logMutex);
+			size = 0;
+		}
+		size += lens[i];
+	}
+	written += arch_flushRecords(log, segment, records, iov, lens, first, count);
+
+	if(written < count){
+		char buff[100];
+		snprintf(buff, ARRAY_SIZE(buff), "Archive lost %d of %d messages.", count - written, count);
+		log_logMessage(buff, WARNING);
+	}
+
+	for(int i = 0; i < count; i++){
+		com_releaseBuffer(records[i]->buffer);
+		free(records[i]);
+	}
+
+	return written;
+}
+
+int arch_expire(struct arch_Log *log, time_t now){
+	time_t oldest = now - fig_Configuration.archiveRetention;
+	int removed = 0;
+
+	pthread_mutex_lock(&log->logMutex);
+	while(log->numSegments > 1 && log->segments[0].lastTime < oldest){
+		char path[ARCH_PATH_LEN];
+		arch_segmentPath(log, log->segments[0].firstId, path);
+
+		// Readers that already mapped it keep their mapping
+		if(unlink(path) == -1)
+			log_logError("Error removing archive segment", WARNING);
+
+		free(log->segments[0].index);
+		log->numSegments--;
+		memmove(log->segments, &log->segments[1], log->numSegments * sizeof(struct arch_Segment));
+		removed++;
+	}
+	pthread_mutex_unlock(&log->logMutex);
+
+	return removed;
+}
+
+int arch_read(char *group, char *channel, unsigned long beforeId, time_t since, int max,
+		void (*func)(unsigned long msgid, time_t time, char *line, int len, void *data), void *data,
+		unsigned long *resumeId){
+	if(resumeId != NULL)
+		*resumeId = 0;
+	if(arch_state.running == 0 || max <= 0)
+		return 0;
+
+	struct arch_Log *log = arch_getLog(group);
+	if(log == NULL)
+		return -1;
+
+	// Copy out what is needed, the writer may move the segments around
+	unsigned long hash = arch_hashChannel(channel, strlen(channel));
+	pthread_mutex_lock(&log->logMutex);
+	int numRanges = 0;
+	struct arch_Range *ranges = malloc((log->numSegments + 1) * sizeof(struct arch_Range));
+	for(int i = log->numSegments - 1; ranges != NULL && i >= 0; i--){
+		struct arch_Segment *segment = &log->segments[i];
+		if(segment->lastTime < since)
+			break; // Everything before is older too
+		if(segment->size == 0 || (beforeId != 0 && segment->minId >= beforeId) || arch_hasChannel(segment, hash) == -1)
+			continue;
+
+		ranges[numRanges].firstId = segment->firstId;
+		ranges[numRanges].minId = segment->minId;
+		ranges[numRanges].start = arch_findOffset(segment, since);
+		ranges[numRanges].end = segment->size;
+		ranges[numRanges].lines = NULL;
+		numRanges++;
+	}
+	pthread_mutex_unlock(&log->logMutex);
+
+	struct arch_Line *lines = malloc(max * sizeof(struct arch_Line));
+	struct arch_Line *found = malloc(max * sizeof(struct arch_Line));
+	if(ranges == NULL || lines == NULL || found == NULL){
+		log_logError("Error allocating archive read", WARNING);
+		free(ranges);
+		free(lines);
+		free(found);
+		return -1;
+	}
+
+	// Newest segment first, lines fill the result from its end
+	int filled = 0;
+	long scanned = 0;
+	for(int r = 0; r < numRanges && filled < max; r++){
+		// Stop between segments, the client goes on before the oldest one read
+		if(scanned >= ARCH_READ_BYTES){
+			if(resumeId != NULL)
+				*resumeId = ranges[r-1].minId;
+			break;
+		}
+
+		char path[ARCH_PATH_LEN];
+		arch_segmentPath(log, ranges[r].firstId, path);
+
+		int fd = open(path, O_RDONLY);
+		if(fd == -1)
+			continue; // Expired in the meantime
+
+		char *map = mmap(NULL, ranges[r].end, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED)
+			continue;
+		madvise(map, ranges[r].end, MADV_SEQUENTIAL);
+		scanned += ranges[r].end - ranges[r].start;
+
+		// Keep the last "need" matches of this segment in a circular array
+		int need = max - filled, numFound = 0;
+		long pos = ranges[r].start;
+		while(pos < ranges[r].end){
+			char *end = memchr(&map[pos], '\n', ranges[r].end - pos);
+			if(end == NULL)
+				break;
+
+			int len = end - &map[pos] + 1;
+			unsigned long msgid;
+			time_t time;
+			char *chan;
+			int chanLen;
+			int header = arch_parseRecord(&map[pos], len, &msgid, &time, &chan, &chanLen);
+			if(header > 0 && (beforeId == 0 || msgid < beforeId) && time >= since
+					&& chanLen == (int) strlen(channel) && strncasecmp(chan, channel, chanLen) == 0){
+				struct arch_Line *line = &found[numFound % need];
+				line->msgid = msgid;
+				line->time = time;
+				line->str = &map[pos + header];
+				line->len = len - header - (len - header >= 2 && map[pos + len - 2] == '\r' ? 2 : 1);
+				numFound++;
+			}
+
+			pos += len;
+		}
+
+		// Copy the lines that are kept so the segment can be unmapped right away
+		int keep = numFound < need ? numFound : need;
+		long size = 0;
+		for(int i = 0; i < keep; i++)
+			size += found[(numFound - keep + i) % need].len;
+
+		char *copy = keep > 0 ? malloc(size + 1) : NULL;
+		if(keep > 0 && copy == NULL){
+			log_logError("Error allocating archive lines", WARNING);
+			keep = 0;
+		}
+		ranges[r].lines = copy;
+
+		for(int i = 0; i < keep; i++){
+			struct arch_Line *line = &lines[max - filled - keep + i];
+			*line = found[(numFound - keep + i) % need];
+			memcpy(copy, line->str, line->len);
+			line->str = copy;
+			copy += line->len;
+		}
+		filled += keep;
+		munmap(map, ranges[r].end);
+	}
+
+	for(int i = max - filled; i < max; i++)
+		func(lines[i].msgid, lines[i].time, lines[i].str, lines[i].len, data);
+
+	for(int r = 0; r < numRanges; r++)
+		free(ranges[r].lines);
+
+	free(ranges);
+	free(lines);
+	free(found);
+	return filled;
+}
+
+int arch_query(struct arch_Query *query){
+	if(__atomic_load_n(&arch_state.running, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	pthread_mutex_lock(&arch_state.readMutex);
+	struct link_Node *node = link_add(&arch_state.reads, query);
+	pthread_cond_signal(&arch_state.readCond);
+	pthread_mutex_unlock(&arch_state.readMutex);
+
+	return node == NULL ? -1 : 1;
+}
+
+void arch_freeQuery(struct arch_Query *query){
+	if(query == NULL)
+		return;
+
+	if(query->entries != NULL)
+		hist_releaseEntries(query->entries, query->numEntries);
+	free(query->entries);
+	free(query);
+}
+
+void *arch_readerThread(UNUSED(void *param)){
+	while(1){
+		pthread_mutex_lock(&arch_state.readMutex);
+		while(arch_state.running && link_isEmpty(&arch_state.reads) == 1)
+			pthread_cond_wait(&arch_state.readCond, &arch_state.readMutex);
+
+		struct link_List pending = arch_state.reads;
+		memset(&arch_state.reads, 0, sizeof(struct link_List));
+		int running = arch_state.running;
+		pthread_mutex_unlock(&arch_state.readMutex);
+
+		while(link_isEmpty(&pending) == -1){
+			struct arch_Query *query = link_remove(&pending, 0);
+			if(running)
+				arch_answer(query);
+			arch_freeQuery(query);
+		}
+
+		if(running == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+int arch_answer(struct arch_Query *query){
+	struct cmd_History history = {com_allocBuffer(BUFSIZ), query->nick, query->target, 0};
+	if(history.batch == NULL){
+		log_logError("Error allocating history reply", WARNING);
+		return -1;
+	}
+
+	// Disk only has what is older than the oldest line memory had
+	int num = query->numEntries;
+	unsigned long resumeId = 0;
+	if(num < query->max && fig_Configuration.useArchive)
+		arch_read(query->group, query->channel, num > 0 ? query->entries[0].msgid : query->beforeId, query->since,
+				query->max - num, rpl_history, &history, &resumeId);
+
+	for(int i = 0; i < num; i++){
+		struct com_Buffer *buffer = query->entries[i].buffer;
+		int len = buffer->len >= 2 ? buffer->len - 2 : buffer->len; // Without the \r\n
+		rpl_history(query->entries[i].msgid, query->entries[i].time, buffer->str, len, &history);
+	}
+
+	// Lines the read did not get to are older than resumeId
+	if(resumeId != 0)
+		history.oldest = resumeId;
+
+	char str[BUFSIZ + 128]; // The target and the text around it
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s %s %lu :End of history", thisServer, RPL_ENDOFHISTORY,
+			query->nick, query->target, history.oldest);
+	com_appendBuffer(&history.batch, str);
+
+	// The user may have left while the query waited
+	struct usr_UserData *user = query->user;
+	if(__atomic_load_n(&user->id, __ATOMIC_ACQUIRE) == query->userId)
+		com_sendBuffer(user, history.batch);
+
+	com_releaseBuffer(history.batch);
+	return num;
+}
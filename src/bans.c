@@ -0,0 +1,573 @@
+#define LOG_SUBSYSTEM LOG_USER
+#include "bans.h"
+#include "boundless.h"
+
+int ban_init(struct ban_List *list){
+	list->current = ban_createSet(NULL, 0);
+	if(list->current == NULL)
+		return -1;
+
+	return 1;
+}
+
+void ban_free(struct ban_List *list){
+	if(list->current != NULL)
+		ban_freeSet(list->current);
+	list->current = NULL;
+}
+
+int ban_normalizeMask(char *mask, char *buff, int size){
+	if(mask == NULL || mask[0] == '\0')
+		return -1;
+
+	int hasNick = strchr(mask, '!') != NULL;
+	int hasHost = strchr(mask, '@') != NULL;
+
+	if(hasNick && hasHost){
+		snprintf(buff, size, "%s", mask);
+	} else if(hasHost){
+		snprintf(buff, size, "*!%s", mask);
+	} else if(hasNick){
+		snprintf(buff, size, "%s@*", mask);
+	} else {
+		snprintf(buff, size, "%s!*@*", mask);
+	}
+
+	for(int i = 0; buff[i] != '\0'; i++)
+		buff[i] = tolower((unsigned char) buff[i]);
+
+	return 1;
+}
+
+int ban_hasWildcards(char *str){
+	return strpbrk(str, "*?") != NULL;
+}
+
+int ban_strSetInit(struct ban_StrSet *set, int count){
+	unsigned long size = 4;
+	while(size < (unsigned long) count * 2)
+		size <<= 1;
+
+	set->mask = size - 1;
+	set->items = calloc(size, sizeof(char *));
+	if(set->items == NULL){
+		log_logError("Error allocating ban set", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+void ban_strSetAdd(struct ban_StrSet *set, char *str){
+	unsigned long pos = hash_string(str) & set->mask;
+	while(set->items[pos] != NULL){
+		if(hash_keysEqual(set->items[pos], str) == 1)
+			return;
+
+		pos = (pos + 1) & set->mask;
+	}
+
+	set->items[pos] = str;
+}
+
+int ban_strSetContains(struct ban_StrSet *set, char *str){
+	unsigned long pos = hash_string(str) & set->mask;
+	while(set->items[pos] != NULL){
+		if(hash_keysEqual(set->items[pos], str) == 1)
+			return 1;
+
+		pos = (pos + 1) & set->mask;
+	}
+
+	return -1;
+}
+
+int ban_addrToBytes(struct sockaddr_storage *addr, unsigned char bytes[16]){
+	if(addr->ss_family == AF_INET6){
+		memcpy(bytes, &((struct sockaddr_in6 *) addr)->sin6_addr, 16);
+		return 1;
+	}
+
+	if(addr->ss_family == AF_INET){ // Store as ::ffff:a.b.c.d
+		memset(bytes, 0, 10);
+		bytes[10] = bytes[11] = 0xff;
+		memcpy(&bytes[12], &((struct sockaddr_in *) addr)->sin_addr, 4);
+		return 1;
+	}
+
+	return -1;
+}
+
+int ban_parseCidr(char *str, unsigned char bytes[16]){
+	char addr[INET6_ADDRSTRLEN];
+	char *slash = strchr(str, '/');
+	if(slash == NULL || slash - str >= (int) sizeof(addr))
+		return -1;
+
+	memcpy(addr, str, slash - str);
+	addr[slash - str] = '\0';
+
+	char *end;
+	long len = strtol(slash + 1, &end, 10);
+	if(*end != '\0' || slash[1] == '\0')
+		return -1;
+
+	if(inet_pton(AF_INET, addr, &bytes[12]) == 1){
+		if(len < 0 || len > 32)
+			return -1;
+
+		memset(bytes, 0, 10);
+		bytes[10] = bytes[11] = 0xff;
+		return len + 96;
+	}
+
+	if(inet_pton(AF_INET6, addr, bytes) == 1 && len >= 0 && len <= 128)
+		return len;
+
+	return -1;
+}
+
+// Adds a range to the trie, nodes must have room for len more nodes
+void ban_trieAdd(struct ban_Set *set, unsigned char bytes[16], int len){
+	int node = 0;
+	for(int i = 0; i < len && set->nodes[node].terminal == 0; i++){
+		int bit = (bytes[i / 8] >> (7 - i % 8)) & 1;
+
+		if(set->nodes[node].child[bit] == 0){
+			set->nodes[node].child[bit] = set->numNodes;
+			set->numNodes++;
+		}
+		node = set->nodes[node].child[bit];
+	}
+
+	set->nodes[node].terminal = 1;
+}
+
+int ban_trieContains(struct ban_Set *set, unsigned char bytes[16]){
+	int node = 0;
+	for(int i = 0; i < 128; i++){
+		if(set->nodes[node].terminal == 1)
+			return 1;
+
+		int bit = (bytes[i / 8] >> (7 - i % 8)) & 1;
+		node = set->nodes[node].child[bit];
+		if(node == 0)
+			return -1;
+	}
+
+	return set->nodes[node].terminal == 1 ? 1 : -1;
+}
+
+struct ban_Set *ban_createSet(char **masks, int count){
+	struct ban_Set *set = calloc(1, sizeof(struct ban_Set));
+	if(set == NULL){
+		log_logError("Error allocating ban set", ERROR);
+		return NULL;
+	}
+
+	// A range needs at most one node per bit of its prefix
+	int numNodes = 1;
+	for(int i = 0; i < count; i++){
+		unsigned char bytes[16];
+		int prefixLen;
+		if(strncmp(masks[i], "*!*@", 4) == 0 && !ban_hasWildcards(masks[i] + 4)
+				&& (prefixLen = ban_parseCidr(masks[i] + 4, bytes)) > 0)
+			numNodes += prefixLen;
+	}
+
+	set->masks = calloc(count + 1, sizeof(char *));
+	set->globs = calloc(count + 1, sizeof(struct ban_Glob));
+	set->nodes = calloc(numNodes, sizeof(struct ban_TrieNode));
+	set->numNodes = 1;
+	if(set->masks == NULL || set->globs == NULL || set->nodes == NULL
+			|| ban_strSetInit(&set->hosts, count) == -1 || ban_strSetInit(&set->nicks, count) == -1){
+		log_logError("Error allocating ban set", ERROR);
+		ban_freeSet(set);
+		return NULL;
+	}
+
+	for(int i = 0; i < count; i++){
+		int len = strlen(masks[i]) + 1;
+
+		// The mask followed by a copy of it split into nick, user and host
+		char *mask = malloc(len * 2);
+		if(mask == NULL){
+			log_logError("Error allocating ban mask", ERROR);
+			ban_freeSet(set);
+			return NULL;
+		}
+		memcpy(mask, masks[i], len);
+		memcpy(mask + len, masks[i], len);
+		set->masks[set->count++] = mask;
+
+		char *nick = mask + len;
+		char *user = strchr(nick, '!');
+		char *host = user != NULL ? strchr(user, '@') : NULL;
+		if(host == NULL)
+			continue; // Not normalized, can never match
+
+		*user++ = '\0';
+		*host++ = '\0';
+
+		int anyNick = !strcmp(nick, "*"), anyUser = !strcmp(user, "*"), anyHost = !strcmp(host, "*");
+		unsigned char bytes[16];
+		int prefixLen;
+
+		if(anyNick && anyUser && !ban_hasWildcards(host) && (prefixLen = ban_parseCidr(host, bytes)) >= 0){
+			ban_trieAdd(set, bytes, prefixLen);
+		} else if(anyNick && anyUser && !ban_hasWildcards(host)){
+			ban_strSetAdd(&set->hosts, host);
+		} else if(anyUser && anyHost && !ban_hasWildcards(nick)){
+			ban_strSetAdd(&set->nicks, nick);
+		} else {
+			struct ban_Glob *glob = &set->globs[set->numGlobs++];
+			ban_compilePart(&glob->parts[BAN_NICK], anyNick ? NULL : nick);
+			ban_compilePart(&glob->parts[BAN_USER], anyUser ? NULL : user);
+			ban_compilePart(&glob->parts[BAN_HOST], anyHost ? NULL : host);
+		}
+	}
+
+	if(ban_indexGlobs(set) == -1){
+		ban_freeSet(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+void ban_compilePart(struct ban_GlobPart *part, char *pattern){
+	memset(part, 0, sizeof(struct ban_GlobPart));
+	part->pattern = pattern;
+	if(pattern == NULL)
+		return;
+
+	part->len = strlen(pattern);
+	for(int i = 0; i < part->len; i++){
+		if(pattern[i] == '*')
+			part->hasStar = 1;
+		else
+			part->minLen++;
+	}
+
+	part->prefixLen = strcspn(pattern, "*?");
+	if(part->prefixLen == part->len)
+		return; // No wildcards, the prefix is the whole pattern
+
+	while(part->suffixLen < part->len && pattern[part->len - part->suffixLen - 1] != '*'
+			&& pattern[part->len - part->suffixLen - 1] != '?')
+		part->suffixLen++;
+}
+
+int ban_partMatch(struct ban_GlobPart *part, char *str, int len){
+	if(part->pattern == NULL)
+		return 1;
+
+	if(len < part->minLen || (!part->hasStar && len != part->minLen))
+		return -1;
+
+	// Most masks fail on the plain ends, before any backtracking
+	if(memcmp(part->pattern, str, part->prefixLen) != 0
+			|| memcmp(part->pattern + part->len - part->suffixLen, str + len - part->suffixLen, part->suffixLen) != 0)
+		return -1;
+
+	if(part->prefixLen == part->len)
+		return 1;
+
+	return ban_globMatch(part->pattern + part->prefixLen, str + part->prefixLen);
+}
+
+int ban_nextTrigram(char *pattern, int pos){
+	int run = 0;
+	for(int i = pos; pattern[i] != '\0'; i++){
+		run = pattern[i] == '*' || pattern[i] == '?' ? 0 : run + 1;
+		if(run == 3)
+			return i - 2;
+	}
+
+	return -1;
+}
+
+unsigned long ban_hashTrigram(int tag, char *str){
+	unsigned long hash = tag;
+	for(int i = 0; i < 3; i++)
+		hash = hash * 31 + (unsigned char) str[i];
+
+	return (hash * 0x9E3779B97F4A7C15UL) >> 32;
+}
+
+int ban_indexGlobs(struct ban_Set *set){
+	unsigned long size = 16;
+	while(size < (unsigned long) set->numGlobs * 2)
+		size <<= 1;
+
+	set->globMask = size - 1;
+	set->unindexed = -1;
+	set->globIndex = malloc(size * sizeof(int));
+	int *counts = calloc(size, sizeof(int));
+	if(set->globIndex == NULL || counts == NULL){
+		log_logError("Error allocating ban index", ERROR);
+		free(counts);
+		return -1;
+	}
+	memset(set->globIndex, -1, size * sizeof(int));
+
+	// How many masks could go into each bucket
+	for(int i = 0; i < set->numGlobs; i++){
+		for(int j = 0; j < 3; j++){
+			char *pattern = set->globs[i].parts[j].pattern;
+			for(int pos = pattern != NULL ? ban_nextTrigram(pattern, 0) : -1; pos >= 0; pos = ban_nextTrigram(pattern, pos + 1))
+				counts[ban_hashTrigram(j == BAN_HOST, pattern + pos) & set->globMask]++;
+		}
+	}
+
+	// Every mask goes into the emptiest of its buckets
+	for(int i = 0; i < set->numGlobs; i++){
+		long best = -1;
+		for(int j = 0; j < 3; j++){
+			char *pattern = set->globs[i].parts[j].pattern;
+			for(int pos = pattern != NULL ? ban_nextTrigram(pattern, 0) : -1; pos >= 0; pos = ban_nextTrigram(pattern, pos + 1)){
+				unsigned long bucket = ban_hashTrigram(j == BAN_HOST, pattern + pos) & set->globMask;
+				if(best == -1 || counts[bucket] < counts[best])
+					best = bucket;
+			}
+		}
+
+		int *head = best == -1 ? &set->unindexed : &set->globIndex[best];
+		set->globs[i].next = *head;
+		*head = i;
+	}
+
+	free(counts);
+	return 1;
+}
+
+void ban_freeSet(void *ptr){
+	struct ban_Set *set = ptr;
+
+	if(set->masks != NULL){
+		for(int i = 0; i < set->count; i++)
+			free(set->masks[i]);
+	}
+
+	free(set->masks);
+	free(set->hosts.items);
+	free(set->nicks.items);
+	free(set->nodes);
+	free(set->globs);
+	free(set->globIndex);
+	free(set);
+}
+
+// Returns the index of mask in set or -1
+int ban_findMask(struct ban_Set *set, char *mask){
+	for(int i = 0; i < set->count; i++){
+		if(hash_keysEqual(set->masks[i], mask) == 1)
+			return i;
+	}
+
+	return -1;
+}
+
+// Replaces the current set, caller must hold the owner's mutex
+int ban_publish(struct ban_List *list, char **masks, int count){
+	struct ban_Set *new = ban_createSet(masks, count);
+	if(new == NULL)
+		return -1;
+
+	struct ban_Set *old = list->current;
+	__atomic_store_n(&list->current, new, __ATOMIC_RELEASE);
+	rcl_retire(old, ban_freeSet);
+
+	return 1;
+}
+
+int ban_add(struct ban_List *list, char *mask){
+	struct ban_Set *set = list->current;
+	if(ban_findMask(set, mask) >= 0)
+		return -1;
+
+	char **masks = malloc((set->count + 1) * sizeof(char *));
+	if(masks == NULL){
+		log_logError("Error allocating ban list", ERROR);
+		return -1;
+	}
+
+	memcpy(masks, set->masks, set->count * sizeof(char *));
+	masks[set->count] = mask;
+
+	int ret = ban_publish(list, masks, set->count + 1);
+	free(masks);
+
+	return ret;
+}
+
+int ban_addList(struct ban_List *list, char **masks, int count){
+	struct ban_Set *set = list->current;
+	char **all = malloc((set->count + count + 1) * sizeof(char *));
+	if(all == NULL){
+		log_logError("Error allocating ban list", ERROR);
+		return -1;
+	}
+
+	memcpy(all, set->masks, set->count * sizeof(char *));
+	int total = set->count;
+	for(int i = 0; i < count; i++){
+		if(ban_findMask(set, masks[i]) < 0)
+			all[total++] = masks[i];
+	}
+
+	int ret = total == set->count ? -1 : ban_publish(list, all, total);
+	free(all);
+
+	return ret;
+}
+
+int ban_remove(struct ban_List *list, char *mask){
+	struct ban_Set *set = list->current;
+	int index = ban_findMask(set, mask);
+	if(index < 0)
+		return -1;
+
+	char **masks = malloc((set->count + 1) * sizeof(char *));
+	if(masks == NULL){
+		log_logError("Error allocating ban list", ERROR);
+		return -1;
+	}
+
+	int count = 0;
+	for(int i = 0; i < set->count; i++){
+		if(i != index)
+			masks[count++] = set->masks[i];
+	}
+
+	int ret = ban_publish(list, masks, count);
+	free(masks);
+
+	return ret;
+}
+
+// Checks the three parts of a wildcard mask against lowercase strings
+int ban_globMatchAll(struct ban_Glob *glob, char *nick, int nickLen, char *host, int hostLen){
+	if(ban_partMatch(&glob->parts[BAN_NICK], nick, nickLen) != 1)
+		return -1;
+	if(ban_partMatch(&glob->parts[BAN_USER], nick, nickLen) != 1)
+		return -1;
+	if(ban_partMatch(&glob->parts[BAN_HOST], host, hostLen) != 1)
+		return -1;
+
+	return 1;
+}
+
+// Tries one chain of globs against the host and the IPv4 form of it
+int ban_matchChain(struct ban_Set *set, int first, char *nick, int nickLen, char *host, int hostLen, char *plainHost){
+	for(int i = first; i != -1; i = set->globs[i].next){
+		if(ban_globMatchAll(&set->globs[i], nick, nickLen, host, hostLen) == 1)
+			return 1;
+		if(plainHost != NULL && ban_globMatchAll(&set->globs[i], nick, nickLen, plainHost, hostLen - (plainHost - host)) == 1)
+			return 1;
+	}
+
+	return -1;
+}
+
+int ban_matchGlobs(struct ban_Set *set, char *nick, char *host, char *plainHost){
+	int nickLen = strlen(nick), hostLen = strlen(host);
+
+	if(ban_matchChain(set, set->unindexed, nick, nickLen, host, hostLen, plainHost) == 1)
+		return 1;
+
+	// A matching mask is in the bucket of one of the trigrams of the strings, plainHost is part of host
+	for(int pos = 0; pos + 3 <= nickLen; pos++){
+		int first = set->globIndex[ban_hashTrigram(0, nick + pos) & set->globMask];
+		if(first != -1 && ban_matchChain(set, first, nick, nickLen, host, hostLen, plainHost) == 1)
+			return 1;
+	}
+	for(int pos = 0; pos + 3 <= hostLen; pos++){
+		int first = set->globIndex[ban_hashTrigram(1, host + pos) & set->globMask];
+		if(first != -1 && ban_matchChain(set, first, nick, nickLen, host, hostLen, plainHost) == 1)
+			return 1;
+	}
+
+	return -1;
+}
+
+int ban_isBanned(struct ban_List *list, struct usr_UserData *user){
+	char nick[fig_Configuration.nickLen];
+	int ret = -1;
+
+	rcl_readLock();
+	struct ban_Set *set = __atomic_load_n(&list->current, __ATOMIC_ACQUIRE);
+	if(set == NULL || set->count == 0){
+		rcl_readUnlock();
+		return -1;
+	}
+
+	if(usr_getNickname(nick, user) == -1)
+		nick[0] = '\0';
+
+	// Masks are lowercase, so the strings are lowered once for all of them
+	char host[ARRAY_SIZE(user->host)];
+	int i;
+	for(i = 0; nick[i] != '\0'; i++)
+		nick[i] = tolower((unsigned char) nick[i]);
+	for(i = 0; i < (int) ARRAY_SIZE(host) - 1 && user->host[i] != '\0'; i++)
+		host[i] = tolower((unsigned char) user->host[i]);
+	host[i] = '\0';
+
+	// The user part of a prefix is the nickname, see usr_getPrefix
+	char *plainHost = NULL;
+	if(strncmp(host, "::ffff:", 7) == 0 && strchr(host, '.') != NULL)
+		plainHost = host + 7; // Let *!*@1.2.3.4 match IPv4 mapped hosts
+
+	unsigned char bytes[16];
+
+	if(ban_strSetContains(&set->hosts, host) == 1
+			|| (plainHost != NULL && ban_strSetContains(&set->hosts, plainHost) == 1)){
+		ret = 1;
+	} else if(nick[0] != '\0' && ban_strSetContains(&set->nicks, nick) == 1){
+		ret = 1;
+	} else if(set->numNodes > 1 && ban_addrToBytes(&user->socketInfo.addr, bytes) == 1
+			&& ban_trieContains(set, bytes) == 1){
+		ret = 1;
+	} else if(set->numGlobs > 0){
+		ret = ban_matchGlobs(set, nick, host, plainHost);
+	}
+	rcl_readUnlock();
+
+	return ret;
+}
+
+int ban_forEach(struct ban_List *list, void (*func)(char *mask, void *data), void *data){
+	rcl_readLock();
+	struct ban_Set *set = __atomic_load_n(&list->current, __ATOMIC_ACQUIRE);
+	int count = set->count;
+	for(int i = 0; i < count; i++)
+		func(set->masks[i], data);
+	rcl_readUnlock();
+
+	return count;
+}
+
+int ban_globMatch(char *pattern, char *str){
+	char *star = NULL, *retry = NULL;
+
+	while(*str != '\0'){
+		if(*pattern == '*'){
+			star = pattern++;
+			retry = str;
+		} else if(*pattern == '?' || (*pattern != '\0' && *pattern == (char) tolower((unsigned char) *str))){
+			pattern++;
+			str++;
+		} else if(star != NULL){ // Let the last star swallow one more character
+			pattern = star + 1;
+			str = ++retry;
+		} else {
+			return -1;
+		}
+	}
+
+	while(*pattern == '*')
+		pattern++;
+
+	return *pattern == '\0' ? 1 : -1;
+}
@@ -8,31 +8,68 @@
 #include "linkedlist.h"
 #include "chat.h"
 #include "commands.h"
+#include "reclaim.h"
+#include "history.h"
+#include "archive.h"
+#include "search.h"
+#include "snapshot.h"
+#include "upgrade.h"
+#include "clock.h"
+#include "capture.h"
 
 void cleanUpServer(){
 	log_logMessage("Server is now quitting.", INFO);
 
-	log_close();
+	upg_close();
+	mtr_close();
+	snap_close();
 	com_close();
+	srch_close();
+	arch_close();
 	chat_close();
 	events_close();
+	cap_close();
+	rcl_close();
+	log_close(); // Last, so everything logged while quitting is written
 }
 
 int main(){
 	log_logMessage("Now starting boundless.chat server: V1.2.0.", INFO);
     atexit(cleanUpServer);
 
+    if(init_clock() == -1) /* clock.h */
+		return -1;
     if(init_config("example_config.conf") == -1) /* config.h */
 		return -1;
     if(init_logging() == -1) /* logging.h */
 		return -1;
+    if(init_reclaim() == -1) /* reclaim.h */
+		return -1;
+    if(init_history() == -1) /* history.h */
+		return -1;
+    if(init_upgrade() == -1) /* upgrade.h */
+		return -1;
+    if(init_archive() == -1) /* archive.h */
+		return -1;
+    if(init_search() == -1) /* search.h */
+		return -1;
+    if(init_capture() == -1) /* capture.h */
+		return -1;
+    if(init_tracing() == -1) /* trace.h */
+		return -1;
     if(init_chat() == -1) /* chat.h */
 		return -1;
+    if(init_snapshot() == -1) /* snapshot.h */
+		return -1;
+    if(init_events() == -1) /* events.h, before any user gets its timer */
+		return -1;
     if(init_server() == -1) /* communication.h */
 		return -1;
     if(init_commands() == -1) /* commands.h */
 		return -1;
-    if(init_events() == -1) /* events.h */
+    if(init_metrics() == -1) /* metrics.h */
+		return -1;
+    if(upg_resume() == -1) /* upgrade.h */
 		return -1;
 
 	evt_executeEvents();
@@ -0,0 +1,143 @@
+#define LOG_SUBSYSTEM LOG_COM
+#include "capture.h"
+#include "boundless.h"
+
+struct cap_Capture cap_state = {.fd = -1};
+
+// Counts lines for 1 in N sampling without sharing a counter between threads
+__thread unsigned long cap_lines = 0;
+
+int init_capture(){
+	if(fig_Configuration.useCapture == 0)
+		return 1;
+
+	uint64_t size = (uint64_t) fig_Configuration.captureSize * 1024;
+	size -= size % CAP_ALIGN;
+	long total = sizeof(struct cap_Header) + size;
+
+	int fd = open(fig_Configuration.captureFile, O_RDWR | O_CREAT, 0640);
+	if(fd == -1){
+		log_logError("Error opening capture file", ERROR);
+		return -1;
+	}
+
+	if(ftruncate(fd, total) == -1){
+		log_logError("Error sizing capture file", ERROR);
+		close(fd);
+		return -1;
+	}
+
+	char *map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		log_logError("Error mapping capture file", ERROR);
+		close(fd);
+		return -1;
+	}
+
+	// A capture of the same size continues where the last run stopped
+	struct cap_Header *header = (struct cap_Header *) map;
+	if(memcmp(header->magic, CAP_MAGIC, 8) || header->version != CAP_VERSION || header->size != size){
+		memset(header, 0, sizeof(struct cap_Header));
+		memcpy(header->magic, CAP_MAGIC, 8);
+		header->version = CAP_VERSION;
+		header->headerLen = sizeof(struct cap_Header);
+		header->size = size;
+	}
+
+	cap_state.fd = fd;
+	cap_state.header = header;
+	cap_state.ring = map + sizeof(struct cap_Header);
+	cap_state.size = size;
+	cap_state.sample = fig_Configuration.captureSample;
+	cap_state.sampleUsers = fig_Configuration.captureSampleUsers;
+	__atomic_store_n(&cap_state.enabled, 1, __ATOMIC_RELEASE);
+
+	char buff[BUFSIZ + 64]; // CaptureFile and the message around it
+	snprintf(buff, ARRAY_SIZE(buff), "Capturing 1 in %lu %s to %s.", cap_state.sample,
+			cap_state.sampleUsers ? "users" : "lines", fig_Configuration.captureFile);
+	log_logMessage(buff, INFO);
+
+	return 1;
+}
+
+void cap_close(){
+	if(!__atomic_exchange_n(&cap_state.enabled, 0, __ATOMIC_ACQ_REL))
+		return;
+
+	// Threads that are still writing a record keep the mapping alive
+	msync(cap_state.header, sizeof(struct cap_Header) + cap_state.size, MS_ASYNC);
+	close(cap_state.fd);
+	cap_state.fd = -1;
+}
+
+int cap_isSampled(int userId){
+	if(cap_state.sample <= 1)
+		return 1;
+
+	if(cap_state.sampleUsers) // Spreads consecutive ids over the buckets
+		return ((uint32_t) userId * 2654435761u) % cap_state.sample == 0;
+
+	return cap_lines++ % cap_state.sample == 0;
+}
+
+void cap_record(int direction, int slot, int userId, char *data, int len){
+	if(!__atomic_load_n(&cap_state.enabled, __ATOMIC_ACQUIRE))
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+	// Without the line endings
+	int start = 0;
+	for(int i = 0; i <= len; i++){
+		if(i < len && data[i] != '\n' && data[i] != '\r' && data[i] != '\0')
+			continue;
+
+		if(i > start && cap_isSampled(userId))
+			cap_addRecord(direction, slot, userId, time, data + start, i - start);
+		start = i + 1;
+	}
+}
+
+void cap_addRecord(int direction, int slot, int userId, uint64_t time, char *line, int len){
+	if(len > UINT16_MAX)
+		len = UINT16_MAX;
+
+	uint64_t need = (sizeof(struct cap_Record) + len + CAP_ALIGN - 1) / CAP_ALIGN * CAP_ALIGN;
+	uint64_t size = cap_state.size;
+	if(need > size)
+		return;
+
+	// Reserve, taking the rest of the ring as well when the record would not fit before its end
+	uint64_t head = __atomic_load_n(&cap_state.header->head, __ATOMIC_RELAXED);
+	uint64_t pos, skip;
+	do {
+		pos = head;
+		skip = size - pos % size < need ? size - pos % size : 0;
+	} while(!__atomic_compare_exchange_n(&cap_state.header->head, &head, pos + skip + need, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	if(skip > 0){
+		struct cap_Record *filler = (struct cap_Record *) (cap_state.ring + pos % size);
+		memset(filler, 0, sizeof(struct cap_Record));
+		filler->pos = pos;
+		filler->direction = CAP_SKIP;
+		__atomic_store_n(&filler->committed, 1, __ATOMIC_RELEASE);
+		pos += skip;
+	}
+
+	struct cap_Record *record = (struct cap_Record *) (cap_state.ring + pos % size);
+	__atomic_store_n(&record->committed, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->pos = pos;
+	record->time = time;
+	record->userId = userId;
+	record->slot = slot;
+	record->len = len;
+	record->direction = direction;
+	record->unused = 0;
+	memcpy(record + 1, line, len);
+
+	__atomic_store_n(&record->committed, 1, __ATOMIC_RELEASE);
+}
@@ -1,6 +1,7 @@
+#define LOG_SUBSYSTEM LOG_CHAN
 #include "channel.h"
 
-const char chan_chanModes[] = {'o', 's', 'i', 'b', 'v', 'm', 'k'};
+const char chan_chanModes[] = {'o', 's', 'i', 'b', 'v', 'm', 'k', 'l'};
 
 int chan_getUserChannelPrivs(struct usr_UserData *user, struct link_Node *chan) {
 	if(chan == NULL || chan->data == NULL || user == NULL || user->id < 0){
@@ -8,18 +9,7 @@ int chan_getUserChannelPrivs(struct usr_UserData *user, struct link_Node *chan)
 	}
 
 	struct chan_Channel *channel = chan->data;
-	int ret = -1;
-
-    pthread_mutex_lock(&channel->channelMutex);
-	for(int i = 0; i < channel->max; i++){
-		if(channel->users[i].user == user){
-			ret = channel->users[i].permLevel;
-			break;
-		}
-	}
-    pthread_mutex_unlock(&channel->channelMutex);
-
-	return ret;
+	return mbr_getPermLevel(&channel->members, user);
 }
 
 int chan_removeUserFromChannel(struct link_Node *channelNode, struct usr_UserData *user){
@@ -32,14 +22,7 @@ int chan_removeUserFromChannel(struct link_Node *channelNode, struct usr_UserDat
     }
 
 	pthread_mutex_lock(&channel->channelMutex);
-	for(int i = 0; i < channel->max; i++){
-		if(channel->users[i].user == user){
-			// Match
-			memset(&channel->users[i], 0, sizeof(struct chan_ChannelUser));
-			ret = 1;
-			break;
-		}
-	}
+	ret = mbr_remove(&channel->members, user);
 	pthread_mutex_unlock(&channel->channelMutex);
     
     return ret;
@@ -132,11 +115,23 @@ struct link_Node *chan_createChannel(char *name, struct link_Node *group, struct
     // TODO - make sure name is legal
     strncpy(channel->name, name, fig_Configuration.chanNameLength-1);
 
-	// Setup array of users with default size of 10
-	channel->max = 100;
-	channel->users = calloc(channel->max, sizeof(struct chan_Channel));
-	if(channel->users == NULL){
-        log_logError("Error creating channel", ERROR);
+	// Small rooms stay small, the array grows as users join
+	if(mbr_init(&channel->members) == -1){
+		free(channel->name);
+		free(channel);
+        return NULL;
+	}
+
+	if(ban_init(&channel->bans) == -1){
+		mbr_free(&channel->members);
+		free(channel->name);
+		free(channel);
+        return NULL;
+	}
+
+	if(hist_init(&channel->history, fig_Configuration.historySize) == -1){
+		ban_free(&channel->bans);
+		mbr_free(&channel->members);
 		free(channel->name);
 		free(channel);
         return NULL;
@@ -148,6 +143,15 @@ struct link_Node *chan_createChannel(char *name, struct link_Node *group, struct
 
 	channel->group = group;
 	struct link_Node *chanNode = grp_addChannel(group, channel);
+	if(chanNode == NULL){ // Name already taken
+		pthread_mutex_destroy(&channel->channelMutex);
+		mbr_free(&channel->members);
+		ban_free(&channel->bans);
+		hist_free(&channel->history);
+		free(channel->name);
+		free(channel);
+		return NULL;
+	}
 
 	if(user != NULL){ // Add first user
 		chan_addToChannel(chanNode, user, 2);
@@ -203,6 +207,14 @@ char *chan_executeChanMode(char op, char mode, struct link_Node *channelNode, ch
 			if(op == '+')
 				return chan_setKey(channelNode, data);
 			return chan_removeKey(channelNode, data);
+
+		case 'l':
+			if(op == '-')
+				*index -= 1; // Removing the limit takes no data
+			return chan_setLimit(channelNode, op, data);
+
+		case 'b':
+			return chan_setBan(channelNode, op, data);
 		
 		default: // No special action needed, simply add it to the array
 			*index -= 1; // Undo addition (No data used)
@@ -318,6 +330,62 @@ int chan_checkKey(struct link_Node *channelNode, char *key){
 	return ret;
 }
 
+// Sets or removes the channel's user limit
+char *chan_setLimit(struct link_Node *channelNode, char op, char *limit){
+	if(channelNode == NULL || channelNode->data == NULL)
+		return ERR_UNKNOWNERROR;
+
+	struct chan_Channel *channel = channelNode->data;
+
+	int max = 0;
+	if(op == '+'){
+		if(limit == NULL || (max = atoi(limit)) <= 0)
+			return ERR_NEEDMOREPARAMS;
+	}
+
+	pthread_mutex_lock(&channel->channelMutex);
+	channel->members.limit = max;
+	pthread_mutex_unlock(&channel->channelMutex);
+
+	chan_changeChannelModeArray(op, 'l', channelNode);
+
+	return NULL;
+}
+
+// Adds or removes a ban mask
+char *chan_setBan(struct link_Node *channelNode, char op, char *mask){
+	if(channelNode == NULL || channelNode->data == NULL)
+		return ERR_UNKNOWNERROR;
+
+	struct chan_Channel *channel = channelNode->data;
+
+	char normal[MAX_MESSAGE_LENGTH];
+	if(mask == NULL || ban_normalizeMask(mask, normal, ARRAY_SIZE(normal)) == -1)
+		return ERR_NEEDMOREPARAMS;
+
+	// Joins never lock, they see either the old or the new set
+	pthread_mutex_lock(&channel->channelMutex);
+	if(op == '+')
+		ban_add(&channel->bans, normal);
+	else
+		ban_remove(&channel->bans, normal);
+	pthread_mutex_unlock(&channel->channelMutex);
+
+	return NULL;
+}
+
+// Checks the channel's bans, then the bans of its group
+int chan_isBanned(struct link_Node *channelNode, struct usr_UserData *user){
+	if(user == NULL || channelNode == NULL || channelNode->data == NULL)
+		return -1;
+
+	struct chan_Channel *channel = channelNode->data;
+	if(ban_isBanned(&channel->bans, user) == 1)
+		return 1;
+
+	return grp_isBanned(channel->group, user);
+}
+
 // Remove or give chan op or voice
 char *chan_giveChanPerms(struct link_Node *channelNode, struct usr_UserData *user, char op, int perm){
 	if(channelNode == NULL || channelNode->data == NULL){
@@ -325,121 +393,114 @@ char *chan_giveChanPerms(struct link_Node *channelNode, struct usr_UserData *use
 	}
 
     struct chan_Channel *channel = channelNode->data;
-	struct chan_ChannelUser *chanUser = chan_isInChannel(channelNode, user);
-	if(chanUser == NULL){
-		return ERR_USERNOTINCHANNEL;
-	}
+	char *ret = NULL;
 
     pthread_mutex_lock(&channel->channelMutex);
-	if(op == '-'){
-		chanUser->permLevel = 0;
-	} else {
-		chanUser->permLevel = perm;
-	}
+	if(mbr_setPermLevel(&channel->members, user, op == '-' ? 0 : perm) == -1)
+		ret = ERR_USERNOTINCHANNEL;
     pthread_mutex_unlock(&channel->channelMutex);
 
-	return NULL;
+	return ret;
 }
 
 // Check if a user is in a channel
-struct chan_ChannelUser *chan_isInChannel(struct link_Node *channelNode, struct usr_UserData *user){
+int chan_isInChannel(struct link_Node *channelNode, struct usr_UserData *user){
 	if(user == NULL || channelNode == NULL || channelNode->data == NULL){
-		return NULL;
+		return -1;
 	}
 
     struct chan_Channel *channel = channelNode->data;
-	struct chan_ChannelUser *ret = NULL;
-
-    pthread_mutex_lock(&channel->channelMutex);
-	for(int i = 0; i < channel->max; i++){
-		if(channel->users[i].user == user){
-            ret = &channel->users[i];
-			break;
-		}
-	}
-    pthread_mutex_unlock(&channel->channelMutex);
-
-    return ret;
+	return mbr_getPermLevel(&channel->members, user) == -1 ? -1 : 1;
 }
 
 // Add a user to a channel
-struct chan_ChannelUser *chan_addToChannel(struct link_Node *channelNode, struct usr_UserData *user, int permLevel){
-    struct chan_Channel *channel = channelNode->data;
-	struct chan_ChannelUser *chanUser = chan_isInChannel(channelNode, user);
-
-    if(chanUser == NULL){ // Not in the channel
-        pthread_mutex_lock(&channel->channelMutex);
-		for(int i = 0; i < channel->max; i++){
-			if(channel->users[i].user == NULL){ // Empty spot
-				channel->users[i].user = user;
-				channel->users[i].permLevel = permLevel;
-				chanUser = &channel->users[i];
-				break;
-			}
-		}
-        pthread_mutex_unlock(&channel->channelMutex);
-    }
-
-    return chanUser;
-}
+int chan_addToChannel(struct link_Node *channelNode, struct usr_UserData *user, int permLevel){
+	if(user == NULL || channelNode == NULL || channelNode->data == NULL){
+		return -1;
+	}
 
-// Will fill a string with a list of users
-int chan_getUsersInChannel(struct link_Node *channelNode, char *buff, int size){
     struct chan_Channel *channel = channelNode->data;
-    char nickname[fig_Configuration.nickLen];
-    int pos = 1;
+	int ret = 1;
 
-	strncpy(buff, ":", size);
-    pthread_mutex_lock(&channel->channelMutex);
-	for(int i = 0; i < channel->max; i++){
-		if(channel->users[i].user != NULL){
-			switch(channel->users[i].permLevel) {
-				case 2: // Channel operator
-					strncat(buff, "@", size - pos - 1);
-					pos++;
-					break;
-
-				case 1: // Channel voice
-					strncat(buff, "+", size - pos - 1);
-					pos++;
-					break;
-			}
+	pthread_mutex_lock(&channel->channelMutex);
+	if(mbr_find(channel->members.current, user) == -1){ // Not in the channel
+		// Checked under the mutexes +b is set under, a join never slips past a new ban
+		int banned = -1;
+		if(permLevel < 2){
+			struct grp_Group *group = channel->group->data;
+			banned = ban_isBanned(&channel->bans, user);
+
+			pthread_mutex_lock(&group->groupMutex);
+			if(banned == -1)
+				banned = ban_isBanned(&group->bans, user);
+			pthread_mutex_unlock(&group->groupMutex);
+		}
 
-			usr_getNickname(nickname, channel->users[i].user);
-			strncat(buff, nickname, size - pos - 1);
-			pos = strlen(buff);
+		ret = banned == 1 ? -2 : mbr_add(&channel->members, user, permLevel);
+	}
+	pthread_mutex_unlock(&channel->channelMutex);
 
-			// Space inbetween users
-			buff[pos] = ' ';
-			buff[pos + 1] = '\0';
-			pos++;
-		}
-    }
-    pthread_mutex_unlock(&channel->channelMutex);
+    return ret;
+}
 
-    return 1;
+// Chanops are shown as @nick and voiced users as +nick
+struct mbr_Names *chan_getNames(struct link_Node *channelNode, int lineLen){
+	if(channelNode == NULL || channelNode->data == NULL)
+		return NULL;
+
+    struct chan_Channel *channel = channelNode->data;
+	return mbr_getNames(&channel->members, " +@", lineLen);
 }
 
 // Send a message to every user in a channel
+// Works on a snapshot of the members so the channel is never locked
 int chan_sendChannelMessage(struct chat_Message *cmd, struct link_Node *channelNode){
 	struct usr_UserData *origin = cmd->user;
     struct chan_Channel *channel = channelNode->data;
 
-    pthread_mutex_lock(&channel->channelMutex);
-	for(int i = 0; i < channel->max; i++){
-        cmd->user = channel->users[i].user;
-		
-		// Dont send to sender or invalid users
-		if(cmd->user == origin || cmd->user == NULL){
-			continue;
-		}
+	// Every member shares the same line
+    char str[BUFSIZ];
+    chat_messageToString(cmd, str, ARRAY_SIZE(str));
+	struct com_Buffer *buffer = com_createBuffer(str);
+	if(buffer == NULL)
+		return -1;
 
-        chat_sendMessage(cmd);
-    }
-    pthread_mutex_unlock(&channel->channelMutex);
+	struct mbr_Snapshot *snapshot = mbr_acquire(&channel->members);
+	if(mbr_partition(snapshot) != NULL){ // Large: each IO thread delivers to its own members
+		com_fanOut(snapshot, origin, buffer);
+	} else {
+		for(int i = 0; i < snapshot->count; i++){
+			// Dont send to sender
+			if(MBR_MEMBER(snapshot, i)->user == origin){
+				continue;
+			}
 
-	cmd->user = origin;
+			com_sendBuffer(MBR_MEMBER(snapshot, i)->user, buffer);
+		}
+	}
+	mbr_release();
+
+	// History and archive keep the same buffer instead of a copy
+	if(!strcmp(cmd->command, "PRIVMSG")){
+		unsigned long msgid = hist_newMsgid();
+		time_t now = clk_now();
+		hist_add(&channel->history, buffer, msgid, now);
+
+		struct grp_Group *group = channel->group->data;
+		if(fig_Configuration.useArchive)
+			arch_append(group->name, channel->name, msgid, now, buffer);
+		if(fig_Configuration.useSearch)
+			srch_addMessage(channel, msgid, now, buffer);
+	}
 
+	com_releaseBuffer(buffer);
     return 1;
 }
 
+int chan_replayHistory(struct link_Node *channelNode, struct usr_UserData *user){
+	if(user == NULL || channelNode == NULL || channelNode->data == NULL)
+		return -1;
+
+    struct chan_Channel *channel = channelNode->data;
+	return hist_replay(&channel->history, user);
+}
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM LOG_CHAT
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
@@ -7,6 +8,8 @@
 #include "chat.h"
 #include "linkedlist.h"
 #include "commands.h"
+#include "capture.h"
+#include "metrics.h"
 
 struct chat_ServerLists serverLists = {0};
 struct chat_DataQueue dataQueue = {0};
@@ -40,6 +43,9 @@ int init_chat(){
         return -1;
     }
 
+	if(hash_init(&serverLists.groupIndex, 64) == -1)
+		return -1;
+
 	// Allocate users array
 	serverLists.users = calloc(fig_Configuration.clients, sizeof(struct usr_UserData));
 	if(serverLists.users == NULL){
@@ -99,7 +105,7 @@ int chat_setupDataThreads(struct fig_ConfigData *config){
 
 int chat_insertQueue(struct usr_UserData *user, int type, char *str, struct chat_Message *msg){
 	struct com_QueueJob *job;
-	job = calloc(1, sizeof(struct com_QueueJob));
+	job = calloc(1, sizeof(struct com_QueueJob) + COM_LINE_LEN);
 	if(job == NULL){
 		log_logError("Error allocating job", ERROR);
 		if(msg != NULL)
@@ -111,7 +117,11 @@ int chat_insertQueue(struct usr_UserData *user, int type, char *str, struct chat
 	job->user = user;
 	job->msg = msg;
 	if(str != NULL)
-		strncpy(job->str, str, ARRAY_SIZE(job->str)-1);
+		strncpy(job->str, str, COM_LINE_LEN-1);
+	if(trc_state.enabled){
+		job->trace.origin = msg != NULL ? msg->traceOrigin : trc_origin;
+		job->trace.queued = trc_now();
+	}
 
     pthread_mutex_lock(&dataQueue.queueMutex); 
     link_add(&dataQueue.queue, job);
@@ -124,6 +134,10 @@ void *chat_processQueue(void *param){
     struct chat_DataQueue *dataQ = param;
     struct timespec delay = {.tv_nsec = 1000000}; // 1ms
 
+	if(trc_state.enabled)
+		trc_registerThread("data");
+	mtr_registerThread("data", -1);
+
     while(1) { 
         // Make sure to set as null to prevent undefined behavior
         struct com_QueueJob *job = NULL;
@@ -132,6 +146,7 @@ void *chat_processQueue(void *param){
         pthread_mutex_lock(&dataQ->queueMutex);
         if(link_isEmpty(&dataQ->queue) < 0){
             job = link_remove(&dataQ->queue, 0);
+            dataQ->busy++;
         }
         pthread_mutex_unlock(&dataQ->queueMutex);
 
@@ -142,31 +157,72 @@ void *chat_processQueue(void *param){
             continue;
         }
 
+        uint64_t busyStart = trc_now();
         if(!job->user){
             log_logMessage("Job user is NULL", DEBUG);
             free(job);
+            __atomic_sub_fetch(&dataQ->busy, 1, __ATOMIC_RELEASE);
             continue;
         }
 
+        // Only jobs that came from a read carry an origin
+        uint64_t start = 0;
+        if(trc_state.enabled && job->trace.origin){
+            start = trc_record(job->type == 0 ? TRC_DATA_QUEUE : TRC_COMMAND_QUEUE, job->trace.queued);
+            trc_origin = job->trace.origin; // Output queued from here on belongs to this line
+        }
+
         if(job->user->id >= 0){ // Make sure user is valid
             switch (job->type) {
                 case 0: // Text to cmd
                     chat_parseInput(job); 
+                    if(start)
+                        trc_record(TRC_PARSE, start);
                     break;
 
                 case 1: // Run the cmd
                     cmd_runCommand(job->msg);
+                    if(start)
+                        trc_record(TRC_COMMAND, start);
                     free(job->msg);
                     break;                
             }
         }
+        trc_origin = 0;
 
         free(job);
+        __atomic_sub_fetch(&dataQ->busy, 1, __ATOMIC_RELEASE);
+        mtr_count(MTR_EVENTS, 1);
+        mtr_count(MTR_BUSY, trc_now() - busyStart);
     }
 
     return NULL;
 }
 
+int chat_waitIdle(){
+    struct timespec delay = {.tv_nsec = 1000000}; // 1ms
+
+    while(1){
+        pthread_mutex_lock(&dataQueue.queueMutex);
+        int idle = link_isEmpty(&dataQueue.queue) == 1 && __atomic_load_n(&dataQueue.busy, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&dataQueue.queueMutex);
+
+        if(idle)
+            return 1;
+
+        nanosleep(&delay, NULL);
+    }
+}
+
+int chat_getQueueDepth(int *busy){
+    pthread_mutex_lock(&dataQueue.queueMutex);
+    int depth = dataQueue.queue.size;
+    *busy = __atomic_load_n(&dataQueue.busy, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&dataQueue.queueMutex);
+
+    return depth;
+}
+
 // TODO - Support multiple cmds in one read
 // TODO - Handle null bytes? also handle MAJOR issues with memcpy (size of copied)
 int chat_parseInput(struct com_QueueJob *job){
@@ -182,7 +238,7 @@ int chat_parseInput(struct com_QueueJob *job){
     // Find where the message ends (\r or \n); if not supplied just take the very end of the buffer
     int length = 0;
     int currentPos = 0, loc = 0; // Helps to keep track of where string should be copied
-    for (int i = 0; i < ARRAY_SIZE(job->str)-1; i++){
+    for (int i = 0; i < COM_LINE_LEN-1; i++){
         if(job->str[i] == '\n' || job->str[i] == '\r' || job->str[i] == '\0'){
             length = i+1;
             job->str[i] = ' ';
@@ -196,6 +252,8 @@ int chat_parseInput(struct com_QueueJob *job){
     }
 
     log_logMessage(job->str, MESSAGE);
+    if(cap_state.enabled)
+        cap_record(CAP_IN, user - serverLists.users, user->id, job->str, length > 0 ? length - 1 : (int) strnlen(job->str, COM_LINE_LEN));
 
     if(job->str[0] == ':'){
        loc = chat_findNextSpace(0, length, job->str);
@@ -228,6 +286,7 @@ int chat_parseInput(struct com_QueueJob *job){
     }
 
     cmd->user = user;
+    cmd->traceOrigin = job->trace.origin;
 
     return chat_insertQueue(user, 1, NULL, cmd);
 }
@@ -244,6 +303,16 @@ int chat_sendMessage(struct chat_Message *msg) {
     return 1;
 }
 
+int chat_appendMessage(struct com_Buffer **buffer, struct chat_Message *msg) {
+    if(msg == NULL || buffer == NULL || *buffer == NULL){
+        return -1;
+    }
+
+    char str[BUFSIZ];
+    chat_messageToString(msg, str, ARRAY_SIZE(str));
+    return com_appendBuffer(buffer, str);
+}
+
 int chat_sendServerMessage(struct chat_Message *cmd){
     struct usr_UserData *user;
     char str[BUFSIZ];
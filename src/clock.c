@@ -0,0 +1,120 @@
+#include "clock.h"
+
+struct clk_Cache clk_cache;
+
+int init_clock(){
+	clk_refresh();
+
+	__atomic_store_n(&clk_cache.running, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&clk_cache.thread, NULL, clk_thread, NULL) != 0){
+		__atomic_store_n(&clk_cache.running, 0, __ATOMIC_RELEASE);
+		log_logError("Error creating clock thread", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+time_t clk_now(){
+	if(!__atomic_load_n(&clk_cache.running, __ATOMIC_ACQUIRE))
+		return time(NULL);
+
+	return __atomic_load_n(&clk_cache.now, __ATOMIC_ACQUIRE);
+}
+
+void clk_getLogTime(char str[CLK_LOG_LEN]){
+	if(!__atomic_load_n(&clk_cache.running, __ATOMIC_ACQUIRE)){
+		char isoTime[CLK_ISO_LEN], date[CLK_DATE_LEN];
+		clk_format(time(NULL), str, isoTime, date);
+		return;
+	}
+
+	clk_copy(str, clk_cache.logTime, CLK_LOG_LEN);
+}
+
+void clk_getIsoTime(char str[CLK_ISO_LEN]){
+	if(!__atomic_load_n(&clk_cache.running, __ATOMIC_ACQUIRE)){
+		char logTime[CLK_LOG_LEN], date[CLK_DATE_LEN];
+		clk_format(time(NULL), logTime, str, date);
+		return;
+	}
+
+	clk_copy(str, clk_cache.isoTime, CLK_ISO_LEN);
+}
+
+void clk_getDate(char str[CLK_DATE_LEN]){
+	if(!__atomic_load_n(&clk_cache.running, __ATOMIC_ACQUIRE)){
+		char logTime[CLK_LOG_LEN], isoTime[CLK_ISO_LEN];
+		clk_format(time(NULL), logTime, isoTime, str);
+		return;
+	}
+
+	clk_copy(str, clk_cache.date, CLK_DATE_LEN);
+}
+
+void clk_copy(char *dest, char *src, int len){
+	unsigned long before, after;
+
+	do {
+		before = __atomic_load_n(&clk_cache.seq, __ATOMIC_ACQUIRE);
+		memcpy(dest, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&clk_cache.seq, __ATOMIC_RELAXED);
+	} while((before & 1) || before != after);
+
+	dest[len-1] = '\0';
+}
+
+void clk_format(time_t time, char logTime[CLK_LOG_LEN], char isoTime[CLK_ISO_LEN], char date[CLK_DATE_LEN]){
+	struct tm local, utc;
+	localtime_r(&time, &local);
+	gmtime_r(&time, &utc);
+
+	// Years past 9999 do not fit, strftime leaves the buffer undefined then
+	if(strftime(logTime, CLK_LOG_LEN, "[%Y-%m-%d %H:%M:%S]", &local) == 0)
+		logTime[0] = '\0';
+	if(strftime(isoTime, CLK_ISO_LEN, "%Y-%m-%dT%H:%M:%S.000Z", &utc) == 0)
+		isoTime[0] = '\0';
+	if(strftime(date, CLK_DATE_LEN, "%Y-%m-%d", &local) == 0)
+		date[0] = '\0';
+}
+
+void clk_refresh(){
+	char logTime[CLK_LOG_LEN], isoTime[CLK_ISO_LEN], date[CLK_DATE_LEN];
+	struct timespec wall;
+
+	// time() may read a coarser clock that is still in the last second
+	clock_gettime(CLOCK_REALTIME, &wall);
+	time_t now = wall.tv_sec;
+	if(now == __atomic_load_n(&clk_cache.now, __ATOMIC_RELAXED))
+		return;
+
+	// Formatted before the sequence number goes odd, so readers spin as briefly as possible
+	clk_format(now, logTime, isoTime, date);
+
+	__atomic_add_fetch(&clk_cache.seq, 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(clk_cache.logTime, logTime, CLK_LOG_LEN);
+	memcpy(clk_cache.isoTime, isoTime, CLK_ISO_LEN);
+	memcpy(clk_cache.date, date, CLK_DATE_LEN);
+	__atomic_store_n(&clk_cache.now, now, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&clk_cache.seq, 1, __ATOMIC_RELEASE);
+}
+
+void *clk_thread(void *param){
+	(void) param;
+	struct timespec wall, delay;
+
+	while(1){
+		clk_refresh();
+
+		// Sleep relative to now until just past the next second, so a wall clock that jumps back does not stall the cache
+		clock_gettime(CLOCK_REALTIME, &wall);
+		long ns = 1000000000L - wall.tv_nsec + 1000000;
+		delay.tv_sec = ns / 1000000000L;
+		delay.tv_nsec = ns % 1000000000L;
+		nanosleep(&delay, NULL);
+	}
+
+	return NULL;
+}
@@ -1,4 +1,6 @@
+#define LOG_SUBSYSTEM LOG_CHAT
 #include "commands.h"
+#include "events.h"
 
 struct cmd_CommandList cmd_commandList;
 struct chat_Message cmd_unknownCommand;
@@ -35,6 +37,10 @@ int init_commands() {
     cmd_addCommand("MODE", 2, 1, &cmd_mode);
     cmd_addCommand("PING", 0, 0, &cmd_ping);
     cmd_addCommand("PONG", 0, 0, &cmd_pong);
+    cmd_addCommand("HISTORY", 1, 1, &cmd_history);
+	if(fig_Configuration.useSearch)
+		cmd_addCommand("SEARCH", 2, 1, &cmd_search);
+    cmd_addCommand("STATS", 0, 2, &cmd_stats);
 
     log_logMessage("Successfully initalized commands.", INFO);
     return 1;
@@ -53,6 +59,7 @@ int cmd_addCommand(char *word, int minParams, int permLevel, int (*func)(struct
 	command->permLevel = permLevel;
 
     pthread_mutex_lock(&cmd_commandList.commandMutex);
+	command->id = cmd_commandList.commands.size;
     link_add(&cmd_commandList.commands, command);
     pthread_mutex_unlock(&cmd_commandList.commandMutex);
 
@@ -81,6 +88,12 @@ int cmd_runCommand(struct chat_Message *cmd){
 			if(usr_userHasMode(cmd->user, 'r') == 1 && command->permLevel >= 1){
                 char *params[] = {":You have not registered: use NICK first"};
                 chat_createMessage(&reply, cmd->user, thisServer, ERR_NOTREGISTERED, params, 1);
+                break;
+			}
+
+			if(usr_userHasMode(cmd->user, 'o') != 1 && command->permLevel >= 2){
+                char *params[] = {":Permission Denied- You're not an IRC operator"};
+                chat_createMessage(&reply, cmd->user, thisServer, ERR_NOPRIVILEGES, params, 1);
                 break;
 			}
 
@@ -91,7 +104,9 @@ int cmd_runCommand(struct chat_Message *cmd){
                 break;
             }
 
+            uint64_t start = trc_now();
             ret = command->func(cmd, &reply);
+            mtr_recordCommand(command->id, trc_now() - start);
             break;
         }
     }
@@ -120,7 +135,7 @@ struct link_Node *cmd_checkChannelPerms(struct chat_Message *msg, char *chanName
         return NULL;
     }
 
-	if(chan_isInChannel(chan, user) == NULL){
+	if(chan_isInChannel(chan, user) == -1){
 		err_notonchannel(msg, chan->data, user);	
 		return NULL;
 	}
@@ -165,6 +180,34 @@ void err_chanoprivsneeded(struct chat_Message *msg, struct chan_Channel *chan, s
 	pthread_mutex_unlock(&chan->channelMutex);
 }
 
+// Generate a RPL_BANLIST reply
+void rpl_banlist(char *mask, void *data){
+	struct cmd_BanList *list = data;
+	char *params[] = {list->nick, list->target, mask};
+	chat_createMessage(list->msg, list->user, thisServer, RPL_BANLIST, params, 3);
+	chat_sendMessage(list->msg);
+}
+
+int cmd_listBans(struct chat_Message *reply, struct usr_UserData *user, char *target, struct ban_List *bans){
+	char nick[fig_Configuration.nickLen];
+	usr_getNickname(nick, user);
+
+	struct cmd_BanList list = {reply, user, nick, target};
+	ban_forEach(bans, rpl_banlist, &list);
+
+	char *params[] = {nick, target, ":End of channel ban list"};
+	chat_createMessage(reply, user, thisServer, RPL_ENDOFBANLIST, params, 3);
+	return 1;
+}
+
+// "MODE #chan b" and "MODE #chan +b" without a mask list the bans
+int cmd_isBanListRequest(struct chat_Message *cmd){
+	if(cmd->params[2][0] != '\0')
+		return -1;
+
+	return !strcmp(cmd->params[1], "b") || !strcmp(cmd->params[1], "+b") ? 1 : -1;
+}
+
 // Changes a user's nickname
 const char *nick_usage = ":Usage: NICK <nickname>";
 const char *nick_welcome = ":Welcome to the server!";
@@ -182,19 +225,17 @@ int cmd_nick(struct chat_Message *cmd, struct chat_Message *reply){
 
     struct usr_UserData *otherUser = usr_getUserByName(cmd->params[0]);
     if(otherUser == NULL) { // No other user has this name
-		char oldName[fig_Configuration.nickLen];
-		usr_getNickname(oldName, user);
+		char oldPrefix[ARRAY_SIZE(reply->prefix)];
+		usr_getPrefix(oldPrefix, ARRAY_SIZE(oldPrefix), user);
 		int isUnreg = usr_userHasMode(user, 'r');
 
-		// Set the name in the user's buffer
-        pthread_mutex_lock(&user->userMutex);
-        strncpy(user->nickname, cmd->params[0], fig_Configuration.nickLen-1);
-        pthread_mutex_unlock(&user->userMutex);
+		// Readers never lock the name, a new one is simply published
+        usr_setNickname(user, cmd->params[0]);
 
         params[0] = cmd->params[0];
 		// User is already registered
 		if(isUnreg != 1){
-			chat_createMessage(reply, user, oldName, "NICK", params, 1);
+			chat_createMessage(reply, user, oldPrefix, "NICK", params, 1);
 			chat_sendServerMessage(reply); // TODO - change to all channels user is in + "contacts"
 			return 1;
 		}
@@ -218,7 +259,7 @@ int cmd_nick(struct chat_Message *cmd, struct chat_Message *reply){
 int cmd_privmsg(struct chat_Message *cmd, struct chat_Message *reply){
     struct usr_UserData *user = cmd->user;
     struct usr_UserData *otherUser;
-    struct link_Node *channel;
+    struct link_Node *channel = NULL;
     char *params[ARRAY_SIZE(cmd->params)];
     int size = 1;
 
@@ -241,16 +282,22 @@ int cmd_privmsg(struct chat_Message *cmd, struct chat_Message *reply){
 			chat_createMessage(reply, user, thisServer, ERR_CANNOTSENDTOCHAN, params, 1);
 			return -1;
 		}
+
+		// Banned users may stay, but only voiced users may speak
+		if(chan_getUserChannelPrivs(user, channel) < 1 && chan_isBanned(channel, user) == 1){
+			chat_createMessage(reply, user, thisServer, ERR_CANNOTSENDTOCHAN, params, 1);
+			return -1;
+		}
     }
 
     // Success
-    char nickname[fig_Configuration.nickLen];
-    usr_getNickname(nickname, user);
+    char prefix[ARRAY_SIZE(reply->prefix)];
+    usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
 
     params[0] = cmd->params[0];
     params[1] = cmd->params[1];
 
-    chat_createMessage(reply, otherUser, nickname, "PRIVMSG", params, size);
+    chat_createMessage(reply, otherUser, prefix, "PRIVMSG", params, size);
     if(channel == NULL){
         return 1;
     }
@@ -272,9 +319,11 @@ int cmd_join(struct chat_Message *cmd, struct chat_Message *reply){
 
 	char nick[fig_Configuration.nickLen];
 	usr_getNickname(nick, user);
+	char prefix[ARRAY_SIZE(reply->prefix)];
+	usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
 
-	// Used to generate the NAMES command later
-	char namesCMD[MAX_MESSAGE_LENGTH] = "NAMES "; 
+	// Targets of the NAMES reply sent after joining
+	char namesList[MAX_MESSAGE_LENGTH] = "";
 
 	// Split name into group and channel
 	char names[2][1000];
@@ -297,11 +346,17 @@ int cmd_join(struct chat_Message *cmd, struct chat_Message *reply){
 		// NAMES
 		char buff[fig_Configuration.groupNameLength];
 		grp_getName(groupNode, buff, ARRAY_SIZE(buff));
-		strncat(namesCMD, buff, ARRAY_SIZE(namesCMD)-strlen(namesCMD)-2);
+		strncat(namesList, buff, ARRAY_SIZE(namesList)-strlen(namesList)-2);
 	} else { // Join if not already in
-		if(grp_isInGroup(groupNode, user) == NULL){
-			struct grp_GroupUser *grpUsr = grp_addUser(groupNode, user, 0);
-			if(grpUsr == NULL){
+		if(grp_isInGroup(groupNode, user) == -1){
+			ret = grp_addUser(groupNode, user, 0);
+			if(ret == -2){
+				params[1] = ":Cannot join group (+b)";
+				chat_createMessage(reply, user, thisServer, ERR_BANNEDFROMCHAN, params, 2);
+				return -1;
+			}
+
+			if(ret == -1){
 				// FULL
 				chat_createMessage(reply, user, thisServer, ERR_GROUPISFULL, params, 1);
 				return -1;
@@ -311,19 +366,20 @@ int cmd_join(struct chat_Message *cmd, struct chat_Message *reply){
 			grp_getName(groupNode, buff, ARRAY_SIZE(buff));
 
 			params[0] = buff;
-			chat_createMessage(reply, user, nick, "JOIN", params, 1);
+			chat_createMessage(reply, user, prefix, "JOIN", params, 1);
 			grp_sendGroupMessage(reply, groupNode);
 			params[0] = cmd->params[0]; // Reset back to default
 
 			// NAMES
-			strncat(namesCMD, buff, ARRAY_SIZE(namesCMD)-strlen(namesCMD)-2);
+			strncat(namesList, buff, ARRAY_SIZE(namesList)-strlen(namesList)-2);
 		}
 	}
 
 	if(names[1][0] == '\0'){ // No further action: group joined
-		// Generate names for the JOIN
-		chat_insertQueue(user, 0, namesCMD, NULL);
-		return 2;
+		if(namesList[0] == '\0')
+			return 2; // Already a member
+
+		return cmd_namesReply(reply, user, namesList);
 	}
 
 	// Sort out channel	
@@ -346,41 +402,68 @@ int cmd_join(struct chat_Message *cmd, struct chat_Message *reply){
 			return -1;
 		}
 		
-		struct chan_ChannelUser *chanUsr = chan_addToChannel(channelNode, user, 0);
-		if(chanUsr == NULL){
+		ret = chan_addToChannel(channelNode, user, 0);
+		if(ret == -2){
+			params[1] = ":Cannot join channel (+b)";
+			chat_createMessage(reply, user, thisServer, ERR_BANNEDFROMCHAN, params, 2);
+			return -1;
+		}
+
+		if(ret == -1){
 			// FULL
 			chat_createMessage(reply, user, thisServer, ERR_CHANNELISFULL, params, 1);
 			return -1;
 		}
 
-		chat_createMessage(reply, user, nick, "JOIN", params, 1);
+		chat_createMessage(reply, user, prefix, "JOIN", params, 1);
 		chan_sendChannelMessage(reply, channelNode);
 	}
 
 	// Generate names for the JOIN
-	if(namesCMD[6] != '\0') // Also joined a GROUP
-		strcat(namesCMD, ",");
-	strncat(namesCMD, cmd->params[0], ARRAY_SIZE(namesCMD)-strlen(namesCMD)-2);
-	chat_insertQueue(user, 0, namesCMD, NULL);
+	if(namesList[0] != '\0') // Also joined a GROUP
+		strcat(namesList, ",");
+	strncat(namesList, cmd->params[0], ARRAY_SIZE(namesList)-strlen(namesList)-2);
 
-	return 2;
+	// Served straight from the cache instead of queueing a NAMES command
+	ret = cmd_namesReply(reply, user, namesList);
+
+	// Recent messages come after the JOIN burst
+	chan_replayHistory(channelNode, user);
+	return ret;
 }
 
 // Returns list of names
-// TODO - Hidden/private channels and multiple channels
+// TODO - Hidden/private channels
 int cmd_names(struct chat_Message *cmd, struct chat_Message *reply){
-    struct usr_UserData *user = cmd->user;
-    char *params[ARRAY_SIZE(cmd->params)];
+	return cmd_namesReply(reply, cmd->user, cmd->params[0]);
+}
+
+// Longest list of names that still fits in a 512 byte RPL_NAMREPLY
+// :<server> 353 <nick> = <target> :<names>\r\n
+int cmd_namesLineLen(char *target){
+	int len = 512 - 12 - strlen(thisServer) - fig_Configuration.nickLen - strlen(target);
+
+	if(len > (int) ARRAY_SIZE(((struct chat_Message *) 0)->params[0]) - 1)
+		len = ARRAY_SIZE(((struct chat_Message *) 0)->params[0]) - 1;
+	if(len < 64)
+		len = 64;
+
+	return len;
+}
+
+int cmd_namesReply(struct chat_Message *reply, struct usr_UserData *user, char *targets){
+    char *params[ARRAY_SIZE(reply->params)];
 	char items[5][1001] = {0};
 
 	char buff[BUFSIZ];
-	strncpy(buff, cmd->params[0], ARRAY_SIZE(buff));
+	strncpy(buff, targets, ARRAY_SIZE(buff)-1);
+	buff[ARRAY_SIZE(buff)-1] = '\0';
     
 	// Split up into array based on commas
 	int loc = 0, num = 0;
 	while(loc != -1 && num < ARRAY_SIZE(items)){
 		int oldLoc = loc;
-		loc = chat_findCharacter(buff, strlen(cmd->params[0]), ',');
+		loc = chat_findCharacter(buff, strlen(targets), ',');
 		if(loc > -1){
 			buff[loc] = '\0'; // Aid to strncpy	
 			loc++; // Start at char after ','
@@ -392,7 +475,11 @@ int cmd_names(struct chat_Message *cmd, struct chat_Message *reply){
 
 	char nick[fig_Configuration.nickLen];
 	usr_getNickname(nick, user);
-	char names[ARRAY_SIZE(cmd->params[0])];
+
+	// Every line goes out as a single job with one rearm of the socket
+	struct com_Buffer *batch = com_allocBuffer(BUFSIZ);
+	if(batch == NULL)
+		return -1;
 	for(int i = 0; i < ARRAY_SIZE(items); i++){
 		if(items[i][0] == '\0')
 			break;
@@ -401,35 +488,37 @@ int cmd_names(struct chat_Message *cmd, struct chat_Message *reply){
 		params[0] = nick;
 		params[1] = "=";
 		params[2] = items[i];
-		params[3] = names;
 
 		// Check to see if channel is the correct one first
 		struct link_Node *chan = chan_getChannelByName(items[i]);
-		if(chan == NULL && items[i][0] != '&'){ // Both invalid
+		struct link_Node *group = NULL;
+		if(chan == NULL && (items[i][0] != '&' || (group = grp_getGroup(items[i])) == NULL)){
 			params[0] = items[i];
 			chat_createMessage(reply, user, thisServer, ERR_NOSUCHCHANNEL, params, 1);
+			chat_appendMessage(&batch, reply);
 			continue;
-		} else if(chan != NULL){ // Channel valid
-			chan_getUsersInChannel(chan, names, ARRAY_SIZE(names));
-		} else { // Group valid
-			struct link_Node *group = grp_getGroup(items[i]);
-			if(group == NULL){
-				params[0] = items[i];
-				chat_createMessage(reply, user, thisServer, ERR_NOSUCHCHANNEL, params, 1);
-				continue;
-			}
-
-			grp_getUsersInGroup(group, names, ARRAY_SIZE(names));
 		}
 
-		chat_createMessage(reply, user, thisServer, RPL_NAMREPLY, params, 4);
-		chat_sendMessage(reply);
+		// Lines are shared by everyone asking until the members change
+		int lineLen = cmd_namesLineLen(items[i]);
+		rcl_readLock();
+		struct mbr_Names *names = chan != NULL ? chan_getNames(chan, lineLen) : grp_getNames(group, lineLen);
+		for(int j = 0; names != NULL && j < names->numLines; j++){
+			params[3] = names->lines[j];
+			chat_createMessage(reply, user, thisServer, RPL_NAMREPLY, params, 4);
+			chat_appendMessage(&batch, reply);
+		}
+		rcl_readUnlock();
 	}
 
-	params[0] = cmd->params[0];
+	params[0] = targets;
 	params[1] = ":End of /NAMES list";
 	chat_createMessage(reply, user, thisServer, RPL_ENDOFNAMES, params, 2);
-	return 1;
+	chat_appendMessage(&batch, reply);
+
+	com_sendBuffer(user, batch);
+	com_releaseBuffer(batch);
+	return 2;
 }
 
 // Leave a channel or group
@@ -452,12 +541,12 @@ int cmd_part(struct chat_Message *cmd, struct chat_Message *reply){
 	}
 
     // Success
-    char nickname[fig_Configuration.nickLen];
-    usr_getNickname(nickname, user);
+    char prefix[ARRAY_SIZE(reply->prefix)];
+    usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
     params[0] = cmd->params[0];
     size = 1;
 
-    chat_createMessage(reply, user, nickname, "PART", params, size);
+    chat_createMessage(reply, user, prefix, "PART", params, size);
     chan_sendChannelMessage(reply, channel);
 
     return 1;
@@ -482,8 +571,8 @@ int cmd_kick(struct chat_Message *cmd, struct chat_Message *reply){
 	}
 
     // Success
-    char nickname[fig_Configuration.nickLen];
-    usr_getNickname(nickname, user);
+    char prefix[ARRAY_SIZE(reply->prefix)];
+    usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
     params[0] = cmd->params[0];
 	params[1] = cmd->params[1];
 	if(cmd->params[2][0] != '\0'){
@@ -491,7 +580,7 @@ int cmd_kick(struct chat_Message *cmd, struct chat_Message *reply){
 		size = 3;
 	}
 
-    chat_createMessage(reply, otherUser, nickname, "KICK", params, size);
+    chat_createMessage(reply, otherUser, prefix, "KICK", params, size);
     chan_sendChannelMessage(reply, channel);
 
     return 1;
@@ -542,8 +631,7 @@ int cmd_mode(struct chat_Message *cmd, struct chat_Message *reply){
 			return cmd_modeChan(cmd, reply, op, hasOp);
 			
 		case TYPE_GROUP:
-			//return cmd_modeGroup(cmd, reply, op, hasOp);
-			return 2;
+			return cmd_modeGroup(cmd, reply, op, hasOp);
 	}
 
 	return cmd_modeUser(cmd, reply, op, hasOp);
@@ -585,12 +673,24 @@ int cmd_modeChan(struct chat_Message *cmd, struct chat_Message *reply, char op,
     char *params[ARRAY_SIZE(cmd->params)];
 	char nickname[fig_Configuration.nickLen];
 	usr_getNickname(nickname, user);
+	char prefix[ARRAY_SIZE(reply->prefix)];
+	usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
 
 	// Default values
     params[0] = cmd->params[0];
 	params[1] = cmd->params[1];
 	params[2] = cmd->params[2];
 
+	// Anyone in the channel may see the bans
+	if(cmd_isBanListRequest(cmd) == 1){
+		channel = cmd_checkChannelPerms(reply, cmd->params[0], user, 0);
+		if(!channel)
+			return -1;
+
+		struct chan_Channel *chan = channel->data;
+		return cmd_listBans(reply, user, cmd->params[0], &chan->bans);
+	}
+
 	channel = cmd_checkChannelPerms(reply, cmd->params[0], user, 2);
 	if(!channel){
 		return -1;
@@ -609,47 +709,319 @@ int cmd_modeChan(struct chat_Message *cmd, struct chat_Message *reply, char op,
 		}
 	}
 
-	chat_createMessage(reply, NULL, nickname, "MODE", params, 3+index);
+	chat_createMessage(reply, NULL, prefix, "MODE", params, 3+index);
     chan_sendChannelMessage(reply, channel);
 	return 2;
 }
 
 // Used by cmd_mode specifically for a group
-/*
+// TODO - group modes other than bans
 int cmd_modeGroup(struct chat_Message *cmd, struct chat_Message *reply, char op, int hasOp){
     struct usr_UserData *user = cmd->user;
-	struct link_Node *group = NULL;
     char *params[ARRAY_SIZE(cmd->params)];
 	char nickname[fig_Configuration.nickLen];
 	usr_getNickname(nickname, user);
+	char prefix[ARRAY_SIZE(reply->prefix)];
+	usr_getPrefix(prefix, ARRAY_SIZE(prefix), user);
 
 	// Default values
     params[0] = cmd->params[0];
 	params[1] = cmd->params[1];
 	params[2] = cmd->params[2];
 
-	group = cmd_checkChannelPerms(reply, cmd->params[0], user, 2);
-	if(!channel){
+	struct link_Node *groupNode = grp_getGroup(cmd->params[0]);
+	if(groupNode == NULL || grp_isInGroup(groupNode, user) == -1){
+		params[1] = ":You are not in this group!";
+		chat_createMessage(reply, user, thisServer, ERR_NOTONCHANNEL, params, 2);
 		return -1;
 	}
 
-	// Set all the modes
-	for(int i = hasOp; i < (int) strlen(cmd->params[1]); i++){
-		//TODO - multiple data for multiple flags
-		char *ret = chan_executeChanMode(op, cmd->params[1][i], channel, cmd->params[2]);		
+	struct grp_Group *group = groupNode->data;
+	if(cmd_isBanListRequest(cmd) == 1)
+		return cmd_listBans(reply, user, cmd->params[0], &group->bans);
+
+	// Group operators are permLevel 1
+	if(mbr_getPermLevel(&group->members, user) < 1){
+		params[1] = ":You don't have sufficient privileges for this group!";
+		chat_createMessage(reply, user, thisServer, ERR_CHANOPRIVSNEEDED, params, 2);
+		return -1;
+	}
+
+	// Only bans are stored for now, other modes are accepted silently
+	int index = 0, changed = 0;
+	for(int i = hasOp; i < (int) strlen(cmd->params[1]) && index < 1; i++){
+		if(cmd->params[1][i] != 'b')
+			continue;
+
+		char *ret = grp_setBan(groupNode, op, cmd->params[2]);
 		if(ret != NULL){
 			params[0] = nickname;
-			params[1] = params[2]; // Problematic value
 			chat_createMessage(reply, user, thisServer, ret, params, 1);
 			return -1;
 		}
+		index++;
+		changed = 1;
 	}
 
-	chat_createMessage(reply, NULL, nickname, "MODE", params, 3);
-    chan_sendChannelMessage(reply, channel);
+	if(changed == 0)
+		return 2;
+
+	chat_createMessage(reply, NULL, prefix, "MODE", params, 3);
+	grp_sendGroupMessage(reply, groupNode);
 	return 2;
 }
-*/
+
+// Generate a RPL_HISTORY line, lines carry their msgid and time so the client can ask for older ones
+void rpl_history(unsigned long msgid, time_t time, char *line, int len, void *data){
+	struct cmd_History *history = data;
+	char str[BUFSIZ];
+
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s %s %lu %ld :%.*s", thisServer, RPL_HISTORY,
+			history->nick, history->target, msgid, (long) time, len, line);
+	com_appendBuffer(&history->batch, str);
+
+	if(history->oldest == 0 || msgid < history->oldest)
+		history->oldest = msgid;
+}
+
+// Pages backwards through a channel's messages, from memory and then from the archive
+// HISTORY <channel> [<before msgid>] [<count>] [<since unix time>]
+int cmd_history(struct chat_Message *cmd, struct chat_Message *reply){
+	struct usr_UserData *user = cmd->user;
+
+	struct link_Node *channelNode = cmd_checkChannelPerms(reply, cmd->params[0], user, 0);
+	if(channelNode == NULL)
+		return -1;
+
+	struct chan_Channel *channel = channelNode->data;
+	struct grp_Group *group = channel->group->data;
+	unsigned long before = cmd->paramCount > 1 ? strtoul(cmd->params[1], NULL, 10) : 0;
+	int max = cmd->paramCount > 2 ? atoi(cmd->params[2]) : fig_Configuration.historyReplay;
+	time_t since = cmd->paramCount > 3 ? strtol(cmd->params[3], NULL, 10) : 0;
+	if(max <= 0 || max > HIST_PAGE_MAX)
+		max = HIST_PAGE_MAX;
+
+	char nick[fig_Configuration.nickLen];
+	usr_getNickname(nick, user);
+
+	struct arch_Query *query = calloc(1, sizeof(struct arch_Query));
+	if(query != NULL)
+		query->entries = malloc(max * sizeof(struct hist_Entry));
+	if(query == NULL || query->entries == NULL){
+		log_logError("Error allocating history query", WARNING);
+		arch_freeQuery(query);
+		return -1;
+	}
+
+	strncpy(query->nick, nick, ARRAY_SIZE(query->nick) - 1);
+	strncpy(query->target, cmd->params[0], ARRAY_SIZE(query->target) - 1);
+	query->user = user;
+	query->userId = __atomic_load_n(&user->id, __ATOMIC_ACQUIRE);
+	query->group = group->name;
+	query->channel = channel->name;
+	query->beforeId = before;
+	query->since = since;
+	query->max = max;
+
+	// Whatever memory cannot cover comes from disk, the reader thread reads it
+	// With HistorySize 0 memory holds nothing and everything comes from disk
+	if(channel->history.capacity > 0)
+		query->numEntries = hist_collect(&channel->history, before, since, query->entries, max);
+	if(query->numEntries < max && fig_Configuration.useArchive && arch_query(query) == 1)
+		return 2;
+
+	// Nothing to read from disk, memory alone answers
+	query->max = query->numEntries;
+	arch_answer(query);
+	arch_freeQuery(query);
+	return 2;
+}
+
+// Only builds the query, the search thread answers it
+// SEARCH <channel or group> [<since unix time>] [<until unix time>] :<words>
+int cmd_search(struct chat_Message *cmd, struct chat_Message *reply){
+	struct usr_UserData *user = cmd->user;
+    char *params[ARRAY_SIZE(cmd->params)];
+	char *target = cmd->params[0];
+
+	struct srch_Query *query = calloc(1, sizeof(struct srch_Query));
+	if(query == NULL){
+		log_logError("Error allocating search query", WARNING);
+		return -1;
+	}
+
+	char nick[fig_Configuration.nickLen];
+	usr_getNickname(nick, user);
+	strncpy(query->nick, nick, ARRAY_SIZE(query->nick) - 1);
+	strncpy(query->words, cmd->params[cmd->paramCount - 1], ARRAY_SIZE(query->words) - 1);
+	query->user = user;
+	query->userId = __atomic_load_n(&user->id, __ATOMIC_ACQUIRE);
+	query->since = cmd->paramCount > 2 ? strtol(cmd->params[1], NULL, 10) : 0;
+	query->until = cmd->paramCount > 3 ? strtol(cmd->params[2], NULL, 10) : time(NULL);
+	query->max = SRCH_PAGE_MAX;
+
+	if(target[0] == '&' && strchr(target, '/') == NULL){
+		struct link_Node *groupNode = grp_getGroup(target);
+		if(groupNode == NULL){
+			params[0] = target;
+			chat_createMessage(reply, user, thisServer, ERR_NOSUCHGROUP, params, 1);
+			srch_freeQuery(query);
+			return -1;
+		}
+
+		// Results may only come from channels the user could read anyway
+		struct grp_Group *group = groupNode->data;
+		pthread_mutex_lock(&group->groupMutex);
+		query->channels = malloc((group->channels.size + 1) * sizeof(struct chan_Channel *));
+		for(struct link_Node *node = group->channels.head; query->channels != NULL && node != NULL; node = node->next){
+			if(chan_isInChannel(node, user) == 1)
+				query->channels[query->numChannels++] = node->data;
+		}
+		pthread_mutex_unlock(&group->groupMutex);
+	} else {
+		struct link_Node *channelNode = cmd_checkChannelPerms(reply, target, user, 0);
+		if(channelNode == NULL){
+			srch_freeQuery(query);
+			return -1;
+		}
+
+		query->channels = malloc(sizeof(struct chan_Channel *));
+		if(query->channels != NULL)
+			query->channels[query->numChannels++] = channelNode->data;
+	}
+
+	if(query->channels == NULL || srch_query(query) == -1){
+		srch_freeQuery(query);
+		params[0] = nick;
+		params[1] = "0";
+		params[2] = ":Search failed";
+		chat_createMessage(reply, user, thisServer, RPL_ENDOFSEARCH, params, 3);
+		return 1;
+	}
+
+	return 2;
+}
+
+// STATS [<query>], answers e when no query is given
+int cmd_stats(struct chat_Message *cmd, struct chat_Message *reply){
+	struct usr_UserData *user = cmd->user;
+    char *params[ARRAY_SIZE(cmd->params)];
+	char query[2] = {cmd->paramCount > 0 ? cmd->params[0][0] : 'e', '\0'};
+
+	char nick[fig_Configuration.nickLen];
+	usr_getNickname(nick, user);
+
+	struct com_Buffer *batch = com_allocBuffer(BUFSIZ);
+	if(batch == NULL){
+		log_logError("Error allocating stats reply", WARNING);
+		return -1;
+	}
+
+	// Unknown queries only get the end of the list
+	if(query[0] == 'e')
+		cmd_statsEvents(&batch, nick);
+	else if(query[0] == 't')
+		cmd_statsTrace(&batch, nick);
+	else if(query[0] == 'm')
+		cmd_statsMetrics(&batch, nick);
+
+	params[0] = nick;
+	params[1] = query;
+	params[2] = ":End of STATS report";
+	chat_createMessage(reply, user, thisServer, RPL_ENDOFSTATS, params, 3);
+	chat_appendMessage(&batch, reply);
+
+	com_sendBuffer(user, batch);
+	com_releaseBuffer(batch);
+	return 2;
+}
+
+void cmd_statsEvents(struct com_Buffer **batch, char *nick){
+	struct evt_Stats stats[EVT_MAX_EVENTS];
+	char str[BUFSIZ];
+
+	int count = evt_getStats(stats, EVT_MAX_EVENTS);
+	for(int i = 0; i < count; i++){
+		unsigned long runs = stats[i].runs > 0 ? stats[i].runs : 1;
+
+		snprintf(str, ARRAY_SIZE(str), ":%s %s %s %s %lu %lu %lu %ld %ld %ld %ld :runs overruns skipped late(avg max) runtime(avg max) in us",
+				thisServer, RPL_STATSEVENT, nick, stats[i].name, stats[i].runs, stats[i].overruns, stats[i].skipped,
+				stats[i].lateTotal / (long) runs, stats[i].lateMax, stats[i].runTotal / (long) runs, stats[i].runMax);
+		com_appendBuffer(batch, str);
+	}
+}
+
+void cmd_statsTrace(struct com_Buffer **batch, char *nick){
+	struct trc_Summary summaries[TRC_NUM_STAGES];
+	char str[BUFSIZ];
+
+	// Nothing is recorded without EnableTracing, an empty report says so
+	if(!trc_state.enabled || trc_getSummary(summaries) == -1)
+		return;
+
+	for(int i = 0; i < TRC_NUM_STAGES; i++){
+		snprintf(str, ARRAY_SIZE(str), ":%s %s %s %s %lu %lu %lu %lu %lu %lu %lu :count mean p50 p90 p99 p99.9 max in ns",
+				thisServer, RPL_STATSTRACE, nick, summaries[i].stage, summaries[i].count, summaries[i].mean,
+				summaries[i].p50, summaries[i].p90, summaries[i].p99, summaries[i].p999, summaries[i].max);
+		com_appendBuffer(batch, str);
+	}
+}
+
+void cmd_statsMetrics(struct com_Buffer **batch, char *nick){
+	char str[BUFSIZ];
+
+	struct mtr_Report *report = malloc(sizeof(struct mtr_Report));
+	if(report == NULL){
+		log_logError("Error allocating metrics report", WARNING);
+		return;
+	}
+	mtr_makeReport(report);
+
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s users %d :connected", thisServer, RPL_STATSMETRIC, nick, report->users);
+	com_appendBuffer(batch, str);
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s dataqueue %d %d :waiting running", thisServer, RPL_STATSMETRIC, nick,
+			report->dataQueue, report->dataBusy);
+	com_appendBuffer(batch, str);
+
+	uint64_t *depths = report->sendQ;
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s sendq %lu %d %lu %lu %lu %lu %lu %lu %lu %lu :queued deepest users(0 1 4 16 64 256 1024 more)",
+			thisServer, RPL_STATSMETRIC, nick, report->sendQTotal, report->sendQMax,
+			depths[0], depths[1], depths[2], depths[3], depths[4], depths[5], depths[6], depths[7]);
+	com_appendBuffer(batch, str);
+
+	uint64_t *perSecond = report->perSecond, *counters = report->counters;
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s in %lu %lu %lu %lu :messages bytes per second, messages bytes in total",
+			thisServer, RPL_STATSMETRIC, nick, perSecond[MTR_MSGS_IN], perSecond[MTR_BYTES_IN], counters[MTR_MSGS_IN], counters[MTR_BYTES_IN]);
+	com_appendBuffer(batch, str);
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s out %lu %lu %lu %lu :messages bytes per second, messages bytes in total",
+			thisServer, RPL_STATSMETRIC, nick, perSecond[MTR_MSGS_OUT], perSecond[MTR_BYTES_OUT], counters[MTR_MSGS_OUT], counters[MTR_BYTES_OUT]);
+	com_appendBuffer(batch, str);
+
+	for(int i = 0; i < report->numThreads; i++){
+		struct mtr_ThreadReport *thread = &report->threads[i];
+		snprintf(str, ARRAY_SIZE(str), ":%s %s %s thread %s %d %lu %lu %.1f :wakeups events per second, busy percent",
+				thisServer, RPL_STATSMETRIC, nick, thread->name, thread->index, thread->perSecond[MTR_WAKEUPS],
+				thread->perSecond[MTR_EVENTS], thread->perSecond[MTR_BUSY] / 1e7);
+		com_appendBuffer(batch, str);
+	}
+
+	for(int i = 0; i < report->numCommands; i++){
+		struct mtr_Command *stats = &report->commands[i].stats;
+		if(stats->count == 0)
+			continue;
+
+		snprintf(str, ARRAY_SIZE(str), ":%s %s %s command %s %lu %lu %lu :runs runtime(avg max) in us",
+				thisServer, RPL_STATSMETRIC, nick, report->commands[i].name, stats->count,
+				stats->total / stats->count / 1000, stats->max / 1000);
+		com_appendBuffer(batch, str);
+	}
+
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s memory %d %ld :retired allocations, history bytes",
+			thisServer, RPL_STATSMETRIC, nick, report->retired, report->historyBytes);
+	com_appendBuffer(batch, str);
+
+	free(report);
+}
 
 // Send back a PONG
 int cmd_ping(struct chat_Message *cmd, struct chat_Message *reply){
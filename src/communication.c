@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM LOG_COM
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -14,11 +15,19 @@
 #include "logging.h"
 #include "config.h"
 #include "chat.h"
+#include "upgrade.h"
+#include "capture.h"
+#include "metrics.h"
 
 struct com_SocketInfo serverSockAddr;
-pthread_t *threads;
-int com_serverSocket = -1, com_epollfd = -1;
+struct com_IOThread *com_ioThreads;
+int com_serverSocket = -1;
 int com_numThreads = -1;
+int com_nextThread = 0; // Round robin for new connections
+int com_paused = 0;
+int com_numPaused = 0;
+pthread_mutex_t com_pauseMutex;
+pthread_cond_t com_pauseCond;
 struct usr_UserData *serverUser;
 
 int timeOut, messageLimit;
@@ -26,8 +35,15 @@ int timeOut, messageLimit;
 extern struct chat_ServerLists serverLists;
 
 int init_server(){
-    // Initalize the server socket
-    com_serverSocket = com_startServerSocket(&fig_Configuration, &serverSockAddr, 0);
+    if(pthread_mutex_init(&com_pauseMutex, NULL) != 0 || pthread_cond_init(&com_pauseCond, NULL) != 0){
+        log_logError("Error initalizing pause lock.", ERROR);
+        return -1;
+    }
+
+    // A server that took over keeps listening on the socket it was handed
+    com_serverSocket = upg_takeListener(&serverSockAddr);
+    if(com_serverSocket < 0)
+        com_serverSocket = com_startServerSocket(&fig_Configuration, &serverSockAddr, 0);
     if(com_serverSocket < 0){
         log_logMessage("Retrying with IPv4...", INFO);
         com_serverSocket = com_startServerSocket(&fig_Configuration, &serverSockAddr, 1);
@@ -36,13 +52,6 @@ int init_server(){
         }
     }
 
-	// Create the epoll
-	com_epollfd = epoll_create1(0);
-	if(com_epollfd == -1){
-		log_logError("Error setting up epoll", FATAL);
-		return -1;
-	}
-
 	// TODO deal with random users sending data to this user
 	serverUser = usr_createUser(&serverSockAddr, fig_Configuration.serverName);
 	if(!serverUser){
@@ -50,20 +59,26 @@ int init_server(){
 		return -1;
 	}
 
-	// Setup listening socket in the epoll	
+	timeOut = fig_Configuration.timeOut;
+	messageLimit = fig_Configuration.messageLimit;
+
+    //Setup threads for listening
+    com_numThreads = com_setupIOThreads(&fig_Configuration);
+	if(com_numThreads < 0)
+		return -1;
+
+    return 1;
+}
+
+int com_listen(){
+	// Setup listening socket in the first thread's epoll
 	struct epoll_event ev;
 	ev.events = EPOLLIN|EPOLLONESHOT;
 	ev.data.ptr = serverUser;
-	if(epoll_ctl(com_epollfd, EPOLL_CTL_ADD, com_serverSocket, &ev) == -1){
+	if(epoll_ctl(com_ioThreads[0].epollfd, EPOLL_CTL_ADD, com_serverSocket, &ev) == -1){
 		log_logError("Error adding listening socket to epoll", FATAL);
 		return -1;
 	}
-    
-	timeOut = fig_Configuration.timeOut;
-	messageLimit = fig_Configuration.messageLimit;
-
-    //Setup threads for listening
-    com_numThreads = com_setupIOThreads(&fig_Configuration);
 
     return 1;
 }
@@ -73,7 +88,7 @@ void com_close(){
         close(com_serverSocket);
     }
 
-    free(threads);
+    free(com_ioThreads);
 }
 
 // Make a new job and insert it into the queue for sending
@@ -81,21 +96,128 @@ int com_sendStr(struct usr_UserData *user, char *msg){
 	if(user == NULL || user == &serverLists.users[0])
 		return -1;
 
-    struct com_QueueJob *job = calloc(1, sizeof(struct com_QueueJob));
+    struct com_QueueJob *job = calloc(1, sizeof(struct com_QueueJob) + COM_LINE_LEN);
     job->user = user;
 
-    snprintf(job->str, ARRAY_SIZE(job->str), "%s\r\n", msg);
+    snprintf(job->str, COM_LINE_LEN, "%s\r\n", msg);
     com_insertQueue(job);
 
+    return com_rearmWrite(user);
+}
+
+struct com_Buffer *com_createBuffer(char *msg){
+	int len = strlen(msg) + 2;
+
+	struct com_Buffer *buffer = malloc(sizeof(struct com_Buffer) + len + 1);
+	if(buffer == NULL){
+		log_logError("Error allocating buffer", ERROR);
+		return NULL;
+	}
+
+	buffer->refs = 1;
+	buffer->size = len + 1;
+	buffer->len = snprintf(buffer->str, len + 1, "%s\r\n", msg);
+
+	return buffer;
+}
+
+struct com_Buffer *com_allocBuffer(int size){
+	struct com_Buffer *buffer = malloc(sizeof(struct com_Buffer) + size);
+	if(buffer == NULL){
+		log_logError("Error allocating buffer", ERROR);
+		return NULL;
+	}
+
+	buffer->refs = 1;
+	buffer->size = size;
+	buffer->len = 0;
+	buffer->str[0] = '\0';
+
+	return buffer;
+}
+
+int com_appendBuffer(struct com_Buffer **buffer, char *msg){
+	struct com_Buffer *current = *buffer;
+	int len = strlen(msg) + 2;
+
+	// Double until it fits, a batch is built once and then only read
+	if(current->len + len + 1 > current->size){
+		int size = current->size * 2;
+		while(current->len + len + 1 > size)
+			size *= 2;
+
+		struct com_Buffer *grown = realloc(current, sizeof(struct com_Buffer) + size);
+		if(grown == NULL){
+			log_logError("Error growing buffer", ERROR);
+			return -1;
+		}
+
+		grown->size = size;
+		*buffer = current = grown;
+	}
+
+	current->len += snprintf(&current->str[current->len], len + 1, "%s\r\n", msg);
+	return 1;
+}
+
+void com_releaseBuffer(struct com_Buffer *buffer){
+	if(buffer != NULL && __atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(buffer);
+}
+
+void com_freeJob(struct com_QueueJob *job){
+	if(job == NULL)
+		return;
+
+	com_releaseBuffer(job->buffer);
+	free(job);
+}
+
+// Make a new job that references the buffer and insert it into the queue
+int com_sendBuffer(struct usr_UserData *user, struct com_Buffer *buffer){
+	if(com_queueBuffer(user, buffer) == -1)
+		return -1;
+
+	return com_rearmWrite(user);
+}
+
+int com_queueBuffer(struct usr_UserData *user, struct com_Buffer *buffer){
+	if(user == NULL || user == &serverLists.users[0] || buffer == NULL)
+		return -1;
+
+	// Only the header, the line itself lives in the buffer
+	struct com_QueueJob *job = calloc(1, sizeof(struct com_QueueJob));
+	if(job == NULL){
+		log_logError("Error allocating job", ERROR);
+		return -1;
+	}
+
+	job->user = user;
+	job->buffer = buffer;
+	__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+
+	if(com_insertQueue(job) < 0){
+		com_freeJob(job);
+		return -1;
+	}
+
+	return 1;
+}
+
+int com_rearmWrite(struct usr_UserData *user){
 	// Safely get user's socket
 	pthread_mutex_lock(&user->userMutex);
 	int sock = user->socketInfo.socket2;
+	int epollfd = com_ioThreads[user->socketInfo.ioThread].epollfd;
 	pthread_mutex_unlock(&user->userMutex);
 
+	if(trc_state.enabled)
+		trc_stampOnce(&user->traceArmed);
+
 	// Setup to allow for a write
 	struct epoll_event ev = {.events = EPOLLOUT|EPOLLONESHOT};
 	ev.data.ptr = user;
-	if(epoll_ctl(com_epollfd, EPOLL_CTL_MOD, sock, &ev) == -1){
+	if(epoll_ctl(epollfd, EPOLL_CTL_MOD, sock, &ev) == -1){
 		log_logError("Error rearming write socket", WARNING);
 		usr_deleteUser(user);
 		return -1;
@@ -104,6 +226,117 @@ int com_sendStr(struct usr_UserData *user, char *msg){
     return 1;
 }
 
+int com_fanOut(struct mbr_Snapshot *snapshot, struct usr_UserData *origin, struct com_Buffer *buffer){
+	for(int i = 0; i < snapshot->numParts && i < com_numThreads; i++){
+		if(snapshot->start[i] == snapshot->start[i+1])
+			continue; // No members on this thread
+
+		struct com_FanOut *fanOut = malloc(sizeof(struct com_FanOut));
+		if(fanOut == NULL){
+			log_logError("Error allocating fan out", ERROR);
+			return -1;
+		}
+
+		// The IO thread keeps both alive until it is done
+		mbr_holdSnapshot(snapshot);
+		__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+		fanOut->snapshot = snapshot;
+		fanOut->buffer = buffer;
+		fanOut->origin = origin;
+		fanOut->traceOrigin = trc_origin;
+
+		struct com_IOThread *thread = &com_ioThreads[i];
+		pthread_mutex_lock(&thread->fanOutMutex);
+		link_add(&thread->fanOut, fanOut);
+		pthread_mutex_unlock(&thread->fanOutMutex);
+
+		uint64_t one = 1;
+		if(write(thread->eventfd, &one, sizeof(one)) == -1)
+			log_logError("Error waking IO thread", WARNING);
+	}
+
+	return 1;
+}
+
+int com_runFanOut(struct com_IOThread *thread){
+	uint64_t count;
+	if(read(thread->eventfd, &count, sizeof(count)) == -1)
+		return -1;
+
+	return com_drainFanOut(thread);
+}
+
+int com_drainFanOut(struct com_IOThread *thread){
+	while(1){
+		struct com_FanOut *fanOut = NULL;
+
+		pthread_mutex_lock(&thread->fanOutMutex);
+		if(link_isEmpty(&thread->fanOut) == -1)
+			fanOut = link_removeNode(&thread->fanOut, thread->fanOut.head);
+		pthread_mutex_unlock(&thread->fanOutMutex);
+
+		if(fanOut == NULL)
+			break;
+
+		// Only members whose connection lives on this thread
+		struct mbr_Snapshot *snapshot = fanOut->snapshot;
+		trc_origin = fanOut->traceOrigin;
+		int *order = &snapshot->start[snapshot->numParts + 1];
+		for(int i = snapshot->start[thread->id]; i < snapshot->start[thread->id+1]; i++){
+			struct usr_UserData *user = MBR_MEMBER(snapshot, order[i])->user;
+			if(user != fanOut->origin)
+				com_sendBuffer(user, fanOut->buffer);
+		}
+		trc_origin = 0;
+
+		com_releaseBuffer(fanOut->buffer);
+		mbr_releaseSnapshot(snapshot);
+		free(fanOut);
+	}
+
+	return 1;
+}
+
+int com_pauseIO(){
+	pthread_mutex_lock(&com_pauseMutex);
+	__atomic_store_n(&com_paused, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&com_pauseMutex);
+
+	// Threads sleeping inside of epoll_wait only notice once woken
+	uint64_t one = 1;
+	for(int i = 0; i < com_numThreads; i++){
+		if(write(com_ioThreads[i].eventfd, &one, sizeof(one)) == -1)
+			log_logError("Error waking IO thread", WARNING);
+	}
+
+	pthread_mutex_lock(&com_pauseMutex);
+	while(com_numPaused < com_numThreads)
+		pthread_cond_wait(&com_pauseCond, &com_pauseMutex);
+	pthread_mutex_unlock(&com_pauseMutex);
+
+	return 1;
+}
+
+void com_resumeIO(){
+	pthread_mutex_lock(&com_pauseMutex);
+	__atomic_store_n(&com_paused, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&com_pauseCond);
+	pthread_mutex_unlock(&com_pauseMutex);
+}
+
+void com_waitWhilePaused(){
+	if(__atomic_load_n(&com_paused, __ATOMIC_ACQUIRE) == 0)
+		return;
+
+	pthread_mutex_lock(&com_pauseMutex);
+	com_numPaused++;
+	pthread_cond_broadcast(&com_pauseCond);
+	while(com_paused)
+		pthread_cond_wait(&com_pauseCond, &com_pauseMutex);
+	com_numPaused--;
+	pthread_mutex_unlock(&com_pauseMutex);
+}
+
 // Will remove all remaining jobs in a user's queue
 int com_cleanQueue(struct usr_UserData *user){
 	if(user == NULL)
@@ -112,7 +345,7 @@ int com_cleanQueue(struct usr_UserData *user){
 	pthread_mutex_lock(&user->userMutex); 
 
 	while(link_isEmpty(&user->sendQ) == -1){ // Keep removing items until empty
-		free(link_remove(&user->sendQ, 0));
+		com_freeJob(link_remove(&user->sendQ, 0));
 	}
 
 	pthread_mutex_unlock(&user->userMutex); 
@@ -133,6 +366,11 @@ int com_insertQueue(struct com_QueueJob *job){
         return -1; 
     }
 
+	if(trc_state.enabled){
+		job->trace.origin = trc_origin;
+		job->trace.queued = trc_now();
+	}
+
     pthread_mutex_lock(&user->userMutex);
 	struct link_Node *ret = link_add(&user->sendQ, job);
 	if(ret == NULL){
@@ -173,6 +411,7 @@ int com_readFromSocket(struct epoll_event *userEvent, int epollfd){
 		return -1;
 	}
 	int sockfd = user->socketInfo.socket;
+	uint64_t traceStart = trc_state.enabled ? trc_now() : 0;
 		
 	char buff[MAX_MESSAGE_LENGTH+1] = {0};
 	int bytes = read(sockfd, buff, ARRAY_SIZE(buff)-1);
@@ -198,8 +437,9 @@ int com_readFromSocket(struct epoll_event *userEvent, int epollfd){
 		default: ; 
 			// Check time inbetween messages (too fast == quit)
 			pthread_mutex_lock(&user->userMutex);
-			double timeDifference = difftime(time(NULL), user->lastMsg);
-			user->lastMsg = time(NULL);
+			time_t now = clk_now();
+			double timeDifference = difftime(now, user->lastMsg);
+			user->lastMsg = now;
 			user->pinged = -1; // Reset ping
 			pthread_mutex_unlock(&user->userMutex);
 
@@ -210,7 +450,9 @@ int com_readFromSocket(struct epoll_event *userEvent, int epollfd){
 			}
 
 			// Split up each line into its own job
-			int loc = 0;
+			trc_origin = traceStart;
+			mtr_count(MTR_BYTES_IN, bytes);
+			int loc = 0, lines = 0;
 			while(loc >= 0){
 				int oldLoc = loc;
 				char line[1024];
@@ -221,7 +463,12 @@ int com_readFromSocket(struct epoll_event *userEvent, int epollfd){
 					buff[loc - 1] = '\0';
 				strncpy(line, &buff[oldLoc], ARRAY_SIZE(line)-1);
 				chat_insertQueue(user, 0, line, NULL);
+				lines++;
 			}
+			mtr_count(MTR_MSGS_IN, lines);
+			trc_origin = 0;
+			if(traceStart)
+				trc_record(TRC_READ, traceStart);
 	}
 
 	return 1;
@@ -235,6 +482,12 @@ int com_writeToSocket(struct epoll_event *userEvent, int epollfd){
 		return -1;
 	}
 
+	uint64_t traceStart = 0, armed = 0;
+	if(trc_state.enabled){
+		traceStart = trc_now();
+		armed = __atomic_exchange_n(&user->traceArmed, 0, __ATOMIC_RELAXED);
+	}
+
 	// Remove the first job
 	struct com_QueueJob *job = NULL;
 	pthread_mutex_lock(&user->userMutex);
@@ -246,9 +499,24 @@ int com_writeToSocket(struct epoll_event *userEvent, int epollfd){
 	if(job == NULL)
 		return -1;
 
-	char buff[ARRAY_SIZE(job->str)];
-	strncpy(buff, job->str, ARRAY_SIZE(buff));
-	free(job);
+	// Wakeups that find the queue empty are not waits anyone had to sit through
+	struct trc_Stamps trace = job->trace;
+	if(traceStart){
+		if(armed && traceStart > armed)
+			trc_recordValue(TRC_EPOLLOUT, traceStart - armed);
+		if(trace.queued)
+			trc_recordValue(TRC_SEND_QUEUE, traceStart > trace.queued ? traceStart - trace.queued : 0);
+	}
+
+	// Buffers may hold many lines, they are written as they are
+	char *str = job->str;
+	int len;
+	if(job->buffer != NULL){
+		str = job->buffer->str;
+		len = job->buffer->len;
+	} else {
+		len = strnlen(job->str, COM_LINE_LEN);
+	}
 
 	pthread_mutex_lock(&user->userMutex);
 	int socket = user->socketInfo.socket2;
@@ -256,16 +524,32 @@ int com_writeToSocket(struct epoll_event *userEvent, int epollfd){
 		socket = -1;
 	pthread_mutex_unlock(&user->userMutex);
 
-	if(socket < 0)
+	if(socket < 0){
+		com_freeJob(job);
 		return -1;
+	}
 
-	log_logMessage(buff, MESSAGE);
-	int ret = write(user->socketInfo.socket2, buff, strlen(buff));
+	log_logMessage(str, MESSAGE);
+	if(cap_state.enabled)
+		cap_record(CAP_OUT, user - serverLists.users, user->id, str, len);
+	// A client that already went away must not take the server down with SIGPIPE
+	uint64_t sendStart = traceStart ? trc_now() : 0;
+	int ret = send(user->socketInfo.socket2, str, len, MSG_NOSIGNAL);
+	com_freeJob(job);
 	if(ret == -1){
 		log_logError("Error writing to client", ERROR);
 		usr_deleteUser(user);
 		return -1;
 	}
+	mtr_count(MTR_MSGS_OUT, 1);
+	mtr_count(MTR_BYTES_OUT, ret);
+
+	if(sendStart){
+		uint64_t now = trc_record(TRC_WRITE, sendStart);
+		if(trace.origin)
+			trc_recordValue(TRC_TOTAL, now > trace.origin ? now - trace.origin : 0);
+		trc_stampOnce(&user->traceArmed);
+	}
 	
 	// Setup to allow for another write if avaliable
 	struct epoll_event ev = {.events = EPOLLOUT|EPOLLONESHOT};
@@ -281,12 +565,17 @@ int com_writeToSocket(struct epoll_event *userEvent, int epollfd){
 
 // TODO - clean this mess of a method up
 void *com_communicateWithClients(void *param){
-    int *epollfd = param;
+	struct com_IOThread *thread = param;
+    int *epollfd = &thread->epollfd;
 	struct usr_UserData *user;
 
 	// First is options, second is storage
 	struct epoll_event events[10];
     int num;
+
+	if(trc_state.enabled)
+		trc_registerThread("io");
+	mtr_registerThread("io", thread->id);
 	
     while(1){
         num = epoll_wait(*epollfd, events, ARRAY_SIZE(events), -1); 
@@ -297,20 +586,33 @@ void *com_communicateWithClients(void *param){
 			log_logError("epoll_wait", ERROR);
 			exit(EXIT_FAILURE);
 		}
+		uint64_t busyStart = trc_now();
+		mtr_count(MTR_WAKEUPS, 1);
+		mtr_count(MTR_EVENTS, num);
 
 		for(int i = 0; i < num; i++){
+			// Events left in this batch are handled if the upgrade fails
+			com_waitWhilePaused();
+
 			user = events[i].data.ptr;
 			if(user == serverUser){
 				com_acceptClient(&serverSockAddr, *epollfd);
 				continue;
 			}
 
+			if(events[i].data.ptr == thread){ // Broadcast from a data thread
+				com_runFanOut(thread);
+				continue;
+			}
+
 			if(events[i].events & EPOLLIN){
 				com_readFromSocket(&events[i], *epollfd);
 			} else if (events[i].events & EPOLLOUT){
 				com_writeToSocket(&events[i], *epollfd);
 			} // Add disconnection/error
 		}
+		mtr_count(MTR_BUSY, trc_now() - busyStart);
+		com_waitWhilePaused();
     }
     
     return NULL;
@@ -320,15 +622,39 @@ int com_setupIOThreads(struct fig_ConfigData *config){
     char buff[BUFSIZ];
     int numThreads = config->threadsIO;
 
-	threads = calloc(numThreads, sizeof(pthread_t));
-	if(threads == NULL){
+	com_ioThreads = calloc(numThreads, sizeof(struct com_IOThread));
+	if(com_ioThreads == NULL){
 		log_logError("Error allocating space for IO threads", FATAL);
 		exit(EXIT_FAILURE);
 	}
 
     int ret = 0;
     for(int i = 0; i < numThreads; i++){
-        ret = pthread_create(&threads[i], NULL, com_communicateWithClients, &com_epollfd);
+		struct com_IOThread *thread = &com_ioThreads[i];
+		thread->id = i;
+
+		// Create the epoll
+		thread->epollfd = epoll_create1(0);
+		if(thread->epollfd == -1){
+			log_logError("Error setting up epoll", FATAL);
+			return -1;
+		}
+
+		ret = pthread_mutex_init(&thread->fanOutMutex, NULL);
+		if (ret < 0){
+			log_logError("Error initalizing pthread_mutex.", ERROR);
+			return -1;
+		}
+
+		// Level triggered, com_runFanOut resets it
+		thread->eventfd = eventfd(0, EFD_NONBLOCK);
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = thread};
+		if(thread->eventfd == -1 || epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, thread->eventfd, &ev) == -1){
+			log_logError("Error setting up eventfd", FATAL);
+			return -1;
+		}
+
+        ret = pthread_create(&thread->thread, NULL, com_communicateWithClients, thread);
         if(ret != 0){
             snprintf(buff, ARRAY_SIZE(buff), "Error with pthread_create: %d", ret);
             log_logMessage(buff, ERROR);
@@ -372,6 +698,7 @@ int com_acceptClient(struct com_SocketInfo *serverSock, int epoll_sock){
 
 	// Fill in newCli struct
 	newCli.socket = client;
+	newCli.ioThread = __atomic_fetch_add(&com_nextThread, 1, __ATOMIC_RELAXED) % com_numThreads;
 	memcpy(&newCli.addr, &cliAddr, cliAddrSize);
 	newCli.socket2 = dup(client);
 	if(newCli.socket2 == -1){
@@ -393,25 +720,35 @@ int com_acceptClient(struct com_SocketInfo *serverSock, int epoll_sock){
 			close(newCli.socket2);
 			return -1;
 		} 
-		ev.data.ptr = user;
 
-		// Add to epoll
-		if(epoll_ctl(epoll_sock, EPOLL_CTL_ADD, client, &ev) == -1){
-			log_logError("epoll_ctl accepting client", WARNING);
+		if(com_addClient(user) == -1)
 			return -1;
-		}
-
-		// Setup to allow for a write
-		ev.events = EPOLLOUT|EPOLLONESHOT;
-		if(epoll_ctl(epoll_sock, EPOLL_CTL_ADD, newCli.socket2, &ev) == -1){
-			log_logError("epoll_ctl writing to client", WARNING);
-			return -1;
-		}
 	}
 
 	return 0;
 }
 
+int com_addClient(struct usr_UserData *user){
+	struct epoll_event ev = {.data.ptr = user};
+
+	// Add to the epoll of the thread that will own it
+	// The write side goes first: once reads are enabled a reply may already try to rearm it
+	int userEpoll = com_ioThreads[user->socketInfo.ioThread].epollfd;
+	ev.events = EPOLLOUT|EPOLLONESHOT;
+	if(epoll_ctl(userEpoll, EPOLL_CTL_ADD, user->socketInfo.socket2, &ev) == -1){
+		log_logError("epoll_ctl writing to client", WARNING);
+		return -1;
+	}
+
+	ev.events = EPOLLIN|EPOLLONESHOT;
+	if(epoll_ctl(userEpoll, EPOLL_CTL_ADD, user->socketInfo.socket, &ev) == -1){
+		log_logError("epoll_ctl accepting client", WARNING);
+		return -1;
+	}
+
+	return 1;
+}
+
 int com_startServerSocket(struct fig_ConfigData* data, struct com_SocketInfo* sockAddr, int forceIPv4){
 	int sock;
 	struct addrinfo hints;
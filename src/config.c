@@ -9,20 +9,59 @@
 const char *options[] = {"port", "log", "enablelogging", "numiothreads", 
 						"numdatathreads", "numclients", "nicklength", 
 						"servername", "channelnamelength", "groupnamelength", 
-						"timeout", "messagelimit"};
+						"timeout", "messagelimit", "largechannel",
+						"historysize", "historyreplay", "historyreplayage",
+						"historymemory", "enablearchive", "archivedirectory",
+						"archivesegmentsize", "archiveretention", "enablesearch",
+						"searchmessages", "enablestate", "statefile",
+						"stateinterval", "enableupgrade", "upgradesocket",
+						"numeventthreads", "logoverflow", "loglevel",
+						"logmaxsize", "logcompress", "logretention",
+						"enablecapture", "capturefile", "capturesize",
+						"capturesample", "capturesampleusers", "enabletracing",
+						"enablemetrics", "metricssocket"};
 
 // Struct to store all config data
 struct fig_ConfigData fig_Configuration = {
 	.logDirectory = "/var/log/boundless-server",
 	.serverName = "example.boundless.chat",
 	.useFile = 0,
+	.logBlock = 0,
+	.logMaxSize = 0,
+	.logCompress = 0,
+	.logRetention = 0,
 	.port = 6667,
 	.threadsIO = 1,
 	.threadsDATA = 1,
+	.threadsEVENT = 2,
 	.clients = 20,
 	.nickLen = 10,
 	.chanNameLength = 200,
-	.groupNameLength = 200
+	.groupNameLength = 200,
+	.largeChannel = 1000,
+	.historySize = 100,
+	.historyReplay = 10,
+	.historyReplayAge = 86400,
+	.historyMemory = 65536,
+	.useArchive = 0,
+	.archiveDirectory = "/var/lib/boundless-server/archive",
+	.archiveSegmentSize = 4096,
+	.archiveRetention = 2592000,
+	.useSearch = 0,
+	.searchMessages = 1000000,
+	.useState = 0,
+	.stateFile = "/var/lib/boundless-server/state.bin",
+	.stateInterval = 300,
+	.useUpgrade = 0,
+	.upgradeSocket = "/var/lib/boundless-server/upgrade.sock",
+	.useCapture = 0,
+	.captureFile = "/var/lib/boundless-server/capture.bin",
+	.captureSize = 65536,
+	.captureSample = 1,
+	.captureSampleUsers = 0,
+	.useTracing = 0,
+	.useMetrics = 0,
+	.metricsSocket = "/var/lib/boundless-server/metrics.sock"
 };
 
 int init_config(char *dir){
@@ -87,6 +126,7 @@ void fig_parseLine(char *line, int lineNo){
 	//Execute based on the string's value (value is equal to index in option)
 	errno = 0;
 	int *val;
+	int min = 1;
 	switch (option) {
 		case 1:
 			//log
@@ -153,8 +193,213 @@ void fig_parseLine(char *line, int lineNo){
 			val = &fig_Configuration.messageLimit;
 			goto edit_int;
 
+		case 12:
+			//largeChannel
+			val = &fig_Configuration.largeChannel;
+			goto edit_int;
+
+		case 13:
+			//historySize, 0 turns history off
+			val = &fig_Configuration.historySize;
+			min = 0;
+			goto edit_int;
+
+		case 14:
+			//historyReplay
+			val = &fig_Configuration.historyReplay;
+			goto edit_int;
+
+		case 15:
+			//historyReplayAge
+			val = &fig_Configuration.historyReplayAge;
+			goto edit_int;
+
+		case 16:
+			//historyMemory
+			val = &fig_Configuration.historyMemory;
+			goto edit_int;
+
+		case 17:
+			//enable archive
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useArchive = 1;
+			} else {
+				fig_Configuration.useArchive = 0;
+			}
+			break;
+
+		case 18:
+			//archive directory
+			strncpy(fig_Configuration.archiveDirectory, words[1], ARRAY_SIZE(fig_Configuration.archiveDirectory)-1);
+			break;
+
+		case 19:
+			//archiveSegmentSize
+			val = &fig_Configuration.archiveSegmentSize;
+			goto edit_int;
+
+		case 20:
+			//archiveRetention
+			val = &fig_Configuration.archiveRetention;
+			goto edit_int;
+
+		case 21:
+			//enable search
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useSearch = 1;
+			} else {
+				fig_Configuration.useSearch = 0;
+			}
+			break;
+
+		case 22:
+			//searchMessages
+			val = &fig_Configuration.searchMessages;
+			goto edit_int;
+
+		case 23:
+			//enable state
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useState = 1;
+			} else {
+				fig_Configuration.useState = 0;
+			}
+			break;
+
+		case 24:
+			//state file
+			strncpy(fig_Configuration.stateFile, words[1], ARRAY_SIZE(fig_Configuration.stateFile)-1);
+			break;
+
+		case 25:
+			//stateInterval
+			val = &fig_Configuration.stateInterval;
+			goto edit_int;
+
+		case 26:
+			//enable upgrade
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useUpgrade = 1;
+			} else {
+				fig_Configuration.useUpgrade = 0;
+			}
+			break;
+
+		case 27:
+			//upgrade socket
+			strncpy(fig_Configuration.upgradeSocket, words[1], ARRAY_SIZE(fig_Configuration.upgradeSocket)-1);
+			break;
+
+		case 28:
+			//num event threads
+			val = &fig_Configuration.threadsEVENT;
+			goto edit_int;
+
+		case 29:
+			//log overflow
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "block", MAX_STRLEN)){
+				fig_Configuration.logBlock = 1;
+			} else if(!strncmp(words[1], "drop", MAX_STRLEN)){
+				fig_Configuration.logBlock = 0;
+			}
+			break;
+
+		case 30:
+			//log level, optionally of a single subsystem: LogLevel [<subsystem>] <level>
+			if(log_setLevel(numWords > 2 ? words[1] : NULL, words[numWords > 2 ? 2 : 1]) == -1){
+				char buff[100];
+				snprintf(buff, ARRAY_SIZE(buff), "Line %d: Unknown log level or subsystem.", lineNo);
+				log_logMessage(buff, WARNING);
+			}
+			break;
+
+		case 31:
+			//logMaxSize
+			val = &fig_Configuration.logMaxSize;
+			goto edit_int;
+
+		case 32:
+			//log compress
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.logCompress = 1;
+			} else {
+				fig_Configuration.logCompress = 0;
+			}
+			break;
+
+		case 33:
+			//logRetention
+			val = &fig_Configuration.logRetention;
+			goto edit_int;
+
+		case 34:
+			//enable capture
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useCapture = 1;
+			} else {
+				fig_Configuration.useCapture = 0;
+			}
+			break;
+
+		case 35:
+			//capture file
+			strncpy(fig_Configuration.captureFile, words[1], ARRAY_SIZE(fig_Configuration.captureFile)-1);
+			break;
+
+		case 36:
+			//captureSize
+			val = &fig_Configuration.captureSize;
+			goto edit_int;
+
+		case 37:
+			//captureSample
+			val = &fig_Configuration.captureSample;
+			goto edit_int;
+
+		case 38:
+			//sample users instead of lines
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.captureSampleUsers = 1;
+			} else {
+				fig_Configuration.captureSampleUsers = 0;
+			}
+			break;
+
+		case 39:
+			//enable tracing
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useTracing = 1;
+			} else {
+				fig_Configuration.useTracing = 0;
+			}
+			break;
+
+		case 40:
+			//enable metrics
+			fig_lowerString(words[1]);
+			if(!strncmp(words[1], "true", MAX_STRLEN)){
+				fig_Configuration.useMetrics = 1;
+			} else {
+				fig_Configuration.useMetrics = 0;
+			}
+			break;
+
+		case 41:
+			//metrics socket
+			strncpy(fig_Configuration.metricsSocket, words[1], ARRAY_SIZE(fig_Configuration.metricsSocket)-1);
+			break;
+
 		edit_int:
-			fig_editConfigInt(val, words[1], lineNo);	
+			fig_editConfigInt(val, words[1], lineNo, min);
 			break;
 
 	}
@@ -182,7 +427,7 @@ int fig_readConfig(char *path){
 }
 
 // Will edit the given config int value based on the given value and determine if is valid
-int fig_editConfigInt(int *orig, char *str, int lineNo){
+int fig_editConfigInt(int *orig, char *str, int lineNo, int min){
 	errno = 0;
 	int val = strtol(str, NULL, 10);
 	char buff[100];
@@ -193,7 +438,7 @@ int fig_editConfigInt(int *orig, char *str, int lineNo){
 		return -1;
 	}
 
-	if(val <= 0){
+	if(val < min){
 		snprintf(buff, ARRAY_SIZE(buff), "Line %d: %d is invalid, using default %d.", lineNo, val, *orig);
 		log_logError(buff, WARNING);
 		return -1;
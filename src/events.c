@@ -1,41 +1,89 @@
+#define LOG_SUBSYSTEM LOG_EVENTS
 #include "events.h"
 
-struct evt_List events;
+struct evt_Scheduler evt_scheduler;
+struct evt_Registry evt_registry;
+struct evt_Pool evt_pool;
 
-pthread_mutex_t timerMutex;
-pthread_cond_t timerCond;
+int init_events(){
+	// Due jobs would only pile up in the queue without a worker
+	if(fig_Configuration.threadsEVENT < 1){
+		log_logMessage("NumEventThreads has to be at least 1.", ERROR);
+		return -1;
+	}
 
-// TODO - fix issues with events blocking each other
+	if(evt_initScheduler(&evt_scheduler) == -1)
+		return -1;
 
-int init_events(){
-    // Initalize mutex to prevent locking issues
-    int ret = pthread_mutex_init(&events.mutex, NULL);
-    if (ret < 0){
-        log_logError("Error initalizing pthread_mutex.", ERROR);
+	if(pthread_mutex_init(&evt_registry.mutex, NULL) != 0 || pthread_mutex_init(&evt_pool.mutex, NULL) != 0){
+        log_logMessage("Error initalizing pthread_mutex.", ERROR);
         return -1;
-   	}
+	}
 
-    ret = pthread_mutex_init(&timerMutex, NULL);
-    if (ret < 0){
-        log_logError("Error initalizing pthread_mutex.", ERROR);
+	if(pthread_cond_init(&evt_pool.cond, NULL) != 0 || pthread_cond_init(&evt_pool.idleCond, NULL) != 0){
+        log_logMessage("Error initalizing pthread_cond.", ERROR);
         return -1;
-    }
+	}
 
-	ret = pthread_cond_init(&timerCond, NULL);
-    if (ret < 0){
-        log_logError("Error initalizing pthread_cond.", ERROR);
+	evt_pool.threads = calloc(fig_Configuration.threadsEVENT, sizeof(pthread_t));
+	if(evt_pool.threads == NULL){
+        log_logError("Error initalizing event threads.", ERROR);
         return -1;
-    }
-	
-	evt_userTimeout();
-	//evt_test();
+	}
+
+	for(int i = 0; i < fig_Configuration.threadsEVENT; i++){
+		if(pthread_create(&evt_pool.threads[i], NULL, evt_workerThread, NULL) != 0){
+			log_logError("Error creating event thread", ERROR);
+			return -1;
+		}
+	}
+
+	// Due right away, they run as soon as evt_executeEvents starts
+	if(evt_addEvent("ReclaimMemory", 1000, 500, EVT_NO_OVERLAP, evt_reclaimMemory) == 0)
+		return -1;
+	if(evt_addEvent("SampleMetrics", 1000, 500, EVT_NO_OVERLAP, evt_sampleMetrics) == 0)
+		return -1;
+	if(fig_Configuration.useState && evt_addEvent("SaveState", fig_Configuration.stateInterval * 1000L, 5000, EVT_NO_OVERLAP, evt_saveState) == 0)
+		return -1;
+	//evt_addEvent("Test", 5000, 100, 0, evt_test);
 
 	return 1;
 }
 
 void events_close(){
-	// TODO destroy MUTEXES and COND
-	return; // Clear out events.list
+	// The main thread runs the events, it stops with the process
+	return;
+}
+
+int evt_initScheduler(struct evt_Scheduler *sched){
+	memset(sched, 0, sizeof(struct evt_Scheduler));
+	sched->freeSlot = -1;
+
+    int ret = pthread_mutex_init(&sched->mutex, NULL);
+    if (ret != 0){
+        log_logMessage("Error initalizing pthread_mutex.", ERROR);
+        return -1;
+   	}
+
+	// Deadlines are on CLOCK_MONOTONIC, so waiting has to be as well
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	ret = pthread_cond_init(&sched->cond, &attr);
+	pthread_condattr_destroy(&attr);
+    if (ret != 0){
+        log_logMessage("Error initalizing pthread_cond.", ERROR);
+        return -1;
+    }
+
+	return 1;
+}
+
+void evt_closeScheduler(struct evt_Scheduler *sched){
+	free(sched->timers);
+	free(sched->heap);
+	pthread_mutex_destroy(&sched->mutex);
+	pthread_cond_destroy(&sched->cond);
 }
 
 // Compares two timespec values and returns true if second is earlier
@@ -43,139 +91,477 @@ int evt_compareTimes(struct timespec *first, struct timespec *second){
 	// Check seconds first, because they are bigger
 	if(first->tv_sec == second->tv_sec)
 		return first->tv_nsec > second->tv_nsec;
-	
+
 	return first->tv_sec > second->tv_sec;
 }
 
-int evt_addEvent(struct timespec *execTime, int (*func)()){
-	if(func == NULL)
+void evt_addMs(struct timespec *time, long ms){
+	time->tv_sec += ms / 1000;
+	time->tv_nsec += (ms % 1000) * 1000000;
+	if(time->tv_nsec >= 1000000000){
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+long evt_diffUs(struct timespec *first, struct timespec *second){
+	return (second->tv_sec - first->tv_sec) * 1000000L + (second->tv_nsec - first->tv_nsec) / 1000;
+}
+
+uint64_t evt_addTimer(struct evt_Scheduler *sched, long delay, long interval, int flags, int (*func)(void *data), void *data){
+	return evt_scheduleTimer(sched, delay, interval, flags, func, data, NULL);
+}
+
+uint64_t evt_scheduleTimer(struct evt_Scheduler *sched, long delay, long interval, int flags,
+		int (*func)(void *data), void *data, struct evt_Stats *stats){
+	if(func == NULL || delay < 0 || interval < 0)
+		return 0;
+
+	pthread_mutex_lock(&sched->mutex);
+	int slot = evt_allocTimer(sched);
+	if(slot == -1){
+		pthread_mutex_unlock(&sched->mutex);
+		return 0;
+	}
+
+	struct evt_Timer *timer = &sched->timers[slot];
+	clock_gettime(CLOCK_MONOTONIC, &timer->execTime);
+	evt_addMs(&timer->execTime, delay);
+	timer->interval = interval;
+	timer->func = func;
+	timer->data = data;
+	timer->stats = stats;
+	timer->flags = flags;
+
+	evt_heapPush(sched, slot);
+	uint64_t handle = ((uint64_t) timer->generation << 32) | (uint32_t) (slot + 1);
+
+	if(timer->heapPos == 0)
+		evt_notify(sched);
+	pthread_mutex_unlock(&sched->mutex);
+
+	return handle;
+}
+
+uint64_t evt_addEvent(char *name, long interval, long maxRuntime, int flags, int (*func)(void *data)){
+	pthread_mutex_lock(&evt_registry.mutex);
+	if(evt_registry.count == EVT_MAX_EVENTS){
+		pthread_mutex_unlock(&evt_registry.mutex);
+		log_logMessage("Too many events, raise EVT_MAX_EVENTS.", ERROR);
+		return 0;
+	}
+
+	struct evt_Stats *stats = &evt_registry.events[evt_registry.count++];
+	strncpy(stats->name, name, ARRAY_SIZE(stats->name) - 1);
+	stats->maxRuntime = maxRuntime;
+	pthread_mutex_unlock(&evt_registry.mutex);
+
+	return evt_scheduleTimer(&evt_scheduler, 0, interval, flags, func, NULL, stats);
+}
+
+int evt_getStats(struct evt_Stats *stats, int max){
+	pthread_mutex_lock(&evt_registry.mutex);
+	int count = evt_registry.count < max ? evt_registry.count : max;
+	memcpy(stats, evt_registry.events, count * sizeof(struct evt_Stats));
+	pthread_mutex_unlock(&evt_registry.mutex);
+
+	return count;
+}
+
+int evt_cancelTimer(struct evt_Scheduler *sched, uint64_t handle){
+	pthread_mutex_lock(&sched->mutex);
+	int slot = evt_findTimer(sched, handle);
+	if(slot == -1){
+		pthread_mutex_unlock(&sched->mutex);
 		return -1;
+	}
 
-	// Create the item struct
-	struct evt_Item *item = calloc(1, sizeof(struct evt_Item));
-    if(item == NULL){
-        log_logError("Error allocating event", DEBUG);
+	struct evt_Timer *timer = &sched->timers[slot];
+	if(timer->state == EVT_WAITING){
+		int wasFirst = timer->heapPos == 0;
+		evt_heapRemove(sched, timer->heapPos);
+		evt_freeTimer(sched, slot);
+		if(wasFirst)
+			evt_notify(sched);
+	} else { // Running, whoever runs it frees it
+		timer->state = EVT_CANCELLED;
+	}
+	pthread_mutex_unlock(&sched->mutex);
+
+	return 1;
+}
+
+int evt_moveTimer(struct evt_Scheduler *sched, uint64_t handle, long delay){
+	if(delay < 0)
 		return -1;
-    }
 
-	item->func = func;
-	if(execTime == NULL){
-		clock_gettime(CLOCK_REALTIME, &item->execTime);
+	pthread_mutex_lock(&sched->mutex);
+	int slot = evt_findTimer(sched, handle);
+	if(slot == -1){
+		pthread_mutex_unlock(&sched->mutex);
+		return -1;
+	}
+
+	struct evt_Timer *timer = &sched->timers[slot];
+	clock_gettime(CLOCK_MONOTONIC, &timer->execTime);
+	evt_addMs(&timer->execTime, delay);
+
+	if(timer->state == EVT_WAITING){
+		// Only one of them does anything
+		int wasFirst = timer->heapPos == 0;
+		evt_heapUp(sched, timer->heapPos);
+		evt_heapDown(sched, timer->heapPos);
+		if(wasFirst || timer->heapPos == 0)
+			evt_notify(sched);
 	} else {
-		memcpy(&item->execTime, execTime, sizeof(struct timespec));
-	}
-
-	// Insert it so that the order of events is correct (earliest -> latest)
-	pthread_mutex_lock(&events.mutex);
-	struct link_Node *node;
-	int pos = 0;
-	for(node = events.list.head; node != NULL; node = node->next){
-		struct evt_Item *nodeItem = node->data;
-		
-		// Earlier than current one = insert before
-		if(evt_compareTimes(&nodeItem->execTime, &item->execTime) == 1)
+		timer->state = EVT_MOVED;
+	}
+	pthread_mutex_unlock(&sched->mutex);
+
+	return 1;
+}
+
+int evt_findTimer(struct evt_Scheduler *sched, uint64_t handle){
+	int slot = (int) (handle & 0xFFFFFFFF) - 1;
+	if(slot < 0 || slot >= sched->numTimers)
+		return -1;
+
+	struct evt_Timer *timer = &sched->timers[slot];
+	if(timer->generation != (uint32_t) (handle >> 32))
+		return -1;
+	if(timer->state == EVT_FREE || timer->state == EVT_CANCELLED)
+		return -1;
+
+	return slot;
+}
+
+int evt_allocTimer(struct evt_Scheduler *sched){
+	int slot = sched->freeSlot;
+	if(slot != -1){
+		sched->freeSlot = sched->timers[slot].nextFree;
+		return slot;
+	}
+
+	if(sched->numTimers == sched->maxTimers){
+		int size = sched->maxTimers == 0 ? EVT_MIN_TIMERS : sched->maxTimers * 2;
+
+		// Grown one after another, a failure leaves the old (still big enough) array
+		struct evt_Timer *timers = realloc(sched->timers, size * sizeof(struct evt_Timer));
+		if(timers == NULL){
+			log_logError("Error allocating timers", DEBUG);
+			return -1;
+		}
+		sched->timers = timers;
+
+		int *heap = realloc(sched->heap, size * sizeof(int));
+		if(heap == NULL){
+			log_logError("Error allocating timers", DEBUG);
+			return -1;
+		}
+		sched->heap = heap;
+		sched->maxTimers = size;
+	}
+
+	slot = sched->numTimers++;
+	memset(&sched->timers[slot], 0, sizeof(struct evt_Timer));
+	return slot;
+}
+
+void evt_freeTimer(struct evt_Scheduler *sched, int slot){
+	struct evt_Timer *timer = &sched->timers[slot];
+	timer->state = EVT_FREE;
+	timer->generation++;
+	timer->func = NULL;
+	timer->data = NULL;
+	timer->nextFree = sched->freeSlot;
+	sched->freeSlot = slot;
+}
+
+void evt_heapSwap(struct evt_Scheduler *sched, int first, int second){
+	int slot = sched->heap[first];
+	sched->heap[first] = sched->heap[second];
+	sched->heap[second] = slot;
+
+	sched->timers[sched->heap[first]].heapPos = first;
+	sched->timers[sched->heap[second]].heapPos = second;
+}
+
+void evt_heapUp(struct evt_Scheduler *sched, int pos){
+	while(pos > 0){
+		int parent = (pos - 1) / 2;
+		if(!evt_compareTimes(&sched->timers[sched->heap[parent]].execTime, &sched->timers[sched->heap[pos]].execTime))
 			break;
 
-		pos++;
+		evt_heapSwap(sched, parent, pos);
+		pos = parent;
 	}
+}
 
-	if(link_insert(&events.list, item, pos) == NULL)
-		log_logMessage("Error adding event.", WARNING);
-	pthread_mutex_unlock(&events.mutex);
+void evt_heapDown(struct evt_Scheduler *sched, int pos){
+	while(1){
+		int earliest = pos;
+		int child = pos * 2 + 1;
 
-	pthread_cond_signal(&timerCond);
+		for(int i = child; i < child + 2 && i < sched->heapSize; i++){
+			if(evt_compareTimes(&sched->timers[sched->heap[earliest]].execTime, &sched->timers[sched->heap[i]].execTime))
+				earliest = i;
+		}
 
-	return 1;
+		if(earliest == pos)
+			break;
+
+		evt_heapSwap(sched, pos, earliest);
+		pos = earliest;
+	}
 }
 
-// Runs the next event, if any, from the queue
-int evt_runNextEvent(){
-	struct link_Node *node;
-	struct evt_Item *item;
+void evt_heapPush(struct evt_Scheduler *sched, int slot){
+	int pos = sched->heapSize++;
+	sched->heap[pos] = slot;
+	sched->timers[slot].heapPos = pos;
+	sched->timers[slot].state = EVT_WAITING;
+	evt_heapUp(sched, pos);
+}
 
-	// Get first event in list
-	pthread_mutex_lock(&events.mutex);
-	node = events.list.head;
+void evt_heapRemove(struct evt_Scheduler *sched, int pos){
+	int last = --sched->heapSize;
+	if(pos != last){
+		evt_heapSwap(sched, pos, last);
 
-	if(node != NULL)
-		item = link_remove(&events.list, 0);
-	pthread_mutex_unlock(&events.mutex);
-	
-	if(item == NULL)
-		return -1;
+		// The one that took its place can be earlier or later, only one of them does anything
+		evt_heapUp(sched, pos);
+		evt_heapDown(sched, pos);
+	}
+}
+
+void evt_notify(struct evt_Scheduler *sched){
+	pthread_cond_signal(&sched->cond);
+}
 
+int evt_advanceTimer(struct evt_Timer *timer, struct timespec *now){
+	// Keep the pace, but skip the runs that were missed instead of catching up on them
+	int skipped = -1;
+	do {
+		evt_addMs(&timer->execTime, timer->interval);
+		skipped++;
+	} while(!evt_compareTimes(&timer->execTime, now));
+
+	return skipped;
+}
+
+int evt_takeNextEvent(struct evt_Scheduler *sched, struct evt_Job *job){
 	struct timespec currentTime;
-	clock_gettime(CLOCK_REALTIME, &currentTime);
-	if(currentTime.tv_sec >= item->execTime.tv_sec){ // Should be executed
-		int ret = item->func();
-		free(item);
-		return ret;
+	clock_gettime(CLOCK_MONOTONIC, &currentTime);
+
+	pthread_mutex_lock(&sched->mutex);
+	if(sched->heapSize == 0 || evt_compareTimes(&sched->timers[sched->heap[0]].execTime, &currentTime) == 1){
+		pthread_mutex_unlock(&sched->mutex);
+		return -1;
+	}
+
+	int slot = sched->heap[0];
+	struct evt_Timer *timer = &sched->timers[slot];
+	job->sched = sched;
+	job->slot = slot;
+	job->func = timer->func;
+	job->data = timer->data;
+	job->stats = timer->stats;
+	job->execTime = timer->execTime;
+	job->skipped = 0;
+
+	if(timer->interval > 0 && !(timer->flags & EVT_NO_OVERLAP)){
+		// Already waits for its next run, nothing is left to do once this one returns
+		job->skipped = evt_advanceTimer(timer, &currentTime);
+		evt_heapDown(sched, 0);
+		job->slot = -1;
+	} else {
+		evt_heapRemove(sched, 0);
+		timer->state = EVT_RUNNING;
 	}
+	pthread_mutex_unlock(&sched->mutex);
 
-	// Put unused item back
-	pthread_mutex_lock(&events.mutex);
-	if(link_add(&events.list, item) == NULL)
-		log_logMessage("Error adding event.", WARNING);
-	pthread_mutex_unlock(&events.mutex);
+	return 1;
+}
+
+void evt_runJob(struct evt_Job *job){
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	job->func(job->data);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->skipped += evt_finishJob(job);
 
-	return -1;
+	if(job->stats != NULL)
+		evt_recordRun(job, evt_diffUs(&job->execTime, &start), evt_diffUs(&start, &end));
 }
 
-void evt_waitUntilNextEvent(){
-	struct timespec execTime;
+int evt_finishJob(struct evt_Job *job){
+	struct evt_Scheduler *sched = job->sched;
+	int skipped = 0;
+	if(job->slot == -1)
+		return 0;
+
+	pthread_mutex_lock(&sched->mutex);
+	struct evt_Timer *timer = &sched->timers[job->slot]; // The array may have grown meanwhile
+
+	if(timer->state == EVT_RUNNING && timer->interval > 0){
+		struct timespec currentTime;
+		clock_gettime(CLOCK_MONOTONIC, &currentTime);
+		skipped = evt_advanceTimer(timer, &currentTime);
+		evt_heapPush(sched, job->slot);
+	} else if(timer->state == EVT_MOVED){
+		evt_heapPush(sched, job->slot);
+	} else {
+		evt_freeTimer(sched, job->slot);
+	}
+
+	if(timer->state == EVT_WAITING && timer->heapPos == 0)
+		evt_notify(sched);
+	pthread_mutex_unlock(&sched->mutex);
+
+	return skipped;
+}
 
-	// Grab the time from the list
-	pthread_mutex_lock(&events.mutex);
-	struct link_Node *itemNode = events.list.head;
-	if(itemNode != NULL)
-		execTime = ((struct evt_Item *) itemNode->data)->execTime;
-	pthread_mutex_unlock(&events.mutex);
+void evt_recordRun(struct evt_Job *job, long late, long runtime){
+	struct evt_Stats *stats = job->stats;
+	char buff[200];
+	int overrun = runtime > stats->maxRuntime * 1000;
+
+	pthread_mutex_lock(&evt_registry.mutex);
+	stats->runs++;
+	stats->skipped += job->skipped;
+	stats->lateTotal += late;
+	stats->runTotal += runtime;
+	if(late > stats->lateMax)
+		stats->lateMax = late;
+	if(runtime > stats->runMax)
+		stats->runMax = runtime;
+	if(overrun)
+		stats->overruns++;
+	pthread_mutex_unlock(&evt_registry.mutex);
+
+	if(overrun){
+		snprintf(buff, ARRAY_SIZE(buff), "Event %s ran for %ld ms, longer than its %ld ms.", stats->name, runtime / 1000, stats->maxRuntime);
+		log_logMessage(buff, WARNING);
+	}
+}
 
-		
-	pthread_mutex_lock(&timerMutex);
+void evt_waitUntilNextEvent(struct evt_Scheduler *sched){
+	pthread_mutex_lock(&sched->mutex);
 
 	int ret;
-	if(itemNode == NULL){ // Wait indefinetly
-		ret = pthread_cond_wait(&timerCond, &timerMutex);
+	if(sched->heapSize == 0){ // Wait indefinetly
+		ret = pthread_cond_wait(&sched->cond, &sched->mutex);
 	} else {
-		ret = pthread_cond_timedwait(&timerCond, &timerMutex, &execTime);
+		struct timespec execTime = sched->timers[sched->heap[0]].execTime;
+		ret = pthread_cond_timedwait(&sched->cond, &sched->mutex, &execTime);
 	}
 
 	if(ret != 0 && ret != ETIMEDOUT)
-		log_logError("pthread_cond_wait", ERROR);
+		log_logMessage("Error waiting for the next event.", ERROR);
 
-	pthread_mutex_unlock(&timerMutex);
+	pthread_mutex_unlock(&sched->mutex);
 }
 
 // Will dedicate a thread to executing events at the correct times
 int evt_executeEvents(){
+	struct evt_Job job;
+
 	while(1){
-		evt_waitUntilNextEvent();
-		evt_runNextEvent();
+		evt_waitUntilNextEvent(&evt_scheduler);
+
+		while(evt_takeNextEvent(&evt_scheduler, &job) == 1){
+			if(evt_dispatchJob(&job) == 1)
+				continue;
+
+			// Late is still better than never, but not while an upgrade holds the pool
+			if(__atomic_load_n(&evt_pool.paused, __ATOMIC_ACQUIRE) == 0)
+				evt_runJob(&job);
+			else
+				evt_finishJob(&job);
+		}
 	}
 
 	return 1;
 }
 
+int evt_dispatchJob(struct evt_Job *job){
+	struct evt_Job *queued = malloc(sizeof(struct evt_Job));
+	if(queued == NULL){
+		log_logError("Error allocating event job", WARNING);
+		return -1;
+	}
+	memcpy(queued, job, sizeof(struct evt_Job));
+
+	pthread_mutex_lock(&evt_pool.mutex);
+	if(link_add(&evt_pool.queue, queued) == NULL){
+		pthread_mutex_unlock(&evt_pool.mutex);
+		free(queued);
+		return -1;
+	}
+	pthread_cond_signal(&evt_pool.cond);
+	pthread_mutex_unlock(&evt_pool.mutex);
+
+	return 1;
+}
+
+void *evt_workerThread(UNUSED(void *param)){
+	while(1){
+		pthread_mutex_lock(&evt_pool.mutex);
+		while(evt_pool.paused || link_isEmpty(&evt_pool.queue) == 1)
+			pthread_cond_wait(&evt_pool.cond, &evt_pool.mutex);
+
+		struct evt_Job *job = link_remove(&evt_pool.queue, 0);
+		evt_pool.busy++;
+		pthread_mutex_unlock(&evt_pool.mutex);
+
+		if(job != NULL)
+			evt_runJob(job);
+		free(job);
+
+		pthread_mutex_lock(&evt_pool.mutex);
+		evt_pool.busy--;
+		pthread_cond_broadcast(&evt_pool.idleCond);
+		pthread_mutex_unlock(&evt_pool.mutex);
+	}
+
+	return NULL;
+}
+
+void evt_pausePool(){
+	pthread_mutex_lock(&evt_pool.mutex);
+	__atomic_store_n(&evt_pool.paused, 1, __ATOMIC_RELEASE);
+	while(evt_pool.busy > 0)
+		pthread_cond_wait(&evt_pool.idleCond, &evt_pool.mutex);
+	pthread_mutex_unlock(&evt_pool.mutex);
+}
+
+void evt_resumePool(){
+	pthread_mutex_lock(&evt_pool.mutex);
+	__atomic_store_n(&evt_pool.paused, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&evt_pool.cond);
+	pthread_mutex_unlock(&evt_pool.mutex);
+}
+
 /* Start of EVENTS */
 // Will print "test" every 5 seconds
-int evt_test(){
+int evt_test(UNUSED(void *data)){
 	log_logMessage("Test event.", EVENT);
-	
-	struct timespec execTime;
-	clock_gettime(CLOCK_REALTIME, &execTime);
-	execTime.tv_sec += 5;
-	evt_addEvent(&execTime, &evt_test);
-
 	return 1;
 }
 
-// Searches for and kicks users that surpassed their message timeouts
-int evt_userTimeout(){
-	struct timespec execTime;
-	clock_gettime(CLOCK_REALTIME, &execTime);
-	execTime.tv_sec += 1;
-	evt_addEvent(&execTime, &evt_userTimeout);
+// Frees memory retired by lock free writers once readers are done with it
+int evt_reclaimMemory(UNUSED(void *data)){
+	return rcl_collect();
+}
+
+// Turns the per thread counters into the rates STATS m reports
+int evt_sampleMetrics(UNUSED(void *data)){
+	return mtr_sample();
+}
 
-	return usr_timeOutUsers(fig_Configuration.timeOut);
+// Saves groups and channels so a restart can bring them back
+int evt_saveState(UNUSED(void *data)){
+	return snap_save();
 }
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM LOG_CHAN
 #include "group.h"
 
 const char grp_groupModes[] = {'o', 's', 'i', 'b', 'm', 'k'};
@@ -32,23 +33,42 @@ struct link_Node *grp_createGroup(char *name, struct usr_UserData *user){
 
 	strncpy(group->name, name, fig_Configuration.groupNameLength-1);
 
-	group->max = 100;
-	group->users = calloc(group->max, sizeof(struct grp_GroupUser));
-	if(group->users == NULL){
-        log_logError("Error creating group", ERROR);
+	if(mbr_init(&group->members) == -1){
 		free(group->name);
 		free(group);
         return NULL;
 	}
 
-	// Add to main list
+	if(hash_init(&group->channelIndex, 16) == -1){
+		free(group->name);
+		mbr_free(&group->members);
+		free(group);
+        return NULL;
+	}
+
+	if(ban_init(&group->bans) == -1){
+		hash_free(&group->channelIndex);
+		free(group->name);
+		mbr_free(&group->members);
+		free(group);
+        return NULL;
+	}
+
+	// Add to main list, the index decides if the name is still free
     pthread_mutex_lock(&serverLists.groupsMutex);
-    struct link_Node *node = link_add(&serverLists.groups, group);
+    struct link_Node *node = NULL;
+	if(hash_get(&serverLists.groupIndex, group->name) == NULL){
+		node = link_add(&serverLists.groups, group);
+		if(node != NULL)
+			hash_put(&serverLists.groupIndex, group->name, node);
+	}
     pthread_mutex_unlock(&serverLists.groupsMutex);
 
 	if(node == NULL){
+		hash_free(&group->channelIndex);
+		ban_free(&group->bans);
 		free(group->name);
-		free(group->users);
+		mbr_free(&group->members);
 		free(group);
         return NULL;
 	}
@@ -63,33 +83,14 @@ struct link_Node *grp_createGroup(char *name, struct usr_UserData *user){
 }
 
 struct link_Node *grp_getGroup(char *name){
-	struct link_Node *node;
-	struct grp_Group *group;
-
 	if(name[0] == '\0') // Null defaults to default group
 		return serverLists.groups.head;
 
 	if(name[0] != '&')
 		return NULL;
 
-	pthread_mutex_lock(&serverLists.groupsMutex);
-	
-	for(node = serverLists.groups.head; node != NULL; node = node->next){
-		group = node->data;
-		pthread_mutex_lock(&group->groupMutex);
-
-		if(!strncmp(group->name, name, fig_Configuration.groupNameLength)){
-			pthread_mutex_unlock(&serverLists.groupsMutex);
-			pthread_mutex_unlock(&group->groupMutex);
-			return node;
-		}
-
-		pthread_mutex_unlock(&group->groupMutex);
-	}
-
-	pthread_mutex_unlock(&serverLists.groupsMutex);
-
-	return NULL;
+	// Names never change, so the index can be read without any locks
+	return hash_get(&serverLists.groupIndex, name);
 }
 
 // Returns group's name safely
@@ -109,50 +110,32 @@ int grp_getName(struct link_Node *groupNode, char *buff, int size){
 // TODO -auto join channels
 // TODO - send names message
 // TODO check for key access
-struct grp_GroupUser *grp_addUser(struct link_Node *groupNode, struct usr_UserData *user, int permLevel){
-	struct grp_Group *group = groupNode->data;
-	struct grp_GroupUser *grpUser = NULL;
-
-	if(group == NULL)
-		return NULL;
+int grp_addUser(struct link_Node *groupNode, struct usr_UserData *user, int permLevel){
+	if(groupNode == NULL || groupNode->data == NULL || user == NULL)
+		return -1;
 
-	// Already in group
-	grpUser = grp_isInGroup(groupNode, user);
-	if(grpUser != NULL)
-		return grpUser;
+	struct grp_Group *group = groupNode->data;
+	int ret = 1;
 
 	pthread_mutex_lock(&group->groupMutex);
-	for(int i = 0; i < group->max; i++){
-		if(group->users[i].user == NULL){
-			group->users[i].user = user;
-			group->users[i].permLevel = permLevel;
-			grpUser = &group->users[i];
-			break;
-		}
+	if(mbr_find(group->members.current, user) == -1){ // Not in the group yet
+		// Checked under the mutex +b is set under, a join never slips past a new ban
+		if(permLevel < 1 && ban_isBanned(&group->bans, user) == 1)
+			ret = -2;
+		else
+			ret = mbr_add(&group->members, user, permLevel);
 	}
 	pthread_mutex_unlock(&group->groupMutex);
 
-	return grpUser;
+	return ret;
 }
 
-struct grp_GroupUser *grp_isInGroup(struct link_Node *groupNode, struct usr_UserData *user){
-	struct grp_Group *group = groupNode->data;
-	struct grp_GroupUser *grpUser = NULL;
-
-	if(group == NULL)
-		return NULL;
+int grp_isInGroup(struct link_Node *groupNode, struct usr_UserData *user){
+	if(groupNode == NULL || groupNode->data == NULL)
+		return -1;
 
-	// Go thru each user and check
-	pthread_mutex_lock(&group->groupMutex);
-	for(int i = 0; i < group->max; i++){
-		if(group->users[i].user == user){
-			grpUser = &group->users[i];
-			break;
-		}
-	}
-	pthread_mutex_unlock(&group->groupMutex);
-	
-	return grpUser;
+	struct grp_Group *group = groupNode->data;
+	return mbr_getPermLevel(&group->members, user) == -1 ? -1 : 1;
 }
 
 struct link_Node *grp_addChannel(struct link_Node *groupNode, struct chan_Channel *chan){
@@ -160,39 +143,25 @@ struct link_Node *grp_addChannel(struct link_Node *groupNode, struct chan_Channe
 		return NULL;
 		
 	struct grp_Group *group = groupNode->data;
+	struct link_Node *chanNode = NULL;
 
 	pthread_mutex_lock(&group->groupMutex);
-	struct link_Node *chanNode = link_add(&group->channels, chan);
+	if(hash_get(&group->channelIndex, chan->name) == NULL){
+		chanNode = link_add(&group->channels, chan);
+		if(chanNode != NULL)
+			hash_put(&group->channelIndex, chan->name, chanNode);
+	}
 	pthread_mutex_unlock(&group->groupMutex);
 
 	return chanNode;
 }
 
 struct link_Node *grp_getChannel(struct link_Node *groupNode, char *name){
-	struct grp_Group *group = groupNode->data;
-	if(group == NULL)
+	if(groupNode == NULL || groupNode->data == NULL)
 		return NULL;
 
-	struct link_Node *node;
-	struct chan_Channel *channel;
-	pthread_mutex_lock(&group->groupMutex);
-	
-	for(node = group->channels.head; node != NULL; node = node->next){
-		channel = node->data;
-		pthread_mutex_lock(&channel->channelMutex);
-
-		if(!strncmp(channel->name, name, fig_Configuration.chanNameLength)){
-			pthread_mutex_unlock(&group->groupMutex);
-			pthread_mutex_unlock(&channel->channelMutex);
-			return node;
-		}
-
-		pthread_mutex_unlock(&channel->channelMutex);
-	}
-
-	pthread_mutex_unlock(&group->groupMutex);
-
-	return NULL;
+	struct grp_Group *group = groupNode->data;
+	return hash_get(&group->channelIndex, name);
 }
 
 int grp_isGroupMode(char mode){
@@ -205,56 +174,70 @@ int grp_isGroupMode(char mode){
 	return -1;
 }
 
-// Fills string with names of users in the group
-int grp_getUsersInGroup(struct link_Node *groupNode, char *buff, int size){
-    struct grp_Group *group = groupNode->data;
-    char nickname[fig_Configuration.nickLen];
-    int pos = 1;
-
-    buff[0] = ':';
-    pthread_mutex_lock(&group->groupMutex);
-	for(int i = 0; i < group->max; i++){
-		if(group->users[i].user != NULL){
-			switch(group->users[i].permLevel) {
-				case 1: // Group operator
-					strncat(buff, "^", size - pos - 1);
-					pos++;
-					break;
-			}
+// Adds or removes a ban mask
+char *grp_setBan(struct link_Node *groupNode, char op, char *mask){
+	if(groupNode == NULL || groupNode->data == NULL)
+		return ERR_UNKNOWNERROR;
 
-			usr_getNickname(nickname, group->users[i].user);
-			strncat(buff, nickname, size - pos - 1);
-			pos = strlen(buff);
+	struct grp_Group *group = groupNode->data;
+	char normal[MAX_MESSAGE_LENGTH];
+	if(mask == NULL || ban_normalizeMask(mask, normal, ARRAY_SIZE(normal)) == -1)
+		return ERR_NEEDMOREPARAMS;
 
-			// Space inbetween users
-			buff[pos] = ' ';
-			buff[pos + 1] = '\0';
-			pos++;
-		}
-    }
-    pthread_mutex_unlock(&group->groupMutex);
+	pthread_mutex_lock(&group->groupMutex);
+	if(op == '+')
+		ban_add(&group->bans, normal);
+	else
+		ban_remove(&group->bans, normal);
+	pthread_mutex_unlock(&group->groupMutex);
 
-    return 1;
+	return NULL;
+}
+
+int grp_isBanned(struct link_Node *groupNode, struct usr_UserData *user){
+	if(groupNode == NULL || groupNode->data == NULL || user == NULL)
+		return -1;
+
+	struct grp_Group *group = groupNode->data;
+	return ban_isBanned(&group->bans, user);
 }
 
+// Groupops are shown as ^nick
+struct mbr_Names *grp_getNames(struct link_Node *groupNode, int lineLen){
+	if(groupNode == NULL || groupNode->data == NULL)
+		return NULL;
+
+    struct grp_Group *group = groupNode->data;
+	return mbr_getNames(&group->members, " ^", lineLen);
+}
+
+// Works on a snapshot of the members so the group is never locked
 int grp_sendGroupMessage(struct chat_Message *cmd, struct link_Node *groupNode){
 	struct usr_UserData *origin = cmd->user;
     struct grp_Group *group = groupNode->data;
 
-    pthread_mutex_lock(&group->groupMutex);
-	for(int i = 0; i < group->max; i++){
-        cmd->user = group->users[i].user;
-		
-		// Dont send to sender or invalid users
-		if(cmd->user == origin || cmd->user == NULL){
-			continue;
-		}
+	// Every member shares the same line
+    char str[BUFSIZ];
+    chat_messageToString(cmd, str, ARRAY_SIZE(str));
+	struct com_Buffer *buffer = com_createBuffer(str);
+	if(buffer == NULL)
+		return -1;
 
-        chat_sendMessage(cmd);
-    }
-    pthread_mutex_unlock(&group->groupMutex);
+	struct mbr_Snapshot *snapshot = mbr_acquire(&group->members);
+	if(mbr_partition(snapshot) != NULL){ // Large: each IO thread delivers to its own members
+		com_fanOut(snapshot, origin, buffer);
+	} else {
+		for(int i = 0; i < snapshot->count; i++){
+			// Dont send to sender
+			if(MBR_MEMBER(snapshot, i)->user == origin){
+				continue;
+			}
 
-	cmd->user = origin;
+			com_sendBuffer(MBR_MEMBER(snapshot, i)->user, buffer);
+		}
+	}
+	mbr_release();
 
+	com_releaseBuffer(buffer);
     return 1;
 }
@@ -0,0 +1,182 @@
+#include "hashtable.h"
+
+struct hash_Buckets *hash_createBuckets(unsigned long size){
+	struct hash_Buckets *buckets = calloc(1, sizeof(struct hash_Buckets) + size * sizeof(struct hash_Entry *));
+	if(buckets == NULL){
+		log_logError("Error allocating hash buckets", ERROR);
+		return NULL;
+	}
+
+	buckets->mask = size - 1;
+	return buckets;
+}
+
+// Frees a bucket array along with every entry still chained to it
+void hash_freeBuckets(void *ptr){
+	struct hash_Buckets *buckets = ptr;
+	struct hash_Entry *entry, *next;
+
+	for(unsigned long i = 0; i <= buckets->mask; i++){
+		for(entry = buckets->heads[i]; entry != NULL; entry = next){
+			next = entry->next;
+			free(entry);
+		}
+	}
+
+	free(buckets);
+}
+
+int hash_init(struct hash_Table *table, int size){
+	unsigned long realSize = 1;
+	while(realSize < (unsigned long) size)
+		realSize <<= 1;
+
+	int ret = pthread_mutex_init(&table->writeMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	table->count = 0;
+	table->buckets = hash_createBuckets(realSize);
+	if(table->buckets == NULL)
+		return -1;
+
+	return 1;
+}
+
+void hash_free(struct hash_Table *table){
+	if(table->buckets != NULL)
+		hash_freeBuckets(table->buckets);
+
+	table->buckets = NULL;
+	table->count = 0;
+	pthread_mutex_destroy(&table->writeMutex);
+}
+
+unsigned long hash_string(char *str){
+	unsigned long hash = 14695981039346656037UL;
+
+	for(; *str != '\0'; str++){
+		hash ^= tolower((unsigned char) *str);
+		hash *= 1099511628211UL;
+	}
+
+	return hash;
+}
+
+int hash_keysEqual(char *first, char *second){
+	for(; *first != '\0' && *second != '\0'; first++, second++){
+		if(tolower((unsigned char) *first) != tolower((unsigned char) *second))
+			return -1;
+	}
+
+	return *first == *second ? 1 : -1;
+}
+
+void *hash_get(struct hash_Table *table, char *key){
+	unsigned long hash = hash_string(key);
+	void *data = NULL;
+
+	rcl_readLock();
+	struct hash_Buckets *buckets = __atomic_load_n(&table->buckets, __ATOMIC_ACQUIRE);
+	struct hash_Entry *entry = __atomic_load_n(&buckets->heads[hash & buckets->mask], __ATOMIC_ACQUIRE);
+	for(; entry != NULL; entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE)){
+		if(entry->hash == hash && hash_keysEqual(entry->key, key) == 1){
+			data = entry->data;
+			break;
+		}
+	}
+	rcl_readUnlock();
+
+	return data;
+}
+
+// Doubles the amount of buckets, must hold writeMutex
+// Entries are copied so readers of the old array are never misled
+int hash_grow(struct hash_Table *table){
+	struct hash_Buckets *old = table->buckets;
+	struct hash_Buckets *new = hash_createBuckets((old->mask + 1) * 2);
+	if(new == NULL)
+		return -1;
+
+	for(unsigned long i = 0; i <= old->mask; i++){
+		struct hash_Entry *entry;
+		for(entry = old->heads[i]; entry != NULL; entry = entry->next){
+			int keyLen = strlen(entry->key) + 1;
+			struct hash_Entry *copy = malloc(sizeof(struct hash_Entry) + keyLen);
+			if(copy == NULL){
+				log_logError("Error growing hash table", WARNING);
+				hash_freeBuckets(new);
+				return -1;
+			}
+
+			memcpy(copy, entry, sizeof(struct hash_Entry) + keyLen);
+			copy->next = new->heads[copy->hash & new->mask];
+			new->heads[copy->hash & new->mask] = copy;
+		}
+	}
+
+	__atomic_store_n(&table->buckets, new, __ATOMIC_RELEASE);
+	rcl_retire(old, hash_freeBuckets);
+
+	return 1;
+}
+
+int hash_put(struct hash_Table *table, char *key, void *data){
+	unsigned long hash = hash_string(key);
+	int keyLen = strlen(key) + 1;
+
+	struct hash_Entry *entry = malloc(sizeof(struct hash_Entry) + keyLen);
+	if(entry == NULL){
+		log_logError("Error allocating hash entry", ERROR);
+		return -1;
+	}
+	entry->hash = hash;
+	entry->data = data;
+	memcpy(entry->key, key, keyLen);
+
+	pthread_mutex_lock(&table->writeMutex);
+	struct hash_Buckets *buckets = table->buckets;
+	struct hash_Entry *node;
+	for(node = buckets->heads[hash & buckets->mask]; node != NULL; node = node->next){
+		if(node->hash == hash && hash_keysEqual(node->key, key) == 1){
+			pthread_mutex_unlock(&table->writeMutex);
+			free(entry);
+			return -1; // Already taken
+		}
+	}
+
+	// Entry must be complete before it becomes reachable
+	entry->next = buckets->heads[hash & buckets->mask];
+	__atomic_store_n(&buckets->heads[hash & buckets->mask], entry, __ATOMIC_RELEASE);
+	table->count++;
+
+	if((unsigned long) table->count > (buckets->mask + 1) * 2)
+		hash_grow(table);
+	pthread_mutex_unlock(&table->writeMutex);
+
+	return 1;
+}
+
+void *hash_remove(struct hash_Table *table, char *key){
+	unsigned long hash = hash_string(key);
+	void *data = NULL;
+
+	pthread_mutex_lock(&table->writeMutex);
+	struct hash_Buckets *buckets = table->buckets;
+	struct hash_Entry **link = &buckets->heads[hash & buckets->mask];
+	for(; *link != NULL; link = &(*link)->next){
+		struct hash_Entry *entry = *link;
+		if(entry->hash == hash && hash_keysEqual(entry->key, key) == 1){
+			__atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+			data = entry->data;
+			table->count--;
+			rcl_retire(entry, NULL);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&table->writeMutex);
+
+	return data;
+}
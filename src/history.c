@@ -0,0 +1,169 @@
+#define LOG_SUBSYSTEM LOG_STORE
+#include "history.h"
+#include "boundless.h"
+
+long hist_totalBytes = 0;
+unsigned long hist_nextId = 1;
+
+int init_history(){
+	// Leaves room for a million messages a second
+	hist_nextId = (unsigned long) time(NULL) << 20;
+
+	return 1;
+}
+
+unsigned long hist_newMsgid(){
+	return __atomic_fetch_add(&hist_nextId, 1, __ATOMIC_RELAXED);
+}
+
+void hist_seedMsgid(unsigned long next){
+	unsigned long current = __atomic_load_n(&hist_nextId, __ATOMIC_RELAXED);
+	while(current < next && !__atomic_compare_exchange_n(&hist_nextId, &current, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+int hist_init(struct hist_Ring *ring, int capacity){
+	int ret = pthread_mutex_init(&ring->ringMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	ring->capacity = capacity;
+	ring->head = 0;
+	ring->count = 0;
+	ring->bytes = 0;
+	ring->entries = NULL; // Quiet channels never pay for a ring
+
+	return 1;
+}
+
+void hist_free(struct hist_Ring *ring){
+	pthread_mutex_lock(&ring->ringMutex);
+	while(ring->count > 0)
+		hist_dropOldest(ring);
+
+	free(ring->entries);
+	ring->entries = NULL;
+	pthread_mutex_unlock(&ring->ringMutex);
+
+	pthread_mutex_destroy(&ring->ringMutex);
+}
+
+long hist_entrySize(struct com_Buffer *buffer){
+	return sizeof(struct hist_Entry) + sizeof(struct com_Buffer) + buffer->size;
+}
+
+int hist_add(struct hist_Ring *ring, struct com_Buffer *buffer, unsigned long msgid, time_t time){
+	long limit = (long) fig_Configuration.historyMemory * 1024;
+	long size = hist_entrySize(buffer);
+	int ret = -1;
+
+	if(ring->capacity <= 0) // HistorySize 0, nothing is kept
+		return -1;
+
+	pthread_mutex_lock(&ring->ringMutex);
+	if(ring->entries == NULL){
+		ring->entries = calloc(ring->capacity, sizeof(struct hist_Entry));
+		if(ring->entries == NULL){
+			pthread_mutex_unlock(&ring->ringMutex);
+			log_logError("Error allocating history", WARNING);
+			return -1;
+		}
+	}
+
+	if(ring->count == ring->capacity)
+		hist_dropOldest(ring);
+
+	// Over the global cap this channel makes room with its own lines
+	while(ring->count > 0 && __atomic_load_n(&hist_totalBytes, __ATOMIC_RELAXED) + size > limit)
+		hist_dropOldest(ring);
+
+	if(__atomic_load_n(&hist_totalBytes, __ATOMIC_RELAXED) + size <= limit){
+		struct hist_Entry *entry = &ring->entries[ring->head];
+		entry->msgid = msgid;
+		entry->time = time;
+		entry->buffer = buffer;
+		__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+
+		ring->head = (ring->head + 1) % ring->capacity;
+		ring->count++;
+		ring->bytes += size;
+		__atomic_add_fetch(&hist_totalBytes, size, __ATOMIC_RELAXED);
+		ret = 1;
+	}
+	pthread_mutex_unlock(&ring->ringMutex);
+
+	return ret;
+}
+
+void hist_dropOldest(struct hist_Ring *ring){
+	if(ring->count == 0)
+		return;
+
+	int oldest = (ring->head - ring->count + ring->capacity) % ring->capacity;
+	struct hist_Entry *entry = &ring->entries[oldest];
+	long size = hist_entrySize(entry->buffer);
+
+	ring->bytes -= size;
+	__atomic_sub_fetch(&hist_totalBytes, size, __ATOMIC_RELAXED);
+	com_releaseBuffer(entry->buffer);
+	entry->buffer = NULL;
+	ring->count--;
+}
+
+int hist_collect(struct hist_Ring *ring, unsigned long beforeId, time_t since, struct hist_Entry *out, int max){
+	int num = 0;
+	if(ring->capacity <= 0 || max <= 0)
+		return 0;
+
+	// Walk from the newest entry backwards, filling out from its end
+	pthread_mutex_lock(&ring->ringMutex);
+	for(int i = 0; i < ring->count && num < max; i++){
+		struct hist_Entry *entry = &ring->entries[(ring->head - 1 - i + ring->capacity) % ring->capacity];
+		if(beforeId != 0 && entry->msgid >= beforeId)
+			continue;
+		if(entry->time < since)
+			break;
+
+		out[max - 1 - num] = *entry;
+		__atomic_add_fetch(&entry->buffer->refs, 1, __ATOMIC_RELAXED);
+		num++;
+	}
+	pthread_mutex_unlock(&ring->ringMutex);
+
+	memmove(out, &out[max - num], num * sizeof(struct hist_Entry));
+	return num;
+}
+
+void hist_releaseEntries(struct hist_Entry *entries, int count){
+	for(int i = 0; i < count; i++)
+		com_releaseBuffer(entries[i].buffer);
+}
+
+int hist_replay(struct hist_Ring *ring, struct usr_UserData *user){
+	int max = fig_Configuration.historyReplay;
+	if(max > ring->capacity)
+		max = ring->capacity;
+	if(max <= 0) // History or its replay is off
+		return 0;
+
+	struct hist_Entry *entries = malloc(max * sizeof(struct hist_Entry));
+	if(entries == NULL){
+		log_logError("Error allocating history replay", WARNING);
+		return -1;
+	}
+
+	int num = hist_collect(ring, 0, clk_now() - fig_Configuration.historyReplayAge, entries, max);
+	if(num > 0){
+		// The lines go out exactly as they were broadcast, with a single rearm
+		for(int i = 0; i < num; i++)
+			com_queueBuffer(user, entries[i].buffer);
+		com_rearmWrite(user);
+	}
+
+	hist_releaseEntries(entries, num);
+	free(entries);
+
+	return num;
+}
@@ -53,9 +53,11 @@ struct link_Node *link_insert(struct link_List *list, void *data, int pos){
 void *link_remove(struct link_List *list, int pos){
     struct link_Node *node = link_getNode(list, pos);
     if(node == NULL){
-		char buff[100];
-		snprintf(buff, ARRAY_SIZE(buff), "Position %d does not exist", pos);
-		log_logMessage(buff, DEBUG);
+		if(log_isEnabled(DEBUG)){
+			char buff[100];
+			snprintf(buff, ARRAY_SIZE(buff), "Position %d does not exist", pos);
+			log_logMessage(buff, DEBUG);
+		}
 		return NULL;
     }
 
@@ -128,7 +130,7 @@ int link_indexOf(struct link_List *list, struct link_Node *target){
 }
 
 struct link_Node *link_getNode(struct link_List *list, int pos){
-    if(list->head == NULL || pos < 0){
+    if(list->head == NULL || pos < 0 || pos >= list->size){
             return NULL;
     }
 
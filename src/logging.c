@@ -1,16 +1,34 @@
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include "logging.h"
 #include "config.h"
+#include "clock.h"
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 const char* LOG_DEFAULT_LOGGING_DIR = "/var/log/irc-server/";
-FILE* log_LogFile;
+struct log_File log_current; // Where records are written
 
 struct log_Config log_LoggingConfig;
+struct log_Writer log_writer;
+struct log_Maintainer log_maintainer;
+int log_levels[LOG_NUM_SUBSYSTEMS]; // TRACE, everything is logged by default
+
+// Indexed by level and by subsystem
+const char *log_levelNames[] = {"trace", "debug", "info", "warning", "error", "fatal"};
+const char *log_subsystemNames[] = {"core", "com", "chat", "user", "chan", "events", "store", "upgrade"};
+
+// Every thread gets its own ring the first time it logs
+__thread struct log_Ring *log_self = NULL;
 
 int init_logging(){
     log_editConfig(fig_Configuration.useFile, fig_Configuration.logDirectory);
@@ -18,6 +36,27 @@ int init_logging(){
         log_openFile();
     }
 
+    if(pthread_mutex_init(&log_writer.mutex, NULL) != 0 || pthread_cond_init(&log_writer.cond, NULL) != 0){
+        log_printLogFormat("Error initalizing the log writer, logging synchronously.", WARNING);
+        return 1;
+    }
+
+    // Compresses and removes rotated files
+    if(log_LoggingConfig.useFile && (fig_Configuration.logCompress || fig_Configuration.logRetention > 0)){
+        if(pthread_mutex_init(&log_maintainer.mutex, NULL) != 0 || pthread_cond_init(&log_maintainer.cond, NULL) != 0
+                || pthread_create(&log_maintainer.thread, NULL, log_maintainThread, NULL) != 0)
+            log_printLogError("Error creating the log maintainer, rotated files are kept as they are", WARNING);
+        else
+            log_maintainer.running = 1;
+        log_noteOpen();
+    }
+
+    __atomic_store_n(&log_writer.running, 1, __ATOMIC_RELEASE);
+    if(pthread_create(&log_writer.thread, NULL, log_writerThread, NULL) != 0){
+        __atomic_store_n(&log_writer.running, 0, __ATOMIC_RELEASE);
+        log_printLogError("Error creating the log writer, logging synchronously", WARNING);
+    }
+
     return 1;
 }
 
@@ -43,28 +82,19 @@ void log_editConfig(int useFile, char* dir){
 		strcat(msg, log_LoggingConfig.directory);
 		log_printLogFormat(msg, INFO);
 
-		if(log_LogFile)
-			fclose(log_LogFile);
+		if(log_current.file){
+			fclose(log_current.file);
+			log_current.file = NULL;
+		}
 	}
 }	
 
 int log_openFile(){
-    //get file location for this log
-    // XXX fix this strcpy to be strncpy
-    char fileLoc[BUFSIZ];
-    char endChar = log_LoggingConfig.directory[strlen(log_LoggingConfig.directory) - 1];
-    strcpy(fileLoc, log_LoggingConfig.directory);
-    if(endChar != '\\' || endChar != '/')
-        strcat(fileLoc, "/");
-
-    //YYYY-MM-DD.log filename
-    char time[11];
-    log_getTimeShort(time);
-    strcat(fileLoc, time);
-    strcat(fileLoc, ".log");
-
-    log_LogFile = fopen(fileLoc, "a+");	
-    if(!log_LogFile){
+    //YYYY-MM-DD.log, continuing the last file of today that still has room
+    char date[11];
+    log_getTimeShort(date);
+
+    if(log_openPath(&log_current, date, log_findIndex(date, 0)) == -1){
         log_printLogError("Error opening log file", ERROR);
         log_editConfig(0, log_LoggingConfig.directory);
         return -1;
@@ -73,35 +103,523 @@ int log_openFile(){
     return 0;
 }
 
+void log_getPath(char *path, int size, char *date, int index){
+	char *dir = log_LoggingConfig.directory;
+	char *sep = dir[0] != '\0' && dir[strlen(dir) - 1] == '/' ? "" : "/";
+
+	if(index == 0)
+		snprintf(path, size, "%s%s%s.log", dir, sep, date);
+	else
+		snprintf(path, size, "%s%s%s.%d.log", dir, sep, date, index);
+}
+
+int log_openPath(struct log_File *file, char *date, int index){
+	char path[BUFSIZ];
+	log_getPath(path, ARRAY_SIZE(path), date, index);
+
+	FILE *opened = fopen(path, "a");
+	if(opened == NULL)
+		return -1;
+
+	fseek(opened, 0, SEEK_END);
+	file->file = opened;
+	file->size = ftell(opened);
+	file->index = index;
+	strncpy(file->date, date, ARRAY_SIZE(file->date) - 1);
+	file->date[ARRAY_SIZE(file->date) - 1] = '\0';
+
+	log_noteOpen();
+	return 1;
+}
+
+void log_noteOpen(){
+	if(!log_maintainer.running)
+		return;
+
+	struct log_File *files[2] = {&log_current, &log_writer.next};
+	pthread_mutex_lock(&log_maintainer.mutex);
+	for(int i = 0; i < 2; i++){
+		char *name = log_maintainer.open[i];
+		int size = ARRAY_SIZE(log_maintainer.open[i]);
+		if(files[i]->file == NULL)
+			name[0] = '\0';
+		else if(files[i]->index == 0)
+			snprintf(name, size, "%s.log", files[i]->date);
+		else
+			snprintf(name, size, "%s.%d.log", files[i]->date, files[i]->index);
+	}
+	pthread_mutex_unlock(&log_maintainer.mutex);
+}
+
+int log_findIndex(char *date, int first){
+	long max = fig_Configuration.logMaxSize * 1024L;
+	char path[BUFSIZ];
+	struct stat info;
+
+	// The newest file of the day, retention leaves gaps below it
+	int last = -1, compressed = 0;
+	DIR *dir = opendir(log_LoggingConfig.directory);
+	if(dir != NULL){
+		struct dirent *entry;
+		while((entry = readdir(dir)) != NULL){
+			if(!log_isLogName(entry->d_name) || strncmp(entry->d_name, date, 10))
+				continue;
+
+			int index = entry->d_name[10] == '.' ? atoi(entry->d_name + 11) : 0;
+			int gz = strstr(entry->d_name + 10, ".gz") != NULL;
+			if(index > last || (index == last && gz)){
+				last = index;
+				compressed = gz;
+			}
+		}
+		closedir(dir);
+	}
+
+	// Continue it while it has room, a compressed one was rotated away before a restart
+	int index = last < 0 ? 0 : last;
+	if(last >= 0 && compressed)
+		index++;
+	else if(last >= 0 && max > 0){
+		log_getPath(path, ARRAY_SIZE(path), date, last);
+		if(stat(path, &info) == 0 && info.st_size >= max)
+			index++;
+	}
+
+	if(index < first)
+		index = first;
+	return index < LOG_MAX_INDEX ? index : LOG_MAX_INDEX;
+}
+
+int log_rotate(long len){
+	long max = fig_Configuration.logMaxSize * 1024L;
+	char date[11];
+	log_getTimeShort(date);
+
+	int newDay = strcmp(date, log_current.date) != 0;
+	int full = max > 0 && log_current.size > 0 && log_current.size + len > max;
+	if(!newDay && !full){
+		log_prepareNext();
+		return 1;
+	}
+
+	int index = log_findIndex(date, newDay ? 0 : log_current.index + 1);
+	log_retireFile(&log_current);
+
+	// Usually the file is already open
+	if(log_writer.next.file != NULL && !strcmp(log_writer.next.date, date) && log_writer.next.index == index){
+		log_current = log_writer.next;
+		memset(&log_writer.next, 0, sizeof(struct log_File));
+		log_noteOpen();
+		return 1;
+	}
+
+	log_discardFile(&log_writer.next);
+	if(log_openPath(&log_current, date, index) == -1){
+		log_printLogError("Error opening log file", ERROR);
+		log_editConfig(0, log_LoggingConfig.directory);
+		return -1;
+	}
+
+	return 1;
+}
+
+void log_prepareNext(){
+	long max = fig_Configuration.logMaxSize * 1024L;
+	time_t now = clk_now();
+
+	if(log_writer.next.file != NULL || now == log_writer.lastCheck)
+		return;
+	log_writer.lastCheck = now;
+
+	if(max > 0 && log_current.size > max / 10 * 9){
+		if(log_openPath(&log_writer.next, log_current.date, log_findIndex(log_current.date, log_current.index + 1)) == -1)
+			log_printLogError("Error opening the next log file", WARNING);
+		return;
+	}
+
+	// Shortly before midnight tomorrow's file is opened
+	char date[11];
+	struct tm tm;
+	time_t soon = now + LOG_PREOPEN_SECS;
+	localtime_r(&soon, &tm);
+	if(strftime(date, ARRAY_SIZE(date), "%Y-%m-%d", &tm) == 0)
+		return;
+
+	if(strcmp(date, log_current.date) && log_openPath(&log_writer.next, date, log_findIndex(date, 0)) == -1)
+		log_printLogError("Error opening the next log file", WARNING);
+}
+
+void log_retireFile(struct log_File *file){
+	if(file->file == NULL)
+		return;
+
+	fclose(file->file);
+	file->file = NULL;
+
+	if(!log_maintainer.running)
+		return;
+
+	char path[BUFSIZ];
+	log_getPath(path, ARRAY_SIZE(path), file->date, file->index);
+
+	struct log_Pending *pending = malloc(sizeof(struct log_Pending));
+	if(pending == NULL){
+		log_printLogError("Error queueing a rotated log file", WARNING);
+		return;
+	}
+	strncpy(pending->path, path, ARRAY_SIZE(pending->path) - 1);
+	pending->path[ARRAY_SIZE(pending->path) - 1] = '\0';
+
+	pending->next = NULL;
+
+	// Oldest first, so retention never removes a file that is still waiting
+	pthread_mutex_lock(&log_maintainer.mutex);
+	struct log_Pending **last = &log_maintainer.pending;
+	while(*last != NULL)
+		last = &(*last)->next;
+	*last = pending;
+	pthread_cond_signal(&log_maintainer.cond);
+	pthread_mutex_unlock(&log_maintainer.mutex);
+}
+
+void log_discardFile(struct log_File *file){
+	if(file->file == NULL)
+		return;
+
+	fclose(file->file);
+	file->file = NULL;
+
+	// Opened ahead of time but never needed
+	if(file->size == 0){
+		char path[BUFSIZ];
+		log_getPath(path, ARRAY_SIZE(path), file->date, file->index);
+		unlink(path);
+	}
+}
+
+void *log_maintainThread(void *param){
+	(void) param;
+
+	// Nice values are per thread on Linux, gzip inherits it
+	if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19) == -1)
+		log_printLogError("Error lowering the priority of the log maintainer", WARNING);
+
+	while(1){
+		pthread_mutex_lock(&log_maintainer.mutex);
+		while(log_maintainer.pending == NULL)
+			pthread_cond_wait(&log_maintainer.cond, &log_maintainer.mutex);
+
+		struct log_Pending *pending = log_maintainer.pending;
+		log_maintainer.pending = pending->next;
+		pthread_mutex_unlock(&log_maintainer.mutex);
+
+		// Retention may have removed it already
+		struct stat info;
+		if(fig_Configuration.logCompress && stat(pending->path, &info) == 0)
+			log_compress(pending->path);
+		free(pending);
+
+		if(fig_Configuration.logRetention > 0)
+			log_applyRetention(fig_Configuration.logRetention);
+	}
+
+	return NULL;
+}
+
+int log_compress(char *path){
+	extern char **environ;
+	char *argv[] = {"gzip", path, NULL}; // Without -f an existing archive is never overwritten
+	pid_t pid;
+	int status;
+
+	int ret = posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ);
+	if(ret != 0){
+		errno = ret;
+		log_printLogError("Error starting gzip", WARNING);
+		return -1;
+	}
+
+	if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		log_printLogFormat("gzip could not compress a rotated log file.", WARNING);
+		return -1;
+	}
+
+	return 1;
+}
+
+int log_applyRetention(int keep){
+	DIR *dir = opendir(log_LoggingConfig.directory);
+	if(dir == NULL){
+		log_printLogError("Error opening the log directory", WARNING);
+		return -1;
+	}
+
+	// Newest first, by the date and index in their names
+	struct log_Old old[LOG_MAX_OLD];
+	int count = 0;
+	struct dirent *entry;
+
+	// The files being written are neither counted nor removed
+	char open[2][32];
+	pthread_mutex_lock(&log_maintainer.mutex);
+	memcpy(open, log_maintainer.open, sizeof(open));
+	pthread_mutex_unlock(&log_maintainer.mutex);
+
+	while((entry = readdir(dir)) != NULL){
+		if(!log_isLogName(entry->d_name) || !strcmp(entry->d_name, open[0]) || !strcmp(entry->d_name, open[1]))
+			continue;
+
+		struct log_Old file;
+		strncpy(file.name, entry->d_name, ARRAY_SIZE(file.name) - 1);
+		file.name[ARRAY_SIZE(file.name) - 1] = '\0';
+		file.index = file.name[10] == '.' ? atoi(file.name + 11) : 0;
+
+		int pos = count < LOG_MAX_OLD ? count++ : LOG_MAX_OLD;
+		while(pos > 0 && log_isNewer(&file, &old[pos-1])){
+			if(pos < LOG_MAX_OLD)
+				old[pos] = old[pos-1];
+			pos--;
+		}
+		if(pos < LOG_MAX_OLD)
+			old[pos] = file;
+	}
+	closedir(dir);
+
+	int removed = 0;
+	for(int i = keep; i < count; i++){
+		char path[BUFSIZ + 256]; // Directory, '/' and the file name
+		snprintf(path, ARRAY_SIZE(path), "%s/%s", log_LoggingConfig.directory, old[i].name);
+		if(unlink(path) == 0)
+			removed++;
+	}
+
+	return removed;
+}
+
+int log_isNewer(struct log_Old *first, struct log_Old *second){
+	int cmp = strncmp(first->name, second->name, 10);
+	if(cmp != 0)
+		return cmp > 0;
+
+	return first->index > second->index;
+}
+
+int log_isLogName(char *name){
+	// YYYY-MM-DD[.N].log[.gz]
+	for(int i = 0; i < 10; i++){
+		if(i == 4 || i == 7){
+			if(name[i] != '-')
+				return 0;
+		} else if(name[i] < '0' || name[i] > '9'){
+			return 0;
+		}
+	}
+
+	return strstr(name + 10, ".log") != NULL;
+}
+
 void log_close(){
-	if(log_LogFile){
-		fclose(log_LogFile);
+	if(__atomic_exchange_n(&log_writer.running, 0, __ATOMIC_ACQ_REL)){
+		pthread_mutex_lock(&log_writer.mutex);
+		pthread_cond_signal(&log_writer.cond);
+		pthread_mutex_unlock(&log_writer.mutex);
+		pthread_join(log_writer.thread, NULL);
+
+		// Whatever was queued while the writer did its last round
+		log_drainRings();
+		log_writeBatch();
 	}
+
+	if(log_current.file){
+		fclose(log_current.file);
+		log_current.file = NULL;
+	}
+	log_discardFile(&log_writer.next);
 }
 
-int log_getTime(char str[22]){
-	time_t rawtime;
-	time(&rawtime);
-	struct tm *time = localtime(&rawtime);
-	
-	snprintf(str, 22, "[%04d-%02d-%02d %02d:%02d:%02d]", time->tm_year+1900, time->tm_mon+1, time->tm_mday, time->tm_hour, time->tm_min, time->tm_sec);
+struct log_Ring *log_registerThread(){
+	struct log_Ring *ring = calloc(1, sizeof(struct log_Ring));
+	if(ring == NULL){
+		log_printLogError("Error allocating log ring", ERROR);
+		return NULL;
+	}
+
+	// Lock free push, rings are never removed
+	ring->next = __atomic_load_n(&log_writer.rings, __ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(&log_writer.rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	return ring;
+}
+
+int log_queueMessage(char *msg, int type){
+	if(log_self == NULL && (log_self = log_registerThread()) == NULL)
+		return -1;
+
+	struct log_Ring *ring = log_self;
+	unsigned long head = ring->head;
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	while(head - tail >= LOG_RING_SIZE){
+		if(!fig_Configuration.logBlock){
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+
+		// The writer may have stopped meanwhile
+		if(!__atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE))
+			return -1;
+
+		pthread_mutex_lock(&log_writer.mutex);
+		pthread_cond_signal(&log_writer.cond);
+		pthread_mutex_unlock(&log_writer.mutex);
+
+		struct timespec delay = {.tv_nsec = 100000}; // 0.1ms
+		nanosleep(&delay, NULL);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	}
+
+	struct log_Record *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+	record->time = clk_now();
+	record->type = type;
+	record->len = strlen(msg);
+	if(record->len > LOG_MSG_SIZE)
+		record->len = LOG_MSG_SIZE;
+	memcpy(record->msg, msg, record->len);
+
+	// Publishes the record to the writer
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	// Do not let a busy thread wait for the writer to wake up on its own
+	if(head + 1 - tail == LOG_RING_SIZE / 2){
+		pthread_mutex_lock(&log_writer.mutex);
+		pthread_cond_signal(&log_writer.cond);
+		pthread_mutex_unlock(&log_writer.mutex);
+	}
+
+	return 1;
+}
+
+void *log_writerThread(void *param){
+	(void) param;
+
+	while(1){
+		int running = __atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE);
+		int count = log_drainRings();
+		log_writeBatch();
+
+		// Keeps draining after log_close until nothing is left
+		if(!running && count == 0)
+			break;
+
+		if(count == 0){
+			struct timespec wake;
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_nsec += LOG_WAIT_MS * 1000000L;
+			if(wake.tv_nsec >= 1000000000){
+				wake.tv_sec++;
+				wake.tv_nsec -= 1000000000;
+			}
+
+			pthread_mutex_lock(&log_writer.mutex);
+			if(__atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE))
+				pthread_cond_timedwait(&log_writer.cond, &log_writer.mutex, &wake);
+			pthread_mutex_unlock(&log_writer.mutex);
+		}
+	}
+
+	return NULL;
+}
+
+int log_drainRings(){
+	int count = 0;
+	struct log_Ring *ring;
+
+	for(ring = __atomic_load_n(&log_writer.rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next){
+		unsigned long tail = ring->tail;
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for(; tail != head; tail++){
+			log_addToBatch(&ring->records[tail & (LOG_RING_SIZE - 1)]);
+			count++;
+
+			// Hands the slot back as soon as it is formatted
+			__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if(dropped != ring->reported){
+			struct log_Record record = {.time = clk_now(), .type = WARNING};
+			record.len = snprintf(record.msg, LOG_MSG_SIZE, "%lu log records were dropped, the log writer fell behind.", dropped - ring->reported);
+			log_addToBatch(&record);
+			ring->reported = dropped;
+		}
+	}
+
+	return count;
+}
+
+void log_addToBatch(struct log_Record *record){
+	// The timestamp only changes once a second
+	if(record->time != log_writer.lastTime || log_writer.timeStr[0] == '\0'){
+		if(record->time == clk_now()){
+			clk_getLogTime(log_writer.timeStr);
+		} else { // Queued before the last tick
+			char isoTime[CLK_ISO_LEN], date[CLK_DATE_LEN];
+			clk_format(record->time, log_writer.timeStr, isoTime, date);
+		}
+		log_writer.lastTime = record->time;
+	}
+
+	// Remove newline because a new one is appended
+	int len = record->len;
+	if(len > 0 && record->msg[len-1] == '\n')
+		len--;
+
+	if(log_writer.len + len + 64 > LOG_BATCH_SIZE)
+		log_writeBatch();
+
+	log_writer.len += snprintf(log_writer.batch + log_writer.len, LOG_BATCH_SIZE - log_writer.len, "%s - [%s] - %.*s\n",
+			log_writer.timeStr, log_getTypeName(record->type), len, record->msg);
+}
+
+void log_writeBatch(){
+	if(log_writer.len == 0)
+		return;
+
+	fwrite(log_writer.batch, 1, log_writer.len, stdout);
+	fflush(stdout);
+
+	if(log_LoggingConfig.useFile){
+		if((!log_current.file && log_openFile() < 0) || log_rotate(log_writer.len) < 0){
+			log_writer.len = 0;
+			return;
+		}
+
+		if(fwrite(log_writer.batch, 1, log_writer.len, log_current.file) != (size_t) log_writer.len){
+			log_printLogError("Error writing to log file", ERROR);
+			log_editConfig(0, log_LoggingConfig.directory);
+		} else {
+			fflush(log_current.file);
+			log_current.size += log_writer.len;
+		}
+	}
+
+	log_writer.len = 0;
+}
 
+int log_getTime(char str[22]){
+	clk_getLogTime(str);
 	return 0;
 }
 
 int log_getTimeShort(char str[11]){
-	time_t rawtime;
-	time(&rawtime);
-	struct tm *time = localtime(&rawtime);
-	
-	snprintf(str, 11, "%04d-%02d-%02d", time->tm_year+1900, time->tm_mon+1, time->tm_mday);
-
+	clk_getDate(str);
 	return 0;
 }
 
 int log_logToFile(char* msg, int type){
 	//check to see if log file is already open
-	if(!log_LogFile){
+	if(!log_current.file){
             if(log_openFile() < 0){
                 return -1;
             }
@@ -109,12 +627,14 @@ int log_logToFile(char* msg, int type){
 
 	char formattedMsg[BUFSIZ];
 	log_createLogFormat(formattedMsg, ARRAY_SIZE(formattedMsg), msg, type);
-	if(fprintf(log_LogFile, "%s\n", formattedMsg) < 0){
+	int len = fprintf(log_current.file, "%s\n", formattedMsg);
+	if(len < 0){
 		log_printLogError("Error writing to log file", ERROR);
 		log_editConfig(0, log_LoggingConfig.directory);
 		return -1;
 	}
-	fflush(log_LogFile);
+	fflush(log_current.file);
+	log_current.size += len;
 
 	return 0;
 }
@@ -141,65 +661,104 @@ void log_createLogFormat(char* buffer, int size, char* msg, int type){
 	log_getTime(time);
 
 	char formattedType[16];
-	char* typeStr;
+	char* typeStr = log_getTypeName(type);
+	snprintf(formattedType, ARRAY_SIZE(formattedType), " - [%s] - ", typeStr);
+
+	strncpy(buffer, time, size-1);
+	buffer[size-1] = '\0';
+	strncat(buffer, formattedType, size-strlen(buffer));
+	strncat(buffer, msg, size-strlen(buffer));
+
+        // Remove newline because printing will put one
+        if(buffer[strlen(buffer)-1] == '\n'){
+            buffer[strlen(buffer)-1] = '\0';
+        }
+}
+
+char *log_getTypeName(int type){
 	switch (type) {
 		case TRACE:
-			typeStr = "TRACE";
-			break;
+			return "TRACE";
 
 		case DEBUG:
-			typeStr = "DEBUG";
-			break;
+			return "DEBUG";
 
 		case INFO:
-			typeStr = "INFO";
-			break;
+			return "INFO";
 
 		case WARNING:
-			typeStr = "WARNING";
-			break;
+			return "WARNING";
 
 		case ERROR:
-			typeStr = "ERROR";
-			break;
+			return "ERROR";
 
 		case FATAL:
-			typeStr = "FATAL";
-			break;
+			return "FATAL";
 
 		case MESSAGE:
-			typeStr = "MESSAGE";
-			break;
+			return "MESSAGE";
 		
 		case EVENT:
-			typeStr = "EVENT";
-			break;
+			return "EVENT";
+	}
+
+	return "UNKNOWN";
+}
 
+int log_setLevel(char *subsystem, char *level){
+	int rank = log_findLevel(level);
+	if(rank == -1)
+		return -1;
+
+	if(subsystem == NULL){
+		for(int i = 0; i < LOG_NUM_SUBSYSTEMS; i++)
+			log_levels[i] = rank;
+		return 1;
 	}
-	
-	snprintf(formattedType, size, " - [%s] - ", typeStr);
 
-	strncpy(buffer, time, size-1);
-	buffer[size-1] = '\0';
-	strncat(buffer, formattedType, size-strlen(buffer));
-	strncat(buffer, msg, size-strlen(buffer));
+	int index = log_findSubsystem(subsystem);
+	if(index == -1)
+		return -1;
 
-        // Remove newline because printing will put one
-        if(buffer[strlen(buffer)-1] == '\n'){
-            buffer[strlen(buffer)-1] = '\0';
-        }
+	log_levels[index] = rank;
+	return 1;
 }
 
-int log_logError(char* msg, int type){
+int log_findLevel(char *name){
+	for(int i = 0; i < ARRAY_SIZE(log_levelNames); i++){
+		if(!strcasecmp(name, log_levelNames[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+int log_findSubsystem(char *name){
+	for(int i = 0; i < ARRAY_SIZE(log_subsystemNames); i++){
+		if(!strcasecmp(name, log_subsystemNames[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+int log_submitError(char* msg, int type){
 	char fullMsg[BUFSIZ] = {0};
 	strncpy(fullMsg, msg, ARRAY_SIZE(fullMsg)-1);
 	strncat(fullMsg, ": ", 3);
 	strncat(fullMsg, strerror(errno), ARRAY_SIZE(fullMsg)-strlen(fullMsg));
 
-	return log_logMessage(fullMsg, type);
+	return log_submitMessage(fullMsg, type);
+}
+
+int log_submitMessage(char* msg, int type){
+	if(__atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE) && log_queueMessage(msg, type) == 1)
+		return 0;
+
+	return log_writeMessage(msg, type);
 }
 
-int log_logMessage(char* msg, int type){
+int log_writeMessage(char* msg, int type){
 	log_printLogFormat(msg, type);
 
 	if(log_LoggingConfig.useFile){
@@ -0,0 +1,349 @@
+#define LOG_SUBSYSTEM LOG_CHAN
+#include "members.h"
+#include "boundless.h"
+
+int mbr_init(struct mbr_List *list){
+	list->limit = 0;
+	list->version = 0;
+	list->names = NULL;
+	list->current = calloc(1, sizeof(struct mbr_Snapshot));
+	if(list->current == NULL){
+		log_logError("Error allocating member list", ERROR);
+		return -1;
+	}
+	list->current->refs = 1;
+
+	return 1;
+}
+
+void mbr_free(struct mbr_List *list){
+	if(list->current != NULL)
+		mbr_releaseSnapshot(list->current);
+	list->current = NULL;
+
+	free(list->names);
+	list->names = NULL;
+}
+
+struct mbr_Snapshot *mbr_acquire(struct mbr_List *list){
+	rcl_readLock();
+	return __atomic_load_n(&list->current, __ATOMIC_ACQUIRE);
+}
+
+void mbr_release(){
+	rcl_readUnlock();
+}
+
+void mbr_holdSnapshot(struct mbr_Snapshot *snapshot){
+	// Cannot be the last reference, the read section delays the list's release
+	__atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+}
+
+void mbr_releaseSnapshot(void *ptr){
+	struct mbr_Snapshot *snapshot = ptr;
+
+	if(__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0){
+		for(int i = 0; i < snapshot->numChunks; i++)
+			mbr_releaseChunk(snapshot->chunks[i]);
+		free(snapshot->start);
+		free(snapshot);
+	}
+}
+
+void mbr_releaseChunk(struct mbr_Chunk *chunk){
+	if(__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(chunk);
+}
+
+// Counting sort of the member indices by IO thread
+int *mbr_partition(struct mbr_Snapshot *snapshot){
+	int *start = __atomic_load_n(&snapshot->start, __ATOMIC_ACQUIRE);
+	if(start != NULL || snapshot->numParts == 0)
+		return start;
+
+	int numParts = snapshot->numParts;
+	start = calloc(numParts + 1 + snapshot->count, sizeof(int));
+	if(start == NULL){
+		log_logError("Error partitioning member list", WARNING);
+		return NULL;
+	}
+
+	int *order = &start[numParts + 1];
+	for(int i = 0; i < snapshot->count; i++)
+		start[MBR_MEMBER(snapshot, i)->user->socketInfo.ioThread + 1]++;
+
+	for(int i = 0; i < numParts; i++)
+		start[i + 1] += start[i];
+
+	// Fill each partition using a running position per thread
+	int pos[numParts];
+	memcpy(pos, start, sizeof(pos));
+	for(int i = 0; i < snapshot->count; i++)
+		order[pos[MBR_MEMBER(snapshot, i)->user->socketInfo.ioThread]++] = i;
+
+	// Racing broadcasters build the same thing, the first one is kept
+	int *unset = NULL;
+	if(!__atomic_compare_exchange_n(&snapshot->start, &unset, start, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		free(start);
+		return unset;
+	}
+
+	return start;
+}
+
+int mbr_find(struct mbr_Snapshot *snapshot, struct usr_UserData *user){
+	for(int i = 0; i < snapshot->count; i++){
+		if(MBR_MEMBER(snapshot, i)->user == user)
+			return i;
+	}
+
+	return -1;
+}
+
+int mbr_getPermLevel(struct mbr_List *list, struct usr_UserData *user){
+	struct mbr_Snapshot *snapshot = mbr_acquire(list);
+	int pos = mbr_find(snapshot, user);
+	int ret = pos == -1 ? -1 : MBR_MEMBER(snapshot, pos)->permLevel;
+	mbr_release();
+
+	return ret;
+}
+
+struct mbr_Snapshot *mbr_copy(struct mbr_List *list, int extra){
+	struct mbr_Snapshot *old = list->current;
+	int maxChunks = (old->count + extra + MBR_CHUNK_SIZE - 1) / MBR_CHUNK_SIZE;
+
+	struct mbr_Snapshot *new = malloc(sizeof(struct mbr_Snapshot) + maxChunks * sizeof(struct mbr_Chunk *));
+	if(new == NULL){
+		log_logError("Error copying member list", ERROR);
+		return NULL;
+	}
+
+	new->refs = 1;
+	new->count = old->count;
+	new->numParts = 0;
+	new->start = NULL;
+	new->numChunks = old->numChunks;
+	for(int i = 0; i < old->numChunks; i++){
+		new->chunks[i] = old->chunks[i];
+		__atomic_add_fetch(&new->chunks[i]->refs, 1, __ATOMIC_RELAXED);
+	}
+
+	return new;
+}
+
+struct mbr_Member *mbr_edit(struct mbr_Snapshot *snapshot, int index){
+	int pos = index / MBR_CHUNK_SIZE;
+	struct mbr_Chunk *chunk = pos < snapshot->numChunks ? snapshot->chunks[pos] : NULL;
+
+	// Only a chunk no other snapshot points to may be written to
+	if(chunk == NULL || __atomic_load_n(&chunk->refs, __ATOMIC_ACQUIRE) > 1){
+		struct mbr_Chunk *copy = malloc(sizeof(struct mbr_Chunk));
+		if(copy == NULL){
+			log_logError("Error copying member chunk", ERROR);
+			return NULL;
+		}
+		copy->refs = 1;
+
+		if(chunk != NULL){
+			int used = snapshot->count - pos * MBR_CHUNK_SIZE;
+			memcpy(copy->members, chunk->members, (used < MBR_CHUNK_SIZE ? used : MBR_CHUNK_SIZE) * sizeof(struct mbr_Member));
+			mbr_releaseChunk(chunk);
+		} else {
+			snapshot->numChunks++;
+		}
+
+		snapshot->chunks[pos] = copy;
+		chunk = copy;
+	}
+
+	return &chunk->members[index % MBR_CHUNK_SIZE];
+}
+
+// One allocation: the struct, the line pointers and then the text
+struct mbr_Names *mbr_renderNames(struct mbr_Snapshot *snapshot, const char *symbols, int lineLen, unsigned long version){
+	int maxLines = snapshot->count + 1;
+	int maxText = snapshot->count * (fig_Configuration.nickLen + 2) + maxLines * 2;
+
+	struct mbr_Names *names = malloc(sizeof(struct mbr_Names) + maxLines * sizeof(char *) + maxText);
+	if(names == NULL){
+		log_logError("Error allocating NAMES cache", WARNING);
+		return NULL;
+	}
+
+	names->version = version;
+	names->lineLen = lineLen;
+	names->numLines = 0;
+	names->lines = (char **) names->data;
+
+	char nick[fig_Configuration.nickLen];
+	int numSymbols = strlen(symbols);
+	char *pos = &names->data[maxLines * sizeof(char *)];
+	int len = 0;
+
+	for(int i = 0; i < snapshot->count; i++){
+		struct mbr_Member *member = MBR_MEMBER(snapshot, i);
+		if(usr_getNickname(nick, member->user) == -1)
+			continue; // User is disconnecting
+
+		char symbol = member->permLevel < numSymbols ? symbols[member->permLevel] : ' ';
+		int nickLen = strlen(nick);
+		int need = nickLen + (symbol != ' ');
+
+		// Start a new line when this nick would not fit
+		if(len > 0 && len + 1 + need > lineLen){
+			*pos++ = '\0';
+			len = 0;
+		}
+
+		if(len == 0){
+			names->lines[names->numLines++] = pos;
+			*pos++ = ':';
+			len = 1;
+		} else {
+			*pos++ = ' ';
+			len++;
+		}
+
+		if(symbol != ' ')
+			*pos++ = symbol;
+		memcpy(pos, nick, nickLen);
+		pos += nickLen;
+		len += need;
+	}
+	*pos = '\0';
+
+	return names;
+}
+
+struct mbr_Names *mbr_getNames(struct mbr_List *list, const char *symbols, int lineLen){
+	// Read before rendering, a change during the render leaves the cache stale
+	unsigned long version = __atomic_load_n(&list->version, __ATOMIC_ACQUIRE);
+
+	struct mbr_Names *names = __atomic_load_n(&list->names, __ATOMIC_ACQUIRE);
+	if(names != NULL && names->version == version && names->lineLen == lineLen)
+		return names;
+
+	struct mbr_Snapshot *snapshot = __atomic_load_n(&list->current, __ATOMIC_ACQUIRE);
+	names = mbr_renderNames(snapshot, symbols, lineLen, version);
+	if(names == NULL)
+		return NULL;
+
+	// Racing builders simply replace each other, the loser is a later miss
+	struct mbr_Names *old = __atomic_exchange_n(&list->names, names, __ATOMIC_ACQ_REL);
+	if(old != NULL)
+		rcl_retire(old, NULL);
+
+	return names;
+}
+
+void mbr_publish(struct mbr_List *list, struct mbr_Snapshot *snapshot){
+	struct mbr_Snapshot *old = list->current;
+
+	// Big lists are broadcast by every IO thread to its own members
+	// Sorting them waits for the first broadcast, a burst of joins only pays for it once
+	if(snapshot->count >= fig_Configuration.largeChannel && com_numThreads > 1)
+		snapshot->numParts = com_numThreads;
+
+	__atomic_store_n(&list->current, snapshot, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&list->version, 1, __ATOMIC_RELEASE);
+	rcl_retire(old, mbr_releaseSnapshot);
+}
+
+int mbr_add(struct mbr_List *list, struct usr_UserData *user, int permLevel){
+	if(list->limit > 0 && list->current->count >= list->limit)
+		return -1;
+
+	struct mbr_Snapshot *snapshot = mbr_copy(list, 1);
+	if(snapshot == NULL)
+		return -1;
+
+	struct mbr_Member *member = mbr_edit(snapshot, snapshot->count);
+	if(member == NULL){
+		mbr_releaseSnapshot(snapshot);
+		return -1;
+	}
+
+	member->user = user;
+	member->permLevel = permLevel;
+	snapshot->count++;
+
+	mbr_publish(list, snapshot);
+	usr_addList(user, list);
+	return 1;
+}
+
+int mbr_addMany(struct mbr_List *list, struct mbr_Member *members, int count){
+	if(count <= 0)
+		return 1;
+
+	struct mbr_Snapshot *snapshot = mbr_copy(list, count);
+	if(snapshot == NULL)
+		return -1;
+
+	for(int i = 0; i < count; i++){
+		struct mbr_Member *member = mbr_edit(snapshot, snapshot->count);
+		if(member == NULL){
+			mbr_releaseSnapshot(snapshot);
+			return -1;
+		}
+
+		*member = members[i];
+		snapshot->count++;
+	}
+
+	mbr_publish(list, snapshot);
+	for(int i = 0; i < count; i++)
+		usr_addList(members[i].user, list);
+	return 1;
+}
+
+int mbr_remove(struct mbr_List *list, struct usr_UserData *user){
+	int pos = mbr_find(list->current, user);
+	if(pos == -1)
+		return -1;
+
+	struct mbr_Snapshot *snapshot = mbr_copy(list, 0);
+	if(snapshot == NULL)
+		return -1;
+
+	// Swap in the last member, only its chunk and the one at pos change
+	int last = snapshot->count - 1;
+	if(pos != last){
+		struct mbr_Member moved = *MBR_MEMBER(snapshot, last);
+		struct mbr_Member *member = mbr_edit(snapshot, pos);
+		if(member == NULL){
+			mbr_releaseSnapshot(snapshot);
+			return -1;
+		}
+		*member = moved;
+	}
+
+	snapshot->count--;
+	if(snapshot->count % MBR_CHUNK_SIZE == 0) // The last chunk is empty now
+		mbr_releaseChunk(snapshot->chunks[--snapshot->numChunks]);
+
+	mbr_publish(list, snapshot);
+	usr_removeList(user, list);
+	return 1;
+}
+
+int mbr_setPermLevel(struct mbr_List *list, struct usr_UserData *user, int permLevel){
+	int pos = mbr_find(list->current, user);
+	if(pos == -1)
+		return -1;
+
+	struct mbr_Snapshot *snapshot = mbr_copy(list, 0);
+	if(snapshot == NULL)
+		return -1;
+
+	struct mbr_Member *member = mbr_edit(snapshot, pos);
+	if(member == NULL){
+		mbr_releaseSnapshot(snapshot);
+		return -1;
+	}
+	member->permLevel = permLevel;
+
+	mbr_publish(list, snapshot);
+	return 1;
+}
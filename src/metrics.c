@@ -0,0 +1,401 @@
+#define LOG_SUBSYSTEM LOG_CORE
+#include <stdarg.h>
+#include "metrics.h"
+#include "boundless.h"
+
+struct mtr_Metrics mtr_metrics = {.listener = -1};
+pthread_t mtr_listenThread;
+
+const char *mtr_counterNames[MTR_NUM_COUNTERS] = {
+	"messages_in", "bytes_in", "messages_out", "bytes_out", "wakeups", "events", "busy"
+};
+
+__thread struct mtr_Thread *mtr_self = NULL;
+
+int init_metrics(){
+	if(fig_Configuration.useMetrics == 0)
+		return 1;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(fig_Configuration.metricsSocket) >= sizeof(addr.sun_path)){
+		log_logMessage("MetricsSocket path is too long.", ERROR);
+		return -1;
+	}
+	strncpy(addr.sun_path, fig_Configuration.metricsSocket, sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock == -1){
+		log_logError("Error creating metrics socket", ERROR);
+		return -1;
+	}
+
+	// Left behind by the process this one replaced, or by one that crashed
+	unlink(addr.sun_path);
+	if(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || chmod(addr.sun_path, 0600) == -1
+			|| listen(sock, 8) == -1){
+		log_logError("Error listening on MetricsSocket", ERROR);
+		close(sock);
+		return -1;
+	}
+
+	mtr_metrics.listener = sock;
+	if(pthread_create(&mtr_listenThread, NULL, mtr_thread, NULL) != 0){
+		log_logError("Error creating metrics thread", ERROR);
+		return -1;
+	}
+
+	char buff[BUFSIZ + 32]; // MetricsSocket and the message around it
+	snprintf(buff, ARRAY_SIZE(buff), "Serving metrics on %s.", fig_Configuration.metricsSocket);
+	log_logMessage(buff, INFO);
+
+	return 1;
+}
+
+void mtr_close(){
+	if(mtr_metrics.listener == -1)
+		return;
+
+	close(mtr_metrics.listener);
+	mtr_metrics.listener = -1;
+
+	// The process that took over already listens on the same path
+	if(upg_handedOver == 0)
+		unlink(fig_Configuration.metricsSocket);
+}
+
+struct mtr_Thread *mtr_registerThread(const char *name, int index){
+	if(mtr_self != NULL)
+		return mtr_self;
+
+	struct mtr_Thread *thread = aligned_alloc(64, sizeof(struct mtr_Thread));
+	if(thread == NULL){
+		log_logError("Error allocating thread metrics", WARNING);
+		return NULL;
+	}
+	memset(thread, 0, sizeof(struct mtr_Thread));
+	snprintf(thread->name, ARRAY_SIZE(thread->name), "%s", name);
+
+	// Lock free push, threads are never removed
+	thread->next = __atomic_load_n(&mtr_metrics.threads, __ATOMIC_ACQUIRE);
+	do {
+		thread->index = index;
+		if(index != -1)
+			continue;
+
+		// Recounted after a failed push, another thread of the same name may have been added
+		thread->index = 0;
+		for(struct mtr_Thread *other = thread->next; other != NULL; other = other->next){
+			if(!strcmp(other->name, thread->name) && other->index >= thread->index)
+				thread->index = other->index + 1;
+		}
+	} while(!__atomic_compare_exchange_n(&mtr_metrics.threads, &thread->next, thread, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	mtr_self = thread;
+	return thread;
+}
+
+void mtr_count(int counter, uint64_t n){
+	if(mtr_self == NULL && mtr_registerThread("other", -1) == NULL)
+		return;
+
+	// Only this thread writes, the store just has to be whole for readers
+	uint64_t *value = &mtr_self->counters[counter];
+	__atomic_store_n(value, *value + n, __ATOMIC_RELAXED);
+}
+
+void mtr_recordCommand(int id, uint64_t ns){
+	if(id < 0 || id >= MTR_MAX_COMMANDS)
+		return;
+	if(mtr_self == NULL && mtr_registerThread("other", -1) == NULL)
+		return;
+
+	struct mtr_Command *command = &mtr_self->commands[id];
+	__atomic_store_n(&command->total, command->total + ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&command->count, command->count + 1, __ATOMIC_RELAXED);
+	if(ns > command->max)
+		__atomic_store_n(&command->max, ns, __ATOMIC_RELAXED);
+}
+
+int mtr_sample(){
+	uint64_t now = trc_now();
+	uint64_t elapsed = mtr_metrics.sampleTime ? now - mtr_metrics.sampleTime : 0;
+
+	struct mtr_Thread *thread = __atomic_load_n(&mtr_metrics.threads, __ATOMIC_ACQUIRE);
+	for(; thread != NULL; thread = thread->next){
+		for(int i = 0; i < MTR_NUM_COUNTERS; i++){
+			uint64_t value = __atomic_load_n(&thread->counters[i], __ATOMIC_RELAXED);
+			if(elapsed > 0){
+				uint64_t perSecond = (uint64_t) ((double) (value - thread->sampled[i]) * 1e9 / elapsed);
+				__atomic_store_n(&thread->perSecond[i], perSecond, __ATOMIC_RELAXED);
+			}
+			thread->sampled[i] = value;
+		}
+	}
+
+	mtr_metrics.sampleTime = now;
+	return 1;
+}
+
+int mtr_makeReport(struct mtr_Report *report){
+	int sendQBounds[] = MTR_SENDQ_BUCKETS;
+	memset(report, 0, sizeof(struct mtr_Report));
+
+	// The first slot belongs to the server itself
+	for(int i = 1; i < serverLists.max; i++){
+		struct usr_UserData *user = &serverLists.users[i];
+		if(__atomic_load_n(&user->id, __ATOMIC_RELAXED) < 0)
+			continue;
+
+		int depth = __atomic_load_n(&user->sendQ.size, __ATOMIC_RELAXED);
+		int bucket = 0;
+		while(bucket < ARRAY_SIZE(sendQBounds) && depth > sendQBounds[bucket])
+			bucket++;
+
+		report->users++;
+		report->sendQ[bucket]++;
+		report->sendQTotal += depth;
+		if(depth > report->sendQMax)
+			report->sendQMax = depth;
+	}
+
+	report->dataQueue = chat_getQueueDepth(&report->dataBusy);
+	report->retired = rcl_countRetired();
+	report->historyBytes = __atomic_load_n(&hist_totalBytes, __ATOMIC_RELAXED);
+
+	uint64_t commands[MTR_MAX_COMMANDS][3] = {0};
+	struct mtr_Thread *thread = __atomic_load_n(&mtr_metrics.threads, __ATOMIC_ACQUIRE);
+	for(; thread != NULL; thread = thread->next){
+		struct mtr_ThreadReport *threadReport = NULL;
+		if(report->numThreads < MTR_MAX_THREADS){
+			threadReport = &report->threads[report->numThreads++];
+			memcpy(threadReport->name, thread->name, sizeof(threadReport->name));
+			threadReport->index = thread->index;
+		}
+
+		for(int i = 0; i < MTR_NUM_COUNTERS; i++){
+			uint64_t value = __atomic_load_n(&thread->counters[i], __ATOMIC_RELAXED);
+			uint64_t perSecond = __atomic_load_n(&thread->perSecond[i], __ATOMIC_RELAXED);
+			report->counters[i] += value;
+			report->perSecond[i] += perSecond;
+			if(threadReport != NULL){
+				threadReport->counters[i] = value;
+				threadReport->perSecond[i] = perSecond;
+			}
+		}
+
+		for(int i = 0; i < MTR_MAX_COMMANDS; i++){
+			commands[i][0] += __atomic_load_n(&thread->commands[i].count, __ATOMIC_RELAXED);
+			commands[i][1] += __atomic_load_n(&thread->commands[i].total, __ATOMIC_RELAXED);
+			uint64_t max = __atomic_load_n(&thread->commands[i].max, __ATOMIC_RELAXED);
+			if(max > commands[i][2])
+				commands[i][2] = max;
+		}
+	}
+
+	pthread_mutex_lock(&cmd_commandList.commandMutex);
+	for(struct link_Node *node = cmd_commandList.commands.head; node != NULL; node = node->next){
+		struct cmd_Command *command = node->data;
+		if(command == NULL || command->id >= MTR_MAX_COMMANDS)
+			continue;
+
+		struct mtr_CommandReport *commandReport = &report->commands[report->numCommands++];
+		snprintf(commandReport->name, ARRAY_SIZE(commandReport->name), "%s", command->word);
+		commandReport->stats.count = commands[command->id][0];
+		commandReport->stats.total = commands[command->id][1];
+		commandReport->stats.max = commands[command->id][2];
+	}
+	pthread_mutex_unlock(&cmd_commandList.commandMutex);
+
+	return 1;
+}
+
+int mtr_append(char **out, int *size, int len, const char *format, ...){
+	va_list args;
+
+	while(1){
+		va_start(args, format);
+		int needed = vsnprintf(*out + len, *size - len, format, args);
+		va_end(args);
+
+		if(needed < 0)
+			return -1;
+		if(len + needed < *size)
+			return len + needed;
+
+		int grown = *size * 2;
+		while(len + needed >= grown)
+			grown *= 2;
+
+		char *str = realloc(*out, grown);
+		if(str == NULL){
+			log_logError("Error growing metrics report", WARNING);
+			return -1;
+		}
+		*out = str;
+		*size = grown;
+	}
+}
+
+int mtr_formatPrometheus(struct mtr_Report *report, char **out, int *size, int len){
+	int sendQBounds[] = MTR_SENDQ_BUCKETS;
+
+#define MTR_APPEND(...) do { if((len = mtr_append(out, size, len, __VA_ARGS__)) == -1) return -1; } while(0)
+#define MTR_HEADER(name, type, help) MTR_APPEND("# HELP boundless_" name " " help "\n# TYPE boundless_" name " " type "\n")
+
+	MTR_HEADER("users", "gauge", "Connected users");
+	MTR_APPEND("boundless_users %d\n", report->users);
+	MTR_HEADER("dataqueue_jobs", "gauge", "Jobs waiting in the dataQueue");
+	MTR_APPEND("boundless_dataqueue_jobs %d\n", report->dataQueue);
+	MTR_HEADER("dataqueue_busy", "gauge", "Jobs data threads are running");
+	MTR_APPEND("boundless_dataqueue_busy %d\n", report->dataBusy);
+
+	MTR_HEADER("sendq_depth", "histogram", "Jobs in the sendQ of every connected user");
+	uint64_t below = 0;
+	for(int i = 0; i < ARRAY_SIZE(sendQBounds); i++){
+		below += report->sendQ[i];
+		MTR_APPEND("boundless_sendq_depth_bucket{le=\"%d\"} %lu\n", sendQBounds[i], below);
+	}
+	MTR_APPEND("boundless_sendq_depth_bucket{le=\"+Inf\"} %d\n", report->users);
+	MTR_APPEND("boundless_sendq_depth_sum %lu\nboundless_sendq_depth_count %d\n", report->sendQTotal, report->users);
+	MTR_HEADER("sendq_depth_max", "gauge", "Deepest sendQ");
+	MTR_APPEND("boundless_sendq_depth_max %d\n", report->sendQMax);
+
+	// Messages and bytes, the rates are over the last sample
+	for(int i = MTR_MSGS_IN; i <= MTR_BYTES_OUT; i++){
+		const char *name = mtr_counterNames[i];
+		MTR_APPEND("# HELP boundless_%s_total Since the server started\n# TYPE boundless_%s_total counter\n", name, name);
+		MTR_APPEND("boundless_%s_total %lu\n", name, report->counters[i]);
+		MTR_APPEND("# HELP boundless_%s_per_second Over the last second\n# TYPE boundless_%s_per_second gauge\n", name, name);
+		MTR_APPEND("boundless_%s_per_second %lu\n", name, report->perSecond[i]);
+	}
+
+	MTR_HEADER("thread_wakeups_total", "counter", "epoll_wait returning");
+	for(int i = 0; i < report->numThreads; i++){
+		struct mtr_ThreadReport *thread = &report->threads[i];
+		MTR_APPEND("boundless_thread_wakeups_total{thread=\"%s\",index=\"%d\"} %lu\n", thread->name, thread->index, thread->counters[MTR_WAKEUPS]);
+	}
+	MTR_HEADER("thread_events_total", "counter", "epoll events or dataQueue jobs handled");
+	for(int i = 0; i < report->numThreads; i++){
+		struct mtr_ThreadReport *thread = &report->threads[i];
+		MTR_APPEND("boundless_thread_events_total{thread=\"%s\",index=\"%d\"} %lu\n", thread->name, thread->index, thread->counters[MTR_EVENTS]);
+	}
+	MTR_HEADER("thread_busy_seconds_total", "counter", "Time spent working");
+	for(int i = 0; i < report->numThreads; i++){
+		struct mtr_ThreadReport *thread = &report->threads[i];
+		MTR_APPEND("boundless_thread_busy_seconds_total{thread=\"%s\",index=\"%d\"} %.6f\n", thread->name, thread->index, thread->counters[MTR_BUSY] / 1e9);
+	}
+	MTR_HEADER("thread_utilization", "gauge", "Share of the last second spent working");
+	for(int i = 0; i < report->numThreads; i++){
+		struct mtr_ThreadReport *thread = &report->threads[i];
+		MTR_APPEND("boundless_thread_utilization{thread=\"%s\",index=\"%d\"} %.4f\n", thread->name, thread->index, thread->perSecond[MTR_BUSY] / 1e9);
+	}
+
+	MTR_HEADER("command_calls_total", "counter", "Commands run");
+	for(int i = 0; i < report->numCommands; i++)
+		MTR_APPEND("boundless_command_calls_total{command=\"%s\"} %lu\n", report->commands[i].name, report->commands[i].stats.count);
+	MTR_HEADER("command_seconds_total", "counter", "Time spent running commands");
+	for(int i = 0; i < report->numCommands; i++)
+		MTR_APPEND("boundless_command_seconds_total{command=\"%s\"} %.6f\n", report->commands[i].name, report->commands[i].stats.total / 1e9);
+	MTR_HEADER("command_seconds_max", "gauge", "Longest run of a command");
+	for(int i = 0; i < report->numCommands; i++)
+		MTR_APPEND("boundless_command_seconds_max{command=\"%s\"} %.6f\n", report->commands[i].name, report->commands[i].stats.max / 1e9);
+
+	struct evt_Stats events[EVT_MAX_EVENTS];
+	int numEvents = evt_getStats(events, EVT_MAX_EVENTS);
+	MTR_HEADER("event_runs_total", "counter", "Runs of a timed event");
+	for(int i = 0; i < numEvents; i++)
+		MTR_APPEND("boundless_event_runs_total{event=\"%s\"} %lu\n", events[i].name, events[i].runs);
+	MTR_HEADER("event_late_seconds_total", "counter", "Time timed events started after they were due");
+	for(int i = 0; i < numEvents; i++)
+		MTR_APPEND("boundless_event_late_seconds_total{event=\"%s\"} %.6f\n", events[i].name, events[i].lateTotal / 1e6);
+	MTR_HEADER("event_late_seconds_max", "gauge", "Longest delay before a timed event started");
+	for(int i = 0; i < numEvents; i++)
+		MTR_APPEND("boundless_event_late_seconds_max{event=\"%s\"} %.6f\n", events[i].name, events[i].lateMax / 1e6);
+	MTR_HEADER("event_skipped_total", "counter", "Runs dropped because earlier ones fell behind");
+	for(int i = 0; i < numEvents; i++)
+		MTR_APPEND("boundless_event_skipped_total{event=\"%s\"} %lu\n", events[i].name, events[i].skipped);
+
+	MTR_HEADER("reclaim_retired", "gauge", "Retired allocations waiting to be freed");
+	MTR_APPEND("boundless_reclaim_retired %d\n", report->retired);
+	MTR_HEADER("history_bytes", "gauge", "Memory kept alive by the channel history");
+	MTR_APPEND("boundless_history_bytes %ld\n", report->historyBytes);
+
+#undef MTR_HEADER
+#undef MTR_APPEND
+
+	return len;
+}
+
+void *mtr_thread(UNUSED(void *param)){
+	while(1){
+		int conn = accept(mtr_metrics.listener, NULL, NULL);
+		if(conn == -1){
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			break; // Closed by mtr_close()
+		}
+
+		mtr_serve(conn);
+		close(conn);
+	}
+
+	return NULL;
+}
+
+int mtr_serve(int conn){
+	char request[1024] = {0};
+	struct timeval timeout = {.tv_sec = MTR_TIMEOUT};
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Plain readers send nothing, HTTP clients send their request right away
+	struct pollfd pfd = {.fd = conn, .events = POLLIN};
+	if(poll(&pfd, 1, 100) == 1)
+		recv(conn, request, ARRAY_SIZE(request) - 1, MSG_DONTWAIT);
+	int http = !strncmp(request, "GET ", 4);
+
+	struct mtr_Report *report = malloc(sizeof(struct mtr_Report));
+	int size = BUFSIZ * 4;
+	char *body = malloc(size);
+	if(report == NULL || body == NULL){
+		log_logError("Error allocating metrics report", WARNING);
+		free(report);
+		free(body);
+		return -1;
+	}
+
+	int len = -1;
+	if(mtr_makeReport(report) == 1)
+		len = mtr_formatPrometheus(report, &body, &size, 0);
+	free(report);
+
+	char header[256];
+	int headerLen = 0;
+	if(http && len >= 0){
+		headerLen = snprintf(header, ARRAY_SIZE(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: %d\r\nConnection: close\r\n\r\n", len);
+	} else if(http){
+		headerLen = snprintf(header, ARRAY_SIZE(header), "HTTP/1.0 500 Internal Server Error\r\nConnection: close\r\n\r\n");
+	}
+
+	struct iovec parts[2] = {{header, headerLen}, {body, len > 0 ? len : 0}};
+	struct msghdr msg = {.msg_iov = parts, .msg_iovlen = 2};
+	while(parts[0].iov_len + parts[1].iov_len > 0){
+		ssize_t ret = sendmsg(conn, &msg, MSG_NOSIGNAL);
+		if(ret == -1 && errno == EINTR)
+			continue;
+		if(ret == -1)
+			break; // The reader went away or stopped reading
+
+		for(int i = 0; i < 2; i++){
+			size_t done = (size_t) ret < parts[i].iov_len ? (size_t) ret : parts[i].iov_len;
+			parts[i].iov_base = (char *) parts[i].iov_base + done;
+			parts[i].iov_len -= done;
+			ret -= done;
+		}
+	}
+
+	free(body);
+	return len >= 0 ? 1 : -1;
+}
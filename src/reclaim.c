@@ -0,0 +1,150 @@
+#include "reclaim.h"
+
+struct rcl_Domain rcl_domain = {.epoch = 1};
+
+// Every thread gets its own slot the first time it reads
+__thread struct rcl_Thread *rcl_self = NULL;
+
+int init_reclaim(){
+    int ret = pthread_mutex_init(&rcl_domain.retiredMutex, NULL);
+    if (ret < 0){
+        log_logError("Error initalizing pthread_mutex.", ERROR);
+        return -1;
+    }
+
+	return 1;
+}
+
+void rcl_close(){
+	struct rcl_Retired *item, *next;
+
+	pthread_mutex_lock(&rcl_domain.retiredMutex);
+	for(item = rcl_domain.retired; item != NULL; item = next){
+		next = item->next;
+		item->freeFunc(item->ptr);
+		free(item);
+	}
+	rcl_domain.retired = NULL;
+	rcl_domain.numRetired = 0;
+	pthread_mutex_unlock(&rcl_domain.retiredMutex);
+}
+
+// Allocates and links in a slot for the calling thread
+struct rcl_Thread *rcl_registerThread(){
+	struct rcl_Thread *thread = aligned_alloc(64, sizeof(struct rcl_Thread));
+	if(thread == NULL){
+		log_logError("Error allocating reclaim thread", FATAL);
+		exit(EXIT_FAILURE);
+	}
+	memset(thread, 0, sizeof(struct rcl_Thread));
+
+	// Lock free push, slots are never removed
+	thread->next = __atomic_load_n(&rcl_domain.threads, __ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(&rcl_domain.threads, &thread->next, thread, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	return thread;
+}
+
+void rcl_readLock(){
+	if(rcl_self == NULL)
+		rcl_self = rcl_registerThread();
+
+	if(rcl_self->depth++ > 0)
+		return;
+
+	// The announcement must be visible before any protected pointer is loaded
+	__atomic_store_n(&rcl_self->epoch, __atomic_load_n(&rcl_domain.epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcl_readUnlock(){
+	if(rcl_self == NULL || rcl_self->depth <= 0){
+		log_logMessage("Unbalanced rcl_readUnlock", DEBUG);
+		return;
+	}
+
+	if(--rcl_self->depth == 0)
+		__atomic_store_n(&rcl_self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+int rcl_retire(void *ptr, void (*freeFunc)(void *)){
+	if(ptr == NULL)
+		return -1;
+
+	struct rcl_Retired *item = malloc(sizeof(struct rcl_Retired));
+	if(item == NULL){
+		log_logError("Error retiring memory", ERROR);
+		return -1;
+	}
+
+	item->ptr = ptr;
+	item->freeFunc = freeFunc == NULL ? free : freeFunc;
+
+	pthread_mutex_lock(&rcl_domain.retiredMutex);
+	item->epoch = __atomic_load_n(&rcl_domain.epoch, __ATOMIC_SEQ_CST);
+	item->next = rcl_domain.retired;
+	rcl_domain.retired = item;
+	rcl_domain.numRetired++;
+	pthread_mutex_unlock(&rcl_domain.retiredMutex);
+
+	return 1;
+}
+
+int rcl_collect(){
+	struct rcl_Retired *item, *next, *keep = NULL, *list;
+	int freed = 0, kept = 0;
+
+	// Take the whole list so retiring is not blocked while freeing
+	pthread_mutex_lock(&rcl_domain.retiredMutex);
+	list = rcl_domain.retired;
+	rcl_domain.retired = NULL;
+	rcl_domain.numRetired = 0;
+	pthread_mutex_unlock(&rcl_domain.retiredMutex);
+
+	// New readers will announce the new epoch
+	__atomic_add_fetch(&rcl_domain.epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	// Oldest epoch that a reader may still be using
+	unsigned long oldest = ~0UL;
+	struct rcl_Thread *thread;
+	for(thread = __atomic_load_n(&rcl_domain.threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next){
+		unsigned long epoch = __atomic_load_n(&thread->epoch, __ATOMIC_SEQ_CST);
+		if(epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	for(item = list; item != NULL; item = next){
+		next = item->next;
+
+		if(item->epoch < oldest){
+			item->freeFunc(item->ptr);
+			free(item);
+			freed++;
+		} else {
+			item->next = keep;
+			keep = item;
+			kept++;
+		}
+	}
+
+	// Put back whatever is still in use
+	if(keep != NULL){
+		pthread_mutex_lock(&rcl_domain.retiredMutex);
+		for(item = keep; item->next != NULL; item = item->next);
+		item->next = rcl_domain.retired;
+		rcl_domain.retired = keep;
+		rcl_domain.numRetired += kept;
+		pthread_mutex_unlock(&rcl_domain.retiredMutex);
+	}
+
+	return freed;
+}
+
+int rcl_countRetired(){
+	pthread_mutex_lock(&rcl_domain.retiredMutex);
+	int count = rcl_domain.numRetired;
+	pthread_mutex_unlock(&rcl_domain.retiredMutex);
+
+	return count;
+}
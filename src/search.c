@@ -0,0 +1,522 @@
+#define LOG_SUBSYSTEM LOG_STORE
+#include "search.h"
+#include "boundless.h"
+
+struct srch_Index srch_index = {0};
+
+int init_search(){
+	if(fig_Configuration.useSearch == 0)
+		return 1;
+
+	int ret = pthread_mutex_init(&srch_index.queueMutex, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_mutex.", ERROR);
+		return -1;
+	}
+
+	ret = pthread_cond_init(&srch_index.queueCond, NULL);
+	if (ret < 0){
+		log_logError("Error initalizing pthread_cond.", ERROR);
+		return -1;
+	}
+
+	if(hash_init(&srch_index.terms, 1024) == -1)
+		return -1;
+
+	srch_index.base = 0;
+	srch_index.numDocs = 0;
+	srch_index.maxDocs = 0;
+	srch_index.docs = NULL;
+
+	srch_index.running = 1;
+	if(pthread_create(&srch_index.thread, NULL, srch_thread, NULL) != 0){
+		log_logError("Error creating search thread", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+void srch_close(){
+	if(srch_index.running == 0)
+		return;
+
+	pthread_mutex_lock(&srch_index.queueMutex);
+	srch_index.running = 0;
+	pthread_cond_signal(&srch_index.queueCond);
+	pthread_mutex_unlock(&srch_index.queueMutex);
+
+	pthread_join(srch_index.thread, NULL);
+}
+
+int srch_addMessage(struct chan_Channel *channel, unsigned long msgid, time_t time, struct com_Buffer *buffer){
+	if(__atomic_load_n(&srch_index.running, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	struct srch_Job *job = malloc(sizeof(struct srch_Job));
+	if(job == NULL){
+		log_logError("Error allocating search job", WARNING);
+		return -1;
+	}
+
+	job->query = NULL;
+	job->msgid = msgid;
+	job->time = time;
+	job->channel = channel;
+	job->buffer = buffer;
+	__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&srch_index.queueMutex);
+	struct link_Node *node = link_add(&srch_index.queue, job);
+	pthread_cond_signal(&srch_index.queueCond);
+	pthread_mutex_unlock(&srch_index.queueMutex);
+
+	if(node == NULL){
+		com_releaseBuffer(buffer);
+		free(job);
+		return -1;
+	}
+
+	return 1;
+}
+
+int srch_query(struct srch_Query *query){
+	if(__atomic_load_n(&srch_index.running, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	struct srch_Job *job = calloc(1, sizeof(struct srch_Job));
+	if(job == NULL){
+		log_logError("Error allocating search job", WARNING);
+		return -1;
+	}
+	job->query = query;
+
+	pthread_mutex_lock(&srch_index.queueMutex);
+	struct link_Node *node = link_add(&srch_index.queue, job);
+	pthread_cond_signal(&srch_index.queueCond);
+	pthread_mutex_unlock(&srch_index.queueMutex);
+
+	if(node == NULL){
+		free(job);
+		return -1;
+	}
+
+	return 1;
+}
+
+void srch_freeQuery(struct srch_Query *query){
+	if(query == NULL)
+		return;
+
+	free(query->channels);
+	free(query);
+}
+
+void *srch_thread(UNUSED(void *param)){
+	while(1){
+		pthread_mutex_lock(&srch_index.queueMutex);
+		while(srch_index.running && link_isEmpty(&srch_index.queue) == 1)
+			pthread_cond_wait(&srch_index.queueCond, &srch_index.queueMutex);
+
+		// Take everything at once, senders never wait for the index
+		struct link_List pending = srch_index.queue;
+		memset(&srch_index.queue, 0, sizeof(struct link_List));
+		int running = srch_index.running;
+		pthread_mutex_unlock(&srch_index.queueMutex);
+
+		while(link_isEmpty(&pending) == -1){
+			struct srch_Job *job = link_remove(&pending, 0);
+
+			if(job->query != NULL){
+				if(running)
+					srch_answer(job->query);
+				srch_freeQuery(job->query);
+			} else {
+				if(running)
+					srch_indexMessage(job);
+				com_releaseBuffer(job->buffer);
+			}
+			free(job);
+		}
+
+		if(running == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+char *srch_nextWord(char *str, char *end, char word[SRCH_TERM_LEN]){
+	// Letters, digits and anything outside of ASCII make up words
+	while(str < end && !isalnum((unsigned char) *str) && (unsigned char) *str < 0x80)
+		str++;
+
+	if(str >= end)
+		return NULL;
+
+	int len = 0;
+	while(str < end && (isalnum((unsigned char) *str) || (unsigned char) *str >= 0x80)){
+		if(len < SRCH_TERM_LEN - 1)
+			word[len++] = tolower((unsigned char) *str);
+		str++;
+	}
+	word[len] = '\0';
+
+	return str;
+}
+
+int srch_append(struct srch_Posting *list, unsigned long doc){
+	if(list->count > 0 && doc <= list->last)
+		return -1; // The word was already seen in this message
+
+	// A varint needs at most 10 bytes
+	if(list->len + 10 > list->size){
+		int size = list->size == 0 ? 16 : list->size * 2;
+		unsigned char *data = realloc(list->data, size);
+		if(data == NULL){
+			log_logError("Error growing posting list", WARNING);
+			return -1;
+		}
+		list->data = data;
+		list->size = size;
+	}
+
+	unsigned long delta = doc - list->last;
+	while(delta >= 0x80){
+		list->data[list->len++] = (delta & 0x7f) | 0x80;
+		delta >>= 7;
+	}
+	list->data[list->len++] = delta;
+
+	list->last = doc;
+	list->count++;
+
+	if(list->count % SRCH_SKIP_STEP == 0){
+		if(list->numSkips == list->maxSkips){
+			int size = list->maxSkips == 0 ? 4 : list->maxSkips * 2;
+			struct srch_Skip *skips = realloc(list->skips, size * sizeof(struct srch_Skip));
+			if(skips == NULL)
+				return 1; // Still searchable, only slower
+			list->skips = skips;
+			list->maxSkips = size;
+		}
+
+		list->skips[list->numSkips].doc = doc;
+		list->skips[list->numSkips].offset = list->len;
+		list->numSkips++;
+	}
+
+	return 1;
+}
+
+void srch_freePosting(struct srch_Posting *list){
+	free(list->data);
+	free(list->skips);
+	free(list);
+}
+
+int srch_indexMessage(struct srch_Job *job){
+	if(srch_index.numDocs >= fig_Configuration.searchMessages)
+		srch_compact();
+
+	if(srch_index.numDocs == srch_index.maxDocs){
+		int size = srch_index.maxDocs == 0 ? 1024 : srch_index.maxDocs * 2;
+		struct srch_Doc *docs = realloc(srch_index.docs, size * sizeof(struct srch_Doc));
+		if(docs == NULL){
+			log_logError("Error growing search documents", WARNING);
+			return -1;
+		}
+		srch_index.docs = docs;
+		srch_index.maxDocs = size;
+	}
+
+	unsigned long doc = srch_index.base + srch_index.numDocs;
+	struct srch_Doc *entry = &srch_index.docs[srch_index.numDocs++];
+	entry->msgid = job->msgid;
+	entry->time = job->time;
+	entry->channel = job->channel;
+
+	// Only the text after the second ':' is indexed, not the prefix or target
+	struct com_Buffer *buffer = job->buffer;
+	char *end = &buffer->str[buffer->len];
+	char *text = &buffer->str[1];
+	while(text + 1 < end && (text[0] != ' ' || text[1] != ':'))
+		text++;
+	if(text + 1 >= end)
+		return 1;
+
+	char word[SRCH_TERM_LEN];
+	for(text += 2; (text = srch_nextWord(text, end, word)) != NULL;){
+		if(word[1] == '\0')
+			continue; // Single letters match nearly everything
+
+		struct srch_Posting *list = hash_get(&srch_index.terms, word);
+		if(list == NULL){
+			list = calloc(1, sizeof(struct srch_Posting));
+			if(list == NULL){
+				log_logError("Error allocating posting list", WARNING);
+				continue;
+			}
+
+			if(hash_put(&srch_index.terms, word, list) == -1){
+				free(list);
+				continue;
+			}
+		}
+
+		srch_append(list, doc);
+	}
+
+	return 1;
+}
+
+int srch_compact(){
+	int drop = srch_index.numDocs / 2;
+	unsigned long cut = srch_index.base + drop;
+
+	// Rewrite every list without the dropped documents, remember which ones end up empty
+	struct link_List empty = {0};
+	struct hash_Buckets *buckets = srch_index.terms.buckets;
+	for(unsigned long b = 0; b <= buckets->mask; b++){
+		for(struct hash_Entry *entry = buckets->heads[b]; entry != NULL; entry = entry->next){
+			struct srch_Posting *list = entry->data;
+			if(list->last < cut){
+				link_add(&empty, entry->key);
+				continue;
+			}
+
+			struct srch_Posting copy = {0};
+			struct srch_Cursor cursor = {list, 0, 0, 0};
+			if(srch_seek(&cursor, cut) == 1){
+				do {
+					srch_append(&copy, cursor.doc);
+				} while(srch_next(&cursor) == 1);
+			}
+
+			free(list->data);
+			free(list->skips);
+			*list = copy;
+		}
+	}
+
+	while(link_isEmpty(&empty) == -1){
+		char *key = link_remove(&empty, 0);
+		srch_freePosting(hash_remove(&srch_index.terms, key));
+	}
+
+	srch_index.numDocs -= drop;
+	srch_index.base = cut;
+	memmove(srch_index.docs, &srch_index.docs[drop], srch_index.numDocs * sizeof(struct srch_Doc));
+
+	log_logMessage("Dropped the oldest half of the search index.", INFO);
+	return 1;
+}
+
+int srch_next(struct srch_Cursor *cursor){
+	struct srch_Posting *list = cursor->list;
+	if(cursor->index >= list->count)
+		return -1;
+
+	unsigned long delta = 0;
+	int shift = 0;
+	unsigned char byte;
+	do {
+		byte = list->data[cursor->pos++];
+		delta |= (unsigned long) (byte & 0x7f) << shift;
+		shift += 7;
+	} while(byte & 0x80);
+
+	cursor->doc += delta;
+	cursor->index++;
+	return 1;
+}
+
+int srch_seek(struct srch_Cursor *cursor, unsigned long doc){
+	if(cursor->index > 0 && cursor->doc >= doc)
+		return 1;
+
+	// Jump to the last skip point before doc, if it is ahead of the cursor
+	struct srch_Posting *list = cursor->list;
+	int low = cursor->index / SRCH_SKIP_STEP, high = list->numSkips - 1, found = -1;
+	while(low <= high){
+		int mid = (low + high) / 2;
+		if(list->skips[mid].doc < doc){
+			found = mid;
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	if(found != -1 && (found + 1) * SRCH_SKIP_STEP > cursor->index){
+		cursor->doc = list->skips[found].doc;
+		cursor->pos = list->skips[found].offset;
+		cursor->index = (found + 1) * SRCH_SKIP_STEP;
+	}
+
+	while(cursor->index == 0 || cursor->doc < doc){
+		if(srch_next(cursor) == -1)
+			return -1;
+	}
+
+	return 1;
+}
+
+int srch_findTime(time_t time){
+	// Documents are close to sorted by time, they only arrive out of order by a moment
+	int low = 0, high = srch_index.numDocs;
+	while(low < high){
+		int mid = (low + high) / 2;
+		if(srch_index.docs[mid].time < time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+int srch_match(struct srch_Query *query, unsigned long *hits, int max){
+	struct srch_Cursor cursors[SRCH_MAX_TERMS];
+	int numCursors = 0;
+
+	char word[SRCH_TERM_LEN];
+	char *str = query->words, *end = &query->words[strlen(query->words)];
+	while(numCursors < SRCH_MAX_TERMS && (str = srch_nextWord(str, end, word)) != NULL){
+		if(word[1] == '\0')
+			continue;
+
+		struct srch_Posting *list = hash_get(&srch_index.terms, word);
+		if(list == NULL || list->count == 0)
+			return 0; // Every word has to match
+
+		// Keep the shortest list first, it leads the intersection
+		int i = numCursors++;
+		for(; i > 0 && cursors[i - 1].list->count > list->count; i--)
+			cursors[i] = cursors[i - 1];
+		cursors[i] = (struct srch_Cursor) {list, 0, 0, 0};
+	}
+
+	if(numCursors == 0 || srch_index.numDocs == 0)
+		return 0;
+
+	// A second of slack covers documents that arrived slightly out of order
+	unsigned long first = srch_index.base + srch_findTime(query->since - 1);
+	unsigned long last = srch_index.base + srch_findTime(query->until + 2);
+
+	unsigned long *recent = malloc(max * sizeof(unsigned long));
+	if(recent == NULL){
+		log_logError("Error allocating search matches", WARNING);
+		return 0;
+	}
+
+	// The newest max matches are kept in a circular array
+	int found = 0;
+	unsigned long doc = first;
+	while(doc < last && srch_seek(&cursors[0], doc) == 1){
+		doc = cursors[0].doc;
+
+		int i = 1;
+		for(; i < numCursors; i++){
+			if(srch_seek(&cursors[i], doc) == -1)
+				goto done;
+			if(cursors[i].doc != doc)
+				break;
+		}
+
+		if(i < numCursors){ // Another list skipped ahead, so can the leader
+			doc = cursors[i].doc;
+			continue;
+		}
+
+		if(doc >= last)
+			break;
+
+		struct srch_Doc *entry = &srch_index.docs[doc - srch_index.base];
+		if(entry->time >= query->since && entry->time <= query->until){
+			for(int c = 0; c < query->numChannels; c++){
+				if(query->channels[c] == entry->channel){
+					recent[found++ % max] = doc;
+					break;
+				}
+			}
+		}
+		doc++;
+	}
+
+done:;
+	int num = found < max ? found : max;
+	for(int i = 0; i < num; i++)
+		hits[i] = recent[(found - 1 - i) % max];
+	free(recent);
+
+	return num;
+}
+
+void srch_addLine(unsigned long msgid, time_t time, char *line, int len, void *data){
+	struct srch_Line *result = data;
+	if(msgid != result->msgid)
+		return;
+
+	char str[BUFSIZ];
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s %s %lu %ld :%.*s", thisServer, RPL_SEARCH,
+			result->query->nick, result->target, msgid, (long) time, len, line);
+	com_appendBuffer(result->batch, str);
+	result->found = 1;
+}
+
+int srch_addResult(struct com_Buffer **batch, struct srch_Query *query, struct srch_Doc *doc){
+	struct chan_Channel *channel = doc->channel;
+	struct grp_Group *group = channel->group->data;
+
+	char target[BUFSIZ];
+	snprintf(target, ARRAY_SIZE(target), "%s/%s", group->name, channel->name);
+	struct srch_Line result = {doc->msgid, batch, query, target, 0};
+
+	// Recent lines are still in memory
+	struct hist_Entry entry;
+	if(hist_collect(&channel->history, doc->msgid + 1, 0, &entry, 1) == 1){
+		if(entry.msgid == doc->msgid){
+			struct com_Buffer *buffer = entry.buffer;
+			int len = buffer->len >= 2 ? buffer->len - 2 : buffer->len; // Without the \r\n
+			srch_addLine(entry.msgid, entry.time, buffer->str, len, &result);
+		}
+		hist_releaseEntries(&entry, 1);
+	}
+
+	if(result.found == 0 && fig_Configuration.useArchive)
+		arch_read(group->name, channel->name, doc->msgid + 1, doc->time - 1, 1, srch_addLine, &result, NULL);
+
+	return result.found == 1 ? 1 : -1;
+}
+
+int srch_answer(struct srch_Query *query){
+	int max = query->max;
+	unsigned long *hits = malloc(max * sizeof(unsigned long));
+	struct com_Buffer *batch = com_allocBuffer(BUFSIZ);
+	if(hits == NULL || batch == NULL){
+		log_logError("Error allocating search reply", WARNING);
+		free(hits);
+		com_releaseBuffer(batch);
+		return -1;
+	}
+
+	int num = srch_match(query, hits, max), sent = 0;
+	for(int i = 0; i < num; i++){
+		if(srch_addResult(&batch, query, &srch_index.docs[hits[i] - srch_index.base]) == 1)
+			sent++;
+	}
+	free(hits);
+
+	char str[BUFSIZ];
+	snprintf(str, ARRAY_SIZE(str), ":%s %s %s %d :End of search", thisServer, RPL_ENDOFSEARCH, query->nick, sent);
+	com_appendBuffer(&batch, str);
+
+	// The user may have left while the query waited
+	struct usr_UserData *user = query->user;
+	if(__atomic_load_n(&user->id, __ATOMIC_ACQUIRE) == query->userId)
+		com_sendBuffer(user, batch);
+
+	com_releaseBuffer(batch);
+	return sent;
+}
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM LOG_USER
 #include "security.h"
 
 // Compares two strings in constant time for security
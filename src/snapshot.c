@@ -0,0 +1,396 @@
+#define LOG_SUBSYSTEM LOG_STORE
+#include "snapshot.h"
+#include "boundless.h"
+
+int init_snapshot(){
+	if(upg_handoff.active) // The old process sent its state along with the connections
+		return snap_loadData(upg_handoff.state, upg_handoff.header.stateLen, "handed over");
+
+	if(fig_Configuration.useState == 0)
+		return 1;
+
+	return snap_load();
+}
+
+void snap_close(){
+	// After a hot upgrade the new process owns the file
+	if(fig_Configuration.useState == 0 || upg_handedOver)
+		return;
+
+	snap_save();
+}
+
+void snap_put(struct snap_Writer *writer, void *data, long len, int align){
+	long start = align ? (writer->len + 7) & ~7L : writer->len;
+	if(writer->failed || start + len <= writer->size){
+		if(writer->failed == 0){
+			memset(&writer->data[writer->len], 0, start - writer->len);
+			memcpy(&writer->data[start], data, len);
+			writer->len = start + len;
+		}
+		return;
+	}
+
+	long size = writer->size == 0 ? 65536 : writer->size;
+	while(size < start + len)
+		size *= 2;
+
+	char *grown = realloc(writer->data, size);
+	if(grown == NULL){
+		log_logError("Error growing state snapshot", WARNING);
+		writer->failed = 1;
+		return;
+	}
+	writer->data = grown;
+	writer->size = size;
+
+	snap_put(writer, data, len, align);
+}
+
+void snap_putString(struct snap_Writer *writer, char *str){
+	uint16_t len = strnlen(str, UINT16_MAX);
+	snap_put(writer, &len, sizeof(len), 0);
+	snap_put(writer, str, len, 0);
+}
+
+void snap_addMask(char *mask, void *data){
+	struct snap_Strings *strings = data;
+	snap_putString(strings->writer, mask);
+	strings->count++;
+}
+
+int snap_saveGroup(struct snap_Writer *writer, struct link_Node *groupNode){
+	struct grp_Group *group = groupNode->data;
+	struct snap_Record record = {0};
+	char key[ARRAY_SIZE(group->key) + 1] = {0};
+	record.type = SNAP_GROUP;
+
+	// Only copy under the lock, the channels are saved one by one afterwards
+	pthread_mutex_lock(&group->groupMutex);
+	memcpy(record.modes, group->modes, ARRAY_SIZE(record.modes));
+	memcpy(key, group->key, ARRAY_SIZE(group->key));
+	int numChannels = 0;
+	struct link_Node **channels = malloc((group->channels.size + 1) * sizeof(struct link_Node *));
+	for(struct link_Node *node = group->channels.head; channels != NULL && node != NULL; node = node->next)
+		channels[numChannels++] = node;
+	pthread_mutex_unlock(&group->groupMutex);
+
+	if(channels == NULL){
+		log_logError("Error allocating state snapshot", WARNING);
+		writer->failed = 1;
+		return -1;
+	}
+
+	snap_put(writer, &record, sizeof(record), 1);
+	long start = writer->len - sizeof(record);
+	snap_putString(writer, group->name);
+	snap_putString(writer, key);
+
+	struct snap_Strings strings = {writer, 0};
+	ban_forEach(&group->bans, snap_addMask, &strings);
+
+	if(writer->failed == 0){
+		struct snap_Record *saved = (struct snap_Record *) &writer->data[start];
+		saved->numStrings = strings.count;
+	}
+
+	for(int i = 0; i < numChannels; i++)
+		snap_saveChannel(writer, channels[i]);
+	free(channels);
+
+	return writer->failed ? -1 : 1;
+}
+
+int snap_saveChannel(struct snap_Writer *writer, struct link_Node *channelNode){
+	struct chan_Channel *channel = channelNode->data;
+	struct snap_Record record = {0};
+	char key[ARRAY_SIZE(channel->key) + 1] = {0};
+	record.type = SNAP_CHANNEL;
+
+	pthread_mutex_lock(&channel->channelMutex);
+	memcpy(record.modes, channel->modes, ARRAY_SIZE(record.modes));
+	memcpy(key, channel->key, ARRAY_SIZE(channel->key));
+	record.limit = channel->members.limit;
+	pthread_mutex_unlock(&channel->channelMutex);
+
+	snap_put(writer, &record, sizeof(record), 1);
+	long start = writer->len - sizeof(record);
+	snap_putString(writer, channel->name);
+	snap_putString(writer, key);
+
+	struct snap_Strings strings = {writer, 0};
+	ban_forEach(&channel->bans, snap_addMask, &strings);
+
+	if(writer->failed == 0){
+		struct snap_Record *saved = (struct snap_Record *) &writer->data[start];
+		saved->numStrings = strings.count;
+	}
+
+	return writer->failed ? -1 : 1;
+}
+
+int snap_build(struct snap_Writer *writer){
+	struct snap_Header header = {0};
+	memcpy(header.magic, SNAP_MAGIC, ARRAY_SIZE(header.magic));
+	header.version = SNAP_VERSION;
+	header.time = time(NULL);
+	snap_put(writer, &header, sizeof(header), 1);
+
+	// Groups are never freed, so the nodes stay valid once the list is unlocked
+	pthread_mutex_lock(&serverLists.groupsMutex);
+	int numGroups = 0;
+	struct link_Node **groups = malloc((serverLists.groups.size + 1) * sizeof(struct link_Node *));
+	for(struct link_Node *node = serverLists.groups.head; groups != NULL && node != NULL; node = node->next)
+		groups[numGroups++] = node;
+	pthread_mutex_unlock(&serverLists.groupsMutex);
+
+	if(groups == NULL)
+		writer->failed = 1;
+	for(int i = 0; i < numGroups; i++)
+		snap_saveGroup(writer, groups[i]);
+	free(groups);
+
+	if(writer->failed){
+		log_logError("Error building state snapshot", WARNING);
+		free(writer->data);
+		writer->data = NULL;
+		return -1;
+	}
+
+	struct snap_Header *saved = (struct snap_Header *) writer->data;
+	saved->numGroups = numGroups;
+	saved->size = writer->len;
+
+	return 1;
+}
+
+int snap_save(){
+	struct snap_Writer writer = {0};
+	if(snap_build(&writer) == -1)
+		return -1;
+
+	// Readers of the old file never see a partial one
+	char path[BUFSIZ + 8]; // StateFile and ".tmp"
+	snprintf(path, ARRAY_SIZE(path), "%s.tmp", fig_Configuration.stateFile);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if(fd == -1){
+		log_logError("Error opening state snapshot", WARNING);
+		free(writer.data);
+		return -1;
+	}
+
+	long written = 0;
+	while(written < writer.len){
+		ssize_t ret = write(fd, &writer.data[written], writer.len - written);
+		if(ret == -1 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			break;
+		written += ret;
+	}
+	free(writer.data);
+
+	if(written < writer.len || fsync(fd) == -1){
+		log_logError("Error writing state snapshot", WARNING);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	close(fd);
+
+	if(rename(path, fig_Configuration.stateFile) == -1){
+		log_logError("Error replacing state snapshot", WARNING);
+		unlink(path);
+		return -1;
+	}
+
+	return 1;
+}
+
+int snap_getString(char **pos, char *end, char *buff, int size){
+	uint16_t len;
+	if(end - *pos < (long) sizeof(len))
+		return -1;
+
+	memcpy(&len, *pos, sizeof(len));
+	*pos += sizeof(len);
+	if(end - *pos < len)
+		return -1;
+
+	int copy = len < size - 1 ? len : size - 1;
+	memcpy(buff, *pos, copy);
+	buff[copy] = '\0';
+	*pos += len;
+
+	return copy;
+}
+
+char *snap_getStrings(char **pos, char *end, uint32_t count, char ***strings){
+	// Every string takes at least its length, more than fits is a damaged file
+	if((uint64_t) count * sizeof(uint16_t) > (uint64_t) (end - *pos))
+		return NULL;
+
+	long total = 0;
+	char *scan = *pos;
+	for(uint32_t i = 0; i < count; i++){
+		uint16_t len;
+		if(end - scan < (long) sizeof(len))
+			return NULL;
+
+		memcpy(&len, scan, sizeof(len));
+		scan += sizeof(len);
+		if(end - scan < len)
+			return NULL;
+
+		scan += len;
+		total += len + 1;
+	}
+
+	char *data = malloc(total);
+	*strings = malloc(count * sizeof(char *));
+	if(data == NULL || *strings == NULL){
+		log_logError("Error allocating state strings", WARNING);
+		free(data);
+		free(*strings);
+		return NULL;
+	}
+
+	char *copy = data;
+	for(uint32_t i = 0; i < count; i++){
+		uint16_t len;
+		memcpy(&len, *pos, sizeof(len));
+		*pos += sizeof(len);
+
+		memcpy(copy, *pos, len);
+		copy[len] = '\0';
+		(*strings)[i] = copy;
+		copy += len + 1;
+		*pos += len;
+	}
+
+	return data;
+}
+
+struct link_Node *snap_loadRecord(struct snap_Record *record, char **pos, char *end, struct link_Node *groupNode){
+	char name[MAX_MESSAGE_LENGTH], key[MAX_MESSAGE_LENGTH];
+	if(snap_getString(pos, end, name, ARRAY_SIZE(name)) == -1 || snap_getString(pos, end, key, ARRAY_SIZE(key)) == -1)
+		return NULL;
+
+	struct link_Node *channelNode = NULL;
+	if(record->type == SNAP_GROUP){
+		groupNode = grp_getGroup(name);
+		if(groupNode == NULL) // Nobody is in it until its users come back
+			groupNode = grp_createGroup(name, NULL);
+		if(groupNode == NULL)
+			return NULL;
+
+		struct grp_Group *group = groupNode->data;
+		pthread_mutex_lock(&group->groupMutex);
+		memcpy(group->modes, record->modes, ARRAY_SIZE(group->modes));
+		strncpy(group->key, key, ARRAY_SIZE(group->key) - 1);
+		pthread_mutex_unlock(&group->groupMutex);
+	} else if(record->type == SNAP_CHANNEL && groupNode != NULL){
+		channelNode = grp_getChannel(groupNode, name);
+		if(channelNode == NULL)
+			channelNode = chan_createChannel(name, groupNode, NULL);
+		if(channelNode == NULL)
+			return NULL;
+
+		struct chan_Channel *channel = channelNode->data;
+		pthread_mutex_lock(&channel->channelMutex);
+		memcpy(channel->modes, record->modes, ARRAY_SIZE(channel->modes));
+		strncpy(channel->key, key, ARRAY_SIZE(channel->key) - 1);
+		channel->members.limit = record->limit;
+		pthread_mutex_unlock(&channel->channelMutex);
+	} else {
+		return NULL;
+	}
+
+	if(record->numStrings == 0)
+		return groupNode;
+
+	char **strings = NULL;
+	char *data = snap_getStrings(pos, end, record->numStrings, &strings);
+	if(data == NULL)
+		return NULL;
+
+	// Every list is published once instead of once per mask
+	if(channelNode != NULL){
+		struct chan_Channel *channel = channelNode->data;
+		pthread_mutex_lock(&channel->channelMutex);
+		ban_addList(&channel->bans, strings, record->numStrings);
+		pthread_mutex_unlock(&channel->channelMutex);
+	} else {
+		struct grp_Group *group = groupNode->data;
+		pthread_mutex_lock(&group->groupMutex);
+		ban_addList(&group->bans, strings, record->numStrings);
+		pthread_mutex_unlock(&group->groupMutex);
+	}
+
+	free(strings);
+	free(data);
+	return groupNode;
+}
+
+int snap_load(){
+	int fd = open(fig_Configuration.stateFile, O_RDONLY);
+	if(fd == -1){
+		log_logMessage("No saved state, starting empty.", INFO);
+		return 1;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) == -1 || info.st_size < (off_t) sizeof(struct snap_Header)){
+		log_logMessage("State snapshot is too short, ignoring it.", WARNING);
+		close(fd);
+		return 1;
+	}
+
+	char *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		log_logError("Error mapping state snapshot", WARNING);
+		return 1;
+	}
+	madvise(map, info.st_size, MADV_SEQUENTIAL);
+
+	snap_loadData(map, info.st_size, "saved");
+	munmap(map, info.st_size);
+
+	return 1;
+}
+
+int snap_loadData(char *data, long size, char *source){
+	char buff[BUFSIZ];
+	struct snap_Header *header = (struct snap_Header *) data;
+	if(size < (long) sizeof(struct snap_Header) || memcmp(header->magic, SNAP_MAGIC, ARRAY_SIZE(header->magic)) != 0
+			|| header->version != SNAP_VERSION || header->size != (uint64_t) size){
+		log_logMessage("State snapshot is damaged, ignoring it.", WARNING);
+		return 1;
+	}
+
+	// A single pass: every channel record follows the record of its group
+	char *end = &data[size];
+	char *pos = &data[sizeof(struct snap_Header)];
+	struct link_Node *groupNode = NULL;
+	int numRecords = 0;
+	while(1){
+		pos = &data[(pos - data + 7) & ~7L];
+		if(end - pos < (long) sizeof(struct snap_Record))
+			break;
+
+		struct snap_Record *record = (struct snap_Record *) pos;
+		pos += sizeof(struct snap_Record);
+		groupNode = snap_loadRecord(record, &pos, end, groupNode);
+		if(groupNode == NULL){
+			log_logMessage("State snapshot has a damaged record, stopped loading it.", WARNING);
+			break;
+		}
+		numRecords++;
+	}
+
+	snprintf(buff, ARRAY_SIZE(buff), "Restored %d groups and channels %s at %ld.", numRecords, source, (long) header->time);
+	log_logMessage(buff, INFO);
+
+	return 1;
+}
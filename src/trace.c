@@ -0,0 +1,160 @@
+#define LOG_SUBSYSTEM LOG_CORE
+#include "trace.h"
+#include "boundless.h"
+
+struct trc_Tracer trc_state = {0};
+
+const char *trc_stageNames[TRC_NUM_STAGES] = {
+	"read", "dataqueue", "parse", "cmdqueue", "command", "sendq", "epollout", "write", "total"
+};
+
+__thread uint64_t trc_origin = 0;
+__thread struct trc_Thread *trc_self = NULL;
+
+int init_tracing(){
+	if(fig_Configuration.useTracing == 0)
+		return 1;
+
+	__atomic_store_n(&trc_state.enabled, 1, __ATOMIC_RELEASE);
+	log_logMessage("Tracing message latency per stage.", INFO);
+
+	return 1;
+}
+
+uint64_t trc_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+struct trc_Thread *trc_registerThread(const char *name){
+	if(trc_self != NULL)
+		return trc_self;
+
+	struct trc_Thread *thread = calloc(1, sizeof(struct trc_Thread));
+	if(thread == NULL){
+		log_logError("Error allocating trace histograms", WARNING);
+		return NULL;
+	}
+	snprintf(thread->name, ARRAY_SIZE(thread->name), "%s", name);
+
+	// Lock free push, threads are never removed
+	thread->next = __atomic_load_n(&trc_state.threads, __ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(&trc_state.threads, &thread->next, thread, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	trc_self = thread;
+	return thread;
+}
+
+void trc_recordValue(int stage, uint64_t ns){
+	if(trc_self == NULL && trc_registerThread("other") == NULL)
+		return;
+
+	// Only this thread writes, the stores just have to be whole for STATS
+	struct trc_Histogram *hist = &trc_self->stages[stage];
+	uint64_t *bucket = &hist->buckets[trc_bucket(ns)];
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->total, hist->total + ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELAXED);
+	if(ns > hist->max)
+		__atomic_store_n(&hist->max, ns, __ATOMIC_RELAXED);
+}
+
+uint64_t trc_record(int stage, uint64_t start){
+	uint64_t now = trc_now();
+	trc_recordValue(stage, now > start ? now - start : 0);
+
+	return now;
+}
+
+void trc_stampOnce(uint64_t *stamp){
+	uint64_t unset = 0;
+	__atomic_compare_exchange_n(stamp, &unset, trc_now(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+int trc_bucket(uint64_t ns){
+	if(ns < 2 << TRC_SUB_BITS)
+		return ns;
+
+	int shift = 63 - __builtin_clzll(ns) - TRC_SUB_BITS;
+	int bucket = (shift << TRC_SUB_BITS) + (ns >> shift);
+	return bucket < TRC_BUCKETS ? bucket : TRC_BUCKETS - 1;
+}
+
+uint64_t trc_bucketValue(int bucket){
+	if(bucket < 2 << TRC_SUB_BITS)
+		return bucket;
+
+	int shift = (bucket >> TRC_SUB_BITS) - 1;
+	uint64_t mantissa = (bucket & ((1 << TRC_SUB_BITS) - 1)) + (1 << TRC_SUB_BITS);
+	return ((mantissa + 1) << shift) - 1;
+}
+
+int trc_merge(struct trc_Histogram *hist, int stage){
+	int threads = 0;
+	memset(hist, 0, sizeof(struct trc_Histogram));
+
+	struct trc_Thread *thread = __atomic_load_n(&trc_state.threads, __ATOMIC_ACQUIRE);
+	for(; thread != NULL; thread = thread->next, threads++){
+		struct trc_Histogram *src = &thread->stages[stage];
+		for(int i = 0; i < TRC_BUCKETS; i++)
+			hist->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+
+		hist->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+		hist->total += __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+		uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+		if(max > hist->max)
+			hist->max = max;
+	}
+
+	return threads;
+}
+
+uint64_t trc_percentile(struct trc_Histogram *hist, double percentile){
+	// count is read apart from the buckets, so rank against what they hold
+	uint64_t count = 0;
+	for(int i = 0; i < TRC_BUCKETS; i++)
+		count += hist->buckets[i];
+
+	if(count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (percentile / 100.0 * count + 0.5);
+	if(rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for(int i = 0; i < TRC_BUCKETS; i++){
+		seen += hist->buckets[i];
+		if(seen >= rank){
+			uint64_t value = trc_bucketValue(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+int trc_getSummary(struct trc_Summary summaries[TRC_NUM_STAGES]){
+	struct trc_Histogram *hist = malloc(sizeof(struct trc_Histogram));
+	if(hist == NULL){
+		log_logError("Error allocating trace summary", WARNING);
+		return -1;
+	}
+
+	for(int i = 0; i < TRC_NUM_STAGES; i++){
+		trc_merge(hist, i);
+		summaries[i].stage = trc_stageNames[i];
+		summaries[i].count = hist->count;
+		summaries[i].mean = hist->count ? hist->total / hist->count : 0;
+		summaries[i].p50 = trc_percentile(hist, 50);
+		summaries[i].p90 = trc_percentile(hist, 90);
+		summaries[i].p99 = trc_percentile(hist, 99);
+		summaries[i].p999 = trc_percentile(hist, 99.9);
+		summaries[i].max = hist->max;
+	}
+
+	free(hist);
+	return TRC_NUM_STAGES;
+}
@@ -0,0 +1,711 @@
+#define _GNU_SOURCE // struct ucred
+#define LOG_SUBSYSTEM LOG_UPGRADE
+#include "upgrade.h"
+#include "boundless.h"
+
+struct upg_Handoff upg_handoff = {.conn = -1};
+int upg_handedOver = 0;
+int upg_listener = -1;
+pthread_t upg_listenThread;
+
+int init_upgrade(){
+	if(fig_Configuration.useUpgrade == 0)
+		return 1;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(fig_Configuration.upgradeSocket) >= sizeof(addr.sun_path)){
+		log_logMessage("UpgradeSocket path is too long.", ERROR);
+		return -1;
+	}
+	strncpy(addr.sun_path, fig_Configuration.upgradeSocket, sizeof(addr.sun_path) - 1);
+
+	int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(conn == -1){
+		log_logError("Error creating upgrade socket", ERROR);
+		return -1;
+	}
+
+	// Nobody listening means there is no server to replace
+	if(connect(conn, (struct sockaddr *) &addr, sizeof(addr)) == -1){
+		close(conn);
+		return 1;
+	}
+
+	log_logMessage("Taking over from the running server.", INFO);
+	if(upg_checkPeer(conn) == -1 || upg_receive(conn) == -1){
+		close(conn);
+		return -1;
+	}
+
+	return 1;
+}
+
+void upg_close(){
+	if(upg_listener == -1)
+		return;
+
+	close(upg_listener);
+	upg_listener = -1;
+
+	// The process that took over already listens on the same path
+	if(upg_handedOver == 0)
+		unlink(fig_Configuration.upgradeSocket);
+}
+
+int upg_takeListener(struct com_SocketInfo *info){
+	if(upg_handoff.active == 0)
+		return -1;
+
+	socklen_t len = sizeof(info->addr);
+	if(getsockname(upg_handoff.fds[0], (struct sockaddr *) &info->addr, &len) == -1){
+		log_logError("Error reading the handed over socket", ERROR);
+		return -1;
+	}
+
+	info->socket = upg_handoff.fds[0];
+	log_logMessage("Listening on the handed over socket.", INFO);
+	return info->socket;
+}
+
+int upg_listen(){
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(fig_Configuration.upgradeSocket) >= sizeof(addr.sun_path)){
+		log_logMessage("UpgradeSocket path is too long.", ERROR);
+		return -1;
+	}
+	strncpy(addr.sun_path, fig_Configuration.upgradeSocket, sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock == -1){
+		log_logError("Error creating upgrade socket", ERROR);
+		return -1;
+	}
+
+	// Left behind by the process this one replaced, or by one that crashed
+	unlink(addr.sun_path);
+	if(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || chmod(addr.sun_path, 0600) == -1
+			|| listen(sock, 1) == -1){
+		log_logError("Error listening on UpgradeSocket", ERROR);
+		close(sock);
+		return -1;
+	}
+
+	upg_listener = sock;
+	if(pthread_create(&upg_listenThread, NULL, upg_thread, NULL) != 0){
+		log_logError("Error creating upgrade thread", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+void *upg_thread(UNUSED(void *param)){
+	while(1){
+		int conn = accept(upg_listener, NULL, NULL);
+		if(conn == -1){
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			break; // Closed by upg_close()
+		}
+
+		if(upg_checkPeer(conn) == 1)
+			upg_handOver(conn);
+		close(conn);
+	}
+
+	return NULL;
+}
+
+int upg_checkPeer(int conn){
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1){
+		log_logError("Error checking upgrade peer", WARNING);
+		return -1;
+	}
+
+	if(cred.uid != geteuid()){
+		log_logMessage("Refused an upgrade from another user.", WARNING);
+		return -1;
+	}
+
+	return 1;
+}
+
+int upg_handOver(int conn){
+	char buff[BUFSIZ];
+	struct snap_Writer state = {0};
+	struct snap_Writer data = {0};
+	struct upg_Header header = {0};
+	char confirm;
+
+	log_logMessage("A new binary connected, handing the clients over.", INFO);
+	struct timeval timeout = {.tv_sec = UPG_TIMEOUT};
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Nothing may reach the clients between taking the state and quitting
+	// Events go first, a timeout or a save must not run while users are handed over
+	evt_pausePool();
+	com_pauseIO();
+	chat_waitIdle();
+	for(int i = 0; i < com_numThreads; i++)
+		com_drainFanOut(&com_ioThreads[i]);
+	arch_flush();
+
+	int *index = malloc(serverLists.max * sizeof(int));
+	int *fds = malloc((serverLists.max + 1) * sizeof(int));
+	if(index == NULL || fds == NULL){
+		log_logError("Error allocating handoff", WARNING);
+		goto resume;
+	}
+
+	fds[0] = com_serverSocket;
+	int numUsers = upg_addUsers(&data, index, &fds[1]);
+	upg_addGroups(&data, index);
+	if(data.failed){
+		log_logMessage("Error building handoff.", WARNING);
+		goto resume;
+	}
+	if(snap_build(&state) == -1)
+		goto resume;
+
+	memcpy(header.magic, UPG_MAGIC, ARRAY_SIZE(header.magic));
+	header.version = UPG_VERSION;
+	header.numFds = numUsers + 1;
+	header.stateLen = state.len;
+	header.dataLen = data.len;
+	header.nextMsgid = hist_newMsgid();
+
+	if(upg_send(conn, &header, sizeof(header)) == -1 || upg_send(conn, state.data, state.len) == -1
+			|| upg_send(conn, data.data, data.len) == -1 || upg_sendFds(conn, fds, numUsers + 1) == -1
+			|| upg_recv(conn, &confirm, 1) == -1)
+		goto resume;
+
+	// From here on the new process serves the clients
+	upg_handedOver = 1;
+	upg_send(conn, &confirm, 1);
+	snprintf(buff, ARRAY_SIZE(buff), "Handed %d clients over, quitting.", numUsers);
+	log_logMessage(buff, INFO);
+	exit(EXIT_SUCCESS);
+
+resume:
+	log_logMessage("Upgrade failed, resuming.", WARNING);
+	free(state.data);
+	free(data.data);
+	free(index);
+	free(fds);
+	com_resumeIO();
+	evt_resumePool();
+
+	return -1;
+}
+
+int upg_addUsers(struct snap_Writer *writer, int *index, int *fds){
+	char nick[fig_Configuration.nickLen];
+	int count = 0;
+
+	for(int i = 0; i < serverLists.max; i++){
+		struct usr_UserData *user = &serverLists.users[i];
+		struct upg_User record = {.type = UPG_USER};
+		index[i] = -1;
+
+		pthread_mutex_lock(&user->userMutex);
+		int fd = user->socketInfo.socket;
+		int valid = user->id > 0 && fd >= 0; // SERVER is never handed over
+		if(valid){
+			memcpy(record.modes, user->modes, ARRAY_SIZE(record.modes));
+			record.lastMsg = user->lastMsg;
+			record.pinged = user->pinged;
+			memcpy(&record.addr, &user->socketInfo.addr, sizeof(record.addr));
+		}
+		pthread_mutex_unlock(&user->userMutex);
+
+		if(!valid || usr_getNickname(nick, user) == -1)
+			continue;
+
+		snap_put(writer, &record, sizeof(record), 1);
+		long start = writer->len - sizeof(record);
+		snap_putString(writer, nick);
+
+		// Whatever the IO thread did not get to yet
+		uint32_t sendLen = 0;
+		pthread_mutex_lock(&user->userMutex);
+		for(struct link_Node *node = user->sendQ.head; node != NULL; node = node->next){
+			struct com_QueueJob *job = node->data;
+			char *str = job->buffer != NULL ? job->buffer->str : job->str;
+			int len = job->buffer != NULL ? job->buffer->len : (int) strnlen(job->str, COM_LINE_LEN);
+
+			snap_put(writer, str, len, 0);
+			sendLen += len;
+		}
+		pthread_mutex_unlock(&user->userMutex);
+
+		if(writer->failed == 0)
+			((struct upg_User *) &writer->data[start])->sendLen = sendLen;
+
+		index[i] = count;
+		fds[count++] = fd;
+	}
+
+	return count;
+}
+
+int upg_addMembers(struct snap_Writer *writer, struct mbr_List *list, int *index){
+	int count = 0;
+
+	struct mbr_Snapshot *snapshot = mbr_acquire(list);
+	for(int i = 0; i < snapshot->count; i++){
+		long slot = MBR_MEMBER(snapshot, i)->user - serverLists.users;
+		if(slot < 0 || slot >= serverLists.max || index[slot] == -1)
+			continue;
+
+		struct upg_Member member = {index[slot], MBR_MEMBER(snapshot, i)->permLevel};
+		snap_put(writer, &member, sizeof(member), 0);
+		count++;
+	}
+	mbr_release();
+
+	return count;
+}
+
+int upg_addLines(struct snap_Writer *writer, struct hist_Ring *ring){
+	if(ring->capacity <= 0)
+		return 0;
+
+	struct hist_Entry *entries = malloc(ring->capacity * sizeof(struct hist_Entry));
+	if(entries == NULL){
+		log_logError("Error allocating handoff", WARNING);
+		writer->failed = 1;
+		return 0;
+	}
+
+	int count = hist_collect(ring, 0, 0, entries, ring->capacity);
+	for(int i = 0; i < count; i++){
+		struct upg_Line line = {entries[i].msgid, entries[i].time, entries[i].buffer->len};
+		snap_put(writer, &line, sizeof(line), 0);
+		snap_put(writer, entries[i].buffer->str, entries[i].buffer->len, 0);
+	}
+	hist_releaseEntries(entries, count);
+	free(entries);
+
+	return count;
+}
+
+int upg_addList(struct snap_Writer *writer, uint32_t type, char *name, struct mbr_List *list, struct hist_Ring *ring, int *index){
+	struct upg_List record = {.type = type};
+	snap_put(writer, &record, sizeof(record), 1);
+	long start = writer->len - sizeof(record);
+	snap_putString(writer, name);
+
+	uint32_t numMembers = upg_addMembers(writer, list, index);
+	uint32_t numLines = ring != NULL ? upg_addLines(writer, ring) : 0;
+	if(writer->failed == 0){
+		struct upg_List *saved = (struct upg_List *) &writer->data[start];
+		saved->numMembers = numMembers;
+		saved->numLines = numLines;
+	}
+
+	return writer->failed ? -1 : 1;
+}
+
+int upg_addGroups(struct snap_Writer *writer, int *index){
+	// Nothing creates channels while the IO threads are paused
+	pthread_mutex_lock(&serverLists.groupsMutex);
+	for(struct link_Node *groupNode = serverLists.groups.head; groupNode != NULL; groupNode = groupNode->next){
+		struct grp_Group *group = groupNode->data;
+		upg_addList(writer, UPG_GROUP, group->name, &group->members, NULL, index);
+
+		pthread_mutex_lock(&group->groupMutex);
+		struct link_Node *first = group->channels.head;
+		pthread_mutex_unlock(&group->groupMutex);
+
+		for(struct link_Node *node = first; node != NULL; node = node->next){
+			struct chan_Channel *channel = node->data;
+			upg_addList(writer, UPG_CHANNEL, channel->name, &channel->members, &channel->history, index);
+		}
+	}
+	pthread_mutex_unlock(&serverLists.groupsMutex);
+
+	return writer->failed ? -1 : 1;
+}
+
+int upg_send(int conn, void *data, long len){
+	long done = 0;
+	while(done < len){
+		ssize_t ret = send(conn, (char *) data + done, len - done, MSG_NOSIGNAL);
+		if(ret == -1 && errno == EINTR)
+			continue;
+		if(ret == -1){
+			log_logError("Error writing to the upgrade connection", WARNING);
+			return -1;
+		}
+		done += ret;
+	}
+
+	return 1;
+}
+
+int upg_recv(int conn, void *data, long len){
+	long done = 0;
+	while(done < len){
+		ssize_t ret = recv(conn, (char *) data + done, len - done, 0);
+		if(ret == -1 && errno == EINTR)
+			continue;
+		if(ret == -1){
+			log_logError("Error reading from the upgrade connection", WARNING);
+			return -1;
+		}
+		if(ret == 0){
+			log_logMessage("The upgrade connection closed early.", WARNING);
+			return -1;
+		}
+		done += ret;
+	}
+
+	return 1;
+}
+
+int upg_sendFds(int conn, int *fds, int count){
+	union {
+		char buff[CMSG_SPACE(sizeof(int) * UPG_FDS_PER_MSG)];
+		struct cmsghdr align;
+	} control;
+
+	for(int sent = 0; sent < count; sent += UPG_FDS_PER_MSG){
+		int num = count - sent < UPG_FDS_PER_MSG ? count - sent : UPG_FDS_PER_MSG;
+
+		// Every batch rides on a single byte
+		char byte = 0;
+		struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+		struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+		msg.msg_control = control.buff;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * num);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num);
+		memcpy(CMSG_DATA(cmsg), &fds[sent], sizeof(int) * num);
+
+		ssize_t ret;
+		do {
+			ret = sendmsg(conn, &msg, MSG_NOSIGNAL);
+		} while(ret == -1 && errno == EINTR);
+
+		if(ret != 1){
+			log_logError("Error passing sockets", WARNING);
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+int upg_recvFds(int conn, int *fds, int count){
+	union {
+		char buff[CMSG_SPACE(sizeof(int) * UPG_FDS_PER_MSG)];
+		struct cmsghdr align;
+	} control;
+
+	for(int received = 0; received < count; ){
+		int num = count - received < UPG_FDS_PER_MSG ? count - received : UPG_FDS_PER_MSG;
+
+		char byte;
+		struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+		struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+		msg.msg_control = control.buff;
+		msg.msg_controllen = sizeof(control.buff);
+
+		ssize_t ret;
+		do {
+			ret = recvmsg(conn, &msg, 0);
+		} while(ret == -1 && errno == EINTR);
+
+		if(ret != 1){
+			log_logError("Error receiving sockets", ERROR);
+			return -1;
+		}
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+				|| cmsg->cmsg_len != CMSG_LEN(sizeof(int) * num) || (msg.msg_flags & MSG_CTRUNC)){
+			log_logMessage("The running server sent a damaged batch of sockets.", ERROR);
+			return -1;
+		}
+
+		memcpy(&fds[received], CMSG_DATA(cmsg), sizeof(int) * num);
+		received += num;
+	}
+
+	return 1;
+}
+
+int upg_receive(int conn){
+	char buff[BUFSIZ];
+	struct timeval timeout = {.tv_sec = UPG_TIMEOUT};
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	struct upg_Header *header = &upg_handoff.header;
+	if(upg_recv(conn, header, sizeof(struct upg_Header)) == -1)
+		return -1;
+
+	if(memcmp(header->magic, UPG_MAGIC, ARRAY_SIZE(header->magic)) != 0 || header->version != UPG_VERSION
+			|| header->numFds == 0){
+		log_logMessage("The running server sent a handoff this binary does not understand.", ERROR);
+		return -1;
+	}
+
+	upg_handoff.state = malloc(header->stateLen);
+	upg_handoff.data = malloc(header->dataLen + 1);
+	upg_handoff.fds = malloc(header->numFds * sizeof(int));
+	if(upg_handoff.state == NULL || upg_handoff.data == NULL || upg_handoff.fds == NULL){
+		log_logError("Error allocating handoff", ERROR);
+		return -1;
+	}
+
+	if(upg_recv(conn, upg_handoff.state, header->stateLen) == -1 || upg_recv(conn, upg_handoff.data, header->dataLen) == -1
+			|| upg_recvFds(conn, upg_handoff.fds, header->numFds) == -1)
+		return -1;
+
+	// Ids given out by the old process are never repeated
+	hist_seedMsgid(header->nextMsgid);
+
+	upg_handoff.conn = conn;
+	upg_handoff.active = 1;
+
+	snprintf(buff, ARRAY_SIZE(buff), "Received %u sockets and %lu bytes of state.", header->numFds,
+			(unsigned long) (header->stateLen + header->dataLen));
+	log_logMessage(buff, INFO);
+
+	return 1;
+}
+
+int upg_restoreUser(struct upg_User *record, char **pos, char *end, int fd, int number, struct usr_UserData **user){
+	char nick[MAX_MESSAGE_LENGTH];
+	*user = NULL;
+
+	if(snap_getString(pos, end, nick, ARRAY_SIZE(nick)) == -1 || end - *pos < (long) record->sendLen)
+		return -1;
+	char *output = *pos;
+	*pos += record->sendLen;
+
+	struct com_SocketInfo info = {0};
+	info.socket = fd;
+	info.ioThread = number % com_numThreads;
+	memcpy(&info.addr, &record->addr, sizeof(info.addr));
+	info.socket2 = dup(fd);
+	if(info.socket2 == -1){
+		log_logError("Error creating 2nd fd for client", WARNING);
+		close(fd);
+		return 1;
+	}
+
+	*user = usr_createUser(&info, nick);
+	if(*user == NULL){
+		close(info.socket);
+		close(info.socket2);
+		return 1;
+	}
+
+	pthread_mutex_lock(&(*user)->userMutex);
+	memcpy((*user)->modes, record->modes, ARRAY_SIZE((*user)->modes));
+	(*user)->lastMsg = record->lastMsg;
+	(*user)->pinged = record->pinged;
+	pthread_mutex_unlock(&(*user)->userMutex);
+
+	// Written as soon as the connection is added to an epoll
+	if(record->sendLen > 0){
+		struct com_Buffer *buffer = com_allocBuffer(record->sendLen + 1);
+		if(buffer != NULL){
+			memcpy(buffer->str, output, record->sendLen);
+			buffer->len = record->sendLen;
+			buffer->str[buffer->len] = '\0';
+			com_queueBuffer(*user, buffer);
+			com_releaseBuffer(buffer);
+		}
+	}
+
+	return 1;
+}
+
+int upg_restoreList(struct upg_List *record, char **pos, char *end, struct link_Node **groupNode,
+		struct usr_UserData **users, int numUsers){
+	char name[MAX_MESSAGE_LENGTH];
+	if(snap_getString(pos, end, name, ARRAY_SIZE(name)) == -1
+			|| (uint64_t) (end - *pos) < (uint64_t) record->numMembers * sizeof(struct upg_Member))
+		return -1;
+
+	// The snapshot that came along already created every group and channel
+	struct mbr_List *list = NULL;
+	pthread_mutex_t *mutex = NULL;
+	struct chan_Channel *channel = NULL;
+	if(record->type == UPG_GROUP){
+		*groupNode = grp_getGroup(name);
+		if(*groupNode != NULL){
+			struct grp_Group *group = (*groupNode)->data;
+			list = &group->members;
+			mutex = &group->groupMutex;
+		}
+	} else if(*groupNode != NULL){
+		struct link_Node *channelNode = grp_getChannel(*groupNode, name);
+		if(channelNode != NULL){
+			channel = channelNode->data;
+			list = &channel->members;
+			mutex = &channel->channelMutex;
+		}
+	}
+
+	// Every list is published once instead of once per member
+	struct mbr_Member *members = malloc((record->numMembers + 1) * sizeof(struct mbr_Member));
+	if(members == NULL){
+		log_logError("Error allocating members", ERROR);
+		return -1;
+	}
+
+	int count = 0;
+	for(uint32_t i = 0; i < record->numMembers; i++){
+		struct upg_Member member;
+		memcpy(&member, *pos, sizeof(member));
+		*pos += sizeof(member);
+
+		if(member.user < (uint32_t) numUsers && users[member.user] != NULL){
+			members[count].user = users[member.user];
+			members[count].permLevel = member.permLevel;
+			count++;
+		}
+	}
+
+	if(list != NULL){
+		pthread_mutex_lock(mutex);
+		mbr_addMany(list, members, count);
+		pthread_mutex_unlock(mutex);
+	}
+	free(members);
+
+	for(uint32_t i = 0; i < record->numLines; i++){
+		struct upg_Line line;
+		if(end - *pos < (long) sizeof(line))
+			return -1;
+		memcpy(&line, *pos, sizeof(line));
+		*pos += sizeof(line);
+		if(end - *pos < (long) line.len)
+			return -1;
+
+		// Already archived by the old process, only remembered and indexed again
+		struct com_Buffer *buffer = channel != NULL ? com_allocBuffer(line.len + 1) : NULL;
+		if(buffer != NULL){
+			memcpy(buffer->str, *pos, line.len);
+			buffer->len = line.len;
+			buffer->str[buffer->len] = '\0';
+			hist_add(&channel->history, buffer, line.msgid, line.time);
+			srch_addMessage(channel, line.msgid, line.time, buffer);
+			com_releaseBuffer(buffer);
+		}
+		*pos += line.len;
+	}
+
+	return 1;
+}
+
+int upg_restore(struct usr_UserData **users, int numUsers){
+	char *data = upg_handoff.data;
+	char *end = &data[upg_handoff.header.dataLen];
+	char *pos = data;
+	struct link_Node *groupNode = NULL;
+	int numRestored = 0;
+
+	while(1){
+		pos = &data[(pos - data + 7) & ~7L];
+		if(end - pos < (long) sizeof(uint32_t))
+			break;
+
+		int ret = -1;
+		uint32_t type;
+		memcpy(&type, pos, sizeof(type));
+		if(type == UPG_USER && end - pos >= (long) sizeof(struct upg_User) && numRestored < numUsers){
+			struct upg_User *record = (struct upg_User *) pos;
+			pos += sizeof(struct upg_User);
+			ret = upg_restoreUser(record, &pos, end, upg_handoff.fds[numRestored + 1], numRestored, &users[numRestored]);
+			numRestored++;
+		} else if((type == UPG_GROUP || type == UPG_CHANNEL) && end - pos >= (long) sizeof(struct upg_List)){
+			struct upg_List *record = (struct upg_List *) pos;
+			pos += sizeof(struct upg_List);
+			ret = upg_restoreList(record, &pos, end, &groupNode, users, numUsers);
+		}
+
+		if(ret == -1){
+			log_logMessage("The handoff has a damaged record.", ERROR);
+			return -1;
+		}
+	}
+
+	// Sockets without a record are of no use
+	for(int i = numRestored; i < numUsers; i++)
+		close(upg_handoff.fds[i + 1]);
+
+	return 1;
+}
+
+int upg_confirm(){
+	char confirm = 'K';
+	if(upg_send(upg_handoff.conn, &confirm, 1) == -1 || upg_recv(upg_handoff.conn, &confirm, 1) == -1){
+		log_logMessage("The old server did not let go of its clients.", ERROR);
+		return -1;
+	}
+
+	return 1;
+}
+
+int upg_resume(){
+	char buff[BUFSIZ];
+
+	if(upg_handoff.active){
+		int numUsers = upg_handoff.header.numFds - 1;
+		struct usr_UserData **users = calloc(numUsers + 1, sizeof(struct usr_UserData *));
+		if(users == NULL){
+			log_logError("Error allocating handed over users", ERROR);
+			return -1;
+		}
+
+		if(upg_restore(users, numUsers) == -1 || upg_confirm() == -1){
+			free(users);
+			return -1;
+		}
+
+		// The old process is quitting, from here on this one serves the clients
+		int numClients = 0;
+		for(int i = 0; i < numUsers; i++){
+			if(users[i] == NULL)
+				continue;
+
+			if(com_addClient(users[i]) == -1)
+				usr_deleteUser(users[i]);
+			else
+				numClients++;
+		}
+		free(users);
+
+		close(upg_handoff.conn);
+		upg_handoff.conn = -1;
+		free(upg_handoff.state);
+		free(upg_handoff.data);
+		free(upg_handoff.fds);
+		upg_handoff.state = upg_handoff.data = NULL;
+		upg_handoff.fds = NULL;
+
+		snprintf(buff, ARRAY_SIZE(buff), "Took over %d clients.", numClients);
+		log_logMessage(buff, INFO);
+	}
+
+	// Only now, a client accepted earlier could take a nick or channel a handed over user still had
+	if(com_listen() == -1)
+		return -1;
+
+	if(fig_Configuration.useUpgrade == 0)
+		return 1;
+
+	return upg_listen();
+}
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM LOG_USER
 #include "user.h"
 
 size_t usr_globalUserID = 0;
@@ -8,29 +9,138 @@ int usr_getNickname(char *buff, struct usr_UserData *user){
         return -1;
     }
 
-    pthread_mutex_lock(&user->userMutex);
-    strncpy(buff, user->nickname, fig_Configuration.nickLen);
-    pthread_mutex_unlock(&user->userMutex);
+    int ret = -1;
+    rcl_readLock();
+    struct usr_Name *name = __atomic_load_n(&user->name, __ATOMIC_ACQUIRE);
+    if(name != NULL){
+        strncpy(buff, name->nick, fig_Configuration.nickLen);
+        ret = 1;
+    }
+    rcl_readUnlock();
 
-    return 1;
+    return ret;
+}
+
+int usr_getPrefix(char *buff, int size, struct usr_UserData *user){
+    if(user == NULL || user->id < 0){
+        return -1;
+    }
+
+    int ret = -1;
+    rcl_readLock();
+    struct usr_Name *name = __atomic_load_n(&user->name, __ATOMIC_ACQUIRE);
+    if(name != NULL){
+        snprintf(buff, size, "%s", name->prefix);
+        ret = 1;
+    }
+    rcl_readUnlock();
+
+    return ret;
+}
+
+// Both strings share one allocation so a NICK is a single swap
+struct usr_Name *usr_createName(char *nick, char *host){
+	int nickLen = strnlen(nick, fig_Configuration.nickLen-1);
+	int prefixLen = nickLen*2 + strlen(host) + 2; // nick!nick@host
+
+	struct usr_Name *name = malloc(sizeof(struct usr_Name) + nickLen + prefixLen + 2);
+	if(name == NULL){
+		log_logError("Error allocating nickname", ERROR);
+		return NULL;
+	}
+
+	name->nick = name->data;
+	memcpy(name->nick, nick, nickLen);
+	name->nick[nickLen] = '\0';
+
+	name->prefix = &name->data[nickLen+1];
+	snprintf(name->prefix, prefixLen+1, "%s!%s@%s", name->nick, name->nick, host);
+
+	return name;
+}
+
+int usr_setNickname(struct usr_UserData *user, char *nick){
+	if(user == NULL || nick == NULL)
+		return -1;
+
+	struct usr_Name *name = usr_createName(nick, user->host);
+	if(name == NULL)
+		return -1;
+
+	// Readers still holding the old name keep it until they are done
+	struct usr_Name *old = __atomic_exchange_n(&user->name, name, __ATOMIC_ACQ_REL);
+	rcl_retire(old, NULL);
+
+	// Only the lists showing this nick are rendered again
+	pthread_mutex_lock(&user->userMutex);
+	usr_touchLists(user);
+	pthread_mutex_unlock(&user->userMutex);
+
+	return 1;
+}
+
+int usr_addList(struct usr_UserData *user, struct mbr_List *list){
+	int ret = 1;
+
+	pthread_mutex_lock(&user->userMutex);
+	if(user->id < 0){ // Disconnected, the slot forgets its lists
+		pthread_mutex_unlock(&user->userMutex);
+		return -1;
+	}
+
+	if(user->numLists == user->maxLists){
+		int max = user->maxLists == 0 ? 4 : user->maxLists * 2;
+		struct mbr_List **lists = realloc(user->lists, max * sizeof(struct mbr_List *));
+		if(lists == NULL){
+			log_logError("Error growing the lists of a user", WARNING);
+			ret = -1;
+		} else {
+			user->lists = lists;
+			user->maxLists = max;
+		}
+	}
+
+	if(ret == 1)
+		user->lists[user->numLists++] = list;
+	pthread_mutex_unlock(&user->userMutex);
+
+	return ret;
+}
+
+void usr_removeList(struct usr_UserData *user, struct mbr_List *list){
+	pthread_mutex_lock(&user->userMutex);
+	for(int i = 0; i < user->numLists; i++){
+		if(user->lists[i] == list){
+			user->lists[i] = user->lists[--user->numLists];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&user->userMutex);
+}
+
+void usr_touchLists(struct usr_UserData *user){
+	for(int i = 0; i < user->numLists; i++)
+		__atomic_add_fetch(&user->lists[i]->version, 1, __ATOMIC_RELEASE);
 }
 
 struct usr_UserData *usr_getUserByName(char *name){
-    struct usr_UserData *user;
+    struct usr_UserData *user, *ret = NULL;
 
+    rcl_readLock();
     for(int i = 0; i < serverLists.max; i++){
             user = &serverLists.users[i];
-            pthread_mutex_lock(&user->userMutex);
+            if(__atomic_load_n(&user->id, __ATOMIC_ACQUIRE) < 0)
+                    continue;
 
-            if(user->id >= 0 && !strncmp(user->nickname, name, fig_Configuration.nickLen)){
-                    pthread_mutex_unlock(&user->userMutex);
-                    return user;
+            struct usr_Name *userName = __atomic_load_n(&user->name, __ATOMIC_ACQUIRE);
+            if(userName != NULL && !strncmp(userName->nick, name, fig_Configuration.nickLen)){
+                    ret = user;
+                    break;
             }
-
-            pthread_mutex_unlock(&user->userMutex);
     }
+    rcl_readUnlock();
 
-    return NULL;
+    return ret;
 }
 
 struct usr_UserData *usr_getUserBySocket(int sock){
@@ -96,23 +206,35 @@ struct usr_UserData *usr_createUser(struct com_SocketInfo *sockInfo, char *name)
     //Set user's data
     memset(user, 0, sizeof(struct usr_UserData));
 
+	memcpy(&user->socketInfo, sockInfo, sizeof(struct com_SocketInfo));
+	if(getHost(user->host, sockInfo->addr, sockInfo->addr.ss_family) < 0)
+		strncpy(user->host, "unknown", ARRAY_SIZE(user->host)-1);
+
 	// Allocate necesary data for the user's nickname
-	user->nickname = calloc(fig_Configuration.nickLen, sizeof(char));
-	if(user->nickname == NULL){
-		log_logError("Error allocating user memory", ERROR);
+	struct usr_Name *userName = usr_createName(name, user->host);
+	if(userName == NULL){
 		return NULL;
 	}
 
-	memcpy(&user->socketInfo, sockInfo, sizeof(struct com_SocketInfo));
 	usr_changeUserMode(user, '+', 'r');
-	user->lastMsg = time(NULL); // Starting time
+	user->lastMsg = clk_now(); // Starting time
 	user->pinged = 0; // Dont ping on registration, but still kick if idle
 
-    //eventually get this id from saved user data
-    user->id = usr_globalUserID++;
+	// Publish the name before the id so a valid user always has one
+	__atomic_store_n(&user->name, userName, __ATOMIC_RELEASE);
 
+    //eventually get this id from saved user data
 	// Do this last to ensure user isn't selected before it is ready to be used
-    strncpy(user->nickname, name, fig_Configuration.nickLen);
+    __atomic_store_n(&user->id, usr_globalUserID++, __ATOMIC_RELEASE);
+
+	// Nothing can time out before half of TimeOut passed
+	uint64_t timer = evt_addTimer(&evt_scheduler, fig_Configuration.timeOut * 500L, 0, 0, usr_checkTimeout, user);
+	if(timer == 0)
+		log_logMessage("Error adding the timeout timer of a user.", WARNING);
+
+	pthread_mutex_lock(&user->userMutex);
+	user->timer = timer;
+	pthread_mutex_unlock(&user->userMutex);
 
     return user;
 }
@@ -125,9 +247,16 @@ int usr_deleteUser(struct usr_UserData *user){
 		printf("c%p\n", user);
     // Nothing new will be sent to queue
     pthread_mutex_lock(&user->userMutex);
-    user->id = -1; // -1 means invalid user
-	if(user->nickname != NULL)
-		free(user->nickname);
+    __atomic_store_n(&user->id, -1, __ATOMIC_RELEASE); // -1 means invalid user
+	uint64_t timer = user->timer;
+	user->timer = 0;
+	rcl_retire(__atomic_exchange_n(&user->name, NULL, __ATOMIC_ACQ_REL), NULL);
+
+	// The nick leaves the NAMES of its lists, the slot starts over without any
+	usr_touchLists(user);
+	free(user->lists);
+	user->lists = NULL;
+	user->numLists = user->maxLists = 0;
 
     // Remove socket
 	close(user->socketInfo.socket);
@@ -137,6 +266,9 @@ int usr_deleteUser(struct usr_UserData *user){
 
     pthread_mutex_unlock(&user->userMutex);
 
+	// When it is the one deleting the user, it is freed once it returns
+	evt_cancelTimer(&evt_scheduler, timer);
+
     // Remove all pending messages
     com_cleanQueue(user);
 
@@ -148,34 +280,41 @@ int usr_deleteUser(struct usr_UserData *user){
     return 1;
 }
 
-// Searches for and kicks users that surpassed their message timeouts
-int usr_timeOutUsers(int timeOut){
-    struct usr_UserData *user;
+// Kicks the user once it surpassed its message timeout and pings it halfway there
+int usr_checkTimeout(void *data){
+    struct usr_UserData *user = data;
+	int timeOut = fig_Configuration.timeOut;
 
-    for(int i = 0; i < serverLists.max; i++){
-            user = &serverLists.users[i];
+	pthread_mutex_lock(&user->userMutex);
+	int id = user->id;
+	int diff = (int) difftime(clk_now(), user->lastMsg);
+	int pinged = user->pinged;
+	uint64_t timer = user->timer;
+	pthread_mutex_unlock(&user->userMutex);
 
-            pthread_mutex_lock(&user->userMutex);
-			int id = user->id;
-			int diff = (int) difftime(time(NULL), user->lastMsg);
-			int pinged = user->pinged;
-			pthread_mutex_unlock(&user->userMutex);
-
-			if(id != -1 && id != 0){ // Neither invalid nor SERVER
-				if(diff > timeOut){
-					log_logMessage("User timeout.", INFO);
-					usr_deleteUser(user);	
-				} else if(pinged == -1 && diff > timeOut/2){ // Ping user
-					com_sendStr(user, "PING :Timeout imminent.");
-
-					pthread_mutex_lock(&user->userMutex);
-					user->pinged = 1;
-					pthread_mutex_unlock(&user->userMutex);
-				}
-			}
-    }
+	// The slot may have been reused since, the check is just as right for its new user
+	if(id == -1 || id == 0) // Neither invalid nor SERVER
+		return 1;
 
-    return 1;
+	if(diff > timeOut){
+		log_logMessage("User timeout.", INFO);
+		usr_deleteUser(user);
+		return 1;
+	}
+
+	if(pinged == -1 && diff > timeOut/2){ // Ping user
+		com_sendStr(user, "PING :Timeout imminent.");
+
+		pthread_mutex_lock(&user->userMutex);
+		user->pinged = 1;
+		pthread_mutex_unlock(&user->userMutex);
+		pinged = 1;
+	}
+
+	// Messages since only push the next check further out, it looks at lastMsg again then
+	int due = pinged == -1 ? timeOut/2 : timeOut;
+	evt_moveTimer(&evt_scheduler, timer, (due - diff + 1) * 1000L);
+	return 1;
 }
 
 void usr_changeUserMode(struct usr_UserData *user, char op, char mode){
@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "histogram.h"
+
+/*	Synthetic load against a running server:
+		bench [-h host] [-p port] [-c connections] [-m channels] [-j joins]
+			[-z zipf exponent] [-r messages/s] [-s size] [-l message limit]
+			[-d seconds] [-w warmup seconds] [-t threads] [-P server pid] [-o json file]
+
+	Opens the connections, registers each with NICK and lets it join
+	-j of the -m channels, picked uniformly or, with -z, following a Zipf
+	distribution so a few channels get most of the members. Once every
+	connection joined, they send PRIVMSGs to their channels at -r
+	messages per second together, each carrying the time it was due.
+
+	A client that receives one of them records how long the delivery
+	took, from when the message was due rather than when it went out,
+	so a client that fell behind does not hide the delay. A client that
+	falls more than one message behind skips the ones it missed. Only
+	messages due between the warmup and the end are counted.
+
+	MessageLimit is enforced per read by the server, counting from when
+	the connection was accepted: with -l every client waits that long
+	before it registers, registration and joins go out in a single write
+	and every client sends at most once per that many seconds, which
+	caps the rate at connections / limit. With -P the resident memory of the server is read before and
+	after connecting.
+
+	A summary is printed to stderr and the results as JSON to stdout or
+	the -o file, latencies in microseconds.
+*/
+
+#define BENCH_IN_SIZE 16384
+#define BENCH_OUT_SIZE 8192
+#define BENCH_MAX_CONNECTING 64 // Per thread, the listen backlog of the server is small
+#define BENCH_LIMIT_MARGIN 0.05 // Seconds added to MessageLimit
+
+// Phases, in order
+#define BENCH_CONNECT 0
+#define BENCH_RUN 1
+#define BENCH_DRAIN 2
+#define BENCH_DONE 3
+
+#define BENCH_NEW 0
+#define BENCH_CONNECTING 1
+#define BENCH_WAITING 2 // Connected, waiting out MessageLimit before registering
+#define BENCH_REGISTERING 3 // NICK and JOINs sent, waiting for the PONG after them
+#define BENCH_READY 4
+#define BENCH_CLOSED 5
+
+struct bench_Options {
+	char *host, *port, *output;
+	int connections, channels, joins, threads, size;
+	double zipf, rate, limit, duration, warmup;
+	int pid;
+};
+
+struct bench_Client {
+	int fd;
+	int id;
+	int state;
+	int watchOut;
+	uint64_t connectStart;
+	uint64_t registerAt; // While BENCH_WAITING
+	uint64_t nextSend; // When its next message is due
+	int *channels;
+	char in[BENCH_IN_SIZE];
+	int inLen;
+	char out[BENCH_OUT_SIZE];
+	int outLen;
+};
+
+struct bench_Thread {
+	pthread_t thread;
+	int epfd;
+	struct bench_Client *clients;
+	int count;
+	int connected; // Clients that were started so far
+	int cursor; // Next client to send, they are due in order
+	unsigned int seed;
+
+	struct hdr_Histogram latency, setup;
+	unsigned long sent, delivered, skipped, failed, kicked;
+	unsigned long bytesIn, bytesOut;
+};
+
+struct bench_State {
+	struct bench_Options opt;
+	struct addrinfo *addr;
+	double *cdf; // Chance of picking a channel up to and including this one
+	struct bench_Thread *threads;
+
+	int phase;
+	int ready, failed; // Connections that finished or gave up setting up
+	uint64_t runStart; // Messages are due from here on
+	uint64_t measureStart, measureEnd;
+	uint64_t interval; // Between two messages of the same client
+};
+
+struct bench_State bench;
+
+uint64_t bench_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Returns the resident memory of a process in KiB, -1 if it can not be read
+long bench_readRss(int pid){
+	char path[64], line[256];
+	long rss = -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+
+	while(fgets(line, sizeof(line), fp) != NULL){
+		if(!strncmp(line, "VmRSS:", 6)){
+			rss = strtol(line + 6, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return rss;
+}
+
+// Weights channel k with 1 / (k + 1)^exponent, 0 picks every channel alike
+int bench_buildCdf(int channels, double exponent){
+	bench.cdf = malloc(channels * sizeof(double));
+	if(bench.cdf == NULL)
+		return -1;
+
+	double total = 0;
+	for(int i = 0; i < channels; i++){
+		total += exponent > 0 ? 1.0 / pow(i + 1, exponent) : 1.0;
+		bench.cdf[i] = total;
+	}
+	for(int i = 0; i < channels; i++)
+		bench.cdf[i] /= total;
+
+	return 1;
+}
+
+int bench_pickChannel(unsigned int *seed){
+	double value = (double) rand_r(seed) / ((double) RAND_MAX + 1);
+	int low = 0, high = bench.opt.channels - 1;
+
+	while(low < high){
+		int mid = (low + high) / 2;
+		if(bench.cdf[mid] <= value)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+// Picks the distinct channels a client joins
+int bench_pickChannels(struct bench_Client *client, unsigned int *seed){
+	client->channels = malloc(bench.opt.joins * sizeof(int));
+	if(client->channels == NULL)
+		return -1;
+
+	for(int i = 0; i < bench.opt.joins; i++){
+		int channel, taken;
+		do {
+			channel = bench_pickChannel(seed);
+			taken = 0;
+			for(int j = 0; j < i; j++)
+				taken |= client->channels[j] == channel;
+		} while(taken);
+
+		client->channels[i] = channel;
+	}
+
+	return 1;
+}
+
+void bench_watch(struct bench_Thread *thread, struct bench_Client *client, int watchOut){
+	if(watchOut == client->watchOut)
+		return;
+
+	struct epoll_event event = {.events = EPOLLIN | (watchOut ? EPOLLOUT : 0), .data.ptr = client};
+	epoll_ctl(thread->epfd, EPOLL_CTL_MOD, client->fd, &event);
+	client->watchOut = watchOut;
+}
+
+void bench_close(struct bench_Thread *thread, struct bench_Client *client){
+	if(client->state == BENCH_CLOSED)
+		return;
+
+	if(client->state != BENCH_READY){
+		thread->failed++;
+		__atomic_add_fetch(&bench.failed, 1, __ATOMIC_RELAXED);
+	}
+	else if(__atomic_load_n(&bench.phase, __ATOMIC_RELAXED) < BENCH_DONE)
+		thread->kicked++;
+
+	client->state = BENCH_CLOSED;
+	close(client->fd);
+}
+
+void bench_flush(struct bench_Thread *thread, struct bench_Client *client){
+	int written = 0;
+
+	while(written < client->outLen){
+		int ret = send(client->fd, client->out + written, client->outLen - written, MSG_NOSIGNAL);
+		if(ret == -1){
+			if(errno == EAGAIN)
+				break;
+			bench_close(thread, client);
+			return;
+		}
+		written += ret;
+	}
+
+	thread->bytesOut += written;
+	memmove(client->out, client->out + written, client->outLen - written);
+	client->outLen -= written;
+	bench_watch(thread, client, client->outLen > 0);
+}
+
+// Returns -1 if the output buffer is full, the line is not queued then
+int bench_queue(struct bench_Client *client, char *str, int len){
+	if(client->outLen + len > BENCH_OUT_SIZE)
+		return -1;
+
+	memcpy(client->out + client->outLen, str, len);
+	client->outLen += len;
+	return 1;
+}
+
+int bench_connect(struct bench_Thread *thread, struct bench_Client *client){
+	struct addrinfo *addr = bench.addr;
+
+	client->connectStart = bench_now();
+	client->state = BENCH_CONNECTING;
+	client->fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(client->fd == -1){
+		perror("socket");
+		client->state = BENCH_NEW;
+		bench_close(thread, client);
+		return -1;
+	}
+
+	if(connect(client->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS){
+		bench_close(thread, client);
+		return -1;
+	}
+
+	// Wait until it is connected before registering
+	struct epoll_event event = {.events = EPOLLIN | EPOLLOUT, .data.ptr = client};
+	client->watchOut = 1;
+	epoll_ctl(thread->epfd, EPOLL_CTL_ADD, client->fd, &event);
+	return 1;
+}
+
+// NICK, the JOINs and a PING that tells when they are done, all in one write
+void bench_register(struct bench_Thread *thread, struct bench_Client *client){
+	char buff[BENCH_OUT_SIZE];
+	int len = snprintf(buff, sizeof(buff), "NICK b%d\r\n", client->id);
+
+	for(int i = 0; i < bench.opt.joins && len < (int) sizeof(buff); i++)
+		len += snprintf(buff + len, sizeof(buff) - len, "JOIN #bench%d\r\n", client->channels[i]);
+	if(len < (int) sizeof(buff))
+		len += snprintf(buff + len, sizeof(buff) - len, "PING :joined\r\n");
+	if(len >= (int) sizeof(buff)){
+		fprintf(stderr, "Too many joins for a single write\n");
+		bench_close(thread, client);
+		return;
+	}
+
+	client->state = BENCH_REGISTERING;
+	bench_queue(client, buff, len);
+	bench_flush(thread, client);
+}
+
+// Handles a line from the server, now is when it was read
+void bench_handleLine(struct bench_Thread *thread, struct bench_Client *client, char *line, uint64_t now){
+	char *command = line;
+	if(*command == ':'){
+		command = strchr(command, ' ');
+		if(command == NULL)
+			return;
+		command++;
+	}
+
+	if(!strncmp(command, "PRIVMSG ", 8)){
+		char *body = strstr(command, ":bench ");
+		if(body == NULL)
+			return;
+
+		uint64_t due = strtoull(body + 7, NULL, 10);
+		if(due >= bench.measureStart && due < bench.measureEnd){
+			hdr_record(&thread->latency, now > due ? (now - due) / 1000 : 0);
+			thread->delivered++;
+		}
+	}
+	else if(!strncmp(command, "PING", 4)){
+		char buff[600];
+		int len = snprintf(buff, sizeof(buff), "PONG%s\r\n", command + 4);
+		if(len < (int) sizeof(buff) && bench_queue(client, buff, len) == 1)
+			bench_flush(thread, client);
+	}
+	else if(!strncmp(command, "PONG ", 5) && client->state == BENCH_REGISTERING && strstr(command, "joined")){
+		hdr_record(&thread->setup, (now - client->connectStart) / 1000);
+		client->state = BENCH_READY;
+		__atomic_add_fetch(&bench.ready, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void bench_read(struct bench_Thread *thread, struct bench_Client *client){
+	while(client->state != BENCH_CLOSED){
+		int ret = read(client->fd, client->in + client->inLen, sizeof(client->in) - client->inLen - 1);
+		if(ret == 0 || (ret == -1 && errno != EAGAIN)){
+			bench_close(thread, client);
+			return;
+		}
+		if(ret == -1)
+			return;
+
+		uint64_t now = bench_now();
+		thread->bytesIn += ret;
+		client->inLen += ret;
+		client->in[client->inLen] = '\0';
+
+		char *start = client->in, *end;
+		while((end = strchr(start, '\n')) != NULL){
+			*end = '\0';
+			bench_handleLine(thread, client, start, now);
+			start = end + 1;
+		}
+
+		client->inLen -= start - client->in;
+		memmove(client->in, start, client->inLen);
+		if(client->inLen == (int) sizeof(client->in) - 1)
+			client->inLen = 0;
+	}
+}
+
+// Sends the messages that are due, returns milliseconds until the next one
+int bench_send(struct bench_Thread *thread){
+	char buff[BENCH_OUT_SIZE];
+	uint64_t now = bench_now();
+
+	// Clients are due in order of their index, all with the same interval
+	for(int checked = 0; checked < thread->count; checked++){
+		struct bench_Client *client = &thread->clients[thread->cursor];
+		if(client->nextSend > now)
+			return (client->nextSend - now) / 1000000;
+
+		thread->cursor = (thread->cursor + 1) % thread->count;
+
+		uint64_t due = client->nextSend;
+		client->nextSend += bench.interval;
+		if(client->state != BENCH_READY)
+			continue;
+
+		// Catching up would break MessageLimit, only the latest missed message is sent
+		if(client->nextSend <= now){
+			unsigned long missed = (now - client->nextSend) / bench.interval + 1;
+			due += missed * bench.interval;
+			client->nextSend += missed * bench.interval;
+			if(due >= bench.measureStart && due < bench.measureEnd)
+				thread->skipped += missed;
+		}
+
+		int channel = client->channels[rand_r(&thread->seed) % bench.opt.joins];
+		int len = snprintf(buff, sizeof(buff), "PRIVMSG #bench%d :bench %lu %d ", channel, (unsigned long) due, client->id);
+		memset(buff + len, 'x', bench.opt.size);
+		len += bench.opt.size;
+		memcpy(buff + len, "\r\n", 2);
+		len += 2;
+
+		if(bench_queue(client, buff, len) == -1){
+			thread->skipped++;
+			continue;
+		}
+		if(due >= bench.measureStart && due < bench.measureEnd)
+			thread->sent++;
+		bench_flush(thread, client);
+	}
+
+	return 0;
+}
+
+void bench_poll(struct bench_Thread *thread, int timeout){
+	struct epoll_event events[256];
+
+	int count = epoll_wait(thread->epfd, events, 256, timeout);
+	for(int i = 0; i < count; i++){
+		struct bench_Client *client = events[i].data.ptr;
+		if(client->state == BENCH_CLOSED)
+			continue;
+
+		if(events[i].events & (EPOLLERR | EPOLLHUP) && client->state == BENCH_CONNECTING){
+			bench_close(thread, client);
+			continue;
+		}
+		if(events[i].events & EPOLLOUT){
+			if(client->state == BENCH_CONNECTING && bench.opt.limit > 0){
+				client->state = BENCH_WAITING;
+				client->registerAt = bench_now() + (bench.opt.limit + BENCH_LIMIT_MARGIN) * 1e9;
+				bench_watch(thread, client, 0);
+			}
+			else if(client->state == BENCH_CONNECTING)
+				bench_register(thread, client);
+			else
+				bench_flush(thread, client);
+		}
+		if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			bench_read(thread, client);
+	}
+}
+
+void *bench_thread(void *param){
+	struct bench_Thread *thread = param;
+	int phase;
+
+	while((phase = __atomic_load_n(&bench.phase, __ATOMIC_ACQUIRE)) != BENCH_DONE){
+		int timeout = 10;
+
+		if(phase == BENCH_CONNECT){
+			// Keep a few connections setting up at a time
+			uint64_t now = bench_now();
+			int pending = 0;
+			for(int i = 0; i < thread->connected; i++){
+				struct bench_Client *client = &thread->clients[i];
+				if(client->state == BENCH_WAITING && client->registerAt <= now)
+					bench_register(thread, client);
+				pending += client->state == BENCH_CONNECTING || client->state == BENCH_REGISTERING;
+			}
+			while(pending++ < BENCH_MAX_CONNECTING && thread->connected < thread->count)
+				bench_connect(thread, &thread->clients[thread->connected++]);
+		}
+		else if(phase == BENCH_RUN){
+			timeout = bench_send(thread);
+			if(timeout > 10)
+				timeout = 10;
+		}
+
+		bench_poll(thread, timeout);
+	}
+
+	return NULL;
+}
+
+void bench_printStats(FILE *fp, char *name, struct hdr_Histogram *hist){
+	fprintf(fp, "\t\t\"%s\": {\"count\": %lu, \"min\": %lu, \"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, "
+			"\"p99.9\": %lu, \"p99.99\": %lu, \"max\": %lu}\n", name, (unsigned long) hist->total,
+			(unsigned long) (hist->total ? hist->min : 0), hdr_mean(hist), (unsigned long) hdr_percentile(hist, 50),
+			(unsigned long) hdr_percentile(hist, 90), (unsigned long) hdr_percentile(hist, 99),
+			(unsigned long) hdr_percentile(hist, 99.9), (unsigned long) hdr_percentile(hist, 99.99),
+			(unsigned long) hist->max);
+}
+
+void bench_report(double setupSeconds, long rssBefore, long rssAfter){
+	struct bench_Options *opt = &bench.opt;
+	struct hdr_Histogram latency, setup;
+	unsigned long sent = 0, delivered = 0, skipped = 0, failed = 0, kicked = 0, bytesIn = 0, bytesOut = 0;
+	double seconds = opt->duration;
+
+	hdr_init(&latency);
+	hdr_init(&setup);
+	for(int i = 0; i < opt->threads; i++){
+		struct bench_Thread *thread = &bench.threads[i];
+		hdr_merge(&latency, &thread->latency);
+		hdr_merge(&setup, &thread->setup);
+		sent += thread->sent;
+		delivered += thread->delivered;
+		skipped += thread->skipped;
+		failed += thread->failed;
+		kicked += thread->kicked;
+		bytesIn += thread->bytesIn;
+		bytesOut += thread->bytesOut;
+	}
+
+	fprintf(stderr, "%d connections set up in %.2f s (%.0f/s), %lu failed, %lu disconnected later\n",
+			bench.ready, setupSeconds, bench.ready / setupSeconds, failed, kicked);
+	fprintf(stderr, "Sent %.0f messages/s, delivered %.0f/s (fan-out %.1f), %lu skipped\n",
+			sent / seconds, delivered / seconds, sent ? (double) delivered / sent : 0, skipped);
+	fprintf(stderr, "Delivery latency: p50 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\n",
+			(unsigned long) hdr_percentile(&latency, 50), (unsigned long) hdr_percentile(&latency, 99),
+			(unsigned long) hdr_percentile(&latency, 99.9), (unsigned long) latency.max);
+	if(rssBefore >= 0 && rssAfter >= 0 && bench.ready > 0)
+		fprintf(stderr, "Server memory: %ld KiB before, %ld KiB after, %.0f bytes per connection\n",
+				rssBefore, rssAfter, (rssAfter - rssBefore) * 1024.0 / bench.ready);
+
+	FILE *fp = stdout;
+	if(opt->output != NULL && (fp = fopen(opt->output, "w")) == NULL){
+		perror(opt->output);
+		return;
+	}
+
+	fprintf(fp, "{\n\t\"config\": {\"connections\": %d, \"channels\": %d, \"joins\": %d, \"zipf\": %g, \"rate\": %g, "
+			"\"size\": %d, \"limit\": %g, \"duration\": %g, \"warmup\": %g, \"threads\": %d},\n",
+			opt->connections, opt->channels, opt->joins, opt->zipf, opt->rate, opt->size, opt->limit,
+			opt->duration, opt->warmup, opt->threads);
+	fprintf(fp, "\t\"connect\": {\"ready\": %d, \"failed\": %lu, \"disconnected\": %lu, \"seconds\": %.3f, \"rate\": %.1f,\n",
+			bench.ready, failed, kicked, setupSeconds, bench.ready / setupSeconds);
+	bench_printStats(fp, "latency_us", &setup);
+	fprintf(fp, "\t},\n\t\"messages\": {\"sent\": %lu, \"delivered\": %lu, \"skipped\": %lu, \"sent_per_s\": %.1f, "
+			"\"delivered_per_s\": %.1f, \"fanout\": %.2f, \"bytes_in_per_s\": %.0f, \"bytes_out_per_s\": %.0f,\n",
+			sent, delivered, skipped, sent / seconds, delivered / seconds, sent ? (double) delivered / sent : 0,
+			bytesIn / seconds, bytesOut / seconds);
+	bench_printStats(fp, "latency_us", &latency);
+	fprintf(fp, "\t}");
+	if(rssBefore >= 0 && rssAfter >= 0)
+		fprintf(fp, ",\n\t\"server\": {\"rss_before_kib\": %ld, \"rss_after_kib\": %ld, \"bytes_per_connection\": %.0f}",
+				rssBefore, rssAfter, bench.ready ? (rssAfter - rssBefore) * 1024.0 / bench.ready : 0);
+	fprintf(fp, "\n}\n");
+
+	if(fp != stdout)
+		fclose(fp);
+}
+
+void bench_usage(char *name){
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-m channels] [-j channels per connection]\n"
+			"\t[-z zipf exponent, 0 for uniform] [-r messages/s] [-s payload bytes] [-l MessageLimit seconds]\n"
+			"\t[-d seconds] [-w warmup seconds] [-t threads] [-P server pid] [-o json file]\n", name);
+}
+
+int main(int argc, char **argv){
+	struct bench_Options *opt = &bench.opt;
+	*opt = (struct bench_Options) {.host = "localhost", .port = "6667", .connections = 100, .channels = 10,
+			.joins = 1, .threads = 2, .size = 32, .rate = 1000, .duration = 10, .warmup = 2};
+	int option;
+
+	while((option = getopt(argc, argv, "h:p:c:m:j:z:r:s:l:d:w:t:P:o:")) != -1){
+		switch(option){
+		case 'h': opt->host = optarg; break;
+		case 'p': opt->port = optarg; break;
+		case 'c': opt->connections = atoi(optarg); break;
+		case 'm': opt->channels = atoi(optarg); break;
+		case 'j': opt->joins = atoi(optarg); break;
+		case 'z': opt->zipf = atof(optarg); break;
+		case 'r': opt->rate = atof(optarg); break;
+		case 's': opt->size = atoi(optarg); break;
+		case 'l': opt->limit = atof(optarg); break;
+		case 'd': opt->duration = atof(optarg); break;
+		case 'w': opt->warmup = atof(optarg); break;
+		case 't': opt->threads = atoi(optarg); break;
+		case 'P': opt->pid = atoi(optarg); break;
+		case 'o': opt->output = optarg; break;
+		default:
+			bench_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc || opt->connections < 1 || opt->channels < 1 || opt->joins < 1 || opt->joins > opt->channels
+			|| opt->threads < 1 || opt->rate <= 0 || opt->size < 0 || opt->size > 900 || opt->duration <= 0
+			|| opt->warmup < 0 || opt->limit < 0 || opt->zipf < 0){
+		bench_usage(argv[0]);
+		return 1;
+	}
+	if(opt->threads > opt->connections)
+		opt->threads = opt->connections;
+
+	// A client may not send more often than the limit allows, the server compares whole seconds of a clock that
+	// may tick a little late, so a gap of exactly the limit is not always enough
+	double maxRate = opt->limit > 0 ? opt->connections / (opt->limit + BENCH_LIMIT_MARGIN) : opt->rate;
+	if(opt->rate > maxRate){
+		fprintf(stderr, "MessageLimit %g allows at most %.0f messages/s with %d connections\n", opt->limit, maxRate, opt->connections);
+		opt->rate = maxRate;
+	}
+	bench.interval = 1e9 * opt->connections / opt->rate;
+
+	struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+	int ret = getaddrinfo(opt->host, opt->port, &hints, &bench.addr);
+	if(ret != 0){
+		fprintf(stderr, "%s: %s\n", opt->host, gai_strerror(ret));
+		return 1;
+	}
+
+	bench.threads = calloc(opt->threads, sizeof(struct bench_Thread));
+	if(bench.threads == NULL || bench_buildCdf(opt->channels, opt->zipf) == -1){
+		perror("malloc");
+		return 1;
+	}
+
+	long rssBefore = opt->pid ? bench_readRss(opt->pid) : -1;
+	if(opt->pid && rssBefore == -1)
+		fprintf(stderr, "Can not read the memory of process %d\n", opt->pid);
+
+	// Connections are handed out to the threads in turns
+	for(int i = 0; i < opt->threads; i++){
+		struct bench_Thread *thread = &bench.threads[i];
+		thread->count = opt->connections / opt->threads + (i < opt->connections % opt->threads);
+		thread->clients = calloc(thread->count, sizeof(struct bench_Client));
+		thread->epfd = epoll_create1(0);
+		thread->seed = 0x9e3779b9u * (i + 1);
+		hdr_init(&thread->latency);
+		hdr_init(&thread->setup);
+		if(thread->clients == NULL || thread->epfd == -1){
+			perror("setup");
+			return 1;
+		}
+
+		for(int j = 0; j < thread->count; j++){
+			thread->clients[j].id = j * opt->threads + i;
+			if(bench_pickChannels(&thread->clients[j], &thread->seed) == -1){
+				perror("malloc");
+				return 1;
+			}
+		}
+	}
+
+	uint64_t start = bench_now();
+	for(int i = 0; i < opt->threads; i++){
+		if(pthread_create(&bench.threads[i].thread, NULL, bench_thread, &bench.threads[i]) != 0){
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	// Everyone has to be in their channels before the first message goes out
+	while(__atomic_load_n(&bench.ready, __ATOMIC_ACQUIRE) + __atomic_load_n(&bench.failed, __ATOMIC_ACQUIRE) < opt->connections){
+		if(bench_now() - start > 60e9){
+			fprintf(stderr, "Gave up waiting for connections after 60 s\n");
+			break;
+		}
+		usleep(1000);
+	}
+	uint64_t setupEnd = bench_now();
+
+	// Give it a moment to take in the memory of the new connections
+	usleep(100000);
+	long rssAfter = opt->pid ? bench_readRss(opt->pid) : -1;
+
+	// Clients of a thread are due one after another, spread over one interval
+	bench.runStart = bench_now() + 10000000 + (opt->limit > 0 ? (opt->limit + BENCH_LIMIT_MARGIN) * 1e9 : 0);
+	bench.measureStart = bench.runStart + opt->warmup * 1e9;
+	bench.measureEnd = bench.measureStart + opt->duration * 1e9;
+	for(int i = 0; i < opt->threads; i++){
+		struct bench_Thread *thread = &bench.threads[i];
+		for(int j = 0; j < thread->count; j++)
+			thread->clients[j].nextSend = bench.runStart + bench.interval * j / thread->count;
+	}
+	__atomic_store_n(&bench.phase, BENCH_RUN, __ATOMIC_RELEASE);
+
+	// Messages due before the end still get a second to arrive
+	uint64_t now;
+	while((now = bench_now()) < bench.measureEnd)
+		usleep((bench.measureEnd - now) / 1000 < 100000 ? (bench.measureEnd - now) / 1000 + 1 : 100000);
+	__atomic_store_n(&bench.phase, BENCH_DRAIN, __ATOMIC_RELEASE);
+	usleep(1000000);
+	__atomic_store_n(&bench.phase, BENCH_DONE, __ATOMIC_RELEASE);
+
+	for(int i = 0; i < opt->threads; i++)
+		pthread_join(bench.threads[i].thread, NULL);
+
+	bench_report((setupEnd - start) / 1e9, rssBefore, rssAfter);
+	freeaddrinfo(bench.addr);
+	return 0;
+}
@@ -0,0 +1,50 @@
+#include <time.h>
+#include "capread.h"
+
+/*	Prints the records of a capture file, oldest first:
+		capdecode <file> [<slot>]
+	One line per record: time (UTC), direction, slot, user id and the
+	line, bytes that are not printable are written as \xNN
+*/
+
+void printRecord(struct cap_Record *record, void *data){
+	long slot = *(long *) data;
+	if(slot >= 0 && record->slot != (uint64_t) slot)
+		return;
+
+	time_t sec = record->time / 1000000000;
+	struct tm tm;
+	gmtime_r(&sec, &tm);
+
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+	printf("%s.%06luZ %s %u %d ", date, (unsigned long) (record->time % 1000000000) / 1000,
+			record->direction == CAP_IN ? "<<" : ">>", record->slot, record->userId);
+
+	unsigned char *line = (unsigned char *) (record + 1);
+	for(int i = 0; i < record->len; i++){
+		if(line[i] < 0x20 || line[i] >= 0x7f)
+			printf("\\x%02x", line[i]);
+		else
+			putchar(line[i]);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char **argv){
+	if(argc < 2){
+		fprintf(stderr, "Usage: %s <capture file> [<slot>]\n", argv[0]);
+		return 1;
+	}
+	long slot = argc > 2 ? strtol(argv[2], NULL, 10) : -1;
+
+	struct capr_File file;
+	if(capr_open(&file, argv[1]) == -1)
+		return 1;
+
+	long count = capr_walk(&file, printRecord, &slot);
+
+	fprintf(stderr, "%ld records, %lu bytes captured in total\n", count, (unsigned long) file.header->head);
+	capr_close(&file);
+	return 0;
+}
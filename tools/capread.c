@@ -0,0 +1,93 @@
+#include "capread.h"
+
+int capr_open(struct capr_File *file, char *path){
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if(fd == -1 || fstat(fd, &info) == -1){
+		perror(path);
+		if(fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	if(info.st_size < (off_t) sizeof(struct cap_Header)){
+		fprintf(stderr, "%s: Not a capture file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	file->map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(file->map == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	file->mapLen = info.st_size;
+
+	struct cap_Header *header = (struct cap_Header *) file->map;
+	if(memcmp(header->magic, CAP_MAGIC, 8) || header->version != CAP_VERSION
+			|| header->headerLen + header->size > (uint64_t) info.st_size || header->size % CAP_ALIGN){
+		fprintf(stderr, "%s: Not a capture file, or of another version\n", path);
+		munmap(file->map, file->mapLen);
+		return -1;
+	}
+
+	file->header = header;
+	file->ring = file->map + header->headerLen;
+	return 1;
+}
+
+void capr_close(struct capr_File *file){
+	munmap(file->map, file->mapLen);
+}
+
+int capr_isCapture(char *path){
+	char magic[8];
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+		return 0;
+
+	int ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, CAP_MAGIC, 8);
+	fclose(fp);
+	return ret;
+}
+
+long capr_walk(struct capr_File *file, capr_Func func, void *data){
+	uint64_t size = file->header->size, head = file->header->head;
+	uint64_t lap = head - head % size;
+	long count = 0;
+
+	// What is left of the previous lap comes first
+	if(head >= size)
+		count += capr_walkLap(file, lap - size, head % size, size, func, data);
+	count += capr_walkLap(file, lap, 0, head % size, func, data);
+
+	return count;
+}
+
+long capr_walkLap(struct capr_File *file, uint64_t base, uint64_t from, uint64_t to, capr_Func func, void *data){
+	uint64_t size = file->header->size;
+	long count = 0;
+	uint64_t offset = from;
+
+	while(offset + sizeof(struct cap_Record) <= to){
+		struct cap_Record *record = (struct cap_Record *) (file->ring + offset);
+		if(record->pos != base + offset || !record->committed){
+			offset += CAP_ALIGN;
+			continue;
+		}
+
+		if(record->direction == CAP_SKIP)
+			break;
+
+		uint64_t len = (sizeof(struct cap_Record) + record->len + CAP_ALIGN - 1) / CAP_ALIGN * CAP_ALIGN;
+		if(offset + len > size)
+			break;
+
+		func(record, data);
+		count++;
+		offset += len;
+	}
+
+	return count;
+}
@@ -0,0 +1,43 @@
+#ifndef capread_h
+#define capread_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+/*	Reads capture files written by the server (see capture.h) without
+	linking any of it, for capdecode and replay
+*/
+
+struct capr_File {
+	char *map;
+	long mapLen;
+	struct cap_Header *header;
+	char *ring;
+};
+
+// Called for every record, oldest first
+typedef void (*capr_Func)(struct cap_Record *record, void *data);
+
+// Maps a capture file and checks its header, prints why and returns -1 if it is not one
+int capr_open(struct capr_File *file, char *path);
+
+void capr_close(struct capr_File *file);
+
+// Returns 1 if the file at path starts like a capture file
+int capr_isCapture(char *path);
+
+// Calls func for every committed record that is left in the ring, returns the amount
+long capr_walk(struct capr_File *file, capr_Func func, void *data);
+
+// Walks the records of one lap from offset from to offset to, base is the position of its offset 0
+// Offsets that do not hold a committed record of this lap are skipped until one does
+long capr_walkLap(struct capr_File *file, uint64_t base, uint64_t from, uint64_t to, capr_Func func, void *data);
+
+#endif
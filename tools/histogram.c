@@ -0,0 +1,71 @@
+#include "histogram.h"
+
+void hdr_init(struct hdr_Histogram *hist){
+	memset(hist, 0, sizeof(struct hdr_Histogram));
+	hist->min = UINT64_MAX;
+}
+
+int hdr_bucket(uint64_t value){
+	if(value < 2 * HDR_SUB_COUNT)
+		return value;
+
+	int shift = 63 - __builtin_clzll(value) - HDR_SUB_BITS;
+	int bucket = shift * HDR_SUB_COUNT + (value >> shift);
+	return bucket < HDR_BUCKETS ? bucket : HDR_BUCKETS - 1;
+}
+
+uint64_t hdr_bucketValue(int bucket){
+	if(bucket < 2 * HDR_SUB_COUNT)
+		return bucket;
+
+	int shift = bucket / HDR_SUB_COUNT - 1;
+	uint64_t mantissa = bucket % HDR_SUB_COUNT + HDR_SUB_COUNT;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void hdr_record(struct hdr_Histogram *hist, uint64_t value){
+	hist->counts[hdr_bucket(value)]++;
+	hist->total++;
+	hist->sum += value;
+	if(value < hist->min)
+		hist->min = value;
+	if(value > hist->max)
+		hist->max = value;
+}
+
+void hdr_merge(struct hdr_Histogram *dst, struct hdr_Histogram *src){
+	for(int i = 0; i < HDR_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if(src->min < dst->min)
+		dst->min = src->min;
+	if(src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t hdr_percentile(struct hdr_Histogram *hist, double percentile){
+	if(hist->total == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (percentile / 100.0 * hist->total + 0.5);
+	if(rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for(int i = 0; i < HDR_BUCKETS; i++){
+		seen += hist->counts[i];
+		if(seen >= rank){
+			// The bucket bound may lie past the largest value that was recorded
+			uint64_t value = hdr_bucketValue(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+double hdr_mean(struct hdr_Histogram *hist){
+	return hist->total ? hist->sum / hist->total : 0;
+}
@@ -0,0 +1,43 @@
+#ifndef histogram_h
+#define histogram_h
+
+#include <stdint.h>
+#include <string.h>
+
+/*	Log-linear histogram in the spirit of HdrHistogram: values below
+	64 get a bucket each, above that every power of two is split into
+	32 buckets, so any value is known to within about 3% and recording
+	one is a few instructions without any allocation. Values are usually
+	microseconds, up to 2^41 fit
+*/
+
+#define HDR_SUB_BITS 5
+#define HDR_SUB_COUNT (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS ((41 - HDR_SUB_BITS + 1) * HDR_SUB_COUNT)
+
+struct hdr_Histogram {
+	uint64_t counts[HDR_BUCKETS];
+	uint64_t total;
+	uint64_t min, max;
+	double sum;
+};
+
+void hdr_init(struct hdr_Histogram *hist);
+
+// Returns the bucket a value falls into
+int hdr_bucket(uint64_t value);
+
+// Returns the highest value of a bucket
+uint64_t hdr_bucketValue(int bucket);
+
+void hdr_record(struct hdr_Histogram *hist, uint64_t value);
+
+// Adds the values of src to dst
+void hdr_merge(struct hdr_Histogram *dst, struct hdr_Histogram *src);
+
+// Returns the value percentile percent of all values are at or below, 0 if there are none
+uint64_t hdr_percentile(struct hdr_Histogram *hist, double percentile);
+
+double hdr_mean(struct hdr_Histogram *hist);
+
+#endif
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "chat.h"
+#include "config.h"
+#include "clock.h"
+#include "reclaim.h"
+#include "history.h"
+#include "security.h"
+#include "bans.h"
+
+/*	Microbenchmarks of the hot primitives, linked against the server
+	objects without boundless.o:
+		microbench [-r rounds] [-j] [filter]
+
+	Every benchmark runs its operation in batches that take at least a
+	millisecond, then MB_ROUNDS (-r) batches are timed. ns/op is the
+	median batch, min the fastest one. State that builds up, like queued
+	jobs, is cleaned up between batches without being timed.
+
+	malloc, calloc, realloc and aligned_alloc are wrapped with
+	-Wl,--wrap to count allocations/op and bytes/op of the server code,
+	allocations libc makes internally are not seen. epoll_ctl is wrapped
+	as well, it is the transport: output is queued for the users as it
+	would be, but no socket is ever armed.
+
+	-j prints one JSON object per benchmark instead of the table, only
+	benchmarks whose name contains filter run.
+*/
+
+#define MB_ROUNDS 15
+#define MB_MIN_BATCH_NS 1000000
+#define MB_MAX_USERS 100000
+
+struct mb_Result {
+	double nsPerOp, minNsPerOp;
+	double allocsPerOp, bytesPerOp;
+	long ops;
+};
+
+struct mb_Options {
+	int rounds;
+	int json;
+	char *filter;
+};
+
+// Counted on the benchmark thread only
+__thread unsigned long mb_allocs, mb_bytes;
+
+struct mb_Options mb_options = {.rounds = MB_ROUNDS};
+
+extern struct chat_DataQueue dataQueue;
+
+/* Start of WRAPPERS */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size){
+	mb_allocs++;
+	mb_bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size){
+	mb_allocs++;
+	mb_bytes += count * size;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+	mb_allocs++;
+	mb_bytes += size;
+	return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size){
+	mb_allocs++;
+	mb_bytes += size;
+	return __real_aligned_alloc(alignment, size);
+}
+
+// Nothing is ever written, the queued output is dropped by the cleanup of the benchmark
+int __wrap_epoll_ctl(UNUSED(int epfd), UNUSED(int op), UNUSED(int fd), UNUSED(struct epoll_event *event)){
+	return 0;
+}
+/* End of WRAPPERS */
+
+uint64_t mb_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int mb_compareDoubles(const void *first, const void *second){
+	double a = *(const double *) first, b = *(const double *) second;
+	return a < b ? -1 : a > b;
+}
+
+// Times count runs of op, cleanup runs afterwards without being timed
+uint64_t mb_runBatch(void (*op)(void *data), void (*cleanup)(void *data), void *data, long count,
+		unsigned long *allocs, unsigned long *bytes){
+	unsigned long startAllocs = mb_allocs, startBytes = mb_bytes;
+	uint64_t start = mb_now();
+
+	for(long i = 0; i < count; i++)
+		op(data);
+
+	uint64_t elapsed = mb_now() - start;
+	*allocs += mb_allocs - startAllocs;
+	*bytes += mb_bytes - startBytes;
+
+	if(cleanup != NULL)
+		cleanup(data);
+	return elapsed;
+}
+
+void mb_run(char *name, void (*op)(void *data), void (*cleanup)(void *data), void *data){
+	if(mb_options.filter != NULL && strstr(name, mb_options.filter) == NULL)
+		return;
+
+	unsigned long allocs = 0, bytes = 0;
+	long batch = 1;
+
+	// Grow the batch until timing it is accurate, this also warms up
+	while(mb_runBatch(op, cleanup, data, batch, &allocs, &bytes) < MB_MIN_BATCH_NS && batch < (1l << 30))
+		batch *= 2;
+
+	double *times = malloc(mb_options.rounds * sizeof(double));
+	if(times == NULL){
+		perror("malloc");
+		return;
+	}
+
+	allocs = bytes = 0;
+	for(int i = 0; i < mb_options.rounds; i++)
+		times[i] = (double) mb_runBatch(op, cleanup, data, batch, &allocs, &bytes) / batch;
+	qsort(times, mb_options.rounds, sizeof(double), mb_compareDoubles);
+
+	struct mb_Result result = {
+		.nsPerOp = times[mb_options.rounds / 2],
+		.minNsPerOp = times[0],
+		.ops = batch * mb_options.rounds
+	};
+	result.allocsPerOp = (double) allocs / result.ops;
+	result.bytesPerOp = (double) bytes / result.ops;
+	free(times);
+
+	if(mb_options.json)
+		printf("{\"name\": \"%s\", \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"allocs_per_op\": %.2f, "
+				"\"bytes_per_op\": %.1f, \"ops\": %ld}\n", name, result.nsPerOp, result.minNsPerOp,
+				result.allocsPerOp, result.bytesPerOp, result.ops);
+	else
+		printf("%-40s %12.1f %12.1f %10.2f %12.1f %12ld\n", name, result.nsPerOp, result.minNsPerOp,
+				result.allocsPerOp, result.bytesPerOp, result.ops);
+	fflush(stdout);
+}
+
+/* Start of SETUP */
+// Starts what the benchmarks need of the server, without any threads but the clock
+int mb_setup(){
+	log_setLevel(NULL, "fatal");
+
+	fig_Configuration.clients = MB_MAX_USERS + 1;
+	fig_Configuration.threadsDATA = 0;
+	fig_Configuration.nickLen = 20;
+	fig_Configuration.largeChannel = MB_MAX_USERS + 1; // Every broadcast stays on the calling thread
+
+	if(init_clock() == -1 || init_reclaim() == -1 || init_history() == -1 || init_chat() == -1)
+		return -1;
+
+	com_numThreads = 1;
+	com_ioThreads = calloc(1, sizeof(struct com_IOThread));
+	if(com_ioThreads == NULL)
+		return -1;
+
+	// Users are filled in directly, usr_createUser looks for a free slot from the start every time
+	for(int i = 1; i <= MB_MAX_USERS; i++){
+		struct usr_UserData *user = &serverLists.users[i];
+		char nick[32];
+
+		snprintf(nick, sizeof(nick), "u%d", i);
+		strcpy(user->host, "127.0.0.1");
+		user->name = usr_createName(nick, user->host);
+		if(user->name == NULL)
+			return -1;
+		user->socketInfo.socket = user->socketInfo.socket2 = -1;
+		user->lastMsg = clk_now();
+		user->id = i;
+	}
+	serverLists.connected = MB_MAX_USERS;
+
+	return 1;
+}
+/* End of SETUP */
+
+/* Start of BENCHMARKS */
+struct mb_Parse {
+	char *line;
+	struct com_QueueJob *job;
+};
+
+void mb_parseInput(void *data){
+	struct mb_Parse *parse = data;
+
+	// chat_parseInput edits the line in place
+	strcpy(parse->job->str, parse->line);
+	chat_parseInput(parse->job);
+}
+
+// Drops the jobs chat_parseInput queued for the data threads
+void mb_drainDataQueue(UNUSED(void *data)){
+	while(link_isEmpty(&dataQueue.queue) < 0){
+		struct com_QueueJob *job = link_remove(&dataQueue.queue, 0);
+		free(job->msg);
+		free(job);
+	}
+}
+
+void mb_messageToString(void *data){
+	char str[BUFSIZ];
+	chat_messageToString(data, str, ARRAY_SIZE(str));
+}
+
+void mb_findEndLine(void *data){
+	char *str = data;
+	int loc = 0;
+
+	// Walks every line the way com_communicateWithClients splits a read
+	while(loc >= 0)
+		loc = chat_findEndLine(str, BUFSIZ, loc);
+}
+
+struct mb_List {
+	struct link_List list;
+	int pos;
+};
+
+// A queue: add at the tail, take from the head
+void mb_listQueue(void *data){
+	struct mb_List *list = data;
+	link_add(&list->list, list);
+	link_remove(&list->list, 0);
+}
+
+// Removes from the middle, which has to walk to it
+void mb_listMiddle(void *data){
+	struct mb_List *list = data;
+	link_add(&list->list, link_remove(&list->list, list->pos));
+}
+
+void mb_getUserByName(void *data){
+	if(usr_getUserByName(data) == NULL)
+		abort();
+}
+
+void mb_getUserByNameMissing(void *data){
+	if(usr_getUserByName(data) != NULL)
+		abort();
+}
+
+struct mb_Channel {
+	struct link_Node *groupNode, *channelNode;
+	char name[32];
+	struct chat_Message msg;
+	int members;
+};
+
+void mb_getChannel(void *data){
+	struct mb_Channel *channel = data;
+	if(grp_getChannel(channel->groupNode, channel->name) == NULL)
+		abort();
+}
+
+void mb_sendChannelMessage(void *data){
+	struct mb_Channel *channel = data;
+	chan_sendChannelMessage(&channel->msg, channel->channelNode);
+}
+
+// Drops the output queued for the members
+void mb_cleanMembers(void *data){
+	struct mb_Channel *channel = data;
+	for(int i = 1; i <= channel->members; i++)
+		com_cleanQueue(&serverLists.users[i]);
+}
+
+struct mb_Compare {
+	char first[64], second[64];
+};
+
+void mb_constantStrCmp(void *data){
+	struct mb_Compare *compare = data;
+	sec_constantStrCmp(compare->first, compare->second, ARRAY_SIZE(compare->first));
+}
+struct mb_Bans {
+	struct ban_List list;
+	struct usr_UserData *user;
+};
+
+void mb_isBanned(void *data){
+	struct mb_Bans *bans = data;
+	ban_isBanned(&bans->list, bans->user);
+}
+/* End of BENCHMARKS */
+
+void mb_benchParser(){
+	char *lines[][2] = {
+		{"parse/privmsg", "PRIVMSG #general :Hey everyone, did the deploy go out yet? The graphs look fine so far\r\n"},
+		{"parse/join", "JOIN &General-Chat/#general\r\n"},
+		{"parse/ping", "PING :1700000000\r\n"},
+		{"parse/mode", "MODE #general +o someone\r\n"},
+		{"parse/prefixed", ":u1!u1@127.0.0.1 NOTICE u2 :A line that carries its own prefix\r\n"},
+	};
+	struct mb_Parse parse = {0};
+	parse.job = calloc(1, sizeof(struct com_QueueJob) + COM_LINE_LEN);
+	if(parse.job == NULL)
+		return;
+	parse.job->user = &serverLists.users[1];
+
+	for(int i = 0; i < ARRAY_SIZE(lines); i++){
+		parse.line = lines[i][1];
+		mb_run(lines[i][0], mb_parseInput, mb_drainDataQueue, &parse);
+	}
+	free(parse.job);
+
+	struct chat_Message msg = {0};
+	char *params[] = {"#general", ":Hey everyone, did the deploy go out yet? The graphs look fine so far"};
+	chat_createMessage(&msg, &serverLists.users[1], "u1!u1@127.0.0.1", "PRIVMSG", params, 2);
+	mb_run("messageToString/privmsg", mb_messageToString, NULL, &msg);
+
+	// A full read of short lines, as the IO threads see it under load
+	char buff[BUFSIZ] = {0};
+	int len = 0;
+	while(len + 64 < (int) sizeof(buff) - 1)
+		len += snprintf(buff + len, sizeof(buff) - len, "PRIVMSG #general :line number %d of this read\r\n", len);
+	mb_run("findEndLine/8KiB-read", mb_findEndLine, NULL, buff);
+}
+
+void mb_benchList(){
+	int sizes[] = {10, 1000, 100000};
+	char name[64];
+
+	for(int i = 0; i < ARRAY_SIZE(sizes); i++){
+		struct mb_List list = {.pos = sizes[i] / 2};
+		for(int j = 0; j < sizes[i]; j++)
+			link_add(&list.list, &list);
+
+		snprintf(name, sizeof(name), "list/add+remove-head/%d", sizes[i]);
+		mb_run(name, mb_listQueue, NULL, &list);
+		snprintf(name, sizeof(name), "list/remove-middle+add/%d", sizes[i]);
+		mb_run(name, mb_listMiddle, NULL, &list);
+
+		while(link_isEmpty(&list.list) < 0)
+			link_remove(&list.list, 0);
+	}
+}
+
+void mb_benchUsers(){
+	int sizes[] = {1000, 10000, 100000};
+	char name[64], nick[32];
+
+	for(int i = 0; i < ARRAY_SIZE(sizes); i++){
+		serverLists.max = sizes[i] + 1;
+
+		// The last slot, so the whole table is scanned
+		snprintf(nick, sizeof(nick), "u%d", sizes[i]);
+		snprintf(name, sizeof(name), "getUserByName/last/%d", sizes[i]);
+		mb_run(name, mb_getUserByName, NULL, nick);
+
+		snprintf(name, sizeof(name), "getUserByName/missing/%d", sizes[i]);
+		mb_run(name, mb_getUserByNameMissing, NULL, "nobody");
+	}
+
+	serverLists.max = MB_MAX_USERS + 1;
+}
+
+void mb_benchChannels(){
+	struct mb_Channel channel = {0};
+	char name[64];
+
+	channel.groupNode = grp_createGroup("&bench", NULL);
+	if(channel.groupNode == NULL){
+		fprintf(stderr, "Could not create the benchmark group\n");
+		return;
+	}
+
+	for(int i = 0; i < 10000; i++){
+		snprintf(name, sizeof(name), "#c%d", i);
+		if(chan_createChannel(name, channel.groupNode, NULL) == NULL){
+			fprintf(stderr, "Could not create %s\n", name);
+			return;
+		}
+	}
+	strcpy(channel.name, "#c5000");
+	mb_run("getChannel/10000", mb_getChannel, NULL, &channel);
+	strcpy(channel.name, "#c9999");
+	mb_run("getChannel/10000/last-added", mb_getChannel, NULL, &channel);
+
+	// Fan-out to a growing channel, the sender is member 1
+	int sizes[] = {10, 100, 1000};
+	char *params[] = {"&bench/#fanout", ":Hey everyone, did the deploy go out yet? The graphs look fine so far"};
+	channel.channelNode = chan_createChannel("#fanout", channel.groupNode, NULL);
+	chat_createMessage(&channel.msg, &serverLists.users[1], "u1!u1@127.0.0.1", "PRIVMSG", params, 2);
+
+	for(int i = 0; i < ARRAY_SIZE(sizes); i++){
+		while(channel.members < sizes[i])
+			chan_addToChannel(channel.channelNode, &serverLists.users[++channel.members], 0);
+
+		snprintf(name, sizeof(name), "sendChannelMessage/%d", sizes[i]);
+		mb_run(name, mb_sendChannelMessage, mb_cleanMembers, &channel);
+	}
+}
+
+void mb_benchSecurity(){
+	struct mb_Compare compare = {0};
+
+	memset(compare.first, 'k', sizeof(compare.first) - 1);
+	memcpy(compare.second, compare.first, sizeof(compare.second));
+	mb_run("constantStrCmp/equal-63", mb_constantStrCmp, NULL, &compare);
+
+	compare.second[0] = 'x';
+	mb_run("constantStrCmp/differ-first", mb_constantStrCmp, NULL, &compare);
+}
+
+void mb_benchBans(){
+	struct mb_Bans bans = {0};
+	int sizes[] = {100, 1000, 5000};
+	char name[64], mask[64];
+
+	if(ban_init(&bans.list) == -1){
+		fprintf(stderr, "Could not create the ban list\n");
+		return;
+	}
+
+	// Wildcard masks of the usual shapes, none match u1 from 127.0.0.1
+	int count = 0;
+	for(int i = 0; i < ARRAY_SIZE(sizes); i++){
+		for(; count < sizes[i]; count++){
+			switch(count % 4){
+			case 0: snprintf(mask, sizeof(mask), "*!*@*.dyn%d.example.net", count); break;
+			case 1: snprintf(mask, sizeof(mask), "spam%d*!*@*", count); break;
+			case 2: snprintf(mask, sizeof(mask), "*!*bot%d@*", count); break;
+			default: snprintf(mask, sizeof(mask), "*!*@10.%d.*", count);
+			}
+			ban_add(&bans.list, mask);
+		}
+
+		bans.user = &serverLists.users[1];
+		snprintf(name, sizeof(name), "isBanned/wildcard/%d/miss", sizes[i]);
+		mb_run(name, mb_isBanned, NULL, &bans);
+	}
+
+	ban_add(&bans.list, "u99999*!*@127.*");
+	bans.user = &serverLists.users[99999];
+	if(ban_isBanned(&bans.list, bans.user) != 1)
+		fprintf(stderr, "u99999 should be banned\n");
+	mb_run("isBanned/wildcard/5000/hit", mb_isBanned, NULL, &bans);
+
+	ban_free(&bans.list);
+}
+
+int main(int argc, char **argv){
+	int opt;
+
+	while((opt = getopt(argc, argv, "r:j")) != -1){
+		switch(opt){
+		case 'r': mb_options.rounds = atoi(optarg); break;
+		case 'j': mb_options.json = 1; break;
+		default:
+			mb_options.rounds = 0;
+		}
+	}
+	if(mb_options.rounds < 1 || optind < argc - 1){
+		fprintf(stderr, "Usage: %s [-r rounds] [-j] [filter]\n", argv[0]);
+		return 1;
+	}
+	if(optind == argc - 1)
+		mb_options.filter = argv[optind];
+
+	if(mb_setup() == -1){
+		fprintf(stderr, "Could not set up the server state\n");
+		return 1;
+	}
+
+	if(!mb_options.json)
+		printf("%-40s %12s %12s %10s %12s %12s\n", "Benchmark", "ns/op", "min ns/op", "allocs/op", "bytes/op", "ops");
+
+	mb_benchParser();
+	mb_benchList();
+	mb_benchUsers();
+	mb_benchChannels();
+	mb_benchSecurity();
+	mb_benchBans();
+
+	return 0;
+}
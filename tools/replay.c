@@ -0,0 +1,871 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "capread.h"
+#include "histogram.h"
+
+/*	Replays recorded client traffic against a running server:
+		replay [-h host] [-p port] [-s speed] [-n copies] [-t drain] <trace>
+
+	The trace is either a capture file (see capture.h), of which the
+	lines the clients sent are used, or a text file of lines like
+		<milliseconds> <connection> <line>
+	Every connection of the trace gets a client of its own, -n runs
+	the whole trace that many times at once, renaming the NICK of every
+	copy but the first.
+
+	-s 1 keeps the recorded gaps between lines, -s 10 makes them ten
+	times shorter. Lines are sent when they are due no matter how far
+	behind the server is, and latency is measured from then on, so a
+	slow server does not hide behind a slower replay. -s 0 sends as fast
+	as possible, every client sending its next line once the server
+	answered the last one.
+
+	A line is timed by what it causes. A PRIVMSG carries its number at
+	the end of its text and counts once a client receives it: another
+	replayed client or, for a channel, an observer client that joins
+	every channel right after the first replayed client got in. Lines
+	the server answers, such as JOIN, NAMES or HISTORY, count once their
+	reply or an error comes back. Only the rest, such as MODE, which
+	may go unanswered, and commands the server does not know, are
+	followed by a PING and count once its PONG came back. That PING may
+	be handled before the line with more than one data thread, so only
+	those commands can be under-reported. Latencies are reported per
+	command, in microseconds.
+
+	The observer adds a member to every channel, a line that was never
+	answered counts as lost.
+
+	The server kicks clients that send more often than MessageLimit
+	seconds, so it should run with MessageLimit 0.
+*/
+
+#define REP_MAX_COMMANDS 64
+#define REP_IN_SIZE 16384
+#define REP_NAME_LEN 64
+#define REP_OBSERVER "replayobs"
+#define REP_TAG " ~rep" // Followed by the probe number, ends the text of a PRIVMSG
+
+// How a probe is answered
+#define REP_PONG 0
+#define REP_REPLY 1
+#define REP_DELIVERY 2
+
+struct rep_Line {
+	uint64_t time; // Nanoseconds, from the start of the trace
+	long conn; // User id or connection number of the trace, later its index
+	long order; // Keeps lines of the same time in trace order
+	char *line;
+	int command;
+};
+
+struct rep_Command {
+	char name[16];
+	unsigned long sent, lost;
+	struct hdr_Histogram hist;
+};
+
+// The lines of one connection of the trace, in order
+struct rep_Conn {
+	int *lines;
+	int count;
+};
+
+// Commands the server always answers
+struct rep_Reply {
+	char *command;
+	char *replies; // Space separated, numerics or commands that come back from the client itself
+};
+
+struct rep_Reply rep_replies[] = {
+	{"JOIN", "366"}, {"PART", "PART"}, {"KICK", "KICK"}, {"NICK", "NICK 001"},
+	{"NAMES", "366"}, {"HISTORY", "611"}, {"SEARCH", "613"}, {"STATS", "219"}
+};
+
+struct rep_Client {
+	int fd;
+	int copy;
+	struct rep_Conn *conn; // NULL for the observer
+	int next; // Its next line
+	int waiting; // Lines without an answer yet
+	long firstPending, lastPending; // Its probes an error may answer, in order, -1 for none
+	char nick[REP_NAME_LEN];
+	int closed;
+	int watchOut; // Registered for EPOLLOUT
+	char in[REP_IN_SIZE];
+	int inLen;
+	char *out;
+	long outLen, outSize;
+};
+
+struct rep_Probe {
+	uint64_t sent;
+	int command;
+	int kind;
+	int reply; // Index into rep_replies for REP_REPLY
+	int done;
+	long line;
+	long next; // The next pending probe of its client
+	struct rep_Client *client;
+	char target[REP_NAME_LEN]; // The first parameter of the line, for a NICK with the suffix of its copy
+};
+
+// A channel the observer joined or is joining
+struct rep_Channel {
+	char name[REP_NAME_LEN];
+	int joined;
+};
+
+struct rep_Replay {
+	struct rep_Line *lines;
+	long numLines, maxLines;
+	struct rep_Conn *conns;
+	long numConns;
+	struct rep_Command commands[REP_MAX_COMMANDS];
+	int numCommands;
+
+	struct rep_Client *clients;
+	long numClients;
+	struct rep_Probe *probes;
+	long numProbes, maxProbes;
+	long done; // Probes that came back
+	uint64_t lastReply;
+	int epfd;
+
+	struct rep_Client observer;
+	struct rep_Channel *channels;
+	long numChannels, maxChannels;
+
+	unsigned long sentLines, recvLines, sentBytes, recvBytes, kicked;
+};
+
+struct rep_Replay rep;
+
+uint64_t rep_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Returns the command of a line, lines of commands past REP_MAX_COMMANDS share the last one
+int rep_findCommand(char *line){
+	char name[16];
+	int len = 0;
+
+	if(*line == ':'){
+		line = strchr(line, ' ');
+		line = line ? line + 1 : "";
+	}
+	while(line[len] && line[len] != ' ' && len < (int) sizeof(name) - 1){
+		name[len] = line[len] >= 'a' && line[len] <= 'z' ? line[len] - 32 : line[len];
+		len++;
+	}
+	name[len] = '\0';
+
+	for(int i = 0; i < rep.numCommands; i++){
+		if(!strcmp(rep.commands[i].name, name))
+			return i;
+	}
+
+	if(rep.numCommands == REP_MAX_COMMANDS - 1)
+		strcpy(name, "OTHER");
+	if(rep.numCommands == REP_MAX_COMMANDS)
+		return REP_MAX_COMMANDS - 1;
+
+	struct rep_Command *command = &rep.commands[rep.numCommands];
+	strcpy(command->name, name);
+	hdr_init(&command->hist);
+	return rep.numCommands++;
+}
+
+int rep_addLine(uint64_t time, long conn, char *line, int len){
+	while(len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+		len--;
+	if(len == 0)
+		return 1;
+
+	if(rep.numLines == rep.maxLines){
+		rep.maxLines = rep.maxLines ? rep.maxLines * 2 : 1024;
+		struct rep_Line *lines = realloc(rep.lines, rep.maxLines * sizeof(struct rep_Line));
+		if(lines == NULL){
+			perror("realloc");
+			return -1;
+		}
+		rep.lines = lines;
+	}
+
+	struct rep_Line *entry = &rep.lines[rep.numLines];
+	entry->time = time;
+	entry->conn = conn;
+	entry->order = rep.numLines;
+	entry->line = strndup(line, len);
+	if(entry->line == NULL){
+		perror("strndup");
+		return -1;
+	}
+	entry->command = rep_findCommand(entry->line);
+	rep.numLines++;
+
+	return 1;
+}
+
+void rep_addRecord(struct cap_Record *record, void *data){
+	if(record->direction != CAP_IN)
+		return;
+
+	// Slots are reused once a user leaves, ids are not
+	if(rep_addLine(record->time, record->userId, (char *) (record + 1), record->len) == -1)
+		*(int *) data = -1;
+}
+
+int rep_loadText(char *path){
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL){
+		perror(path);
+		return -1;
+	}
+
+	char buff[1024];
+	int number = 0;
+	while(fgets(buff, sizeof(buff), fp) != NULL){
+		double ms;
+		long conn;
+		int pos;
+
+		number++;
+		if(buff[0] == '#' || buff[0] == '\n')
+			continue;
+
+		if(sscanf(buff, "%lf %ld %n", &ms, &conn, &pos) < 2 || ms < 0 || conn < 0){
+			fprintf(stderr, "%s:%d: Expected <milliseconds> <connection> <line>\n", path, number);
+			fclose(fp);
+			return -1;
+		}
+
+		if(rep_addLine(ms * 1000000, conn, &buff[pos], strlen(&buff[pos])) == -1){
+			fclose(fp);
+			return -1;
+		}
+	}
+
+	fclose(fp);
+	return 1;
+}
+
+int rep_compareLines(const void *first, const void *second){
+	const struct rep_Line *a = first, *b = second;
+	if(a->time != b->time)
+		return a->time < b->time ? -1 : 1;
+	return a->order < b->order ? -1 : a->order > b->order;
+}
+
+int rep_compareLongs(const void *first, const void *second){
+	long a = *(const long *) first, b = *(const long *) second;
+	return a < b ? -1 : a > b;
+}
+
+// Sorts the lines, makes their times relative to the first and numbers the connections
+int rep_loadTrace(char *path){
+	if(capr_isCapture(path)){
+		struct capr_File file;
+		int ret = 1;
+
+		if(capr_open(&file, path) == -1)
+			return -1;
+		capr_walk(&file, rep_addRecord, &ret);
+		capr_close(&file);
+		if(ret == -1)
+			return -1;
+	}
+	else if(rep_loadText(path) == -1)
+		return -1;
+
+	if(rep.numLines == 0){
+		fprintf(stderr, "%s: No client lines to replay\n", path);
+		return -1;
+	}
+
+	qsort(rep.lines, rep.numLines, sizeof(struct rep_Line), rep_compareLines);
+
+	uint64_t start = rep.lines[0].time;
+	long *ids = malloc(rep.numLines * sizeof(long));
+	if(ids == NULL){
+		perror("malloc");
+		return -1;
+	}
+	for(long i = 0; i < rep.numLines; i++){
+		rep.lines[i].time -= start;
+		ids[i] = rep.lines[i].conn;
+	}
+
+	// Connections are numbered by the order of their ids
+	qsort(ids, rep.numLines, sizeof(long), rep_compareLongs);
+	for(long i = 0; i < rep.numLines; i++){
+		if(i == 0 || ids[i] != ids[rep.numConns - 1])
+			ids[rep.numConns++] = ids[i];
+	}
+
+	rep.conns = calloc(rep.numConns, sizeof(struct rep_Conn));
+	if(rep.conns == NULL){
+		perror("calloc");
+		free(ids);
+		return -1;
+	}
+
+	for(long i = 0; i < rep.numLines; i++){
+		long *id = bsearch(&rep.lines[i].conn, ids, rep.numConns, sizeof(long), rep_compareLongs);
+		rep.lines[i].conn = id - ids;
+		rep.conns[id - ids].count++;
+	}
+	free(ids);
+
+	for(long i = 0; i < rep.numConns; i++){
+		rep.conns[i].lines = malloc(rep.conns[i].count * sizeof(int));
+		if(rep.conns[i].lines == NULL){
+			perror("malloc");
+			return -1;
+		}
+		rep.conns[i].count = 0;
+	}
+	for(long i = 0; i < rep.numLines; i++){
+		struct rep_Conn *conn = &rep.conns[rep.lines[i].conn];
+		conn->lines[conn->count++] = i;
+	}
+
+	return 1;
+}
+
+int rep_connect(struct rep_Client *client, struct addrinfo *addr){
+	client->fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(client->fd == -1){
+		perror("socket");
+		return -1;
+	}
+
+	if(connect(client->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS){
+		perror("connect");
+		return -1;
+	}
+
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+	if(epoll_ctl(rep.epfd, EPOLL_CTL_ADD, client->fd, &event) == -1){
+		perror("epoll_ctl");
+		return -1;
+	}
+
+	return 1;
+}
+
+void rep_disconnect(struct rep_Client *client){
+	if(client->closed)
+		return;
+
+	client->closed = 1;
+	close(client->fd);
+	if(client->conn != NULL && (client->next < client->conn->count || client->waiting))
+		rep.kicked++;
+}
+
+// Writes as much of the output as the socket takes
+void rep_flush(struct rep_Client *client){
+	long written = 0;
+
+	while(written < client->outLen){
+		long ret = write(client->fd, client->out + written, client->outLen - written);
+		if(ret == -1){
+			if(errno == EAGAIN || errno == ENOTCONN)
+				break;
+			rep_disconnect(client);
+			return;
+		}
+		written += ret;
+	}
+
+	memmove(client->out, client->out + written, client->outLen - written);
+	client->outLen -= written;
+
+	int watchOut = client->outLen > 0;
+	if(watchOut != client->watchOut){
+		struct epoll_event event = {.events = EPOLLIN | (watchOut ? EPOLLOUT : 0), .data.ptr = client};
+		epoll_ctl(rep.epfd, EPOLL_CTL_MOD, client->fd, &event);
+		client->watchOut = watchOut;
+	}
+}
+
+int rep_queue(struct rep_Client *client, char *str, long len){
+	if(client->outLen + len > client->outSize){
+		long size = client->outSize ? client->outSize : 4096;
+		while(size < client->outLen + len)
+			size *= 2;
+
+		char *out = realloc(client->out, size);
+		if(out == NULL){
+			perror("realloc");
+			return -1;
+		}
+		client->out = out;
+		client->outSize = size;
+	}
+
+	memcpy(client->out + client->outLen, str, len);
+	client->outLen += len;
+	return 1;
+}
+
+// Copies the first parameter of a line, without the colon of a trailing one
+void rep_getTarget(char *line, char *target, int size){
+	int len = 0;
+
+	if(*line == ':')
+		line += strcspn(line, " ");
+	line += strspn(line, " ");
+	line += strcspn(line, " ");
+	line += strspn(line, " ");
+	if(*line == ':')
+		line++;
+
+	while(line[len] && line[len] != ' ' && len < size - 1)
+		len++;
+	memcpy(target, line, len);
+	target[len] = '\0';
+}
+
+// Returns whether a space separated list holds a word
+int rep_hasWord(char *words, char *word, int len){
+	while(*words){
+		int wordLen = strcspn(words, " ");
+		if(wordLen == len && !strncmp(words, word, len))
+			return 1;
+		words += wordLen;
+		words += strspn(words, " ");
+	}
+	return 0;
+}
+
+struct rep_Channel *rep_findChannel(char *name){
+	for(long i = 0; i < rep.numChannels; i++){
+		if(!strcasecmp(rep.channels[i].name, name))
+			return &rep.channels[i];
+	}
+	return NULL;
+}
+
+// Lets the observer join a channel a replayed client got into, with the line that client sent
+void rep_observe(struct rep_Probe *probe){
+	if(rep_findChannel(probe->target) != NULL)
+		return;
+
+	if(rep.numChannels == rep.maxChannels){
+		rep.maxChannels = rep.maxChannels ? rep.maxChannels * 2 : 64;
+		struct rep_Channel *channels = realloc(rep.channels, rep.maxChannels * sizeof(struct rep_Channel));
+		if(channels == NULL){
+			perror("realloc");
+			return;
+		}
+		rep.channels = channels;
+	}
+
+	struct rep_Channel *channel = &rep.channels[rep.numChannels++];
+	strcpy(channel->name, probe->target);
+	channel->joined = 0;
+
+	char buff[1100];
+	int len = snprintf(buff, sizeof(buff), "%s\r\n", rep.lines[probe->line].line);
+	if(len < (int) sizeof(buff) && rep_queue(&rep.observer, buff, len) == 1)
+		rep_flush(&rep.observer);
+}
+
+// Sends the next line of a client, followed by a PING if nothing else answers it, sent is when it counts as sent
+int rep_sendNext(struct rep_Client *client, uint64_t sent){
+	if(client->closed || client->next >= client->conn->count)
+		return 1;
+
+	long index = client->conn->lines[client->next++];
+	struct rep_Line *line = &rep.lines[index];
+	char *name = rep.commands[line->command].name;
+	char buff[1100];
+	int len;
+
+	// Nothing answers after a QUIT
+	struct rep_Probe *probe = NULL;
+	if(strcmp(name, "QUIT")){
+		if(rep.numProbes == rep.maxProbes){
+			rep.maxProbes *= 2;
+			struct rep_Probe *probes = realloc(rep.probes, rep.maxProbes * sizeof(struct rep_Probe));
+			if(probes == NULL){
+				perror("realloc");
+				return -1;
+			}
+			rep.probes = probes;
+		}
+
+		probe = &rep.probes[rep.numProbes++];
+		probe->sent = sent;
+		probe->command = line->command;
+		probe->kind = REP_PONG;
+		probe->reply = -1;
+		probe->done = 0;
+		probe->line = index;
+		probe->next = -1;
+		probe->client = client;
+		rep_getTarget(line->line, probe->target, sizeof(probe->target));
+
+		// A PRIVMSG to a channel only reaches the observer once it joined
+		char *target = probe->target;
+		if(!strcmp(name, "PRIVMSG") && strstr(line->line, " :") != NULL){
+			struct rep_Channel *channel = rep_findChannel(target);
+			if((target[0] != '#' && target[0] != '&') || (channel != NULL && channel->joined))
+				probe->kind = REP_DELIVERY;
+		}
+		for(int i = 0; probe->kind == REP_PONG && i < (int) (sizeof(rep_replies) / sizeof(rep_replies[0])); i++){
+			if(!strcmp(name, rep_replies[i].command)){
+				probe->kind = REP_REPLY;
+				probe->reply = i;
+			}
+		}
+	}
+	long id = probe ? probe - rep.probes : -1;
+
+	// Copies after the first need nicks of their own
+	if(client->copy > 0 && !strcmp(name, "NICK")){
+		len = snprintf(buff, sizeof(buff), "%s%d\r\n", line->line, client->copy);
+		snprintf(probe->target + strlen(probe->target), sizeof(probe->target) - strlen(probe->target), "%d", client->copy);
+	}
+	else if(probe != NULL && probe->kind == REP_DELIVERY)
+		len = snprintf(buff, sizeof(buff), "%s" REP_TAG "%ld\r\n", line->line, id);
+	else
+		len = snprintf(buff, sizeof(buff), "%s\r\n", line->line);
+	if(len >= (int) sizeof(buff))
+		len = sizeof(buff) - 1;
+
+	if(rep_queue(client, buff, len) == -1)
+		return -1;
+	rep.sentLines++;
+	rep.sentBytes += len;
+	rep.commands[line->command].sent++;
+
+	if(probe != NULL){
+		if(probe->kind == REP_PONG){
+			len = snprintf(buff, sizeof(buff), "PING :r%ld\r\n", id);
+			if(rep_queue(client, buff, len) == -1)
+				return -1;
+		}
+		else {
+			if(client->lastPending == -1)
+				client->firstPending = id;
+			else
+				rep.probes[client->lastPending].next = id;
+			client->lastPending = id;
+		}
+		client->waiting++;
+	}
+
+	rep_flush(client);
+	return 1;
+}
+
+// Records the latency of a probe, closedLoop sends the next line once the client has no line left unanswered
+void rep_complete(struct rep_Probe *probe, uint64_t now, int closedLoop){
+	struct rep_Client *client = probe->client;
+	long id = probe - rep.probes;
+
+	hdr_record(&rep.commands[probe->command].hist, now > probe->sent ? (now - probe->sent) / 1000 : 0);
+	probe->done = 1;
+	rep.done++;
+	rep.lastReply = now;
+	client->waiting--;
+
+	if(probe->kind != REP_PONG){
+		long *link = &client->firstPending, previous = -1;
+		while(*link != id){
+			previous = *link;
+			link = &rep.probes[*link].next;
+		}
+		*link = probe->next;
+		if(client->lastPending == id)
+			client->lastPending = previous;
+	}
+
+	if(closedLoop && client->waiting == 0)
+		rep_sendNext(client, now);
+}
+
+// Answers the oldest probe of a client a reply is for, an error answers the oldest one there is
+void rep_handleReply(struct rep_Client *client, char *command, int len, char *nick, char *param, uint64_t now, int closedLoop){
+	int numeric = len == 3 && command[0] >= '0' && command[0] <= '9';
+	// Lines the server does not know are timed by their PING
+	int error = numeric && (command[0] == '4' || command[0] == '5') && strncmp(command, "421", 3);
+
+	for(long id = client->firstPending; id != -1; id = rep.probes[id].next){
+		struct rep_Probe *probe = &rep.probes[id];
+		if(!error){
+			if(probe->kind != REP_REPLY || !rep_hasWord(rep_replies[probe->reply].replies, command, len))
+				continue;
+			// Everyone in the channel gets them, only the client's own for its own line count
+			if(!numeric && (strcasecmp(nick, client->nick) || strcasecmp(param, probe->target)))
+				continue;
+
+			if(!strcmp(rep_replies[probe->reply].command, "JOIN"))
+				rep_observe(probe);
+			if(!strcmp(rep_replies[probe->reply].command, "NICK"))
+				strcpy(client->nick, probe->target);
+		}
+
+		rep_complete(probe, now, closedLoop);
+		return;
+	}
+}
+
+// Handles one line from the server, closedLoop sends the next line once the last one was answered
+void rep_handleLine(struct rep_Client *client, char *line, int closedLoop){
+	rep.recvLines++;
+
+	char nick[REP_NAME_LEN] = "";
+	char *command = line;
+	if(*command == ':'){
+		int len = strcspn(command + 1, "! ");
+		snprintf(nick, sizeof(nick), "%.*s", len, command + 1);
+		command = strchr(command, ' ');
+		if(command == NULL)
+			return;
+		command++;
+	}
+
+	if(!strncmp(command, "PING", 4)){
+		char buff[600];
+		int len = snprintf(buff, sizeof(buff), "PONG%s\r\n", command + 4);
+		if(len < (int) sizeof(buff) && rep_queue(client, buff, len) == 1)
+			rep_flush(client);
+		return;
+	}
+
+	int len = strcspn(command, " ");
+	char param[REP_NAME_LEN];
+	rep_getTarget(command, param, sizeof(param));
+	uint64_t now = rep_now();
+
+	if(len == 4 && !strncmp(command, "PONG", 4)){
+		char *token = command + 5;
+		if(*token == ':')
+			token++;
+		if(*token != 'r')
+			return;
+
+		long id = strtol(token + 1, NULL, 10);
+		if(id >= 0 && id < rep.numProbes && rep.probes[id].kind == REP_PONG && !rep.probes[id].done)
+			rep_complete(&rep.probes[id], now, closedLoop);
+	}
+	else if(len == 7 && !strncmp(command, "PRIVMSG", 7)){
+		// Whoever gets it first, the text itself may hold the tag as well
+		char *tag = NULL, *found = command;
+		while((found = strstr(found, REP_TAG)) != NULL)
+			tag = found++;
+		if(tag == NULL)
+			return;
+
+		long id = strtol(tag + strlen(REP_TAG), NULL, 10);
+		if(id >= 0 && id < rep.numProbes && rep.probes[id].kind == REP_DELIVERY && !rep.probes[id].done)
+			rep_complete(&rep.probes[id], now, closedLoop);
+	}
+	else if(client == &rep.observer){
+		if(len == 4 && !strncmp(command, "JOIN", 4) && !strcasecmp(nick, REP_OBSERVER)){
+			struct rep_Channel *channel = rep_findChannel(param);
+			if(channel != NULL)
+				channel->joined = 1;
+		}
+	}
+	else
+		rep_handleReply(client, command, len, nick, param, now, closedLoop);
+}
+
+void rep_read(struct rep_Client *client, int closedLoop){
+	while(!client->closed){
+		long ret = read(client->fd, client->in + client->inLen, sizeof(client->in) - client->inLen - 1);
+		if(ret == 0 || (ret == -1 && errno != EAGAIN)){
+			rep_disconnect(client);
+			return;
+		}
+		if(ret == -1)
+			return;
+
+		rep.recvBytes += ret;
+		client->inLen += ret;
+		client->in[client->inLen] = '\0';
+
+		char *start = client->in, *end;
+		while((end = strchr(start, '\n')) != NULL){
+			*end = '\0';
+			if(end > start && end[-1] == '\r')
+				end[-1] = '\0';
+			rep_handleLine(client, start, closedLoop);
+			start = end + 1;
+		}
+
+		client->inLen -= start - client->in;
+		memmove(client->in, start, client->inLen);
+
+		// A line longer than the buffer is dropped
+		if(client->inLen == (int) sizeof(client->in) - 1)
+			client->inLen = 0;
+	}
+}
+
+void rep_poll(int timeout, int closedLoop){
+	struct epoll_event events[256];
+
+	int count = epoll_wait(rep.epfd, events, 256, timeout);
+	for(int i = 0; i < count; i++){
+		struct rep_Client *client = events[i].data.ptr;
+		if(client->closed)
+			continue;
+
+		if(events[i].events & EPOLLOUT)
+			rep_flush(client);
+		if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			rep_read(client, closedLoop);
+	}
+}
+
+void rep_report(double seconds){
+	printf("Replayed %ld lines of %ld connections with %ld clients in %.2f s\n",
+			rep.sentLines, rep.numConns, rep.numClients, seconds);
+	printf("Sent %.0f lines/s (%.1f KiB/s), received %.0f lines/s (%.1f KiB/s)\n",
+			rep.sentLines / seconds, rep.sentBytes / seconds / 1024, rep.recvLines / seconds, rep.recvBytes / seconds / 1024);
+	if(rep.kicked)
+		printf("%lu clients were disconnected before they were done, is MessageLimit 0?\n", rep.kicked);
+
+	struct hdr_Histogram all;
+	hdr_init(&all);
+	for(long i = 0; i < rep.numProbes; i++){
+		if(!rep.probes[i].done)
+			rep.commands[rep.probes[i].command].lost++;
+	}
+
+	printf("\n%-12s %9s %7s %9s %9s %9s %9s %9s %9s\n", "Command", "Sent", "Lost", "Mean", "p50", "p90", "p99", "p99.9", "Max");
+	for(int i = 0; i <= rep.numCommands; i++){
+		struct rep_Command *command = i < rep.numCommands ? &rep.commands[i] : NULL;
+		struct hdr_Histogram *hist = command ? &command->hist : &all;
+		if(command){
+			if(command->sent == 0)
+				continue;
+			hdr_merge(&all, hist);
+		}
+
+		printf("%-12s %9lu %7lu %9.0f %9lu %9lu %9lu %9lu %9lu\n", command ? command->name : "ALL",
+				command ? command->sent : rep.sentLines, command ? command->lost : (unsigned long) (rep.numProbes - rep.done),
+				hdr_mean(hist), hdr_percentile(hist, 50), hdr_percentile(hist, 90),
+				hdr_percentile(hist, 99), hdr_percentile(hist, 99.9), hist->total ? hist->max : 0);
+	}
+	printf("Latencies in microseconds, from when a line was due until it was delivered or answered\n");
+}
+
+int main(int argc, char **argv){
+	char *host = "localhost", *port = "6667";
+	double speed = 1, drain = 5;
+	int copies = 1, opt;
+
+	while((opt = getopt(argc, argv, "h:p:s:n:t:")) != -1){
+		switch(opt){
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 's': speed = atof(optarg); break;
+		case 'n': copies = atoi(optarg); break;
+		case 't': drain = atof(optarg); break;
+		default:
+			optind = argc + 1;
+		}
+	}
+	if(optind != argc - 1 || speed < 0 || copies < 1){
+		fprintf(stderr, "Usage: %s [-h host] [-p port] [-s speed, 0 for as fast as possible] [-n copies]"
+				" [-t seconds to wait for answers] <capture file or trace>\n", argv[0]);
+		return 1;
+	}
+
+	if(rep_loadTrace(argv[optind]) == -1)
+		return 1;
+
+	struct addrinfo hints = {.ai_socktype = SOCK_STREAM}, *addr;
+	int ret = getaddrinfo(host, port, &hints, &addr);
+	if(ret != 0){
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(ret));
+		return 1;
+	}
+
+	rep.epfd = epoll_create1(0);
+	rep.numClients = rep.numConns * copies;
+	rep.clients = calloc(rep.numClients, sizeof(struct rep_Client));
+	rep.maxProbes = rep.numLines * copies + 1;
+	rep.probes = malloc(rep.maxProbes * sizeof(struct rep_Probe));
+	if(rep.epfd == -1 || rep.clients == NULL || rep.probes == NULL){
+		perror("setup");
+		return 1;
+	}
+
+	for(long i = 0; i < rep.numClients; i++){
+		struct rep_Client *client = &rep.clients[i];
+		client->copy = i / rep.numConns;
+		client->conn = &rep.conns[i % rep.numConns];
+		client->firstPending = client->lastPending = -1;
+		if(rep_connect(client, addr) == -1)
+			return 1;
+	}
+
+	rep.observer.firstPending = rep.observer.lastPending = -1;
+	if(rep_connect(&rep.observer, addr) == -1 || rep_queue(&rep.observer, "NICK " REP_OBSERVER "\r\n", 7 + strlen(REP_OBSERVER)) == -1)
+		return 1;
+	rep_flush(&rep.observer);
+	freeaddrinfo(addr);
+
+	int closedLoop = speed == 0;
+	uint64_t start = rep_now(), end;
+
+	if(closedLoop){
+		for(long i = 0; i < rep.numClients; i++)
+			rep_sendNext(&rep.clients[i], start);
+
+		// Until no client is left with a line it did not send
+		uint64_t last = start;
+		while(rep.done < rep.numProbes || rep.sentLines < (unsigned long) rep.numLines * copies){
+			long before = rep.done;
+			rep_poll(100, closedLoop);
+			if(rep.done != before)
+				last = rep_now();
+			else if(rep_now() - last > drain * 1e9)
+				break;
+		}
+	}
+	else {
+		// Every copy sends line i of the trace at the same time
+		for(long i = 0; i < rep.numLines; ){
+			uint64_t due = start + rep.lines[i].time / speed;
+			uint64_t now = rep_now();
+
+			if(due > now){
+				rep_poll((due - now + 999999) / 1000000, closedLoop);
+				continue;
+			}
+
+			for(int copy = 0; copy < copies; copy++)
+				rep_sendNext(&rep.clients[copy * rep.numConns + rep.lines[i].conn], due);
+			i++;
+		}
+
+		uint64_t deadline = rep_now() + drain * 1e9;
+		while(rep.done < rep.numProbes && rep_now() < deadline)
+			rep_poll(100, closedLoop);
+	}
+	// Waiting for answers that never came does not count
+	end = rep.done == rep.numProbes && rep.lastReply ? rep.lastReply : rep_now();
+
+	rep_report((end - start) / 1e9);
+	return 0;
+}